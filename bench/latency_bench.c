@@ -0,0 +1,462 @@
+/**
+ * End-to-end Latency Benchmark
+ *
+ * Injects synthetic key streams into pipe-backed source devices, runs them
+ * through event_listener_run -> vkbd_process_key and timestamps each key as
+ * it comes out of the pipe-backed virtual device.
+ *
+ * Results are printed to stdout as one JSON object per scenario; all other
+ * output (including library messages) goes to stderr.
+ *
+ * Build & run: make bench
+ * Usage: bench/latency_bench [--suite] [--rt] [--pipelined] [--engine E] [--observer]
+ *                            [--name N] [--events N] [--rate EV/S] [--burst N] [--devices N]
+ *
+ * Compare jitter (latency_ns.stddev, p99.9 - p50) with and without --rt,
+ * and the epoll and io_uring engines with --engine.
+ */
+
+#define _GNU_SOURCE
+
+#include "../vkbd.h"
+#include "../event_listener.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <linux/input.h>
+
+#define BENCH_MAX_BURST 64
+#define HIST_BUCKETS 40  /* log2(ns) buckets: up to ~1100 s */
+
+/* One benchmark scenario */
+typedef struct {
+    const char *name;
+    int events;     /* Key events per device */
+    double rate;    /* Key events per second per device, 0 = unthrottled */
+    int burst;      /* Key events per source frame (one write + SYN_REPORT) */
+    int devices;    /* Number of source devices */
+} bench_config_t;
+
+/* Run the listener thread in real-time mode (--rt) */
+static bool bench_rt = false;
+
+/* Use event_listener_run_pipelined (--pipelined) */
+static bool bench_pipelined = false;
+
+/* Use event_listener_run_uring (--engine uring) */
+static bool bench_uring = false;
+
+/* Attach a logging observer (--observer) */
+static bool bench_observer = false;
+static int observer_sink = -1;
+
+/* Shared benchmark state */
+typedef struct {
+    const bench_config_t *cfg;
+    event_listener_t listener;
+    vkbd_context_t vkbd;
+    uint64_t *send_ns;      /* [device][event] injection timestamps */
+    uint64_t *latency_ns;   /* Collected samples, in arrival order */
+    int samples;
+} bench_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline) {
+    struct timespec ts = {
+        .tv_sec = deadline / 1000000000ULL,
+        .tv_nsec = deadline % 1000000000ULL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+/* Each device types its own key so the consumer can attribute events */
+static uint16_t device_key(int device) {
+    return KEY_1 + device;
+}
+
+/* Injector thread: writes bursts round-robin across devices at the target rate */
+static void *injector_thread(void *arg) {
+    bench_t *b = arg;
+    const bench_config_t *cfg = b->cfg;
+    struct input_event frame[BENCH_MAX_BURST + 1];
+    uint64_t interval = cfg->rate > 0 ? (uint64_t)(1e9 * cfg->burst / cfg->rate) : 0;
+    uint64_t deadline = now_ns();
+
+    memset(frame, 0, sizeof(frame));
+
+    for (int sent = 0; sent < cfg->events; sent += cfg->burst) {
+        int count = cfg->events - sent < cfg->burst ? cfg->events - sent : cfg->burst;
+
+        if (interval) {
+            sleep_until_ns(deadline);
+            deadline += interval;
+        }
+
+        for (int d = 0; d < cfg->devices; d++) {
+            uint64_t t = now_ns();
+            for (int k = 0; k < count; k++) {
+                frame[k].time.tv_sec = t / 1000000000ULL;
+                frame[k].time.tv_usec = (t % 1000000000ULL) / 1000;
+                frame[k].type = EV_KEY;
+                frame[k].code = device_key(d);
+                frame[k].value = (sent + k) & 1 ? 0 : 1;
+                b->send_ns[(size_t)d * cfg->events + sent + k] = t;
+            }
+            frame[count] = frame[0];
+            frame[count].type = EV_SYN;
+            frame[count].code = SYN_REPORT;
+            frame[count].value = 0;
+
+            size_t len = (count + 1) * sizeof(frame[0]);
+            if (write(b->listener.devices[d].peer_fd, frame, len) != (ssize_t)len) {
+                perror("injector: write");
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Stand-in for a key logger: format a line and write it to /dev/null */
+static void log_observer(const struct input_event *ev, void *user_data) {
+    (void)user_data;
+    char line[64];
+    int len = snprintf(line, sizeof(line), "[KEY] %d: code=%d\n", ev->value, ev->code);
+    if (write(observer_sink, line, len) < 0) {
+        /* Ignored */
+    }
+}
+
+/* Listener thread: the code under test */
+static void *listener_thread(void *arg) {
+    bench_t *b = arg;
+    if (bench_pipelined) {
+        event_listener_run_pipelined(&b->listener);
+    } else if (bench_uring) {
+        event_listener_run_uring(&b->listener);
+    } else {
+        event_listener_run(&b->listener);
+    }
+    return NULL;
+}
+
+/* Consumer (main thread): read the virtual device and match keys to injections */
+static int consume(bench_t *b) {
+    const bench_config_t *cfg = b->cfg;
+    const int expected = cfg->events * cfg->devices;
+    int received[MAX_INPUT_DEVICES] = {0};
+    struct input_event out[256];
+
+    while (b->samples < expected) {
+        ssize_t n = read(b->vkbd.device.peer_fd, out, sizeof(out));
+        if (n <= 0) {
+            perror("consumer: read");
+            return -1;
+        }
+        uint64_t t = now_ns();
+
+        for (int i = 0; i < (int)(n / sizeof(out[0])); i++) {
+            if (out[i].type != EV_KEY) {
+                continue;
+            }
+            int d = out[i].code - KEY_1;
+            if (d < 0 || d >= cfg->devices || received[d] >= cfg->events) {
+                fprintf(stderr, "consumer: unexpected key %d\n", out[i].code);
+                return -1;
+            }
+            uint64_t sent = b->send_ns[(size_t)d * cfg->events + received[d]++];
+            b->latency_ns[b->samples++] = t - sent;
+        }
+    }
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, int n, double p) {
+    int idx = (int)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[idx];
+}
+
+/* Print one scenario as a single JSON line */
+static void report(FILE *out, const bench_t *b, uint64_t elapsed_ns) {
+    const bench_config_t *cfg = b->cfg;
+    const int n = b->samples;
+    uint64_t hist[HIST_BUCKETS] = {0};
+    double sum = 0, sum_sq = 0;
+
+    for (int i = 0; i < n; i++) {
+        uint64_t v = b->latency_ns[i];
+        int bucket = v ? 64 - __builtin_clzll(v) : 0;
+        hist[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1]++;
+        sum += v;
+        sum_sq += (double)v * v;
+    }
+    qsort(b->latency_ns, n, sizeof(uint64_t), cmp_u64);
+
+    double mean = sum / n;
+    double variance = sum_sq / n - mean * mean;
+
+    fprintf(out, "{\"name\":\"%s\",\"engine\":\"%s\",\"rt\":%s,\"pipelined\":%s,\"devices\":%d,\"events\":%d,\"rate\":%.0f,\"burst\":%d,",
+            cfg->name, bench_uring ? "uring" : "epoll", bench_rt ? "true" : "false",
+            bench_pipelined ? "true" : "false", cfg->devices, n, cfg->rate, cfg->burst);
+    fprintf(out, "\"throughput_eps\":%.0f,", n / (elapsed_ns / 1e9));
+    fprintf(out, "\"latency_ns\":{\"mean\":%.0f,\"stddev\":%.0f,\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu},",
+            mean, variance > 0 ? sqrt(variance) : 0.0,
+            (unsigned long long)percentile(b->latency_ns, n, 50.0),
+            (unsigned long long)percentile(b->latency_ns, n, 99.0),
+            (unsigned long long)percentile(b->latency_ns, n, 99.9),
+            (unsigned long long)b->latency_ns[n - 1]);
+
+    /* Per-stage breakdown: reader -> ring -> writer */
+    if (bench_pipelined) {
+        const pipeline_stats_t *ps = &b->listener.pipeline_stats;
+        fprintf(out, "\"pipeline\":{\"max_depth\":%u,\"full_stalls\":%lu,\"syn_dropped\":%lu,"
+                "\"queue_ns_mean\":%.0f,\"queue_ns_max\":%llu,"
+                "\"batches\":%lu,\"write_ns_mean\":%.0f,\"write_ns_max\":%llu},",
+                ps->max_depth, ps->full_stalls, ps->syn_dropped,
+                ps->events ? (double)ps->queue_ns_total / ps->events : 0.0,
+                (unsigned long long)ps->queue_ns_max,
+                ps->batches, ps->batches ? (double)ps->write_ns_total / ps->batches : 0.0,
+                (unsigned long long)ps->write_ns_max);
+    }
+
+    /* Syscalls per key on the io_uring engine */
+    if (bench_uring) {
+        const uring_stats_t *us = &b->listener.uring_stats;
+        fprintf(out, "\"uring\":{\"enters\":%lu,\"enters_per_event\":%.3f,\"completions\":%lu,"
+                "\"reads\":%lu,\"writes\":%lu,\"write_deferrals\":%lu},",
+                us->enters, (double)us->enters / n, us->completions,
+                us->reads, us->writes, us->write_deferrals);
+    }
+
+    /* Observer cost, measured on its own thread */
+    if (bench_observer) {
+        vkbd_observer_stats_t os;
+        vkbd_get_observer_stats(&b->vkbd, &os);
+        fprintf(out, "\"observer\":{\"delivered\":%lu,\"dropped\":%lu,\"busy_ns_mean\":%.0f,\"max_lag_ns\":%llu},",
+                os.delivered, os.dropped, os.delivered ? (double)os.busy_ns / os.delivered : 0.0,
+                (unsigned long long)os.max_lag_ns);
+    }
+
+    /* Library's own view: kernel timestamp -> flush, from the injected frame times */
+    latency_hist_t lh;
+    vkbd_get_latency(&b->vkbd, &lh);
+    fprintf(out, "\"source_latency_ns\":{\"count\":%lu,\"mean\":%llu,\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu},",
+            (unsigned long)lh.count, (unsigned long long)latency_mean(&lh),
+            (unsigned long long)latency_percentile(&lh, 50.0),
+            (unsigned long long)latency_percentile(&lh, 99.0),
+            (unsigned long long)latency_percentile(&lh, 99.9),
+            (unsigned long long)lh.max_ns);
+
+    /* Histogram: count of samples with latency < le_ns (power-of-two buckets) */
+    fprintf(out, "\"histogram\":[");
+    bool first = true;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (hist[i]) {
+            fprintf(out, "%s{\"le_ns\":%llu,\"count\":%llu}", first ? "" : ",",
+                    1ULL << i, (unsigned long long)hist[i]);
+            first = false;
+        }
+    }
+    fprintf(out, "]}\n");
+    fflush(out);
+}
+
+/* Run one scenario end to end */
+static int run_scenario(FILE *json, const bench_config_t *cfg) {
+    bench_t b;
+    pthread_t listener_tid, injector_tid;
+    int ret = -1;
+
+    memset(&b, 0, sizeof(b));
+    b.cfg = cfg;
+    b.send_ns = calloc((size_t)cfg->events * cfg->devices, sizeof(uint64_t));
+    b.latency_ns = calloc((size_t)cfg->events * cfg->devices, sizeof(uint64_t));
+    if (!b.send_ns || !b.latency_ns) {
+        fprintf(stderr, "bench: out of memory\n");
+        goto out;
+    }
+
+    if (vkbd_init_backend(&b.vkbd, "Bench Virtual Keyboard", &vkbd_backend_pipe) < 0) {
+        goto out;
+    }
+    if (event_listener_init(&b.listener, &b.vkbd) < 0) {
+        goto out_vkbd;
+    }
+    event_listener_set_backend(&b.listener, &input_backend_pipe);
+    if (bench_observer && vkbd_register_observer(&b.vkbd, log_observer, NULL) < 0) {
+        goto out_listener;
+    }
+    if (bench_rt) {
+        rt_config_t rt;
+        rt_config_default(&rt);
+        event_listener_set_rt(&b.listener, &rt);
+    }
+    for (int d = 0; d < cfg->devices; d++) {
+        char name[32];
+        snprintf(name, sizeof(name), "bench-source-%d", d);
+        if (event_listener_add_device(&b.listener, name) < 0) {
+            goto out_listener;
+        }
+    }
+
+    pthread_create(&listener_tid, NULL, listener_thread, &b);
+    uint64_t start = now_ns();
+    pthread_create(&injector_tid, NULL, injector_thread, &b);
+
+    ret = consume(&b);
+    uint64_t elapsed = now_ns() - start;
+
+    event_listener_stop(&b.listener);
+    pthread_join(injector_tid, NULL);
+    pthread_join(listener_tid, NULL);
+
+    if (ret == 0) {
+        report(json, &b, elapsed);
+    }
+
+out_listener:
+    event_listener_destroy(&b.listener);
+out_vkbd:
+    vkbd_destroy(&b.vkbd);
+out:
+    free(b.send_ns);
+    free(b.latency_ns);
+    return ret;
+}
+
+/* Default suite used by 'make bench' */
+static const bench_config_t suite[] = {
+    { "steady-1k",     2000,  1000.0, 1, 1 },
+    { "steady-20k",   40000, 20000.0, 1, 1 },
+    { "chord-8",      16000,  8000.0, 8, 1 },
+    { "multi-4dev",   10000,  5000.0, 1, 4 },
+    { "flood",       100000,     0.0, 1, 1 },
+    { "flood-burst", 100000,     0.0, 16, 1 },
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--suite] [--rt] [--pipelined] [--engine E] [--observer] [--name N] [--events N] [--rate EV/S] [--burst N] [--devices N]\n"
+            "  --suite     Run the default scenario set (default without scenario options)\n"
+            "  --rt        Run the listener with SCHED_FIFO, mlockall and a prefaulted stack\n"
+            "  --pipelined Separate reader and writer threads (adds per-stage stats)\n"
+            "  --engine    Listener engine: epoll (default) or uring (adds syscall stats)\n"
+            "  --observer  Attach a logging observer (adds observer stats)\n"
+            "  --events    Key events per device (default 10000)\n"
+            "  --rate      Events/s per device, 0 = as fast as possible (default 0)\n"
+            "  --burst     Key events per source frame, max %d (default 1)\n"
+            "  --devices   Source devices, max %d (default 1)\n",
+            prog, BENCH_MAX_BURST, MAX_INPUT_DEVICES);
+}
+
+int main(int argc, char *argv[]) {
+    bench_config_t cfg = { "custom", 10000, 0.0, 1, 1 };
+    bool run_suite = false;
+    bool custom = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--suite") == 0) {
+            run_suite = true;
+            continue;
+        }
+        if (strcmp(arg, "--rt") == 0) {
+            bench_rt = true;
+            continue;
+        }
+        if (strcmp(arg, "--pipelined") == 0) {
+            bench_pipelined = true;
+            continue;
+        }
+        if (strcmp(arg, "--observer") == 0) {
+            bench_observer = true;
+            continue;
+        }
+        if (!val) {
+            usage(argv[0]);
+            return 2;
+        }
+        if (strcmp(arg, "--engine") == 0) {
+            if (strcmp(val, "uring") == 0) {
+                bench_uring = true;
+            } else if (strcmp(val, "epoll") != 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            i++;
+            continue;
+        }
+        custom = true;
+        if (strcmp(arg, "--name") == 0) {
+            cfg.name = val;
+        } else if (strcmp(arg, "--events") == 0) {
+            cfg.events = atoi(val);
+        } else if (strcmp(arg, "--rate") == 0) {
+            cfg.rate = atof(val);
+        } else if (strcmp(arg, "--burst") == 0) {
+            cfg.burst = atoi(val);
+        } else if (strcmp(arg, "--devices") == 0) {
+            cfg.devices = atoi(val);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+
+    /* No scenario options: run the default suite */
+    if (!custom) {
+        run_suite = true;
+    }
+
+    if (cfg.events <= 0 || cfg.rate < 0 || (bench_uring && bench_pipelined) ||
+        cfg.burst < 1 || cfg.burst > BENCH_MAX_BURST ||
+        cfg.devices < 1 || cfg.devices > MAX_INPUT_DEVICES) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    observer_sink = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    /* Keep stdout pure JSON: library chatter is redirected to stderr */
+    FILE *json = fdopen(dup(STDOUT_FILENO), "w");
+    if (!json) {
+        perror("bench: fdopen");
+        return 1;
+    }
+    fflush(stdout);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    int ret = 0;
+    if (run_suite) {
+        for (size_t i = 0; i < sizeof(suite) / sizeof(suite[0]); i++) {
+            if (run_scenario(json, &suite[i]) < 0) {
+                ret = 1;
+            }
+        }
+    } else if (run_scenario(json, &cfg) < 0) {
+        ret = 1;
+    }
+
+    fclose(json);
+    return ret;
+}
@@ -0,0 +1,355 @@
+/**
+ * Capture / Replay - Implementation
+ */
+
+#define _GNU_SOURCE
+
+#include "capture.h"
+#include "clock.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RING_BYTES (CAPTURE_RING_RECORDS * sizeof(capture_record_t))
+
+/* Events per vkbd_process_batch call on replay (one evdev read's worth) */
+#define REPLAY_SPAN 64
+
+/* Write a whole span, resuming short writes */
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Append everything in the ring to the file (at most two spans) */
+static void drain(capture_t *cap) {
+    uint64_t tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&cap->head, memory_order_acquire);
+
+    while (tail != head) {
+        uint64_t start = tail & CAPTURE_RING_MASK;
+        uint64_t n = head - tail;
+        if (start + n > CAPTURE_RING_RECORDS) {
+            n = CAPTURE_RING_RECORDS - start;
+        }
+
+        if (write_all(cap->fd, &cap->ring[start], n * sizeof(capture_record_t)) < 0) {
+            counter_add(&cap->write_errors, 1);
+            perror("capture: write failed");
+        } else {
+            counter_add(&cap->written, n);
+        }
+        counter_add(&cap->flushes, 1);
+
+        /* Written or lost: the slots are free again either way */
+        tail += n;
+        atomic_store_explicit(&cap->tail, tail, memory_order_release);
+    }
+}
+
+/* Flush thread: wake every interval until told to stop */
+static void *flush_thread(void *arg) {
+    capture_t *cap = arg;
+    struct pollfd pfd = { .fd = cap->stop_fd, .events = POLLIN };
+
+    for (;;) {
+        int ret = poll(&pfd, 1, CAPTURE_FLUSH_MS);
+        if (ret > 0 || (ret < 0 && errno != EINTR)) {
+            break;
+        }
+        drain(cap);
+    }
+    drain(cap);
+    return NULL;
+}
+
+/* New file: write the header. Existing one: check it, then append */
+static int open_file(const char *path, event_listener_t *listener) {
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("capture_start: open failed");
+        return -1;
+    }
+
+    struct stat st;
+    capture_header_t header;
+    if (fstat(fd, &st) < 0) {
+        perror("capture_start: fstat failed");
+        goto fail;
+    }
+
+    if (st.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        header.version = CAPTURE_VERSION;
+        header.record_size = sizeof(capture_record_t);
+        header.started_ns = monotonic_ns();
+        for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+            if (listener->devices[i].active) {
+                snprintf(header.devices[i], sizeof(header.devices[i]), "%s", listener->devices[i].name);
+            }
+        }
+        if (write_all(fd, &header, sizeof(header)) < 0) {
+            perror("capture_start: Failed to write header");
+            goto fail;
+        }
+        return fd;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ||
+        header.version != CAPTURE_VERSION || header.record_size != sizeof(capture_record_t)) {
+        fprintf(stderr, "capture_start: %s is not a vkbd capture\n", path);
+        goto fail;
+    }
+
+    /* A record cut short by a crash would shift everything after it */
+    off_t tail = (st.st_size - sizeof(header)) % sizeof(capture_record_t);
+    if (tail && ftruncate(fd, st.st_size - tail) < 0) {
+        perror("capture_start: ftruncate failed");
+        goto fail;
+    }
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+/* Start capturing */
+int capture_start(capture_t *cap, const char *path, event_listener_t *listener) {
+    if (!cap || !path || !listener) {
+        fprintf(stderr, "capture_start: Invalid arguments\n");
+        return -1;
+    }
+
+    memset(cap, 0, sizeof(*cap));
+    cap->stop_fd = -1;
+    cap->fd = open_file(path, listener);
+    if (cap->fd < 0) {
+        return -1;
+    }
+
+    /* Prefaulted: the listener thread never takes a page fault on it */
+    cap->ring = mmap(NULL, RING_BYTES, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (cap->ring == MAP_FAILED) {
+        perror("capture_start: mmap failed");
+        cap->ring = NULL;
+        goto fail;
+    }
+
+    cap->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (cap->stop_fd < 0) {
+        perror("capture_start: eventfd failed");
+        goto fail;
+    }
+
+    atomic_init(&cap->head, 0);
+    atomic_init(&cap->tail, 0);
+    if (pthread_create(&cap->thread, NULL, flush_thread, cap) != 0) {
+        fprintf(stderr, "capture_start: Failed to start flush thread\n");
+        goto fail;
+    }
+
+    cap->running = true;
+    cap->listener = listener;
+    listener->capture = cap;
+    return 0;
+
+fail:
+    if (cap->stop_fd >= 0) {
+        close(cap->stop_fd);
+        cap->stop_fd = -1;
+    }
+    if (cap->ring) {
+        munmap(cap->ring, RING_BYTES);
+        cap->ring = NULL;
+    }
+    close(cap->fd);
+    cap->fd = -1;
+    return -1;
+}
+
+/* Stop capturing */
+void capture_stop(capture_t *cap) {
+    if (!cap || !cap->running) {
+        return;
+    }
+
+    cap->listener->capture = NULL;
+    cap->listener = NULL;
+
+    uint64_t one = 1;
+    if (write(cap->stop_fd, &one, sizeof(one)) < 0) {
+        perror("capture_stop: eventfd write failed");
+    }
+    pthread_join(cap->thread, NULL);
+    cap->running = false;
+
+    fdatasync(cap->fd);
+    close(cap->fd);
+    close(cap->stop_fd);
+    munmap(cap->ring, RING_BYTES);
+    cap->fd = -1;
+    cap->stop_fd = -1;
+    cap->ring = NULL;
+}
+
+/* Map a capture file */
+const capture_record_t *capture_map(const char *path, capture_header_t *header, size_t *count) {
+    if (!path || !count) {
+        fprintf(stderr, "capture_map: Invalid arguments\n");
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("capture_map: open failed");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(capture_header_t)) {
+        fprintf(stderr, "capture_map: %s is not a vkbd capture\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("capture_map: mmap failed");
+        return NULL;
+    }
+
+    const capture_header_t *h = map;
+    if (memcmp(h->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ||
+        h->version != CAPTURE_VERSION || h->record_size != sizeof(capture_record_t)) {
+        fprintf(stderr, "capture_map: %s is not a vkbd capture (or another version)\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    if (header) {
+        *header = *h;
+    }
+    *count = (st.st_size - sizeof(capture_header_t)) / sizeof(capture_record_t);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    return (const capture_record_t *)((const char *)map + sizeof(capture_header_t));
+}
+
+/* Unmap records */
+void capture_unmap(const capture_record_t *records, size_t count) {
+    if (records) {
+        munmap((char *)records - sizeof(capture_header_t),
+               sizeof(capture_header_t) + count * sizeof(capture_record_t));
+    }
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+    struct timespec ts = {
+        .tv_sec = deadline_ns / 1000000000ULL,
+        .tv_nsec = deadline_ns % 1000000000ULL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/* Replay a capture */
+int capture_replay(const char *path, vkbd_context_t *ctx, double speed, int device,
+                   capture_replay_stats_t *stats) {
+    capture_replay_stats_t local;
+    struct input_event span[REPLAY_SPAN];
+    size_t count;
+
+    if (!path || !ctx) {
+        fprintf(stderr, "capture_replay: Invalid arguments\n");
+        return -1;
+    }
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    const capture_record_t *records = capture_map(path, NULL, &count);
+    if (!records) {
+        return -1;
+    }
+
+    uint64_t start = monotonic_ns();
+    uint64_t first_ns = 0;
+    size_t frame = 0;  /* First record of the current frame */
+
+    for (size_t i = 0; i < count; i++) {
+        const capture_record_t *rec = &records[i];
+        if (!(rec->type == EV_SYN && rec->code == SYN_REPORT) && i + 1 < count) {
+            continue;
+        }
+
+        /* Records [frame, i] form one frame, due at its report's offset */
+        uint64_t stamp;
+        if (speed > 0) {
+            if (!first_ns) {
+                first_ns = records[frame].time_ns;
+            }
+            uint64_t offset = rec->time_ns > first_ns ? rec->time_ns - first_ns : 0;
+            stamp = start + (uint64_t)(offset / speed);
+            sleep_until(stamp);
+            uint64_t late = monotonic_ns() - stamp;
+            if (late > stats->max_late_ns) {
+                stats->max_late_ns = late;
+            }
+        } else {
+            stamp = monotonic_ns();
+        }
+
+        /* Handed over in spans, as the listener does with what it reads */
+        int spanned = 0;
+        for (size_t j = frame; j <= i; j++) {
+            if (device >= 0 && records[j].device != device) {
+                continue;
+            }
+            struct input_event *ev = &span[spanned++];
+            ev->time.tv_sec = stamp / 1000000000ULL;
+            ev->time.tv_usec = (stamp % 1000000000ULL) / 1000;
+            ev->type = records[j].type;
+            ev->code = records[j].code;
+            ev->value = records[j].value;
+            if (spanned == REPLAY_SPAN) {
+                vkbd_process_batch(ctx, span, spanned);
+                spanned = 0;
+            }
+            stats->records++;
+        }
+        vkbd_process_batch(ctx, span, spanned);
+        if (vkbd_flush(ctx) < 0) {
+            capture_unmap(records, count);
+            return -1;
+        }
+        stats->frames++;
+        frame = i + 1;
+    }
+
+    stats->duration_ns = monotonic_ns() - start;
+    capture_unmap(records, count);
+    return 0;
+}
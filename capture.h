@@ -0,0 +1,172 @@
+/**
+ * Capture / Replay - Input streams in a compact binary file
+ *
+ * Capture: every event the listener reads is copied, with its source slot
+ * and kernel timestamp, into a lock-free ring in mmap'd memory. A
+ * background thread appends the ring to the file a few times a second, so
+ * the forwarding thread never makes a syscall for it; when the ring is
+ * full, records are dropped and counted instead of blocking.
+ *
+ * File: a capture_header_t, then capture_record_t records, appended only.
+ * Capturing into an existing file continues it.
+ *
+ * Replay: the records are fed back through vkbd_process_batch/vkbd_flush
+ * frame by frame (one SYN_REPORT each), at the original pace scaled by a
+ * speed factor or as fast as possible.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "vkbd.h"
+#include "event_listener.h"
+#include "counter.h"
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define CAPTURE_MAGIC "VKBDCAP"
+#define CAPTURE_VERSION 1
+
+/* Ring capacity in records (power of two): 1 MiB */
+#define CAPTURE_RING_RECORDS 65536
+#define CAPTURE_RING_MASK (CAPTURE_RING_RECORDS - 1)
+
+/* Background flush interval */
+#define CAPTURE_FLUSH_MS 100
+
+/* File header */
+typedef struct {
+    char magic[8];                   /* CAPTURE_MAGIC */
+    uint32_t version;
+    uint32_t record_size;            /* sizeof(capture_record_t) */
+    uint64_t started_ns;             /* CLOCK_MONOTONIC when the file was created */
+    char devices[MAX_INPUT_DEVICES][64];  /* Source names by slot, when the file was created */
+} capture_header_t;
+
+/* One event - 16 bytes instead of the 24 of struct input_event */
+typedef struct {
+    uint64_t time_ns;                /* Kernel timestamp (CLOCK_MONOTONIC) */
+    int32_t value;
+    uint16_t code;
+    uint8_t type;
+    uint8_t device;                  /* Listener slot of the source */
+} capture_record_t;
+
+/* Capture state */
+typedef struct capture {
+    capture_record_t *ring;          /* CAPTURE_RING_RECORDS records, mmap'd */
+    _Alignas(64) _Atomic uint64_t head;  /* Next record to fill (listener thread) */
+    _Alignas(64) _Atomic uint64_t tail;  /* Next record to write (flush thread) */
+    int fd;
+    int stop_fd;                     /* eventfd: flush thread exits */
+    pthread_t thread;
+    bool running;
+    event_listener_t *listener;
+
+    /* Listener thread */
+    counter_t records;               /* Appended to the ring */
+    counter_t dropped;               /* Ring full */
+
+    /* Flush thread */
+    counter_t written;               /* Records written to the file */
+    counter_t flushes;               /* write() calls */
+    counter_t write_errors;
+} capture_t;
+
+/* Replay statistics */
+typedef struct {
+    unsigned long records;
+    unsigned long frames;            /* vkbd_flush calls */
+    uint64_t duration_ns;
+    uint64_t max_late_ns;            /* Worst frame deadline -> queued (paced replay) */
+} capture_replay_stats_t;
+
+/**
+ * Start capturing everything a listener reads into a file
+ *
+ * Call while the listener is not running or from its thread.
+ *
+ * @param cap Pointer to capture_t structure
+ * @param path File to create or continue
+ * @param listener Listener to capture from
+ * @return 0 on success, -1 on error
+ */
+int capture_start(capture_t *cap, const char *path, event_listener_t *listener);
+
+/**
+ * Stop capturing: detach, write what is left and close the file
+ *
+ * Same thread rules as capture_start.
+ *
+ * @param cap Pointer to capture_t structure
+ */
+void capture_stop(capture_t *cap);
+
+/**
+ * Append events read from a source (listener thread, no syscalls)
+ *
+ * @param cap Pointer to capture_t structure
+ * @param device Listener slot of the source
+ * @param evs Events as read
+ * @param count Number of events
+ */
+static inline void capture_append(capture_t *cap, int device, const struct input_event *evs, int count) {
+    uint64_t head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&cap->tail, memory_order_acquire);
+
+    if (__builtin_expect(head + count - tail > CAPTURE_RING_RECORDS, 0)) {
+        counter_add(&cap->dropped, count);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        capture_record_t *rec = &cap->ring[(head + i) & CAPTURE_RING_MASK];
+        rec->time_ns = (uint64_t)evs[i].time.tv_sec * 1000000000ULL +
+                       (uint64_t)evs[i].time.tv_usec * 1000ULL;
+        rec->value = evs[i].value;
+        rec->code = evs[i].code;
+        rec->type = evs[i].type;
+        rec->device = device;
+    }
+    atomic_store_explicit(&cap->head, head + count, memory_order_release);
+    counter_add(&cap->records, count);
+}
+
+/**
+ * Map a capture file read-only
+ *
+ * @param path Capture file
+ * @param header Receives the header (may be NULL)
+ * @param count Receives the number of complete records
+ * @return Records (unmap with capture_unmap), NULL on error
+ */
+const capture_record_t *capture_map(const char *path, capture_header_t *header, size_t *count);
+
+/**
+ * Unmap records returned by capture_map
+ *
+ * @param records Mapped records
+ * @param count Record count returned by capture_map
+ */
+void capture_unmap(const capture_record_t *records, size_t count);
+
+/**
+ * Feed a capture through a virtual keyboard's processing path
+ *
+ * Each frame's events are handed to vkbd_process_batch (so batch handlers
+ * see them as they would a read) and written with one vkbd_flush. Paced replays sleep until each frame is due and stamp it with
+ * that deadline, so the latency histogram includes any lateness; fast ones
+ * stamp each frame with the time it is queued.
+ *
+ * @param path Capture file
+ * @param ctx Virtual keyboard to replay into
+ * @param speed 1.0 = original pace, 2.0 = twice as fast, <= 0 = as fast as possible
+ * @param device Only this source slot, -1 for all
+ * @param stats Receives statistics (may be NULL)
+ * @return 0 on success, -1 on error
+ */
+int capture_replay(const char *path, vkbd_context_t *ctx, double speed, int device,
+                   capture_replay_stats_t *stats);
+
+#endif /* CAPTURE_H */
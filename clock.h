@@ -0,0 +1,32 @@
+/**
+ * Clock - CLOCK_MONOTONIC time and timerfd deadlines
+ *
+ * Header-only. Source timestamps (after EVIOCSCLOCKID), latency, statistics
+ * and every engine timer use CLOCK_MONOTONIC nanoseconds, so deadlines are
+ * absolute and comparable with event times.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Arm a CLOCK_MONOTONIC timerfd at an absolute deadline (0 disarms) */
+static inline void timerfd_arm_at(int fd, uint64_t deadline_ns) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline_ns / 1000000000ULL;
+    its.it_value.tv_nsec = deadline_ns % 1000000000ULL;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+#endif /* CLOCK_H */
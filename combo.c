@@ -0,0 +1,423 @@
+/**
+ * Combo Engine - Implementation
+ */
+
+#include "combo.h"
+#include "clock.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+static void count_compared(combo_engine_t *ce, unsigned long compared) {
+    ce->stats.compared += compared;
+    if (compared > ce->stats.max_compared) {
+        ce->stats.max_compared = compared;
+    }
+}
+
+/* Fire a combo: press its output, swallow its keys until they are released */
+static void fire(combo_engine_t *ce, int idx, const keyset_t *keys) {
+    const combo_t *c = &ce->combos[idx];
+
+    if (c->kind == COMBO_CHORD) {
+        ce->stats.chords++;
+    } else {
+        ce->stats.hotkeys++;
+    }
+
+    for (int w = 0; w < KEYSET_WORDS; w++) {
+        ce->swallowed.w[w] |= keys->w[w];
+    }
+
+    if (c->output) {
+        vkbd_emit_key(ce->vkbd_ctx, c->output, 1);
+        if (ce->active_count < COMBO_MAX_ACTIVE) {
+            combo_active_t *a = &ce->active[ce->active_count++];
+            a->combo = idx;
+            a->keys = *keys;
+            a->output_down = true;
+        } else {
+            vkbd_emit_key(ce->vkbd_ctx, c->output, 0);   /* Nowhere to track it: tap */
+        }
+    }
+
+    if (c->action) {
+        c->action(ce->vkbd_ctx, idx, c->user_data);
+    }
+}
+
+/* A swallowed key went up: the first one releases its combo's output */
+static void release_swallowed(combo_engine_t *ce, uint16_t code) {
+    keyset_clear(&ce->swallowed, code);
+
+    for (int i = 0; i < ce->active_count; i++) {
+        combo_active_t *a = &ce->active[i];
+        if (!keyset_test(&a->keys, code)) {
+            continue;
+        }
+        if (a->output_down) {
+            vkbd_emit_key(ce->vkbd_ctx, ce->combos[a->combo].output, 0);
+            a->output_down = false;
+        }
+        keyset_clear(&a->keys, code);
+        if (keyset_empty(&a->keys)) {
+            ce->active[i] = ce->active[--ce->active_count];
+        }
+        return;
+    }
+}
+
+/* The most specific hotkey on this trigger whose modifiers are all held */
+static int match_hotkey(combo_engine_t *ce, uint16_t code) {
+    int best = -1;
+    unsigned long compared = 0;
+
+    for (int r = ce->head[code]; r >= 0; r = ce->refs[r].next) {
+        const combo_t *c = &ce->combos[ce->refs[r].combo];
+        if (c->kind != COMBO_HOTKEY) {
+            continue;
+        }
+        compared++;
+        if (keyset_contains(&ce->pressed, &c->keys) &&
+            (best < 0 || c->key_count > ce->combos[best].key_count)) {
+            best = ce->refs[r].combo;
+        }
+    }
+    count_compared(ce, compared);
+    return best;
+}
+
+/* Chords through this key that contain keys: exact match, and whether a bigger one could still complete */
+static int match_chord(combo_engine_t *ce, uint16_t code, const keyset_t *keys, bool *bigger) {
+    int exact = -1;
+    unsigned long compared = 0;
+
+    *bigger = false;
+    for (int r = ce->head[code]; r >= 0; r = ce->refs[r].next) {
+        const combo_t *c = &ce->combos[ce->refs[r].combo];
+        if (c->kind != COMBO_CHORD) {
+            continue;
+        }
+        compared++;
+        if (!keyset_contains(&c->keys, keys)) {
+            continue;
+        }
+        if (keyset_equal(&c->keys, keys)) {
+            exact = ce->refs[r].combo;
+        } else {
+            *bigger = true;
+        }
+    }
+    count_compared(ce, compared);
+    return exact;
+}
+
+/* End the chord attempt: fire it if complete, otherwise forward the held presses */
+static void resolve(combo_engine_t *ce) {
+    bool bigger;
+    int exact = match_chord(ce, ce->buffer[0], &ce->pending, &bigger);
+
+    timerfd_arm_at(ce->timer_fd, 0);
+    if (exact >= 0) {
+        fire(ce, exact, &ce->pending);
+    } else {
+        ce->stats.broken++;
+        for (int i = 0; i < ce->buffered; i++) {
+            vkbd_emit_key(ce->vkbd_ctx, ce->buffer[i], 1);
+        }
+    }
+    ce->buffered = 0;
+    keyset_clear_all(&ce->pending);
+}
+
+/* Add a press to the chord being collected, false if no chord can use it */
+static bool extend(combo_engine_t *ce, uint16_t code) {
+    keyset_t keys = ce->pending;
+    bool bigger;
+
+    if (ce->buffered == COMBO_MAX_KEYS || !keyset_test(&ce->chord_keys, code)) {
+        return false;
+    }
+    keyset_set(&keys, code);
+    int exact = match_chord(ce, code, &keys, &bigger);
+    if (exact < 0 && !bigger) {
+        return false;
+    }
+
+    ce->pending = keys;
+    ce->buffer[ce->buffered++] = code;
+    if (exact >= 0 && !bigger) {
+        resolve(ce);   /* Nothing longer to wait for */
+    }
+    return true;
+}
+
+/* Core state machine - every event it lets through is emitted */
+static void feed(combo_engine_t *ce, uint16_t code, int32_t value) {
+    if (keyset_test(&ce->swallowed, code)) {
+        if (value == 0) {
+            release_swallowed(ce, code);
+        }
+        return;
+    }
+
+    if (ce->buffered > 0) {
+        if (keyset_test(&ce->pending, code) && value == 2) {
+            return;   /* Repeats while collecting */
+        }
+        if (value == 1 && extend(ce, code)) {
+            return;
+        }
+        /* Anything else ends the attempt first, then is handled as usual */
+        resolve(ce);
+        feed(ce, code, value);
+        return;
+    }
+
+    if (value == 1) {
+        int hotkey = match_hotkey(ce, code);
+        if (hotkey >= 0) {
+            keyset_t trigger;
+            keyset_clear_all(&trigger);
+            keyset_set(&trigger, code);
+            fire(ce, hotkey, &trigger);
+            return;
+        }
+        if (keyset_test(&ce->chord_keys, code)) {
+            /* Held back until the chord completes, breaks or times out */
+            keyset_set(&ce->pending, code);
+            ce->buffer[0] = code;
+            ce->buffered = 1;
+            ce->pending_since_ns = monotonic_ns();
+            timerfd_arm_at(ce->timer_fd, ce->pending_since_ns + ce->term_ns);
+            return;
+        }
+    }
+
+    vkbd_emit_key(ce->vkbd_ctx, code, value);
+}
+
+/* Filter stage: keys in no combo pass straight through when nothing is pending */
+static vkbd_verdict_t combo_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)ctx;
+    combo_engine_t *ce = user_data;
+    uint16_t code = ev->code;
+
+    if (__builtin_expect(code >= KEY_CNT, 0)) {
+        return VKBD_FILTER_PASS;
+    }
+    if (ev->value == 1) {
+        keyset_set(&ce->pressed, code);
+    } else if (ev->value == 0) {
+        keyset_clear(&ce->pressed, code);
+    }
+
+    if (__builtin_expect(ce->buffered == 0 && ce->head[code] < 0 &&
+                         !keyset_test(&ce->swallowed, code), 1)) {
+        return VKBD_FILTER_PASS;
+    }
+
+    feed(ce, code, ev->value);
+    return VKBD_FILTER_DROP;
+}
+
+/* timerfd source: the chord window ran out */
+static void combo_timer_handler(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)listener;
+    (void)events;
+    combo_engine_t *ce = user_data;
+    uint64_t expirations;
+
+    if (read(ce->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;  /* Disarmed or re-armed since it became readable */
+    }
+    if (ce->buffered > 0) {
+        unsigned long broken = ce->stats.broken;
+        resolve(ce);
+        if (ce->stats.broken != broken) {
+            ce->stats.timeouts++;
+        }
+        vkbd_flush(ce->vkbd_ctx);
+    }
+}
+
+/* Initialize combo engine */
+void combo_init(combo_engine_t *ce, int term_ms) {
+    if (!ce) {
+        return;
+    }
+
+    memset(ce, 0, sizeof(*ce));
+    memset(ce->head, 0xff, sizeof(ce->head));
+    ce->term_ns = (uint64_t)(term_ms > 0 ? term_ms : COMBO_TERM_MS) * 1000000ULL;
+    ce->timer_fd = -1;
+    ce->filter_id = -1;
+}
+
+/* Index a combo under a key */
+static int add_ref(combo_engine_t *ce, uint16_t code, int combo) {
+    if (ce->ref_count >= COMBO_MAX_REFS) {
+        return -1;
+    }
+    ce->refs[ce->ref_count].combo = combo;
+    ce->refs[ce->ref_count].next = ce->head[code];
+    ce->head[code] = ce->ref_count++;
+    return 0;
+}
+
+/* Build a key set, rejecting bad or repeated codes */
+static int make_set(keyset_t *set, const uint16_t *keys, int count) {
+    keyset_clear_all(set);
+    for (int i = 0; i < count; i++) {
+        if (keys[i] == 0 || keys[i] >= KEY_CNT || keyset_test(set, keys[i])) {
+            return -1;
+        }
+        keyset_set(set, keys[i]);
+    }
+    return 0;
+}
+
+/* Add a chord */
+int combo_add_chord(combo_engine_t *ce, const uint16_t *keys, int count, uint16_t output) {
+    keyset_t set;
+
+    if (!ce || !keys || count < 2 || count > COMBO_MAX_KEYS || output >= KEY_CNT ||
+        make_set(&set, keys, count) < 0) {
+        fprintf(stderr, "combo_add_chord: Invalid arguments\n");
+        return -1;
+    }
+
+    if (ce->combo_count >= COMBO_MAX || ce->ref_count + count > COMBO_MAX_REFS) {
+        fprintf(stderr, "combo_add_chord: Too many combos\n");
+        return -1;
+    }
+
+    for (int r = ce->head[keys[0]]; r >= 0; r = ce->refs[r].next) {
+        const combo_t *c = &ce->combos[ce->refs[r].combo];
+        if (c->kind == COMBO_CHORD && keyset_equal(&c->keys, &set)) {
+            fprintf(stderr, "combo_add_chord: Chord already defined\n");
+            return -1;
+        }
+    }
+
+    int idx = ce->combo_count++;
+    combo_t *c = &ce->combos[idx];
+    memset(c, 0, sizeof(*c));
+    c->keys = set;
+    c->kind = COMBO_CHORD;
+    c->key_count = count;
+    c->output = output;
+    for (int i = 0; i < count; i++) {
+        add_ref(ce, keys[i], idx);
+        keyset_set(&ce->chord_keys, keys[i]);
+    }
+    return idx;
+}
+
+/* Add a hotkey */
+int combo_add_hotkey(combo_engine_t *ce, const uint16_t *mods, int mod_count,
+                     uint16_t trigger, uint16_t output) {
+    keyset_t set;
+
+    if (!ce || (mod_count > 0 && !mods) || mod_count < 0 || mod_count > COMBO_MAX_KEYS ||
+        trigger == 0 || trigger >= KEY_CNT || output >= KEY_CNT ||
+        make_set(&set, mods, mod_count) < 0 || keyset_test(&set, trigger)) {
+        fprintf(stderr, "combo_add_hotkey: Invalid arguments\n");
+        return -1;
+    }
+
+    if (ce->combo_count >= COMBO_MAX || ce->ref_count >= COMBO_MAX_REFS) {
+        fprintf(stderr, "combo_add_hotkey: Too many combos\n");
+        return -1;
+    }
+
+    for (int r = ce->head[trigger]; r >= 0; r = ce->refs[r].next) {
+        const combo_t *c = &ce->combos[ce->refs[r].combo];
+        if (c->kind == COMBO_HOTKEY && keyset_equal(&c->keys, &set)) {
+            fprintf(stderr, "combo_add_hotkey: Hotkey already defined\n");
+            return -1;
+        }
+    }
+
+    int idx = ce->combo_count++;
+    combo_t *c = &ce->combos[idx];
+    memset(c, 0, sizeof(*c));
+    c->keys = set;
+    c->trigger = trigger;
+    c->kind = COMBO_HOTKEY;
+    c->key_count = mod_count;
+    c->output = output;
+    add_ref(ce, trigger, idx);
+    return idx;
+}
+
+/* Set the action of a combo */
+int combo_set_action(combo_engine_t *ce, int combo, combo_action_t action, void *user_data) {
+    if (!ce || combo < 0 || combo >= ce->combo_count) {
+        fprintf(stderr, "combo_set_action: Invalid arguments\n");
+        return -1;
+    }
+
+    ce->combos[combo].action = action;
+    ce->combos[combo].user_data = user_data;
+    return 0;
+}
+
+/* Install filter and timer */
+int combo_attach(combo_engine_t *ce, vkbd_context_t *ctx, event_listener_t *listener) {
+    if (!ce || !ctx || !listener) {
+        fprintf(stderr, "combo_attach: Invalid arguments\n");
+        return -1;
+    }
+
+    ce->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ce->timer_fd < 0) {
+        perror("combo_attach: timerfd_create failed");
+        return -1;
+    }
+
+    if (event_listener_add_source(listener, ce->timer_fd, EPOLLIN,
+                                  combo_timer_handler, ce) < 0) {
+        goto fail;
+    }
+    ce->listener = listener;
+
+    /* Set before the filter can run */
+    ce->vkbd_ctx = ctx;
+    ce->filter_id = vkbd_register_filter(ctx, combo_filter, ce);
+    if (ce->filter_id < 0) {
+        event_listener_remove_source(listener, ce->timer_fd);
+        ce->listener = NULL;
+        ce->vkbd_ctx = NULL;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    close(ce->timer_fd);
+    ce->timer_fd = -1;
+    return -1;
+}
+
+/* Remove filter and timer */
+void combo_detach(combo_engine_t *ce) {
+    if (!ce) {
+        return;
+    }
+
+    if (ce->vkbd_ctx && ce->filter_id >= 0) {
+        vkbd_unregister_filter(ce->vkbd_ctx, ce->filter_id);
+        ce->filter_id = -1;
+    }
+    if (ce->timer_fd >= 0) {
+        if (ce->listener) {
+            event_listener_remove_source(ce->listener, ce->timer_fd);
+            ce->listener = NULL;
+        }
+        close(ce->timer_fd);
+        ce->timer_fd = -1;
+    }
+}
@@ -0,0 +1,191 @@
+/**
+ * Combo Engine
+ *
+ * Chords (keys pressed together within a short window, e.g. J+K = Esc) and
+ * hotkeys (held modifiers plus a trigger, e.g. Ctrl+Alt+T) that fire an
+ * output key and/or an action. A chord swallows all of its keys; a hotkey
+ * swallows only its trigger - the modifiers were forwarded when pressed and
+ * stay down, so Ctrl+Alt+T -> F13 reaches applications as Ctrl+Alt+F13.
+ *
+ * Matching works on the set of physical keys down (a keyset_t over every
+ * key code). Combos are indexed by the keys that can complete them, so a
+ * key only looks at the combos it belongs to, and each comparison is a
+ * word-wide subset/equality test over the whole set - the cost per key
+ * does not grow with the number of combos declared. Keys no combo uses
+ * pass straight through.
+ *
+ * A chord key is held back until the chord completes, the window (a
+ * timerfd in the listener's epoll set) runs out or another key breaks it;
+ * then the held keys are forwarded as typed.
+ *
+ * Its output is staged with vkbd_emit() - see there for filter order.
+ */
+
+#ifndef COMBO_H
+#define COMBO_H
+
+#include "vkbd.h"
+#include "event_listener.h"
+#include "keyset.h"
+#include <stdint.h>
+
+/* Maximum number of combos */
+#define COMBO_MAX 512
+
+/* Keys in one chord, modifiers in one hotkey */
+#define COMBO_MAX_KEYS 8
+
+/* Index entries: one per chord key, one per hotkey */
+#define COMBO_MAX_REFS (COMBO_MAX * COMBO_MAX_KEYS)
+
+/* Fired combos whose keys can be down at the same time */
+#define COMBO_MAX_ACTIVE 8
+
+/* Default chord window */
+#define COMBO_TERM_MS 50
+
+/* Combo kinds */
+typedef enum {
+    COMBO_CHORD,   /* All keys pressed within the window, in any order */
+    COMBO_HOTKEY   /* Trigger pressed while the modifiers are held */
+} combo_kind_t;
+
+/**
+ * Action run when a combo fires (listener thread, inside the filter chain)
+ *
+ * May stage events with vkbd_emit().
+ *
+ * @param ctx Virtual keyboard the combo is attached to
+ * @param combo Index returned by combo_add_chord/combo_add_hotkey
+ * @param user_data User data passed to combo_set_action
+ */
+typedef void (*combo_action_t)(vkbd_context_t *ctx, int combo, void *user_data);
+
+/* Combo definition */
+typedef struct {
+    keyset_t keys;          /* Chord: every key. Hotkey: the modifiers */
+    uint16_t trigger;       /* Hotkey only */
+    uint8_t kind;           /* combo_kind_t */
+    uint8_t key_count;      /* Keys in the set - the most specific hotkey wins */
+    uint16_t output;        /* Held while the combo's keys are, 0 = none */
+    combo_action_t action;
+    void *user_data;
+} combo_t;
+
+/* Index entry: a combo the key belongs to */
+typedef struct {
+    uint16_t combo;
+    int16_t next;           /* Next entry for the same key, -1 = last */
+} combo_ref_t;
+
+/* A fired combo whose swallowed keys are still down */
+typedef struct {
+    int combo;
+    keyset_t keys;          /* Swallowed keys not released yet */
+    bool output_down;
+} combo_active_t;
+
+/* Matching statistics */
+typedef struct {
+    unsigned long chords;           /* Chords fired */
+    unsigned long hotkeys;          /* Hotkeys fired */
+    unsigned long broken;           /* Chord attempts forwarded as typed */
+    unsigned long timeouts;         /* ... because the window ran out */
+    unsigned long compared;         /* Combo masks compared */
+    unsigned long max_compared;     /* Most compared for one key */
+} combo_stats_t;
+
+/* Combo engine structure */
+typedef struct {
+    combo_t combos[COMBO_MAX];
+    int combo_count;
+    int16_t head[KEY_CNT];            /* key code -> first refs[] entry, -1 = in no combo */
+    combo_ref_t refs[COMBO_MAX_REFS];
+    int ref_count;
+    keyset_t chord_keys;              /* Keys of any chord */
+    keyset_t pressed;                 /* Physical keys down */
+    uint64_t term_ns;
+
+    /* Chord being collected */
+    keyset_t pending;
+    uint16_t buffer[COMBO_MAX_KEYS];  /* Its presses, in order */
+    int buffered;
+    uint64_t pending_since_ns;
+
+    /* Fired combos */
+    keyset_t swallowed;               /* Releases and repeats to drop */
+    combo_active_t active[COMBO_MAX_ACTIVE];
+    int active_count;
+
+    int timer_fd;
+    int filter_id;
+    vkbd_context_t *vkbd_ctx;
+    event_listener_t *listener;
+    combo_stats_t stats;
+} combo_engine_t;
+
+/**
+ * Initialize combo engine
+ *
+ * @param ce Pointer to combo_engine_t structure
+ * @param term_ms Chord window in milliseconds (<= 0: COMBO_TERM_MS)
+ */
+void combo_init(combo_engine_t *ce, int term_ms);
+
+/**
+ * Add a chord
+ *
+ * @param ce Pointer to combo_engine_t structure
+ * @param keys Key codes (2 to COMBO_MAX_KEYS, any order)
+ * @param count Number of keys
+ * @param output Key held while the chord is, 0 for none
+ * @return Combo index on success, -1 on error (including a duplicate)
+ */
+int combo_add_chord(combo_engine_t *ce, const uint16_t *keys, int count, uint16_t output);
+
+/**
+ * Add a hotkey
+ *
+ * The modifiers are ordinary keys and are forwarded; only the trigger is
+ * swallowed, so the output is seen together with the held modifiers. When several hotkeys share a trigger, the one with the most
+ * modifiers held wins.
+ *
+ * @param ce Pointer to combo_engine_t structure
+ * @param mods Modifier key codes (up to COMBO_MAX_KEYS)
+ * @param mod_count Number of modifiers
+ * @param trigger Key that fires it
+ * @param output Key held while the trigger is, 0 for none
+ * @return Combo index on success, -1 on error (including a duplicate)
+ */
+int combo_add_hotkey(combo_engine_t *ce, const uint16_t *mods, int mod_count,
+                     uint16_t trigger, uint16_t output);
+
+/**
+ * Run a function when a combo fires (after its output is pressed)
+ *
+ * @param ce Pointer to combo_engine_t structure
+ * @param combo Combo index
+ * @param action Function, NULL to remove
+ * @param user_data User data passed to it
+ * @return 0 on success, -1 on error
+ */
+int combo_set_action(combo_engine_t *ce, int combo, combo_action_t action, void *user_data);
+
+/**
+ * Install as a filter stage and register the chord timer with the listener
+ *
+ * @param ce Pointer to combo_engine_t structure
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param listener Listener whose epoll set receives the timerfd
+ * @return 0 on success, -1 on error
+ */
+int combo_attach(combo_engine_t *ce, vkbd_context_t *ctx, event_listener_t *listener);
+
+/**
+ * Remove the filter stage and close the timer
+ *
+ * @param ce Pointer to combo_engine_t structure
+ */
+void combo_detach(combo_engine_t *ce);
+
+#endif /* COMBO_H */
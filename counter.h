@@ -0,0 +1,29 @@
+/**
+ * Counters - Single-writer statistics readable from any thread
+ *
+ * Header-only. Every counter has exactly one writer (the thread that owns
+ * the code path it counts), so an increment is a relaxed load and store -
+ * no lock and no atomic read-modify-write on the hot path. Readers on other
+ * threads (or metrics.h publishing them) load them relaxed.
+ */
+
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef _Atomic uint64_t counter_t;
+
+/* Owning thread only */
+static inline void counter_add(counter_t *c, uint64_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+/* Any thread */
+static inline uint64_t counter_get(const counter_t *c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+#endif /* COUNTER_H */
@@ -4,20 +4,111 @@
  * Captures input from real keyboard devices and forwards to virtual keyboard
  */
 
+#define _GNU_SOURCE
+
 #include "event_listener.h"
+#include "clock.h"
+#include "spsc_ring.h"
+#include "uring.h"
+#include "capture.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <fnmatch.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <linux/input.h>
+#include <linux/netlink.h>
 
 #define INPUT_DIR "/dev/input"
+#define INPUT_SYSFS_DIR "/sys/class/input"
 #define MAX_EVENTS 64
+#define MAX_READ_EVENTS 64
+#define UEVENT_BUFFER 8192
+#define PIPELINE_BATCH 64
+#define URING_ENTRIES 128
+#define URING_OUT_EVENTS (4 * VKBD_OUT_BUFFER)
+#define URING_STOP_TIMEOUT_S 1
+
+/* Pipelined mode: reader thread, its epoll set and the ring to the writer */
+struct listener_pipeline {
+    spsc_ring_t ring;            /* First member: cache-line aligned */
+    event_listener_t *listener;
+    int epoll_fd;                /* Reader's set: devices + stop_fd */
+    int ready_fd;                /* eventfd, reader -> writer: items queued */
+    int stop_fd;                 /* eventfd, writer -> reader: exit */
+    pthread_t reader;
+};
+
+/* io_uring engine: request kind in the low byte of user_data, then the
+ * device slot and the slot generation the request was queued for */
+enum {
+    URING_READ = 1,              /* Device read */
+    URING_READ_POLL,             /* Poll linked in front of a read (after -EAGAIN) */
+    URING_WRITE,                 /* Output write */
+    URING_WRITE_POLL,            /* Poll linked in front of a write (after -EAGAIN) */
+    URING_WRITE_CHECK,           /* NOP linked behind a write - completes only if it came up short */
+    URING_SOURCES,               /* Poll on the epoll set of extra sources */
+    URING_CANCEL,
+    URING_TIMEOUT,               /* Bounds the wait for cancellations on stop */
+};
+
+#define URING_DATA(kind, slot, gen) ((uint64_t)(gen) << 16 | (uint64_t)(slot) << 8 | (kind))
+#define URING_KIND(data) ((int)((data) & 0xff))
+#define URING_SLOT(data) ((int)(((data) >> 8) & 0xff))
+#define URING_GEN(data) ((uint32_t)((data) >> 16))
+
+/* Read state of one device slot */
+struct uring_slot {
+    struct input_event buf[MAX_READ_EVENTS];  /* Owned by the kernel while armed */
+    uint32_t gen;                /* Bumped on release - reads queued before are stale */
+    bool armed;                  /* A read is queued */
+    bool linked;                 /* ...behind a poll */
+    bool canceled;               /* Cancel requested for the queued read */
+    bool poll_first;             /* Last read said -EAGAIN: poll before reading */
+};
+
+/* io_uring mode: the ring, per-device reads and the output double buffer */
+struct listener_uring {
+    uring_t ring;
+    event_listener_t *listener;
+    int device_epoll_fd;         /* Devices are parked here - nobody waits on it */
+    unsigned inflight;           /* Queued requests whose CQE is still due */
+    bool sources_armed;
+    bool stopping;
+    bool timed_out;
+    struct __kernel_timespec stop_timeout;
+    struct uring_slot slots[MAX_INPUT_DEVICES];
+
+    /* Read and source completions reaped while waiting for a write */
+    struct io_uring_cqe backlog[MAX_INPUT_DEVICES + 1];
+    int backlog_count;
+
+    /* Output: one write in flight, later flushes collect behind it in order */
+    struct input_event out[2][URING_OUT_EVENTS];
+    uint64_t out_src[2][URING_OUT_EVENTS];   /* Source times, for latency on completion */
+    int out_len[2];
+    int out_busy;                /* out[] being written, -1 if none */
+    size_t out_done;             /* Bytes of out[out_busy] already written */
+    bool out_counted;            /* Write ahead has a check NOP: the loop waits past its completion */
+    bool out_nowait;             /* Writes say -EAGAIN instead of parking in the kernel */
+    bool write_error_logged;
+};
+
+static void uring_forget(struct listener_uring *u, input_device_t *dev);
 
 /* Bit manipulation macros */
 #define NBITS(x) ((((x) - 1) / (sizeof(long) * 8)) + 1)
@@ -26,36 +117,142 @@
 #define LONG(x) ((x) / (sizeof(long) * 8))
 #define test_bit(bit, array) ((array[LONG(bit)] >> OFFSET(bit)) & 1)
 
-/* Check if device is a keyboard */
-static bool is_keyboard(int fd) {
+/* Describe an open evdev node with ioctls */
+static void input_info_from_fd(int fd, input_info_t *info) {
     unsigned long evbit[NBITS(EV_MAX)] = {0};
-    unsigned long keybit[NBITS(KEY_MAX)] = {0};
+    struct input_id id;
 
-    /* Get event types supported */
-    if (ioctl(fd, EVIOCGBIT(0, sizeof(evbit)), evbit) < 0) {
-        return false;
+    memset(info, 0, sizeof(*info));
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(evbit)), evbit) >= 0 && test_bit(EV_KEY, evbit)) {
+        /* keyset_t words have the kernel's bitmap layout (little-endian longs) */
+        info->has_keys = ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(info->keys.w)), info->keys.w) >= 0;
     }
-
-    /* Check if device supports key events */
-    if (!test_bit(EV_KEY, evbit)) {
-        return false;
+    if (ioctl(fd, EVIOCGID, &id) >= 0) {
+        info->bustype = id.bustype;
+        info->vendor = id.vendor;
+        info->product = id.product;
     }
+    ioctl(fd, EVIOCGNAME(sizeof(info->name)), info->name);
+    ioctl(fd, EVIOCGPHYS(sizeof(info->phys)), info->phys);
+}
 
-    /* Get key codes supported */
-    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybit)), keybit) < 0) {
+/* Check if device is a keyboard: key events, typical letter keys among them */
+static bool is_keyboard(const input_info_t *info) {
+    if (!info->has_keys) {
         return false;
     }
 
-    /* Check for typical keyboard keys */
-    bool has_keyboard_keys = false;
     for (int i = KEY_Q; i <= KEY_P; i++) {
-        if (test_bit(i, keybit)) {
-            has_keyboard_keys = true;
-            break;
+        if (keyset_test(&info->keys, i)) {
+            return true;
         }
     }
+    return false;
+}
+
+/* evdev backend: open, verify and grab a /dev/input/event* node */
+static int evdev_open(input_device_t *dev, const char *path) {
+    /* Open device */
+    int fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        perror("event_listener_add_device: Failed to open device");
+        return -1;
+    }
+
+    /* Check if it's a keyboard (capabilities and ids are kept for routing) */
+    input_info_from_fd(fd, &dev->info);
+    if (!is_keyboard(&dev->info)) {
+        fprintf(stderr, "Device %s is not a keyboard\n", path);
+        close(fd);
+        return -1;
+    }
+    const char *node = strrchr(path, '/');
+    snprintf(dev->info.node, sizeof(dev->info.node), "%s", node ? node + 1 : path);
+    if (!dev->info.name[0]) {
+        snprintf(dev->info.name, sizeof(dev->info.name), "Unknown");
+    }
+
+    /* Grab device (exclusive access) */
+    /* This prevents the original keyboard from sending events to other apps */
+    /* Comment this out if you want to test without exclusive access */
+    if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+        fprintf(stderr, "Warning: Could not grab device %s (may need root)\n", path);
+        fprintf(stderr, "         Events will still be captured but also sent to system\n");
+        /* Continue anyway - useful for testing without breaking system input */
+    }
+
+    /* Kernel stamps events on the same clock vkbd_flush measures latency with */
+    int clk = CLOCK_MONOTONIC;
+    if (ioctl(fd, EVIOCSCLOCKID, &clk) < 0) {
+        fprintf(stderr, "Warning: Could not set monotonic clock on %s\n", path);
+    }
+
+    dev->fd = fd;
+    strncpy(dev->name, dev->info.name, sizeof(dev->name) - 1);
+    return 0;
+}
+
+/* evdev backend: release grab and close */
+static void evdev_close(input_device_t *dev) {
+    ioctl(dev->fd, EVIOCGRAB, 0);
+    close(dev->fd);
+    dev->fd = -1;
+}
+
+const input_backend_t input_backend_evdev = {
+    .name = "evdev",
+    .open = evdev_open,
+    .close = evdev_close,
+};
+
+/* Pipe backend: the path is only used as the device name */
+static int pipe_open(input_device_t *dev, const char *path) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("event_listener_add_device: Failed to create pipe");
+        return -1;
+    }
+
+    /* Read side behaves like an evdev node opened with O_NONBLOCK */
+    int flags = fcntl(fds[0], F_GETFL);
+    if (flags < 0 || fcntl(fds[0], F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("event_listener_add_device: Failed to set O_NONBLOCK");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
 
-    return has_keyboard_keys;
+    dev->fd = fds[0];
+    dev->peer_fd = fds[1];
+    strncpy(dev->name, path, sizeof(dev->name) - 1);
+    snprintf(dev->info.name, sizeof(dev->info.name), "%s", path);
+    return 0;
+}
+
+/* Pipe backend: close both ends */
+static void pipe_close(input_device_t *dev) {
+    close(dev->fd);
+    dev->fd = -1;
+    if (dev->peer_fd >= 0) {
+        close(dev->peer_fd);
+        dev->peer_fd = -1;
+    }
+}
+
+const input_backend_t input_backend_pipe = {
+    .name = "pipe",
+    .open = pipe_open,
+    .close = pipe_close,
+};
+
+/* Wake source: stop() was called - the loop re-checks running */
+static void wake_handler(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)events;
+    (void)user_data;
+    uint64_t value;
+    if (read(listener->wake_fd, &value, sizeof(value)) < 0) {
+        /* Already drained */
+    }
 }
 
 /* Initialize event listener */
@@ -73,8 +270,11 @@ int event_listener_init(event_listener_t *listener, vkbd_context_t *vkbd_ctx) {
     memset(listener, 0, sizeof(event_listener_t));
     listener->vkbd_ctx = vkbd_ctx;
     listener->device_count = 0;
-    listener->running = false;
+    atomic_init(&listener->running, false);
     listener->epoll_fd = -1;
+    listener->wake_fd = -1;
+    listener->hotplug_fd = -1;
+    listener->backend = &input_backend_evdev;
 
     /* Create epoll instance */
     listener->epoll_fd = epoll_create1(0);
@@ -82,8 +282,256 @@ int event_listener_init(event_listener_t *listener, vkbd_context_t *vkbd_ctx) {
         perror("event_listener_init: Failed to create epoll");
         return -1;
     }
+    listener->device_epoll_fd = listener->epoll_fd;
+
+    /* Stop requests arrive through an eventfd, so the loop can block forever */
+    listener->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (listener->wake_fd < 0) {
+        perror("event_listener_init: Failed to create eventfd");
+        goto fail;
+    }
+    if (event_listener_add_source(listener, listener->wake_fd, EPOLLIN, wake_handler, NULL) < 0) {
+        goto fail;
+    }
 
     return 0;
+
+fail:
+    if (listener->wake_fd >= 0) {
+        close(listener->wake_fd);
+        listener->wake_fd = -1;
+    }
+    close(listener->epoll_fd);
+    listener->epoll_fd = -1;
+    return -1;
+}
+
+/* Select input backend */
+void event_listener_set_backend(event_listener_t *listener, const input_backend_t *backend) {
+    if (listener) {
+        listener->backend = backend ? backend : &input_backend_evdev;
+    }
+}
+
+/* Enable / disable real-time mode */
+void event_listener_set_rt(event_listener_t *listener, const rt_config_t *cfg) {
+    if (!listener) {
+        return;
+    }
+
+    listener->rt_enabled = cfg != NULL;
+    if (cfg) {
+        listener->rt = *cfg;
+    }
+}
+
+/* Find the active device opened from path */
+static input_device_t *find_device(event_listener_t *listener, const char *path) {
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        input_device_t *dev = &listener->devices[i];
+        if (dev->active && strcmp(dev->path, path) == 0) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+/* Does out write to the event node at path (whose sysfs parent is sysname)? */
+static bool output_is(const vkbd_context_t *out, const char *path, const char *sysname) {
+    return out && ((sysname[0] && strcmp(out->device.sysname, sysname) == 0) ||
+                   (out->device.node[0] && strcmp(out->device.node, path) == 0));
+}
+
+/* Feedback guard: is path one of our own outputs? Matched by uinput sysname
+ * (the event node's parent in sysfs), by event node without sysfs */
+static bool is_own_output(event_listener_t *listener, const char *device_path) {
+    char path[PATH_MAX];
+    char link[PATH_MAX + 64];
+    char target[512];
+    char sysname[64] = "";
+
+    /* by-id / by-path symlinks name the same node */
+    if (!realpath(device_path, path)) {
+        snprintf(path, sizeof(path), "%s", device_path);
+    }
+    const char *node = strrchr(path, '/');
+    node = node ? node + 1 : path;
+
+    snprintf(link, sizeof(link), "%s/%s/device", INPUT_SYSFS_DIR, node);
+    ssize_t n = readlink(link, target, sizeof(target) - 1);
+    if (n > 0) {
+        target[n] = '\0';
+        const char *base = strrchr(target, '/');
+        snprintf(sysname, sizeof(sysname), "%s", base ? base + 1 : target);
+    }
+
+    if (output_is(listener->vkbd_ctx, path, sysname)) {
+        return true;
+    }
+    for (int i = 0; i < listener->route_count; i++) {
+        if (output_is(listener->routes[i].out, path, sysname)) {
+            return true;
+        }
+    }
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        const input_device_t *dev = &listener->devices[i];
+        if (dev->active && dev->owns_out && output_is(dev->out, path, sysname)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Pick a new device's output: first matching route, else its own or the default */
+static void route_device(event_listener_t *listener, input_device_t *dev) {
+    dev->out = listener->vkbd_ctx;
+    dev->owns_out = false;
+
+    for (int i = 0; i < listener->route_count; i++) {
+        if (listener_match_test(&listener->routes[i].match, &dev->info)) {
+            dev->out = listener->routes[i].out;
+            return;
+        }
+    }
+
+    if (listener->output_ops) {
+        vkbd_context_t *out = listener->output_ops->create(dev, listener->output_data);
+        if (out) {
+            dev->out = out;
+            dev->owns_out = true;
+        } else {
+            fprintf(stderr, "Warning: No output of its own for %s, using the shared one\n", dev->name);
+        }
+    }
+}
+
+/* Stop or resume reading the devices forwarded to an output - their kernel
+ * buffers hold the input meanwhile, the output queue stops growing */
+static void pause_sources(event_listener_t *listener, vkbd_context_t *out, bool paused) {
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        input_device_t *dev = &listener->devices[i];
+        if (!dev->active || dev->out != out || dev->paused == paused) {
+            continue;
+        }
+
+        /* On io_uring the set only parks the devices; reads are not re-armed either */
+        if (paused) {
+            epoll_ctl(listener->device_epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+        } else {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLERR | EPOLLHUP;
+            ev.data.ptr = dev;
+            if (epoll_ctl(listener->device_epoll_fd, EPOLL_CTL_ADD, dev->fd, &ev) < 0) {
+                perror("event_listener: Failed to resume device");
+            }
+        }
+        dev->paused = paused;
+    }
+}
+
+/* EPOLLOUT on an output that fell behind: write its queue, stop watching once
+ * caught up, read its sources again below the low-water mark */
+static void drain_output(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)events;
+    vkbd_context_t *out = user_data;
+    int left = vkbd_drain(out);
+
+    if (left <= 0) {
+        event_listener_remove_source(listener, out->device.fd);
+    }
+    if (left < VKBD_OUT_LOW_WATER) {
+        pause_sources(listener, out, false);
+    }
+}
+
+/* Index of the source draining an output, -1 if none */
+static int output_watch(event_listener_t *listener, vkbd_context_t *out) {
+    for (int i = 0; i < MAX_LISTENER_SOURCES; i++) {
+        const listener_source_t *src = &listener->sources[i];
+        if (src->active && src->handler == drain_output && src->user_data == out) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Write staged events; if the device is full, wake the loop when it takes writes
+ * again, and past the high-water mark stop reading what feeds it */
+static inline void flush_output(event_listener_t *listener, vkbd_context_t *out) {
+    vkbd_flush(out);
+
+    int backlog = vkbd_backlog(out);
+    if (__builtin_expect(backlog > 0, 0)) {
+        if (!out->sink && output_watch(listener, out) < 0) {
+            /* Without a free source slot the queue goes out with the next flush;
+             * a sink's engine drains it as its writes complete */
+            event_listener_add_source(listener, out->device.fd, EPOLLOUT, drain_output, out);
+        }
+        if (backlog >= VKBD_OUT_HIGH_WATER) {
+            pause_sources(listener, out, true);
+        }
+    }
+}
+
+/* An output other than the default has staged events - flush it with the round */
+static inline void mark_pending(event_listener_t *listener, vkbd_context_t *out) {
+    if (__builtin_expect(out == listener->vkbd_ctx, 1)) {
+        return;
+    }
+
+    for (int i = 0; i < listener->pending_count; i++) {
+        if (listener->pending[i] == out) {
+            return;
+        }
+    }
+    if (listener->pending_count < MAX_INPUT_DEVICES) {
+        listener->pending[listener->pending_count++] = out;
+    } else {
+        flush_output(listener, out);
+    }
+}
+
+/* End of a round: one write per output with staged events */
+static void flush_outputs(event_listener_t *listener) {
+    flush_output(listener, listener->vkbd_ctx);
+    for (int i = 0; i < listener->pending_count; i++) {
+        flush_output(listener, listener->pending[i]);
+    }
+    listener->pending_count = 0;
+}
+
+/* Destroy a device's own output, after writing what it still has staged */
+static void release_output(event_listener_t *listener, input_device_t *dev) {
+    if (!dev->owns_out) {
+        return;
+    }
+
+    vkbd_flush(dev->out);
+    if (output_watch(listener, dev->out) >= 0) {
+        event_listener_remove_source(listener, dev->out->device.fd);
+    }
+    for (int i = 0; i < listener->pending_count; i++) {
+        if (listener->pending[i] == dev->out) {
+            listener->pending[i] = listener->pending[--listener->pending_count];
+            break;
+        }
+    }
+    listener->output_ops->destroy(dev->out, listener->output_data);
+    dev->out = NULL;
+    dev->owns_out = false;
+}
+
+/* Take a device out of the epoll set, close it and free its slot */
+static void release_device(event_listener_t *listener, input_device_t *dev) {
+    epoll_ctl(listener->device_epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+    if (listener->uring) {
+        uring_forget(listener->uring, dev);
+    }
+    dev->backend->close(dev);
+    release_output(listener, dev);
+    dev->active = false;
+    listener->device_count--;
+    printf("Removed keyboard: %s (%s)\n", dev->name, dev->path);
 }
 
 /* Add input device to monitor */
@@ -93,212 +541,1487 @@ int event_listener_add_device(event_listener_t *listener, const char *device_pat
         return -1;
     }
 
-    if (listener->device_count >= MAX_INPUT_DEVICES) {
-        fprintf(stderr, "event_listener_add_device: Too many devices\n");
+    if (find_device(listener, device_path)) {
+        fprintf(stderr, "event_listener_add_device: %s already monitored\n", device_path);
         return -1;
     }
 
-    /* Open device */
-    int fd = open(device_path, O_RDONLY | O_NONBLOCK);
-    if (fd < 0) {
-        perror("event_listener_add_device: Failed to open device");
+    /* Never read back what we write - that is a feedback loop */
+    if (is_own_output(listener, device_path)) {
+        fprintf(stderr, "event_listener_add_device: %s is one of our outputs\n", device_path);
         return -1;
     }
 
-    /* Check if it's a keyboard */
-    if (!is_keyboard(fd)) {
-        fprintf(stderr, "Device %s is not a keyboard\n", device_path);
-        close(fd);
+    /* First free slot - slots of disconnected devices are reused */
+    input_device_t *dev = NULL;
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        if (!listener->devices[i].active) {
+            dev = &listener->devices[i];
+            break;
+        }
+    }
+    if (!dev) {
+        fprintf(stderr, "event_listener_add_device: Too many devices\n");
         return -1;
     }
 
-    /* Get device name */
-    char name[256] = "Unknown";
-    ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+    memset(dev, 0, sizeof(*dev));
+    dev->fd = -1;
+    dev->peer_fd = -1;
+    dev->backend = listener->backend;
 
-    /* Skip our own virtual keyboard to prevent feedback loop */
-    if (strstr(name, "Virtual Keyboard") != NULL || 
-        (strstr(name, "Virtual") != NULL && strstr(name, "Keyboard") != NULL)) {
-        fprintf(stderr, "Skipping virtual keyboard: %s\n", name);
-        close(fd);
+    /* Open through the backend (evdev: open + keyboard check + grab) */
+    if (dev->backend->open(dev, device_path) < 0) {
         return -1;
     }
+    strncpy(dev->path, device_path, sizeof(dev->path) - 1);
 
-    /* Grab device (exclusive access) */
-    /* This prevents the original keyboard from sending events to other apps */
-    /* Comment this out if you want to test without exclusive access */
-    if (ioctl(fd, EVIOCGRAB, 1) < 0) {
-        fprintf(stderr, "Warning: Could not grab device %s (may need root)\n", device_path);
-        fprintf(stderr, "         Events will still be captured but also sent to system\n");
-        /* Continue anyway - useful for testing without breaking system input */
-    }
+    /* Decided before the first event can be read */
+    route_device(listener, dev);
 
-    /* Add to epoll with error detection */
+    /* Add to epoll with error detection - data.ptr gives O(1) fd -> device */
     struct epoll_event ev;
     ev.events = EPOLLIN | EPOLLERR | EPOLLHUP;
-    ev.data.fd = fd;
+    ev.data.ptr = dev;
 
-    if (epoll_ctl(listener->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    if (epoll_ctl(listener->device_epoll_fd, EPOLL_CTL_ADD, dev->fd, &ev) < 0) {
         perror("event_listener_add_device: Failed to add to epoll");
-        close(fd);
+        dev->backend->close(dev);
+        release_output(listener, dev);
         return -1;
     }
 
-    /* Store device info */
-    int idx = listener->device_count;
-    listener->devices[idx].fd = fd;
-    strncpy(listener->devices[idx].path, device_path, sizeof(listener->devices[idx].path) - 1);
-    strncpy(listener->devices[idx].name, name, sizeof(listener->devices[idx].name) - 1);
-    listener->devices[idx].active = true;
+    dev->active = true;
     listener->device_count++;
 
-    printf("Added keyboard: %s (%s)\n", name, device_path);
+    if (dev->out != listener->vkbd_ctx) {
+        printf("Added keyboard: %s (%s) -> %s\n", dev->name, device_path, dev->out->device.name);
+    } else {
+        printf("Added keyboard: %s (%s)\n", dev->name, device_path);
+    }
     return 0;
 }
 
-/* Auto-detect and add all keyboard devices */
-int event_listener_auto_detect(event_listener_t *listener) {
-    if (!listener) {
-        fprintf(stderr, "event_listener_auto_detect: NULL listener\n");
+/* Route matching sources to another output */
+int event_listener_add_route(event_listener_t *listener, const listener_match_t *rule,
+                             vkbd_context_t *out) {
+    if (!listener || !rule || !out) {
+        fprintf(stderr, "event_listener_add_route: Invalid arguments\n");
         return -1;
     }
 
-    DIR *dir = opendir(INPUT_DIR);
-    if (!dir) {
-        perror("event_listener_auto_detect: Failed to open /dev/input");
+    if (listener->route_count >= MAX_LISTENER_ROUTES) {
+        fprintf(stderr, "event_listener_add_route: Too many routes\n");
         return -1;
     }
 
-    int count = 0;
-    struct dirent *entry;
-    
-    while ((entry = readdir(dir)) != NULL) {
-        /* Look for event devices */
-        if (strncmp(entry->d_name, "event", 5) != 0) {
-            continue;
-        }
+    listener->routes[listener->route_count].match = *rule;
+    listener->routes[listener->route_count].out = out;
+    listener->route_count++;
+    return 0;
+}
 
-        char path[512];
-        snprintf(path, sizeof(path), "%s/%s", INPUT_DIR, entry->d_name);
+/* Per-source outputs on / off */
+void event_listener_set_outputs(event_listener_t *listener, const listener_output_ops_t *ops,
+                                void *user_data) {
+    if (!listener) {
+        return;
+    }
 
-        /* Try to add device */
-        if (event_listener_add_device(listener, path) == 0) {
-            count++;
-        }
+    listener->output_ops = ops;
+    listener->output_data = ops ? user_data : NULL;
+}
+
+/* Stop monitoring a device */
+int event_listener_remove_device(event_listener_t *listener, const char *device_path) {
+    if (!listener || !device_path) {
+        fprintf(stderr, "event_listener_remove_device: Invalid arguments\n");
+        return -1;
     }
 
-    closedir(dir);
-    
-    if (count == 0) {
-        fprintf(stderr, "No keyboard devices found\n");
+    input_device_t *dev = find_device(listener, device_path);
+    if (!dev) {
+        fprintf(stderr, "event_listener_remove_device: %s not monitored\n", device_path);
         return -1;
     }
 
-    printf("Auto-detected %d keyboard device(s)\n", count);
-    return count;
+    release_device(listener, dev);
+    return 0;
 }
 
-/* Start listening for events */
-int event_listener_run(event_listener_t *listener) {
-    if (!listener) {
-        fprintf(stderr, "event_listener_run: NULL listener\n");
+/* Add an extra fd source */
+int event_listener_add_source(event_listener_t *listener, int fd, uint32_t events,
+                              listener_source_fn handler, void *user_data) {
+    if (!listener || fd < 0 || !handler) {
+        fprintf(stderr, "event_listener_add_source: Invalid arguments\n");
         return -1;
     }
 
-    if (listener->device_count == 0) {
-        fprintf(stderr, "event_listener_run: No devices to monitor\n");
+    listener_source_t *src = NULL;
+    for (int i = 0; i < MAX_LISTENER_SOURCES; i++) {
+        if (!listener->sources[i].active) {
+            src = &listener->sources[i];
+            break;
+        }
+    }
+    if (!src) {
+        fprintf(stderr, "event_listener_add_source: Too many sources\n");
         return -1;
     }
 
-    listener->running = true;
-    printf("Event listener started, monitoring %d device(s)\n", listener->device_count);
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = src;
 
-    struct epoll_event events[MAX_EVENTS];
-    /* Optimized event buffer - balance between speed and safety */
-    struct input_event ev_buffer[16];
-    int error_count = 0;
-    const int MAX_CONSECUTIVE_ERRORS = 100;
+    if (epoll_ctl(listener->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("event_listener_add_source: Failed to add to epoll");
+        return -1;
+    }
 
-    while (listener->running) {
-        /* 1ms timeout for maximum responsiveness */
-        int nfds = epoll_wait(listener->epoll_fd, events, MAX_EVENTS, 1);
-        
-        if (__builtin_expect(nfds < 0, 0)) {
-            if (errno == EINTR) {
-                continue;
-            }
-            perror("event_listener_run: epoll_wait failed");
-            return -1;
-        }
+    src->fd = fd;
+    src->handler = handler;
+    src->user_data = user_data;
+    src->active = true;
+    return 0;
+}
 
-        /* Hot path: process events with minimal overhead */
-        for (int i = 0; i < nfds; i++) {
-            int fd = events[i].data.fd;
-            
-            /* Fast path: check for errors first (unlikely) */
-            if (__builtin_expect(events[i].events & (EPOLLERR | EPOLLHUP), 0)) {
-                fprintf(stderr, "Error on input device fd=%d\n", fd);
-                error_count++;
-                if (error_count > MAX_CONSECUTIVE_ERRORS) {
-                    fprintf(stderr, "Too many errors, stopping listener\n");
-                    listener->running = false;
-                    return -1;
-                }
-                continue;
-            }
-            
-            ssize_t bytes_read = read(fd, ev_buffer, sizeof(ev_buffer));
-            
-            /* Error handling - unlikely path */
-            if (__builtin_expect(bytes_read <= 0, 0)) {
-                if (bytes_read < 0) {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        continue;
-                    }
-                    if (errno == ENODEV || errno == ENOENT) {
-                        epoll_ctl(listener->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-                        close(fd);
-                        continue;
-                    }
-                    error_count++;
-                } else {
-                    /* EOF - device disconnected */
-                    epoll_ctl(listener->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-                    close(fd);
-                }
-                continue;
-            }
-            
-            /* Validate read size - fast check */
-            if (__builtin_expect((bytes_read % sizeof(struct input_event)) != 0, 0)) {
-                error_count++;
-                continue;
-            }
-            
-            /* Reset error count on successful read */
-            error_count = 0;
-            
-            /* Hot path: process events inline */
-            int num_events = bytes_read / sizeof(struct input_event);
-            for (int j = 0; j < num_events; j++) {
-                /* Only key events - most common case */
-                if (__builtin_expect(ev_buffer[j].type == EV_KEY, 1)) {
-                    vkbd_process_key(listener->vkbd_ctx, 
-                                   ev_buffer[j].code, 
-                                   ev_buffer[j].value);
-                }
-            }
+/* Remove an extra fd source */
+int event_listener_remove_source(event_listener_t *listener, int fd) {
+    if (!listener) {
+        return -1;
+    }
+
+    for (int i = 0; i < MAX_LISTENER_SOURCES; i++) {
+        listener_source_t *src = &listener->sources[i];
+        if (src->active && src->fd == fd) {
+            epoll_ctl(listener->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            src->active = false;
+            src->fd = -1;
+            return 0;
         }
     }
 
-    printf("Event listener stopped\n");
-    return 0;
+    fprintf(stderr, "event_listener_remove_source: Unknown fd %d\n", fd);
+    return -1;
+}
+
+/* Map an epoll data.ptr back to a device slot, NULL for extra sources */
+static inline input_device_t *ptr_to_device(event_listener_t *listener, void *ptr) {
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)listener->devices;
+    return __builtin_expect(offset < sizeof(listener->devices), 1) ? ptr : NULL;
+}
+
+/* Read a one-line sysfs attribute, without the trailing newline */
+static int read_attr(const char *dir, const char *attr, char *buf, size_t len) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+
+    buf[n] = '\0';
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' ')) {
+        buf[--n] = '\0';
+    }
+    return 0;
+}
+
+/* sysfs bitmap: hex longs separated by spaces, most significant first */
+static void parse_bitmap(const char *text, uint64_t *words, int nwords) {
+    const int long_bits = sizeof(long) * 8;
+    unsigned long vals[KEY_CNT / (sizeof(long) * 8) + 2];
+    int n = 0;
+    const char *p = text;
+
+    while (n < (int)(sizeof(vals) / sizeof(vals[0]))) {
+        char *end;
+        unsigned long v = strtoul(p, &end, 16);
+        if (end == p) {
+            break;
+        }
+        vals[n++] = v;
+        p = end;
+    }
+
+    memset(words, 0, nwords * sizeof(uint64_t));
+    for (int i = 0; i < n; i++) {
+        int bit = i * long_bits;
+        if (bit / 64 >= nwords) {
+            break;
+        }
+        words[bit / 64] |= (uint64_t)vals[n - 1 - i] << (bit % 64);
+    }
+}
+
+/* Describe an input device from sysfs */
+int input_info_from_sysfs(const char *dir, input_info_t *info) {
+    char buf[1024];
+
+    if (!dir || !info) {
+        fprintf(stderr, "input_info_from_sysfs: Invalid arguments\n");
+        return -1;
+    }
+
+    memset(info, 0, sizeof(*info));
+    if (read_attr(dir, "capabilities/ev", buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    uint64_t ev;
+    parse_bitmap(buf, &ev, 1);
+    info->has_keys = (ev >> EV_KEY) & 1;
+    if (info->has_keys && read_attr(dir, "capabilities/key", buf, sizeof(buf)) == 0) {
+        parse_bitmap(buf, info->keys.w, KEYSET_WORDS);
+    }
+
+    if (read_attr(dir, "name", buf, sizeof(buf)) == 0) {
+        snprintf(info->name, sizeof(info->name), "%s", buf);
+    }
+    if (read_attr(dir, "phys", buf, sizeof(buf)) == 0) {
+        snprintf(info->phys, sizeof(info->phys), "%s", buf);
+    }
+    if (read_attr(dir, "id/bustype", buf, sizeof(buf)) == 0) {
+        info->bustype = strtoul(buf, NULL, 16);
+    }
+    if (read_attr(dir, "id/vendor", buf, sizeof(buf)) == 0) {
+        info->vendor = strtoul(buf, NULL, 16);
+    }
+    if (read_attr(dir, "id/product", buf, sizeof(buf)) == 0) {
+        info->product = strtoul(buf, NULL, 16);
+    }
+    return 0;
+}
+
+/* Without sysfs: open the node and ask it (no grab) */
+static int input_info_from_node(const char *path, input_info_t *info) {
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    input_info_from_fd(fd, info);
+    close(fd);
+    return 0;
+}
+
+/* Describe /dev/input/<node>: sysfs first, the node itself as fallback */
+static int describe_node(const char *node, input_info_t *info, bool *from_sysfs) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s/device", INPUT_SYSFS_DIR, node);
+    *from_sysfs = input_info_from_sysfs(path, info) == 0;
+    if (!*from_sysfs) {
+        snprintf(path, sizeof(path), "%s/%s", INPUT_DIR, node);
+        if (input_info_from_node(path, info) < 0) {
+            return -1;
+        }
+    }
+    snprintf(info->node, sizeof(info->node), "%s", node);
+    return 0;
+}
+
+/* Check a device against one rule */
+bool listener_match_test(const listener_match_t *rule, const input_info_t *info) {
+    if (!rule || !info) {
+        return false;
+    }
+
+    return (rule->vendor == 0 || rule->vendor == info->vendor) &&
+           (rule->product == 0 || rule->product == info->product) &&
+           (rule->phys[0] == '\0' || fnmatch(rule->phys, info->phys, 0) == 0) &&
+           (rule->name[0] == '\0' || fnmatch(rule->name, info->name, 0) == 0);
+}
+
+/* A keyboard that passes the rules */
+static bool accept_device(const input_info_t *info, const listener_match_t *rules, int rule_count) {
+    if (!is_keyboard(info)) {
+        return false;
+    }
+
+    for (int i = 0; i < rule_count; i++) {
+        if (listener_match_test(&rules[i], info)) {
+            return true;
+        }
+    }
+    return rule_count == 0;
+}
+
+/* Call fn for every accepted keyboard - sysfs listing, /dev/input without it */
+static int for_each_keyboard(const listener_match_t *rules, int rule_count, discovery_stats_t *stats,
+                             void (*fn)(const input_info_t *info, void *arg), void *arg) {
+    DIR *dir = opendir(INPUT_SYSFS_DIR);
+    if (!dir) {
+        dir = opendir(INPUT_DIR);
+    }
+    if (!dir) {
+        perror("event_listener: Failed to list input devices");
+        return -1;
+    }
+
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "event", 5) != 0) {
+            continue;
+        }
+
+        input_info_t info;
+        bool from_sysfs;
+        stats->nodes++;
+        if (describe_node(entry->d_name, &info, &from_sysfs) < 0) {
+            continue;
+        }
+        stats->sysfs = from_sysfs;
+        if (accept_device(&info, rules, rule_count)) {
+            stats->matched++;
+            count++;
+            fn(&info, arg);
+        }
+    }
+
+    closedir(dir);
+    return count;
+}
+
+/* Open and grab a discovered keyboard unless it is monitored already (or ours) */
+static void add_discovered(const input_info_t *info, void *arg) {
+    event_listener_t *listener = arg;
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", INPUT_DIR, info->node);
+    if (!find_device(listener, path) && !is_own_output(listener, path) &&
+        event_listener_add_device(listener, path) == 0) {
+        listener->discovery_stats.added++;
+    }
+}
+
+/* Add every matching keyboard that is not monitored yet */
+static int scan_input_dir(event_listener_t *listener) {
+    uint64_t start = monotonic_ns();
+
+    memset(&listener->discovery_stats, 0, sizeof(listener->discovery_stats));
+    if (for_each_keyboard(listener->matches, listener->match_count, &listener->discovery_stats,
+                          add_discovered, listener) < 0) {
+        return -1;
+    }
+    listener->discovery_stats.ns = monotonic_ns() - start;
+    return listener->discovery_stats.added;
+}
+
+static void or_keys(const input_info_t *info, void *arg) {
+    keyset_t *keys = arg;
+    for (int i = 0; i < KEYSET_WORDS; i++) {
+        keys->w[i] |= info->keys.w[i];
+    }
+}
+
+/* Union of the key capabilities of every matching keyboard */
+int event_listener_probe_keys(const listener_match_t *rules, int rule_count, keyset_t *keys) {
+    discovery_stats_t stats;
+
+    if (!keys || rule_count < 0 || (rule_count > 0 && !rules)) {
+        fprintf(stderr, "event_listener_probe_keys: Invalid arguments\n");
+        return -1;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    return for_each_keyboard(rules, rule_count, &stats, or_keys, keys);
+}
+
+/* Add a device match rule */
+int event_listener_add_match(event_listener_t *listener, const listener_match_t *rule) {
+    if (!listener || !rule) {
+        fprintf(stderr, "event_listener_add_match: Invalid arguments\n");
+        return -1;
+    }
+
+    if (listener->match_count >= MAX_LISTENER_MATCHES) {
+        fprintf(stderr, "event_listener_add_match: Too many rules\n");
+        return -1;
+    }
+
+    listener->matches[listener->match_count++] = *rule;
+    return 0;
+}
+
+/* Parse "VVVV:PPPP,phys=PATTERN,name=PATTERN" */
+int listener_match_parse(const char *spec, listener_match_t *rule) {
+    char buf[256];
+
+    if (!spec || !rule) {
+        fprintf(stderr, "listener_match_parse: Invalid arguments\n");
+        return -1;
+    }
+
+    memset(rule, 0, sizeof(*rule));
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    char *save = NULL;
+    for (char *term = strtok_r(buf, ",", &save); term; term = strtok_r(NULL, ",", &save)) {
+        if (strncmp(term, "phys=", 5) == 0) {
+            snprintf(rule->phys, sizeof(rule->phys), "%s", term + 5);
+        } else if (strncmp(term, "name=", 5) == 0) {
+            snprintf(rule->name, sizeof(rule->name), "%s", term + 5);
+        } else {
+            char *colon = strchr(term, ':');
+            char *end;
+            if (!colon) {
+                goto invalid;
+            }
+            *colon = '\0';
+            if (strcmp(term, "*") != 0) {
+                rule->vendor = strtoul(term, &end, 16);
+                if (*term == '\0' || *end != '\0') {
+                    goto invalid;
+                }
+            }
+            if (strcmp(colon + 1, "*") != 0) {
+                rule->product = strtoul(colon + 1, &end, 16);
+                if (colon[1] == '\0' || *end != '\0') {
+                    goto invalid;
+                }
+            }
+        }
+    }
+    return 0;
+
+invalid:
+    fprintf(stderr, "listener_match_parse: Invalid rule '%s' (VVVV:PPPP, phys=..., name=...)\n", spec);
+    return -1;
+}
+
+/* Act on one uevent: "ACTION@DEVPATH\0KEY=VALUE\0KEY=VALUE\0..." */
+static void handle_uevent(event_listener_t *listener, const char *buf, size_t len) {
+    const char *action = NULL;
+    const char *subsystem = NULL;
+    const char *devname = NULL;
+
+    for (size_t off = strlen(buf) + 1; off < len; off += strlen(buf + off) + 1) {
+        const char *kv = buf + off;
+        if (strncmp(kv, "ACTION=", 7) == 0) {
+            action = kv + 7;
+        } else if (strncmp(kv, "SUBSYSTEM=", 10) == 0) {
+            subsystem = kv + 10;
+        } else if (strncmp(kv, "DEVNAME=", 8) == 0) {
+            devname = kv + 8;
+        }
+    }
+
+    /* Only event nodes - input/inputN parents and mouse/js nodes are ignored */
+    if (!action || !subsystem || !devname || strcmp(subsystem, "input") != 0 ||
+        strncmp(devname, "input/event", 11) != 0) {
+        return;
+    }
+
+    char path[256];
+    snprintf(path, sizeof(path), "/dev/%s", devname);
+
+    if (strcmp(action, "add") == 0) {
+        /* Rules and keyboard check from sysfs - other devices are never opened */
+        input_info_t info;
+        bool from_sysfs;
+        if (!find_device(listener, path) && !is_own_output(listener, path) &&
+            describe_node(devname + 6, &info, &from_sysfs) == 0 &&
+            accept_device(&info, listener->matches, listener->match_count)) {
+            event_listener_add_device(listener, path);
+        }
+    } else if (strcmp(action, "remove") == 0 && !listener->pipeline) {
+        /* Usually already released by the EPOLLHUP on its fd. When pipelined,
+         * the reader thread owns the fds and reports the hangup via the ring */
+        input_device_t *dev = find_device(listener, path);
+        if (dev) {
+            release_device(listener, dev);
+        }
+    }
+}
+
+/* Netlink source: drain pending uevents */
+static void hotplug_handler(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)events;
+    (void)user_data;
+    char buf[UEVENT_BUFFER];
+
+    for (;;) {
+        struct sockaddr_nl sender;
+        socklen_t sender_len = sizeof(sender);
+        ssize_t n = recvfrom(listener->hotplug_fd, buf, sizeof(buf) - 1, 0,
+                             (struct sockaddr *)&sender, &sender_len);
+        if (n < 0) {
+            if (errno == ENOBUFS) {
+                /* Socket overran and uevents were lost - resync from /dev/input */
+                fprintf(stderr, "Hotplug: uevents dropped, rescanning %s\n", INPUT_DIR);
+                scan_input_dir(listener);
+                continue;
+            }
+            return;  /* EAGAIN: drained */
+        }
+
+        /* Only trust messages from the kernel itself */
+        if (sender.nl_pid != 0 || n == 0) {
+            continue;
+        }
+        buf[n] = '\0';
+        handle_uevent(listener, buf, n);
+    }
+}
+
+/* Subscribe to kernel uevents */
+int event_listener_enable_hotplug(event_listener_t *listener) {
+    if (!listener) {
+        fprintf(stderr, "event_listener_enable_hotplug: NULL listener\n");
+        return -1;
+    }
+
+    if (listener->backend != &input_backend_evdev) {
+        fprintf(stderr, "event_listener_enable_hotplug: Only supported on the evdev backend\n");
+        return -1;
+    }
+
+    if (listener->hotplug_fd >= 0) {
+        return 0;
+    }
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        perror("event_listener_enable_hotplug: Failed to create netlink socket");
+        return -1;
+    }
+
+    /* Group 1 carries the kernel's own uevents */
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("event_listener_enable_hotplug: Failed to bind netlink socket");
+        close(fd);
+        return -1;
+    }
+
+    listener->hotplug_fd = fd;
+    if (event_listener_add_source(listener, fd, EPOLLIN, hotplug_handler, NULL) < 0) {
+        close(fd);
+        listener->hotplug_fd = -1;
+        return -1;
+    }
+
+    printf("Hotplug enabled\n");
+    return 0;
+}
+
+/* Auto-detect and add all keyboard devices */
+int event_listener_auto_detect(event_listener_t *listener) {
+    if (!listener) {
+        fprintf(stderr, "event_listener_auto_detect: NULL listener\n");
+        return -1;
+    }
+
+    if (listener->backend != &input_backend_evdev) {
+        fprintf(stderr, "event_listener_auto_detect: Only supported on the evdev backend\n");
+        return -1;
+    }
+
+    int count = scan_input_dir(listener);
+    if (count < 0) {
+        return -1;
+    }
+
+    const discovery_stats_t *ds = &listener->discovery_stats;
+    printf("Discovery: %u input nodes, %u matching keyboard(s) in %.2f ms (%s)\n",
+           ds->nodes, ds->matched, ds->ns / 1e6, ds->sysfs ? "sysfs" : "ioctl");
+    
+    if (count == 0) {
+        fprintf(stderr, "No keyboard devices found\n");
+        return -1;
+    }
+
+    printf("Auto-detected %d keyboard device(s)\n", count);
+    return count;
+}
+
+/* Wait for and process one round of events */
+int event_listener_poll(event_listener_t *listener, int timeout_ms) {
+    if (__builtin_expect(!listener, 0)) {
+        return -1;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    /* Read buffer - a full read means more may be pending */
+    struct input_event ev_buffer[MAX_READ_EVENTS];
+    const int MAX_CONSECUTIVE_ERRORS = 100;
+    int processed = 0;
+
+    int nfds = epoll_wait(listener->epoll_fd, events, MAX_EVENTS, timeout_ms);
+    
+    if (__builtin_expect(nfds < 0, 0)) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        perror("event_listener_run: epoll_wait failed");
+        return -1;
+    }
+
+    /* Hot path: process events with minimal overhead */
+    for (int i = 0; i < nfds; i++) {
+        input_device_t *dev = ptr_to_device(listener, events[i].data.ptr);
+
+        /* Extra sources (timers, inotify, ...) - not on the key path */
+        if (__builtin_expect(!dev, 0)) {
+            listener_source_t *src = events[i].data.ptr;
+            if (src->active) {
+                src->handler(listener, events[i].events, src->user_data);
+            }
+            continue;
+        }
+
+        /* Released by a hotplug uevent earlier in this round */
+        if (__builtin_expect(!dev->active, 0)) {
+            continue;
+        }
+
+        int fd = dev->fd;
+        vkbd_context_t *out = dev->out;
+        
+        /* Drain the device: a short read means its buffer is empty */
+        ssize_t bytes_read;
+        do {
+            bytes_read = read(fd, ev_buffer, sizeof(ev_buffer));
+            
+            /* Error handling - unlikely path */
+            if (__builtin_expect(bytes_read <= 0, 0)) {
+                if (bytes_read < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        break;
+                    }
+                    if (errno == ENODEV || errno == ENOENT) {
+                        release_device(listener, dev);
+                        break;
+                    }
+                    counter_add(&listener->counters.read_errors, 1);
+                    listener->error_count++;
+                    if (listener->error_count > MAX_CONSECUTIVE_ERRORS) {
+                        fprintf(stderr, "Too many errors, stopping listener\n");
+                        atomic_store(&listener->running, false);
+                        return -1;
+                    }
+                } else {
+                    /* EOF - device disconnected */
+                    release_device(listener, dev);
+                }
+                break;
+            }
+            
+            /* Validate read size - fast check */
+            if (__builtin_expect((bytes_read % sizeof(struct input_event)) != 0, 0)) {
+                counter_add(&listener->counters.read_errors, 1);
+                listener->error_count++;
+                break;
+            }
+            
+            /* Reset error count on successful read */
+            if (__builtin_expect(listener->error_count != 0, 0)) {
+                counter_add(&listener->counters.error_resets, 1);
+                listener->error_count = 0;
+            }
+            
+            /* Hot path: stage the whole read buffer, written once below */
+            int num_events = bytes_read / sizeof(struct input_event);
+            int keys = 0;
+            if (__builtin_expect(listener->capture != NULL, 0)) {
+                capture_append(listener->capture, dev - listener->devices, ev_buffer, num_events);
+            }
+            for (int j = 0; j < num_events; j++) {
+                keys += (ev_buffer[j].type == EV_KEY);
+                if (__builtin_expect(ev_buffer[j].type == EV_SYN && ev_buffer[j].code == SYN_DROPPED, 0)) {
+                    counter_add(&listener->counters.syn_dropped, 1);
+                }
+            }
+            vkbd_process_batch(out, ev_buffer, num_events);
+            mark_pending(listener, out);
+            counter_add(&dev->events, num_events);
+            counter_add(&dev->keys, keys);
+            processed += keys;
+        } while (bytes_read == sizeof(ev_buffer));
+
+        /* Hung up with nothing left to read: the device is gone */
+        if (__builtin_expect((events[i].events & (EPOLLERR | EPOLLHUP)) && dev->active, 0)) {
+            release_device(listener, dev);
+        }
+    }
+
+    /* One timestamp and one write() per output for everything read this round */
+    flush_outputs(listener);
+
+    return processed;
+}
+
+/* Start listening for events */
+int event_listener_run(event_listener_t *listener) {
+    if (!listener) {
+        fprintf(stderr, "event_listener_run: NULL listener\n");
+        return -1;
+    }
+
+    if (listener->device_count == 0 && listener->hotplug_fd < 0) {
+        fprintf(stderr, "event_listener_run: No devices to monitor\n");
+        return -1;
+    }
+
+    /* Scheduling, pinning and locking happen before the first event */
+    if (listener->rt_enabled && rt_apply(&listener->rt) < 0) {
+        fprintf(stderr, "Warning: Real-time mode only partially applied\n");
+    }
+
+    atomic_store(&listener->running, true);
+    listener->error_count = 0;
+    printf("Event listener started, monitoring %d device(s)\n", listener->device_count);
+
+    while (atomic_load_explicit(&listener->running, memory_order_relaxed)) {
+        /* Block until input, a timer or a stop request - no idle wakeups */
+        if (event_listener_poll(listener, -1) < 0) {
+            atomic_store(&listener->running, false);
+            return -1;
+        }
+    }
+
+    printf("Event listener stopped\n");
+    return 0;
+}
+
+/* Reader -> writer: items are queued */
+static void pipeline_signal(struct listener_pipeline *pl) {
+    uint64_t one = 1;
+    if (write(pl->ready_fd, &one, sizeof(one)) < 0) {
+        /* Counter saturated - the writer is already due to wake */
+    }
+}
+
+/* Queue items, waiting for the writer while the ring is full */
+static void pipeline_push(struct listener_pipeline *pl, const spsc_item_t *items, int n) {
+    while (n > 0) {
+        int done = spsc_write(&pl->ring, items, n);
+        items += done;
+        n -= done;
+        if (__builtin_expect(n > 0, 0)) {
+            pl->listener->pipeline_stats.full_stalls++;
+            pipeline_signal(pl);
+            sched_yield();
+        }
+    }
+}
+
+/* Reader thread: drain every device into the ring */
+static void *pipeline_reader(void *arg) {
+    struct listener_pipeline *pl = arg;
+    event_listener_t *listener = pl->listener;
+    struct epoll_event events[MAX_EVENTS];
+    struct input_event ev_buffer[MAX_READ_EVENTS];
+    spsc_item_t items[MAX_READ_EVENTS];
+
+    /* Same priority as the writer, but free to run on another core */
+    if (listener->rt_enabled) {
+        rt_config_t rt = listener->rt;
+        rt.cpu = -1;
+        rt_apply(&rt);
+    }
+
+    for (;;) {
+        int nfds = epoll_wait(pl->epoll_fd, events, MAX_EVENTS, -1);
+        if (__builtin_expect(nfds < 0, 0)) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("pipeline reader: epoll_wait failed");
+            return NULL;
+        }
+
+        bool queued = false;
+        for (int i = 0; i < nfds; i++) {
+            input_device_t *dev = events[i].data.ptr;
+            if (__builtin_expect(!dev, 0)) {
+                return NULL;  /* stop_fd */
+            }
+
+            bool gone = false;
+            ssize_t bytes_read;
+            do {
+                bytes_read = read(dev->fd, ev_buffer, sizeof(ev_buffer));
+                if (__builtin_expect(bytes_read <= 0, 0)) {
+                    gone = bytes_read == 0 || errno == ENODEV || errno == ENOENT;
+                    if (!gone && errno != EAGAIN && errno != EINTR) {
+                        counter_add(&listener->counters.read_errors, 1);
+                    }
+                    break;
+                }
+                if (__builtin_expect((bytes_read % sizeof(struct input_event)) != 0, 0)) {
+                    counter_add(&listener->counters.read_errors, 1);
+                    break;
+                }
+
+                uint64_t now = monotonic_ns();
+                int n = bytes_read / sizeof(struct input_event);
+                int keys = 0;
+                if (__builtin_expect(listener->capture != NULL, 0)) {
+                    capture_append(listener->capture, dev - listener->devices, ev_buffer, n);
+                }
+                for (int j = 0; j < n; j++) {
+                    items[j].ev = ev_buffer[j];
+                    items[j].read_ns = now;
+                    items[j].ctrl = NULL;
+                    items[j].out = dev->out;
+                    keys += ev_buffer[j].type == EV_KEY;
+                }
+                counter_add(&dev->events, n);
+                counter_add(&dev->keys, keys);
+                pipeline_push(pl, items, n);
+                queued = true;
+            } while (bytes_read == sizeof(ev_buffer));
+
+            if (__builtin_expect(gone || (events[i].events & (EPOLLERR | EPOLLHUP)), 0)) {
+                /* Never touched here again; the writer releases it after its last events */
+                epoll_ctl(pl->epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+                spsc_item_t ctrl = { .ctrl = dev };
+                pipeline_push(pl, &ctrl, 1);
+                queued = true;
+            }
+        }
+
+        if (queued) {
+            pipeline_signal(pl);
+        }
+    }
+}
+
+/* Ready source: drain the ring on the writer thread, one output write per batch */
+static void pipeline_drain(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)events;
+    struct listener_pipeline *pl = user_data;
+    pipeline_stats_t *stats = &listener->pipeline_stats;
+    spsc_item_t batch[PIPELINE_BATCH];
+    struct input_event span[PIPELINE_BATCH];
+    uint64_t value;
+
+    if (read(pl->ready_fd, &value, sizeof(value)) < 0) {
+        /* Already drained */
+    }
+
+    for (;;) {
+        uint32_t depth = spsc_depth(&pl->ring);
+        int n = spsc_read(&pl->ring, batch, PIPELINE_BATCH);
+        if (n == 0) {
+            break;
+        }
+
+        uint64_t start = monotonic_ns();
+        if (depth > stats->max_depth) {
+            stats->max_depth = depth;
+        }
+
+        /* Consecutive items for the same output go through as one span */
+        int spanned = 0;
+        vkbd_context_t *span_out = NULL;
+        for (int i = 0; i < n; i++) {
+            if (spanned > 0 && (batch[i].ctrl != NULL || batch[i].out != span_out)) {
+                vkbd_process_batch(span_out, span, spanned);
+                mark_pending(listener, span_out);
+                spanned = 0;
+            }
+            if (__builtin_expect(batch[i].ctrl != NULL, 0)) {
+                input_device_t *dev = batch[i].ctrl;
+                if (dev->active) {
+                    release_device(listener, dev);
+                }
+                continue;
+            }
+
+            uint64_t queued = start - batch[i].read_ns;
+            stats->queue_ns_total += queued;
+            if (queued > stats->queue_ns_max) {
+                stats->queue_ns_max = queued;
+            }
+            if (__builtin_expect(batch[i].ev.type == EV_SYN && batch[i].ev.code == SYN_DROPPED, 0)) {
+                stats->syn_dropped++;
+                counter_add(&listener->counters.syn_dropped, 1);
+            }
+            span[spanned++] = batch[i].ev;
+            span_out = batch[i].out;
+        }
+        if (spanned > 0) {
+            vkbd_process_batch(span_out, span, spanned);
+            mark_pending(listener, span_out);
+        }
+        flush_outputs(listener);
+
+        uint64_t written = monotonic_ns() - start;
+        stats->events += n;
+        stats->batches++;
+        stats->write_ns_total += written;
+        if (written > stats->write_ns_max) {
+            stats->write_ns_max = written;
+        }
+    }
+}
+
+/* Move every active device into another epoll set */
+static void move_devices(event_listener_t *listener, int epoll_fd) {
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        input_device_t *dev = &listener->devices[i];
+        if (!dev->active || dev->paused) {
+            continue;   /* Paused ones join the new set when they resume */
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLERR | EPOLLHUP;
+        ev.data.ptr = dev;
+        epoll_ctl(listener->device_epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dev->fd, &ev) < 0) {
+            perror("event_listener: Failed to move device");
+        }
+    }
+    listener->device_epoll_fd = epoll_fd;
+}
+
+/* Start listening with separate reader and writer threads */
+int event_listener_run_pipelined(event_listener_t *listener) {
+    if (!listener) {
+        fprintf(stderr, "event_listener_run_pipelined: NULL listener\n");
+        return -1;
+    }
+
+    if (listener->device_count == 0 && listener->hotplug_fd < 0) {
+        fprintf(stderr, "event_listener_run_pipelined: No devices to monitor\n");
+        return -1;
+    }
+
+    struct listener_pipeline *pl;
+    if (posix_memalign((void **)&pl, SPSC_CACHE_LINE, sizeof(*pl)) != 0) {
+        fprintf(stderr, "event_listener_run_pipelined: Out of memory\n");
+        return -1;
+    }
+    spsc_init(&pl->ring);
+    pl->listener = listener;
+    pl->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    pl->ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pl->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    int ret = -1;
+    if (pl->epoll_fd < 0 || pl->ready_fd < 0 || pl->stop_fd < 0) {
+        perror("event_listener_run_pipelined: Failed to create fds");
+        goto out;
+    }
+
+    /* stop_fd is never drained: once written, the reader sees it on every wait */
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(pl->epoll_fd, EPOLL_CTL_ADD, pl->stop_fd, &ev) < 0) {
+        perror("event_listener_run_pipelined: Failed to add to epoll");
+        goto out;
+    }
+    if (event_listener_add_source(listener, pl->ready_fd, EPOLLIN, pipeline_drain, pl) < 0) {
+        goto out;
+    }
+
+    memset(&listener->pipeline_stats, 0, sizeof(listener->pipeline_stats));
+    listener->pipeline = pl;
+    move_devices(listener, pl->epoll_fd);
+
+    if (pthread_create(&pl->reader, NULL, pipeline_reader, pl) != 0) {
+        fprintf(stderr, "event_listener_run_pipelined: Failed to start reader thread\n");
+        goto restore;
+    }
+
+    /* This thread is the writer */
+    if (listener->rt_enabled && rt_apply(&listener->rt) < 0) {
+        fprintf(stderr, "Warning: Real-time mode only partially applied\n");
+    }
+
+    atomic_store(&listener->running, true);
+    listener->error_count = 0;
+    printf("Event listener started (pipelined), monitoring %d device(s)\n", listener->device_count);
+
+    ret = 0;
+    while (atomic_load_explicit(&listener->running, memory_order_relaxed)) {
+        if (event_listener_poll(listener, -1) < 0) {
+            atomic_store(&listener->running, false);
+            ret = -1;
+        }
+    }
+
+    /* Stop the reader, then write out whatever it had queued */
+    uint64_t one = 1;
+    if (write(pl->stop_fd, &one, sizeof(one)) < 0) {
+        perror("event_listener_run_pipelined: Failed to stop reader");
+    }
+    pthread_join(pl->reader, NULL);
+    pipeline_drain(listener, 0, pl);
+    printf("Event listener stopped\n");
+
+restore:
+    move_devices(listener, listener->epoll_fd);
+    listener->pipeline = NULL;
+    event_listener_remove_source(listener, pl->ready_fd);
+out:
+    if (pl->epoll_fd >= 0) {
+        close(pl->epoll_fd);
+    }
+    if (pl->ready_fd >= 0) {
+        close(pl->ready_fd);
+    }
+    if (pl->stop_fd >= 0) {
+        close(pl->stop_fd);
+    }
+    free(pl);
+    return ret;
+}
+
+/* Next SQE, counted as in flight (the ring is sized so this rarely submits) */
+static struct io_uring_sqe *uring_sqe(struct listener_uring *u) {
+    struct io_uring_sqe *sqe;
+    while ((sqe = uring_get_sqe(&u->ring)) == NULL) {
+        uring_enter(&u->ring, 0);
+    }
+    u->inflight++;
+    return sqe;
+}
+
+static void uring_cancel(struct listener_uring *u, uint64_t target) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = URING_DATA(URING_CANCEL, 0, 0);
+}
+
+/* Queue a read on an idle device slot */
+static void uring_arm_read(struct listener_uring *u, int i) {
+    struct uring_slot *slot = &u->slots[i];
+    input_device_t *dev = &u->listener->devices[i];
+
+    /* A linked pair must go out in the same submission */
+    while (uring_sq_space(&u->ring) < 2) {
+        uring_enter(&u->ring, 0);
+    }
+
+    slot->linked = slot->poll_first;
+    if (slot->poll_first) {
+        struct io_uring_sqe *sqe = uring_sqe(u);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = dev->fd;
+        sqe->poll32_events = POLLIN;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = URING_DATA(URING_READ_POLL, i, slot->gen);
+        slot->poll_first = false;
+    }
+
+    uring_prep_rw(uring_sqe(u), IORING_OP_READ, dev->fd, slot->buf, sizeof(slot->buf),
+                  URING_DATA(URING_READ, i, slot->gen));
+    slot->armed = true;
+    slot->canceled = false;
+}
+
+/* Cancel the read queued on a slot (and the poll in front of it) */
+static void uring_cancel_read(struct listener_uring *u, int i) {
+    struct uring_slot *slot = &u->slots[i];
+    if (slot->armed && !slot->canceled) {
+        if (slot->linked) {
+            uring_cancel(u, URING_DATA(URING_READ_POLL, i, slot->gen));
+        }
+        uring_cancel(u, URING_DATA(URING_READ, i, slot->gen));
+        slot->canceled = true;
+    }
+}
+
+/* A device is being released: its queued read must not reach the next
+ * device in this slot, and its buffer stays busy until the read completes */
+static void uring_forget(struct listener_uring *u, input_device_t *dev) {
+    int i = dev - u->listener->devices;
+    uring_cancel_read(u, i);
+    u->slots[i].gen++;
+    u->slots[i].poll_first = false;
+}
+
+/* Poll the epoll set of extra sources (timers, hotplug, wake_fd) */
+static void uring_arm_sources(struct listener_uring *u) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = u->listener->epoll_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_DATA(URING_SOURCES, 0, 0);
+    u->sources_armed = true;
+}
+
+/* Queue the (rest of the) write for out[idx], behind a POLLOUT poll if the device was full
+ *
+ * Otherwise the write completes within the enter that submits it, and the loop
+ * waits for one completion more than that. A write that comes up short
+ * (-EAGAIN, partial) needs the loop though: it cancels the NOP linked behind
+ * it, whose CQE is the wakeup - on success the NOP posts nothing. */
+static void uring_submit_write(struct listener_uring *u, int idx, bool poll_first) {
+    int fd = u->listener->vkbd_ctx->device.fd;
+    const char *buf = (const char *)u->out[idx] + u->out_done;
+    size_t len = u->out_len[idx] * sizeof(struct input_event) - u->out_done;
+    bool check = !poll_first && (u->ring.features & IORING_FEAT_CQE_SKIP);
+
+    /* At most a staging buffer's worth, so pipes take it whole or not at all */
+    if (len > VKBD_OUT_BUFFER * sizeof(struct input_event)) {
+        len = VKBD_OUT_BUFFER * sizeof(struct input_event);
+    }
+
+    /* A linked pair must go out in the same submission */
+    while ((poll_first || check) && uring_sq_space(&u->ring) < 2) {
+        uring_enter(&u->ring, 0);
+    }
+
+    if (poll_first) {
+        struct io_uring_sqe *sqe = uring_sqe(u);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLOUT;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = URING_DATA(URING_WRITE_POLL, 0, 0);
+    }
+
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    uring_prep_rw(sqe, IORING_OP_WRITE, fd, buf, len, URING_DATA(URING_WRITE, 0, 0));
+    if (u->out_nowait) {
+        sqe->rw_flags = RWF_NOWAIT;   /* -EAGAIN rather than parked in the kernel */
+    }
+    if (check) {
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = uring_get_sqe(&u->ring);   /* Not in flight: it may never complete */
+        sqe->opcode = IORING_OP_NOP;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = URING_DATA(URING_WRITE_CHECK, 0, 0);
+    }
+    u->out_busy = idx;
+    u->out_counted = check;
+}
+
+/* Output write completed: resume a short write, else start the next batch and
+ * move what waits in the output queue into the buffer just freed */
+static void uring_write_done(struct listener_uring *u, int res) {
+    event_listener_t *listener = u->listener;
+    int idx = u->out_busy;
+
+    if (res == -EINTR || res == -EAGAIN || res == -ECANCELED) {
+        /* Full device: retry once it is writable, not right away */
+        uring_submit_write(u, idx, res != -EINTR);
+        return;
+    }
+    if (res == -EOPNOTSUPP && u->out_nowait) {
+        /* No RWF_NOWAIT on this device (uinput) - its writes do not block anyway */
+        u->out_nowait = false;
+        uring_submit_write(u, idx, false);
+        return;
+    }
+    if (__builtin_expect(res < 0, 0)) {
+        if (!u->write_error_logged) {
+            fprintf(stderr, "event_listener_run_uring: write failed: %s\n", strerror(-res));
+            u->write_error_logged = true;
+        }
+    } else {
+        /* Accepted by the device: latency for the events completed by this write */
+        int from = u->out_done / sizeof(struct input_event);
+        u->out_done += res;
+        vkbd_record_latency(listener->vkbd_ctx, &u->out_src[idx][from],
+                            u->out_done / sizeof(struct input_event) - from);
+        if (u->out_done < u->out_len[idx] * sizeof(struct input_event)) {
+            uring_submit_write(u, idx, false);
+            return;
+        }
+    }
+
+    u->out_len[idx] = 0;
+    u->out_done = 0;
+    u->out_busy = -1;
+    u->out_counted = false;
+    if (u->out_len[idx ^ 1] > 0) {
+        uring_submit_write(u, idx ^ 1, false);
+        listener->uring_stats.writes++;
+    }
+    if (__builtin_expect(vkbd_backlog(listener->vkbd_ctx) > 0, 0) &&
+        vkbd_drain(listener->vkbd_ctx) < VKBD_OUT_LOW_WATER) {
+        pause_sources(listener, listener->vkbd_ctx, false);
+    }
+}
+
+/* Take every completion: writes are handled here, the rest goes to the backlog */
+static void uring_reap(struct listener_uring *u) {
+    struct io_uring_cqe *cqe;
+
+    while ((cqe = uring_peek_cqe(&u->ring)) != NULL) {
+        struct io_uring_cqe c = *cqe;
+        uring_cqe_seen(&u->ring);
+        if (URING_KIND(c.user_data) != URING_WRITE_CHECK) {
+            u->inflight--;   /* Check NOPs are never counted in flight */
+        }
+        u->listener->uring_stats.completions++;
+
+        switch (URING_KIND(c.user_data)) {
+        case URING_WRITE:
+            uring_write_done(u, c.res);
+            break;
+        case URING_READ:
+        case URING_SOURCES:
+            /* At most one read per slot plus the source poll are ever queued */
+            u->backlog[u->backlog_count++] = c;
+            break;
+        case URING_TIMEOUT:
+            u->timed_out = true;
+            break;
+        default:
+            break;  /* Linked polls and cancellations */
+        }
+    }
+}
+
+/* Output sink: copy the batch and queue its write on the ring */
+static int uring_sink(vkbd_context_t *ctx, const struct input_event *events,
+                      const uint64_t *src_ns, int count, void *user_data) {
+    (void)ctx;
+    struct listener_uring *u = user_data;
+
+    int idx = u->out_busy < 0 ? 0 : u->out_busy ^ 1;
+    if (__builtin_expect(u->out_len[idx] + count > URING_OUT_EVENTS, 0)) {
+        /* Both buffers taken: the output queue keeps it (and coalesces) until a write completes */
+        u->listener->uring_stats.write_deferrals++;
+        return 1;
+    }
+
+    memcpy(&u->out[idx][u->out_len[idx]], events, count * sizeof(*events));
+    memcpy(&u->out_src[idx][u->out_len[idx]], src_ns, count * sizeof(*src_ns));
+    u->out_len[idx] += count;
+    if (u->out_busy < 0) {
+        /* Goes out with the next io_uring_enter */
+        uring_submit_write(u, idx, false);
+        u->listener->uring_stats.writes++;
+    }
+    return 0;
+}
+
+/* A device read completed: forward what it returned */
+static int uring_handle_read(struct listener_uring *u, const struct io_uring_cqe *cqe) {
+    event_listener_t *listener = u->listener;
+    const int MAX_CONSECUTIVE_ERRORS = 100;
+    int i = URING_SLOT(cqe->user_data);
+    struct uring_slot *slot = &u->slots[i];
+    input_device_t *dev = &listener->devices[i];
+    int res = cqe->res;
+    int processed = 0;
+
+    slot->armed = false;
+    if (URING_GEN(cqe->user_data) != slot->gen || !dev->active) {
+        return 0;  /* Queued for a device that has been released since */
+    }
+
+    if (__builtin_expect(res > 0, 1)) {
+        if (__builtin_expect((res % sizeof(struct input_event)) != 0, 0)) {
+            counter_add(&listener->counters.read_errors, 1);
+            listener->error_count++;
+            return 0;
+        }
+        if (__builtin_expect(listener->error_count != 0, 0)) {
+            counter_add(&listener->counters.error_resets, 1);
+            listener->error_count = 0;
+        }
+        listener->uring_stats.reads++;
+
+        int num_events = res / sizeof(struct input_event);
+        if (__builtin_expect(listener->capture != NULL, 0)) {
+            capture_append(listener->capture, dev - listener->devices, slot->buf, num_events);
+        }
+        for (int j = 0; j < num_events; j++) {
+            processed += (slot->buf[j].type == EV_KEY);
+            if (__builtin_expect(slot->buf[j].type == EV_SYN && slot->buf[j].code == SYN_DROPPED, 0)) {
+                counter_add(&listener->counters.syn_dropped, 1);
+            }
+        }
+        vkbd_process_batch(dev->out, slot->buf, num_events);
+        mark_pending(listener, dev->out);
+        counter_add(&dev->events, num_events);
+        counter_add(&dev->keys, processed);
+        return processed;
+    }
+
+    if (res == 0 || res == -ENODEV || res == -ENOENT) {
+        release_device(listener, dev);  /* EOF - device disconnected */
+    } else if (res == -EAGAIN) {
+        slot->poll_first = true;        /* Kernel without poll-driven retry */
+    } else if (res != -EINTR && res != -ECANCELED) {
+        counter_add(&listener->counters.read_errors, 1);
+        if (++listener->error_count > MAX_CONSECUTIVE_ERRORS) {
+            fprintf(stderr, "Too many errors, stopping listener\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Handle the backlog; reads may add to it while it is walked */
+static int uring_process(struct listener_uring *u) {
+    int ret = 0;
+
+    for (int i = 0; i < u->backlog_count; i++) {
+        const struct io_uring_cqe *cqe = &u->backlog[i];
+        if (URING_KIND(cqe->user_data) == URING_SOURCES) {
+            u->sources_armed = false;
+            /* Timers, hotplug and stop requests - the devices are not in this set */
+            if (!u->stopping && event_listener_poll(u->listener, 0) < 0) {
+                ret = -1;
+            }
+        } else if (uring_handle_read(u, cqe) < 0) {
+            ret = -1;
+        }
+    }
+    u->backlog_count = 0;
+    return ret;
+}
+
+/* Start listening on an io_uring */
+int event_listener_run_uring(event_listener_t *listener) {
+    if (!listener) {
+        fprintf(stderr, "event_listener_run_uring: NULL listener\n");
+        return -1;
+    }
+
+    if (listener->device_count == 0 && listener->hotplug_fd < 0) {
+        fprintf(stderr, "event_listener_run_uring: No devices to monitor\n");
+        return -1;
+    }
+
+    struct listener_uring *u = calloc(1, sizeof(*u));
+    if (!u) {
+        fprintf(stderr, "event_listener_run_uring: Out of memory\n");
+        return -1;
+    }
+    u->listener = listener;
+    u->out_busy = -1;
+    u->out_nowait = true;
+    u->device_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (u->device_epoll_fd < 0) {
+        perror("event_listener_run_uring: Failed to create epoll");
+        free(u);
+        return -1;
+    }
+    if (uring_init(&u->ring, URING_ENTRIES) < 0) {
+        close(u->device_epoll_fd);
+        free(u);
+        return -1;
+    }
+
+    memset(&listener->uring_stats, 0, sizeof(listener->uring_stats));
+    listener->uring = u;
+    move_devices(listener, u->device_epoll_fd);
+    vkbd_set_sink(listener->vkbd_ctx, uring_sink, u);
+
+    if (listener->rt_enabled && rt_apply(&listener->rt) < 0) {
+        fprintf(stderr, "Warning: Real-time mode only partially applied\n");
+    }
+
+    atomic_store(&listener->running, true);
+    listener->error_count = 0;
+    printf("Event listener started (io_uring), monitoring %d device(s)\n", listener->device_count);
+
+    int ret = 0;
+    while (atomic_load_explicit(&listener->running, memory_order_relaxed)) {
+        /* Re-arm idle devices (hotplugged ones included) and the source poll */
+        for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+            if (listener->devices[i].active && !listener->devices[i].paused && !u->slots[i].armed) {
+                uring_arm_read(u, i);
+            }
+        }
+        if (!u->sources_armed) {
+            uring_arm_sources(u);
+        }
+
+        /* One syscall: last round's write and the reads go out, then wait.
+         * A checked write counts itself, so its completion alone is no wakeup;
+         * one behind a POLLOUT poll may take any time and does not count */
+        if (uring_enter(&u->ring, 1 + u->out_counted) < 0 && errno != EINTR) {
+            perror("event_listener_run_uring: io_uring_enter failed");
+            ret = -1;
+            break;
+        }
+        listener->uring_stats.enters++;
+        uring_reap(u);
+        if (uring_process(u) < 0) {
+            ret = -1;
+            break;
+        }
+        flush_outputs(listener);
+    }
+
+    /* Stop: cancel the reads, forward what they already returned and
+     * wait for the last write - bounded in case a cancel cannot land */
+    u->stopping = true;
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        uring_cancel_read(u, i);
+    }
+    if (u->sources_armed) {
+        uring_cancel(u, URING_DATA(URING_SOURCES, 0, 0));
+    }
+    u->stop_timeout.tv_sec = URING_STOP_TIMEOUT_S;
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)&u->stop_timeout;
+    sqe->len = 1;
+    sqe->user_data = URING_DATA(URING_TIMEOUT, 0, 0);
+
+    while (u->inflight > 1 && !u->timed_out) {
+        if (uring_enter(&u->ring, 1) < 0 && errno != EINTR) {
+            break;
+        }
+        uring_reap(u);
+        uring_process(u);
+        flush_outputs(listener);
+    }
+    if (!u->timed_out) {
+        sqe = uring_sqe(u);
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = URING_DATA(URING_TIMEOUT, 0, 0);
+        sqe->user_data = URING_DATA(URING_CANCEL, 0, 0);
+        while (u->inflight > 0 && uring_enter(&u->ring, 1) >= 0) {
+            uring_reap(u);
+        }
+    }
+
+    atomic_store(&listener->running, false);
+    vkbd_set_sink(listener->vkbd_ctx, NULL, NULL);
+    listener->uring = NULL;
+    move_devices(listener, listener->epoll_fd);
+    printf("Event listener stopped\n");
+
+    close(u->device_epoll_fd);
+    uring_destroy(&u->ring);
+    if (u->inflight > 0) {
+        /* The kernel may still own read buffers - leak rather than reuse */
+        fprintf(stderr, "event_listener_run_uring: %u request(s) still queued on stop\n", u->inflight);
+    } else {
+        free(u);
+    }
+    return ret;
 }
 
 /* Stop listening for events */
 void event_listener_stop(event_listener_t *listener) {
     if (listener) {
-        listener->running = false;
+        atomic_store(&listener->running, false);
+        if (listener->wake_fd >= 0) {
+            uint64_t one = 1;
+            if (write(listener->wake_fd, &one, sizeof(one)) < 0) {
+                /* Counter saturated - a wakeup is already pending */
+            }
+        }
     }
 }
 
@@ -308,19 +2031,30 @@ void event_listener_destroy(event_listener_t *listener) {
         return;
     }
 
-    listener->running = false;
+    atomic_store(&listener->running, false);
 
     /* Close all device file descriptors */
-    for (int i = 0; i < listener->device_count; i++) {
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
         if (listener->devices[i].active && listener->devices[i].fd >= 0) {
-            /* Release grab */
-            ioctl(listener->devices[i].fd, EVIOCGRAB, 0);
-            close(listener->devices[i].fd);
-            listener->devices[i].fd = -1;
+            /* Release grab (evdev) and close */
+            listener->devices[i].backend->close(&listener->devices[i]);
+            release_output(listener, &listener->devices[i]);
             listener->devices[i].active = false;
         }
     }
 
+    /* Close hotplug socket */
+    if (listener->hotplug_fd >= 0) {
+        close(listener->hotplug_fd);
+        listener->hotplug_fd = -1;
+    }
+
+    /* Close wake eventfd */
+    if (listener->wake_fd >= 0) {
+        close(listener->wake_fd);
+        listener->wake_fd = -1;
+    }
+
     /* Close epoll fd */
     if (listener->epoll_fd >= 0) {
         close(listener->epoll_fd);
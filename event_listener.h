@@ -9,27 +9,176 @@
 #define EVENT_LISTENER_H
 
 #include "vkbd.h"
+#include "rt.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 /* Maximum number of input devices to monitor */
 #define MAX_INPUT_DEVICES 16
 
-/* Input device structure */
+/* Maximum number of extra fd sources (timers, inotify, ...) in the epoll set */
+#define MAX_LISTENER_SOURCES 16
+
+/* Maximum number of device match rules */
+#define MAX_LISTENER_MATCHES 16
+
+/* Maximum number of routing table entries */
+#define MAX_LISTENER_ROUTES 16
+
+typedef struct input_device input_device_t;
+typedef struct event_listener event_listener_t;
+struct capture;
+
+/* What is known about an input device before opening it
+ * Read from /sys/class/input/eventN/device, or with ioctls without sysfs */
 typedef struct {
+    char node[32];               /* "eventN" */
+    char name[256];
+    char phys[64];
+    uint16_t bustype;
+    uint16_t vendor;
+    uint16_t product;
+    bool has_keys;               /* EV_KEY in the event type bitmap */
+    keyset_t keys;               /* Key capability bitmap */
+} input_info_t;
+
+/* Input backend - opens a source device and fills in fd/name
+ * The listener only ever read()s struct input_event records from fd */
+typedef struct {
+    const char *name;
+    int (*open)(input_device_t *dev, const char *path); /* 0 on success, -1 on error */
+    void (*close)(input_device_t *dev);
+} input_backend_t;
+
+/* Input device structure */
+struct input_device {
     int fd;
+    int peer_fd;    /* Write end for in-process backends, -1 otherwise */
     char path[256];
     char name[256];
     bool active;
-} input_device_t;
+    const input_backend_t *backend;
+    input_info_t info;  /* Identity and capabilities, filled in by the backend */
+    vkbd_context_t *out;    /* Output its events are forwarded to */
+    bool owns_out;      /* out was created for this device (per-source mode) */
+    bool paused;        /* Not read while out's backlog is over VKBD_OUT_HIGH_WATER */
+    counter_t events;   /* Events read - written by the thread reading the device */
+    counter_t keys;     /* Key events among them, handed on for forwarding */
+};
 
-/* Event listener context */
+/* Real /dev/input/event* devices, grabbed with EVIOCGRAB (default) */
+extern const input_backend_t input_backend_evdev;
+
+/* In-process stand-in: write struct input_event records to peer_fd */
+extern const input_backend_t input_backend_pipe;
+
+/* Device match rule - every field that is set has to match
+ * A device is used if it matches any rule (or no rules were added) */
+typedef struct {
+    uint16_t vendor;             /* 0 = any */
+    uint16_t product;            /* 0 = any */
+    char phys[64];               /* fnmatch() pattern, "" = any */
+    char name[64];               /* fnmatch() pattern, "" = any */
+} listener_match_t;
+
+/* Routing table entry - sources matching the rule are forwarded to out
+ * Several entries may share an output (a routing group) */
+typedef struct {
+    listener_match_t match;
+    vkbd_context_t *out;
+} listener_route_t;
+
+/* Per-source outputs - sources no route claims get a virtual device of their own */
 typedef struct {
+    vkbd_context_t *(*create)(const input_device_t *dev, void *user_data); /* NULL on error */
+    void (*destroy)(vkbd_context_t *out, void *user_data);
+} listener_output_ops_t;
+
+/* Device discovery statistics (last event_listener_auto_detect) */
+typedef struct {
+    unsigned nodes;              /* event* nodes looked at */
+    unsigned matched;            /* Keyboards that passed the match rules */
+    unsigned added;              /* Opened and grabbed */
+    uint64_t ns;                 /* Wall time of the scan */
+    bool sysfs;                  /* Capabilities came from sysfs (no open) */
+} discovery_stats_t;
+
+/* Extra fd source handler - runs on the listener thread when fd is ready */
+typedef void (*listener_source_fn)(event_listener_t *listener, uint32_t events, void *user_data);
+
+/* Extra fd source structure */
+typedef struct {
+    int fd;
+    listener_source_fn handler;
+    void *user_data;
+    bool active;
+} listener_source_t;
+
+/* Pipelined mode statistics (event_listener_run_pipelined)
+ * Written by the loop threads; read them once the run has returned */
+typedef struct {
+    unsigned long events;        /* Items handed from the reader to the writer */
+    unsigned long batches;       /* Writer drain rounds, one output write each */
+    unsigned long full_stalls;   /* Reader waits on a full ring */
+    unsigned long syn_dropped;   /* SYN_DROPPED reports from the sources */
+    uint32_t max_depth;          /* Deepest ring seen by the writer */
+    uint64_t queue_ns_total;     /* read() -> taken off the ring, per event */
+    uint64_t queue_ns_max;
+    uint64_t write_ns_total;     /* Taken off the ring -> output written, per batch */
+    uint64_t write_ns_max;
+} pipeline_stats_t;
+
+/* io_uring engine statistics (event_listener_run_uring) */
+typedef struct {
+    unsigned long enters;        /* io_uring_enter calls - submit and wait in one */
+    unsigned long completions;   /* CQEs reaped */
+    unsigned long reads;         /* Device reads that returned events */
+    unsigned long writes;        /* Output writes submitted */
+    unsigned long write_deferrals;  /* Flushes left to the output queue: both write buffers busy */
+} uring_stats_t;
+
+/* Listener counters - written by the loop (reader) thread, readable anywhere */
+typedef struct {
+    counter_t read_errors;       /* Failed or malformed device reads */
+    counter_t error_resets;      /* Good reads that cleared a run of errors */
+    counter_t syn_dropped;       /* SYN_DROPPED reports: the kernel buffer overran */
+} listener_counters_t;
+
+struct listener_pipeline;
+struct listener_uring;
+
+/* Event listener context */
+struct event_listener {
     input_device_t devices[MAX_INPUT_DEVICES];
-    int device_count;
+    int device_count;            /* Active slots - freed slots are reused */
+    listener_source_t sources[MAX_LISTENER_SOURCES];
     int epoll_fd;
-    bool running;
-    vkbd_context_t *vkbd_ctx;
-} event_listener_t;
+    int device_epoll_fd;         /* Set the devices are in (reader's set when pipelined) */
+    int wake_fd;                 /* eventfd in the epoll set - wakes the loop on stop */
+    int hotplug_fd;              /* NETLINK_KOBJECT_UEVENT socket, -1 if disabled */
+    int error_count;
+    listener_counters_t counters;
+    listener_match_t matches[MAX_LISTENER_MATCHES];
+    int match_count;             /* 0 = every keyboard */
+    discovery_stats_t discovery_stats;
+    atomic_bool running;
+    vkbd_context_t *vkbd_ctx;    /* Default output */
+    listener_route_t routes[MAX_LISTENER_ROUTES];
+    int route_count;
+    const listener_output_ops_t *output_ops;  /* NULL = unrouted sources share vkbd_ctx */
+    void *output_data;
+    vkbd_context_t *pending[MAX_INPUT_DEVICES];  /* Other outputs with staged events */
+    int pending_count;
+    const input_backend_t *backend;
+    rt_config_t rt;              /* Applied by event_listener_run when rt_enabled */
+    bool rt_enabled;
+    struct listener_pipeline *pipeline;  /* Reader thread + ring while pipelined */
+    pipeline_stats_t pipeline_stats;
+    struct listener_uring *uring;        /* Ring + read buffers while on io_uring */
+    uring_stats_t uring_stats;
+    struct capture *capture;     /* Capture file being appended to, NULL if none */
+};
 
 /**
  * Initialize event listener
@@ -40,15 +189,89 @@ typedef struct {
  */
 int event_listener_init(event_listener_t *listener, vkbd_context_t *vkbd_ctx);
 
+/**
+ * Select the input backend used by event_listener_add_device
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param backend Input backend (e.g., &input_backend_pipe), NULL for evdev
+ */
+void event_listener_set_backend(event_listener_t *listener, const input_backend_t *backend);
+
+/**
+ * Enable real-time mode for event_listener_run
+ * 
+ * The settings are applied on the thread that calls event_listener_run,
+ * right before it enters the loop.
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param cfg Real-time settings (copied), NULL to disable
+ */
+void event_listener_set_rt(event_listener_t *listener, const rt_config_t *cfg);
+
+/**
+ * Route sources matching a rule to another output
+ * 
+ * Routes are checked in the order they were added when a device is added;
+ * the first match wins. Unrouted sources go to the default output (or
+ * their own, see event_listener_set_outputs). The output must outlive the
+ * listener. Writes to it never go through the io_uring engine's ring.
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param rule Sources to route (copied)
+ * @param out Output for them
+ * @return 0 on success, -1 on error
+ */
+int event_listener_add_route(event_listener_t *listener, const listener_match_t *rule,
+                             vkbd_context_t *out);
+
+/**
+ * Give every unrouted source a virtual output of its own
+ * 
+ * ops->create runs on the listener thread when a device is added, before
+ * its first event; ops->destroy when it is released (staged events are
+ * written first). If create fails the source falls back to the default
+ * output. Set it before adding devices and leave it while any device has
+ * an output of its own.
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param ops Output callbacks, NULL to share the default output again
+ * @param user_data User data passed to ops
+ */
+void event_listener_set_outputs(event_listener_t *listener, const listener_output_ops_t *ops,
+                                void *user_data);
+
 /**
  * Add input device to monitor
  * 
+ * Refuses the listener's own outputs (by uinput sysname or event node), so
+ * nothing it writes can come back in.
+ * 
  * @param listener Pointer to event_listener_t structure
  * @param device_path Path to input device (e.g., /dev/input/event0)
  * @return 0 on success, -1 on error
  */
 int event_listener_add_device(event_listener_t *listener, const char *device_path);
 
+/**
+ * Stop monitoring a device and free its slot
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param device_path Path passed to event_listener_add_device
+ * @return 0 on success, -1 if no such device
+ */
+int event_listener_remove_device(event_listener_t *listener, const char *device_path);
+
+/**
+ * Follow keyboards being plugged in and out (evdev backend)
+ * 
+ * Kernel uevents are received on a netlink socket in the epoll set:
+ * new /dev/input/event* keyboards are added, removed ones released.
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @return 0 on success, -1 on error
+ */
+int event_listener_enable_hotplug(event_listener_t *listener);
+
 /**
  * Auto-detect and add all keyboard devices
  * 
@@ -57,17 +280,138 @@ int event_listener_add_device(event_listener_t *listener, const char *device_pat
  */
 int event_listener_auto_detect(event_listener_t *listener);
 
+/**
+ * Collect the key capabilities of the keyboards present
+ * 
+ * Each matching keyboard's key bitmap is ORed into keys. Capabilities are
+ * read from sysfs, so devices are not opened (let alone grabbed). Meant
+ * for vkbd_init_keys, before the virtual device exists.
+ * 
+ * @param rules Match rules (as for event_listener_add_match), NULL for none
+ * @param rule_count Number of rules
+ * @param keys Key set to add to (not cleared first)
+ * @return Number of keyboards found, -1 on error
+ */
+int event_listener_probe_keys(const listener_match_t *rules, int rule_count, keyset_t *keys);
+
+/**
+ * Only use devices matching a rule (auto-detect and hotplug)
+ * 
+ * With no rules every keyboard is used. Rules are checked against sysfs
+ * before a device is opened.
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param rule Rule to add (copied)
+ * @return 0 on success, -1 on error
+ */
+int event_listener_add_match(event_listener_t *listener, const listener_match_t *rule);
+
+/**
+ * Parse a match rule: comma-separated "VVVV:PPPP" (hex ids, '*' for any),
+ * "phys=PATTERN" and "name=PATTERN" terms
+ * 
+ * @param spec Rule text, e.g. "046d:c52b,phys=usb-0000:00:14.0-*"
+ * @param rule Receives the rule
+ * @return 0 on success, -1 on error
+ */
+int listener_match_parse(const char *spec, listener_match_t *rule);
+
+/**
+ * Check a device against one rule
+ * 
+ * @param rule Match rule
+ * @param info Device description
+ * @return true if every field set in the rule matches
+ */
+bool listener_match_test(const listener_match_t *rule, const input_info_t *info);
+
+/**
+ * Describe an input device from its sysfs directory, without opening it
+ * 
+ * @param dir Device directory (e.g., /sys/class/input/event3/device)
+ * @param info Receives the description (node is left empty)
+ * @return 0 on success, -1 on error
+ */
+int input_info_from_sysfs(const char *dir, input_info_t *info);
+
 /**
  * Start listening for events (blocking)
  * 
+ * Needs at least one device unless hotplug is enabled.
+ * 
  * @param listener Pointer to event_listener_t structure
  * @return 0 on success, -1 on error
  */
 int event_listener_run(event_listener_t *listener);
 
+/**
+ * Start listening with separate reader and writer threads (blocking)
+ * 
+ * A reader thread drains the devices into a lock-free SPSC ring and the
+ * calling thread runs callbacks, filters and output writes in batches, so
+ * a slow write or callback never delays reading the sources. Sources and
+ * hotplug keep running on the calling thread; devices that disconnect are
+ * released in order through the ring. Statistics are in pipeline_stats.
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @return 0 on success, -1 on error
+ */
+int event_listener_run_pipelined(event_listener_t *listener);
+
+/**
+ * Start listening on an io_uring (blocking)
+ * 
+ * Every device keeps a read queued on one ring and output writes go
+ * through the same ring (as a vkbd sink), so a round of keys costs a single
+ * io_uring_enter that submits the previous write, re-arms the reads and
+ * waits for the next completion. Extra sources stay in the epoll set, which
+ * is itself polled through the ring. Statistics are in uring_stats.
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @return 0 on success, -1 on error (e.g., io_uring unavailable)
+ */
+int event_listener_run_uring(event_listener_t *listener);
+
+/**
+ * Add an extra fd to the listener's epoll set
+ * 
+ * The handler runs on the listener thread, before the round's output is
+ * flushed, so it may stage events with vkbd_emit().
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param fd File descriptor to watch (not owned by the listener)
+ * @param events epoll event mask (e.g., EPOLLIN)
+ * @param handler Function called when fd is ready
+ * @param user_data User data passed to handler
+ * @return 0 on success, -1 on error
+ */
+int event_listener_add_source(event_listener_t *listener, int fd, uint32_t events,
+                              listener_source_fn handler, void *user_data);
+
+/**
+ * Remove an extra fd from the listener's epoll set
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param fd File descriptor passed to event_listener_add_source
+ * @return 0 on success, -1 on error
+ */
+int event_listener_remove_source(event_listener_t *listener, int fd);
+
+/**
+ * Wait for and process one round of events (non-looping)
+ * 
+ * @param listener Pointer to event_listener_t structure
+ * @param timeout_ms epoll timeout in milliseconds (-1 = block)
+ * @return Number of key events processed, -1 on fatal error
+ */
+int event_listener_poll(event_listener_t *listener, int timeout_ms);
+
 /**
  * Stop listening for events
  * 
+ * Async-signal-safe: may be called from a signal handler or another thread.
+ * The loop blocks in epoll_wait with no timeout and is woken through wake_fd.
+ * 
  * @param listener Pointer to event_listener_t structure
  */
 void event_listener_stop(event_listener_t *listener);
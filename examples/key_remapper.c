@@ -3,8 +3,11 @@
  * 
  * Demonstrates remapping keys (e.g., Caps Lock to Escape)
  * This is a more advanced example showing how to modify key events
+ * with a filter stage: the event is rewritten in place, so exactly one
+ * (remapped) key is forwarded and no extra writes are issued
  * 
- * Compile: gcc key_remapper.c ../vkbd.c ../event_listener.c -o key_remapper
+ * Compile: make examples (from the top directory), or after make library:
+ *          gcc key_remapper.c -I.. -L.. -lvkbd -lpthread -o key_remapper
  * Run: sudo ./key_remapper
  */
 
@@ -15,7 +18,6 @@
 #include <linux/input-event-codes.h>
 
 static event_listener_t *g_listener = NULL;
-static vkbd_context_t *g_vkbd = NULL;
 
 void signal_handler(int sig) {
     (void)sig;
@@ -25,39 +27,31 @@ void signal_handler(int sig) {
     }
 }
 
-/* Custom callback that remaps keys */
-void remap_callback(uint16_t key_code, int32_t value, void *user_data) {
+/* Custom filter that remaps keys */
+vkbd_verdict_t remap_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)ctx;
     (void)user_data;
     
     /* Example remapping rules */
-    uint16_t new_key_code = key_code;
     
     /* Caps Lock -> Escape */
-    if (key_code == KEY_CAPSLOCK) {
-        new_key_code = KEY_ESC;
-        printf("[REMAP] CAPSLOCK -> ESC\n");
+    if (ev->code == KEY_CAPSLOCK) {
+        ev->code = KEY_ESC;
     }
     
     /* Right Alt -> Right Ctrl (for ergonomic reasons) */
-    else if (key_code == KEY_RIGHTALT) {
-        new_key_code = KEY_RIGHTCTRL;
-        printf("[REMAP] RIGHTALT -> RIGHTCTRL\n");
+    else if (ev->code == KEY_RIGHTALT) {
+        ev->code = KEY_RIGHTCTRL;
     }
     
-    /* Send the (possibly remapped) key */
-    if (g_vkbd) {
-        vkbd_send_key(g_vkbd, new_key_code, value);
-        vkbd_sync(g_vkbd);
-    }
+    /* Forward the (possibly remapped) key - no stdio here, this is the forwarding path */
+    return VKBD_FILTER_PASS;
 }
 
 int main() {
     vkbd_context_t vkbd;
     event_listener_t listener;
     
-    g_vkbd = &vkbd;
-    g_listener = &listener;
-    
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
@@ -72,9 +66,9 @@ int main() {
         return 1;
     }
     
-    /* Register remapping callback */
-    if (vkbd_register_callback(&vkbd, remap_callback, NULL) < 0) {
-        fprintf(stderr, "Failed to register callback\n");
+    /* Register remapping filter */
+    if (vkbd_register_filter(&vkbd, remap_filter, NULL) < 0) {
+        fprintf(stderr, "Failed to register filter\n");
         vkbd_destroy(&vkbd);
         return 1;
     }
@@ -84,6 +78,7 @@ int main() {
         vkbd_destroy(&vkbd);
         return 1;
     }
+    g_listener = &listener;  /* Stopping writes to its eventfd: only once it exists */
     
     if (event_listener_auto_detect(&listener) < 0) {
         fprintf(stderr, "Failed to detect keyboard devices\n");
@@ -96,6 +91,7 @@ int main() {
     event_listener_run(&listener);
     
     printf("\nCleaning up...\n");
+    g_listener = NULL;
     event_listener_destroy(&listener);
     vkbd_destroy(&vkbd);
     
@@ -2,7 +2,8 @@
  * Simple Key Logger Example
  * 
  * Minimal example showing how to log all keyboard input
- * Compile: gcc simple_logger.c ../vkbd.c ../event_listener.c -o simple_logger
+ * Compile: make examples (from the top directory), or after make library:
+ *          gcc simple_logger.c -I.. -L.. -lvkbd -lpthread -o simple_logger
  * Run: sudo ./simple_logger
  */
 
@@ -32,7 +33,6 @@ int main() {
     vkbd_context_t vkbd;
     event_listener_t listener;
     
-    g_listener = &listener;
     signal(SIGINT, signal_handler);
     
     printf("Simple Key Logger\n");
@@ -48,6 +48,7 @@ int main() {
         vkbd_destroy(&vkbd);
         return 1;
     }
+    g_listener = &listener;  /* Stopping writes to its eventfd: only once it exists */
     
     if (event_listener_auto_detect(&listener) < 0) {
         event_listener_destroy(&listener);
@@ -58,6 +59,7 @@ int main() {
     printf("Logging started...\n");
     event_listener_run(&listener);
     
+    g_listener = NULL;
     event_listener_destroy(&listener);
     vkbd_destroy(&vkbd);
     
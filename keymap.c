@@ -0,0 +1,406 @@
+/**
+ * Compiled Keymap Module - Implementation
+ */
+
+#define _GNU_SOURCE
+
+#include "keymap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <linux/input.h>
+
+/* Key names - keynames.inc is generated from linux/input-event-codes.h */
+typedef struct {
+    const char *name;
+    uint16_t code;
+} keyname_t;
+
+#define KEYNAME(k) { #k, k },
+static const keyname_t keynames[] = {
+#include "keynames.inc"
+};
+#undef KEYNAME
+
+#define KEYNAME_COUNT (sizeof(keynames) / sizeof(keynames[0]))
+
+/* Look up a key code by name */
+int keymap_key_code(const char *name) {
+    if (!name || !*name) {
+        return -1;
+    }
+
+    /* Numeric code */
+    if (isdigit((unsigned char)name[0])) {
+        char *end;
+        long code = strtol(name, &end, 0);
+        return (*end == '\0' && code >= 0 && code <= KEY_MAX) ? (int)code : -1;
+    }
+
+    for (size_t i = 0; i < KEYNAME_COUNT; i++) {
+        const char *full = keynames[i].name;
+        /* Accept KEY_ESC and ESC (BTN_ names need their prefix) */
+        if (strcasecmp(full, name) == 0 ||
+            (strncmp(full, "KEY_", 4) == 0 && strcasecmp(full + 4, name) == 0)) {
+            return keynames[i].code;
+        }
+    }
+    return -1;
+}
+
+/* Look up a key name by code */
+const char *keymap_key_name(uint16_t code) {
+    for (size_t i = 0; i < KEYNAME_COUNT; i++) {
+        if (keynames[i].code == code) {
+            return keynames[i].name;
+        }
+    }
+    return NULL;
+}
+
+/* Read a compiled file into private memory and validate it
+ * (a copy: rewriting the file in place cannot change a table in use) */
+static keymap_table_t *table_load(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "keymap: Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    keymap_header_t hdr;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        fprintf(stderr, "keymap: %s is too short\n", path);
+        close(fd);
+        return NULL;
+    }
+    if (hdr.magic != KEYMAP_MAGIC || hdr.version != KEYMAP_VERSION ||
+        hdr.key_count == 0 || hdr.key_count > KEY_CNT) {
+        fprintf(stderr, "keymap: %s is not a valid compiled keymap\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    keymap_table_t *table = malloc(sizeof(*table));
+    if (!table) {
+        close(fd);
+        return NULL;
+    }
+    size_t len = (size_t)hdr.key_count * sizeof(uint16_t);
+    ssize_t n = pread(fd, table->map, len, sizeof(hdr));
+    close(fd);
+    if (n != (ssize_t)len) {
+        fprintf(stderr, "keymap: %s is not a valid compiled keymap\n", path);
+        free(table);
+        return NULL;
+    }
+    table->key_count = hdr.key_count;
+    return table;
+}
+
+/* Filter stage: one indexed load per key
+ * Releases and repeats go out as their press did, so a reload while a key
+ * is down cannot leave the old output stuck */
+static vkbd_verdict_t keymap_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)ctx;
+    keymap_t *km = user_data;
+    uint16_t code = ev->code;
+
+    if (__builtin_expect(code >= KEY_CNT, 0)) {
+        return VKBD_FILTER_PASS;
+    }
+
+    uint16_t out;
+    if (ev->value != 1 && keyset_test(&km->held, code)) {
+        out = km->held_as[code];
+        if (ev->value == 0) {
+            keyset_clear(&km->held, code);
+        }
+    } else {
+        const keymap_table_t *table = atomic_load_explicit(&km->table, memory_order_acquire);
+        out = __builtin_expect(code < table->key_count, 1) ? table->map[code] : code;
+        if (ev->value == 1) {
+            km->held_as[code] = out;
+            keyset_set(&km->held, code);
+        }
+    }
+
+    if (__builtin_expect(out == KEYMAP_DROP, 0)) {
+        return VKBD_FILTER_DROP;
+    }
+    ev->code = out;
+    return VKBD_FILTER_PASS;
+}
+
+/* Load a compiled keymap */
+int keymap_init(keymap_t *km, const char *path) {
+    if (!km || !path) {
+        fprintf(stderr, "keymap_init: Invalid arguments\n");
+        return -1;
+    }
+
+    memset(km, 0, sizeof(*km));
+    km->inotify_fd = -1;
+    km->watch_fd = -1;
+    km->filter_id = -1;
+    strncpy(km->path, path, sizeof(km->path) - 1);
+
+    keymap_table_t *table = table_load(path);
+    if (!table) {
+        return -1;
+    }
+    atomic_store_explicit(&km->table, table, memory_order_release);
+    return 0;
+}
+
+/* Add what the keys in a set are remapped to */
+int keymap_add_outputs(const keymap_t *km, keyset_t *keys) {
+    if (!km || !keys) {
+        fprintf(stderr, "keymap_add_outputs: Invalid arguments\n");
+        return -1;
+    }
+
+    const keymap_table_t *table = atomic_load_explicit(&km->table, memory_order_acquire);
+    const keyset_t in = *keys;
+    for (int code = 0; code < table->key_count; code++) {
+        if (keyset_test(&in, code) && table->map[code] != KEYMAP_DROP) {
+            keyset_set(keys, table->map[code]);
+        }
+    }
+    return 0;
+}
+
+/* Install the filter stage */
+int keymap_attach(keymap_t *km, vkbd_context_t *ctx) {
+    if (!km || !ctx) {
+        fprintf(stderr, "keymap_attach: Invalid arguments\n");
+        return -1;
+    }
+
+    km->filter_id = vkbd_register_filter(ctx, keymap_filter, km);
+    if (km->filter_id < 0) {
+        return -1;
+    }
+    km->vkbd_ctx = ctx;
+    return 0;
+}
+
+/* Reload and swap */
+int keymap_reload(keymap_t *km) {
+    if (!km) {
+        return -1;
+    }
+
+    keymap_table_t *table = table_load(km->path);
+    if (!table) {
+        fprintf(stderr, "keymap: Keeping previous table\n");
+        return -1;
+    }
+
+    /* The filter runs on this (listener) thread, so the old table is idle */
+    keymap_table_t *old = atomic_exchange_explicit(&km->table, table, memory_order_acq_rel);
+    free(old);
+    km->reloads++;
+
+    printf("Keymap reloaded: %s\n", km->path);
+    return 0;
+}
+
+/* inotify source: reload when our file is rewritten or replaced */
+static void keymap_inotify_handler(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)listener;
+    (void)events;
+    keymap_t *km = user_data;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    char path[sizeof(km->path)];
+    strncpy(path, km->path, sizeof(path));
+    const char *file = basename(path);
+
+    ssize_t len;
+    while ((len = read(km->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ie = (const struct inotify_event *)p;
+            if (ie->len && strcmp(ie->name, file) == 0) {
+                changed = true;
+            }
+            p += sizeof(*ie) + ie->len;
+        }
+    }
+
+    if (changed) {
+        keymap_reload(km);
+    }
+}
+
+/* Watch the keymap's directory (catches rename-into-place as well as rewrites) */
+int keymap_watch(keymap_t *km, event_listener_t *listener) {
+    if (!km || !listener) {
+        fprintf(stderr, "keymap_watch: Invalid arguments\n");
+        return -1;
+    }
+
+    km->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (km->inotify_fd < 0) {
+        perror("keymap_watch: inotify_init1 failed");
+        return -1;
+    }
+
+    char path[sizeof(km->path)];
+    strncpy(path, km->path, sizeof(path));
+    km->watch_fd = inotify_add_watch(km->inotify_fd, dirname(path),
+                                     IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (km->watch_fd < 0) {
+        perror("keymap_watch: inotify_add_watch failed");
+        goto fail;
+    }
+
+    if (event_listener_add_source(listener, km->inotify_fd, EPOLLIN,
+                                  keymap_inotify_handler, km) < 0) {
+        goto fail;
+    }
+    km->listener = listener;
+    return 0;
+
+fail:
+    close(km->inotify_fd);
+    km->inotify_fd = -1;
+    km->watch_fd = -1;
+    return -1;
+}
+
+/* Tear down */
+void keymap_destroy(keymap_t *km) {
+    if (!km) {
+        return;
+    }
+
+    if (km->vkbd_ctx && km->filter_id >= 0) {
+        vkbd_unregister_filter(km->vkbd_ctx, km->filter_id);
+        km->filter_id = -1;
+    }
+
+    if (km->inotify_fd >= 0) {
+        if (km->listener) {
+            event_listener_remove_source(km->listener, km->inotify_fd);
+        }
+        close(km->inotify_fd);
+        km->inotify_fd = -1;
+    }
+
+    free(atomic_exchange(&km->table, NULL));
+}
+
+/* Trim leading/trailing whitespace in place */
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+/* Compile text keymap to binary */
+int keymap_compile(const char *src_path, const char *out_path) {
+    if (!src_path || !out_path) {
+        fprintf(stderr, "keymap_compile: Invalid arguments\n");
+        return -1;
+    }
+
+    FILE *in = fopen(src_path, "r");
+    if (!in) {
+        fprintf(stderr, "keymap_compile: Failed to open %s: %s\n", src_path, strerror(errno));
+        return -1;
+    }
+
+    /* Identity table: unmapped keys pass through unchanged */
+    uint16_t map[KEY_CNT];
+    for (int i = 0; i < KEY_CNT; i++) {
+        map[i] = i;
+    }
+
+    char line[512];
+    int lineno = 0, rules = 0, errors = 0;
+    while (fgets(line, sizeof(line), in)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *rule = trim(line);
+        if (!*rule) {
+            continue;
+        }
+
+        char *eq = strchr(rule, '=');
+        if (!eq) {
+            fprintf(stderr, "%s:%d: expected 'FROM = TO'\n", src_path, lineno);
+            errors++;
+            continue;
+        }
+        *eq = '\0';
+        char *from_name = trim(rule);
+        char *to_name = trim(eq + 1);
+
+        int from = keymap_key_code(from_name);
+        int to = strcasecmp(to_name, "none") == 0 ? KEYMAP_DROP : keymap_key_code(to_name);
+        if (from <= 0) {
+            fprintf(stderr, "%s:%d: unknown key '%s'\n", src_path, lineno, from_name);
+            errors++;
+            continue;
+        }
+        if (to < 0) {
+            fprintf(stderr, "%s:%d: unknown key '%s'\n", src_path, lineno, to_name);
+            errors++;
+            continue;
+        }
+        map[from] = to;
+        rules++;
+    }
+    fclose(in);
+
+    if (errors) {
+        fprintf(stderr, "keymap_compile: %d error(s), nothing written\n", errors);
+        return -1;
+    }
+
+    /* Write next to the target and rename, so watchers only see whole files */
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", out_path, (int)getpid());
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out) {
+        fprintf(stderr, "keymap_compile: Failed to create %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    keymap_header_t hdr = {
+        .magic = KEYMAP_MAGIC,
+        .version = KEYMAP_VERSION,
+        .key_count = KEY_CNT,
+        .reserved = 0,
+    };
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1 &&
+              fwrite(map, sizeof(map), 1, out) == 1;
+    ok = (fclose(out) == 0) && ok;
+
+    if (!ok || rename(tmp_path, out_path) < 0) {
+        fprintf(stderr, "keymap_compile: Failed to write %s: %s\n", out_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return rules;
+}
@@ -0,0 +1,148 @@
+/**
+ * Compiled Keymap Module
+ *
+ * Flat key-code lookup tables compiled from a text file by vkbd-compile,
+ * loaded by the daemon and hot-reloaded through inotify in the listener loop
+ *
+ * Text format (one rule per line, '#' starts a comment):
+ *   CAPSLOCK = ESC          # names with or without the KEY_ prefix
+ *   KEY_RIGHTALT = KEY_RIGHTCTRL
+ *   F13 = none              # drop the key
+ *   183 = 58                # numeric codes
+ */
+
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "vkbd.h"
+#include "event_listener.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Binary file identification */
+#define KEYMAP_MAGIC   0x504d4b56  /* "VKMP" little-endian */
+#define KEYMAP_VERSION 1
+
+/* Table entry that drops the key (KEY_RESERVED is never forwarded) */
+#define KEYMAP_DROP KEY_RESERVED
+
+/* Binary file header - followed by uint16_t map[key_count] */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t key_count;  /* Number of table entries (KEY_CNT when compiled) */
+    uint32_t reserved;
+} keymap_header_t;
+
+/* Loaded table - a private copy, the file can be rewritten while it is in use */
+typedef struct {
+    uint16_t key_count;
+    uint16_t map[KEY_CNT];  /* map[code] = output code, KEYMAP_DROP to drop */
+} keymap_table_t;
+
+/* Keymap context */
+typedef struct {
+    _Atomic(keymap_table_t *) table;  /* Current table, swapped on reload */
+    keyset_t held;                    /* Source keys down (filter thread) */
+    uint16_t held_as[KEY_CNT];        /* What each of them was pressed as */
+    char path[256];
+    int inotify_fd;
+    int watch_fd;
+    int filter_id;
+    vkbd_context_t *vkbd_ctx;
+    event_listener_t *listener;
+    unsigned long reloads;
+} keymap_t;
+
+/**
+ * Load a compiled keymap
+ *
+ * @param km Pointer to keymap_t structure
+ * @param path Path to compiled keymap (vkbd-compile output)
+ * @return 0 on success, -1 on error
+ */
+int keymap_init(keymap_t *km, const char *path);
+
+/**
+ * Add the output codes of the keys in a set (for vkbd_init_keys)
+ *
+ * Only the current table counts: keys a reloaded keymap starts to produce
+ * are not advertised until the virtual device is created again.
+ *
+ * @param km Pointer to keymap_t structure
+ * @param keys Source key codes, the codes they map to are added
+ * @return 0 on success, -1 on error
+ */
+int keymap_add_outputs(const keymap_t *km, keyset_t *keys);
+
+/**
+ * Install the keymap as a filter stage on a virtual keyboard
+ *
+ * @param km Pointer to keymap_t structure
+ * @param ctx Pointer to vkbd_context_t structure
+ * @return 0 on success, -1 on error
+ */
+int keymap_attach(keymap_t *km, vkbd_context_t *ctx);
+
+/**
+ * Watch the keymap file with inotify inside the listener's epoll set
+ *
+ * The file is reloaded and the table swapped atomically whenever it is
+ * rewritten or replaced (e.g., by vkbd-compile). Reload runs on the
+ * listener thread - the same thread that runs the filter. The table is
+ * read into memory, so the file may be written in place as well as renamed.
+ *
+ * @param km Pointer to keymap_t structure
+ * @param listener Pointer to event_listener_t structure
+ * @return 0 on success, -1 on error
+ */
+int keymap_watch(keymap_t *km, event_listener_t *listener);
+
+/**
+ * Reload the keymap file now
+ *
+ * Frees the previous table right away, so call it on the thread that runs
+ * the filter (the listener thread) or while no events are processed. Keys
+ * held across a reload are released as what they were pressed as.
+ *
+ * @param km Pointer to keymap_t structure
+ * @return 0 on success, -1 on error (the previous table stays active)
+ */
+int keymap_reload(keymap_t *km);
+
+/**
+ * Detach, stop watching and free the table
+ *
+ * @param km Pointer to keymap_t structure
+ */
+void keymap_destroy(keymap_t *km);
+
+/**
+ * Compile a text keymap into the binary format
+ *
+ * The output is written to a temporary file and renamed into place, so a
+ * watching daemon never sees a partial table.
+ *
+ * @param src_path Text keymap
+ * @param out_path Binary keymap to write
+ * @return Number of rules compiled, -1 on error
+ */
+int keymap_compile(const char *src_path, const char *out_path);
+
+/**
+ * Look up a key code by name ("ESC", "KEY_ESC", "esc", "BTN_LEFT" or "1")
+ *
+ * @param name Key name or decimal/hex code
+ * @return Key code, -1 if unknown
+ */
+int keymap_key_code(const char *name);
+
+/**
+ * Look up a key name by code
+ *
+ * @param code Key code
+ * @return Name (e.g., "KEY_ESC"), NULL if unknown
+ */
+const char *keymap_key_name(uint16_t code);
+
+#endif /* KEYMAP_H */
@@ -0,0 +1,65 @@
+/**
+ * Key Set - Fixed-size bitset over all key codes (KEY_CNT bits)
+ *
+ * Header-only; shared by the engines that track pressed keys
+ */
+
+#ifndef KEYSET_H
+#define KEYSET_H
+
+#include <linux/input.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Number of 64-bit words covering KEY_CNT codes */
+#define KEYSET_WORDS ((KEY_CNT + 63) / 64)
+
+/* Key set structure */
+typedef struct {
+    uint64_t w[KEYSET_WORDS];
+} keyset_t;
+
+static inline void keyset_clear_all(keyset_t *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+static inline void keyset_set(keyset_t *set, uint16_t code) {
+    set->w[code >> 6] |= 1ULL << (code & 63);
+}
+
+static inline void keyset_clear(keyset_t *set, uint16_t code) {
+    set->w[code >> 6] &= ~(1ULL << (code & 63));
+}
+
+static inline bool keyset_test(const keyset_t *set, uint16_t code) {
+    return (set->w[code >> 6] >> (code & 63)) & 1;
+}
+
+/* true if every key in sub is also in set (word-wide, vectorizable) */
+static inline bool keyset_contains(const keyset_t *set, const keyset_t *sub) {
+    uint64_t missing = 0;
+    for (int i = 0; i < KEYSET_WORDS; i++) {
+        missing |= sub->w[i] & ~set->w[i];
+    }
+    return missing == 0;
+}
+
+/* true if both sets hold exactly the same keys */
+static inline bool keyset_equal(const keyset_t *a, const keyset_t *b) {
+    uint64_t diff = 0;
+    for (int i = 0; i < KEYSET_WORDS; i++) {
+        diff |= a->w[i] ^ b->w[i];
+    }
+    return diff == 0;
+}
+
+static inline bool keyset_empty(const keyset_t *set) {
+    uint64_t any = 0;
+    for (int i = 0; i < KEYSET_WORDS; i++) {
+        any |= set->w[i];
+    }
+    return any == 0;
+}
+
+#endif /* KEYSET_H */
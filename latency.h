@@ -0,0 +1,88 @@
+/**
+ * Latency Histogram - log2-bucketed nanosecond samples
+ *
+ * Header-only. One thread records (the one that flushes output), any thread
+ * may read: every counter has a single writer and is accessed with relaxed
+ * atomics, so the hot path never takes a lock or an atomic read-modify-write.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "counter.h"
+
+/* Bucket i counts samples below 2^i ns (and at least 2^(i-1)); the last one is open-ended */
+#define LATENCY_BUCKETS 40
+
+/* Histogram structure */
+typedef struct {
+    counter_t count;
+    counter_t total_ns;
+    counter_t max_ns;
+    counter_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+static inline void latency_reset(latency_hist_t *h) {
+    atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->total_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->max_ns, 0, memory_order_relaxed);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        atomic_store_explicit(&h->buckets[i], 0, memory_order_relaxed);
+    }
+}
+
+static inline void latency_record(latency_hist_t *h, uint64_t ns) {
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+
+    counter_add(&h->buckets[bucket], 1);
+    counter_add(&h->count, 1);
+    counter_add(&h->total_ns, ns);
+    if (ns > atomic_load_explicit(&h->max_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+    }
+}
+
+/* Copy for reporting (each counter is read once; the copy is not atomic as a whole) */
+static inline void latency_snapshot(latency_hist_t *dst, const latency_hist_t *src) {
+    atomic_store_explicit(&dst->count, atomic_load_explicit(&src->count, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(&dst->total_ns, atomic_load_explicit(&src->total_ns, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(&dst->max_ns, atomic_load_explicit(&src->max_ns, memory_order_relaxed),
+                          memory_order_relaxed);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        atomic_store_explicit(&dst->buckets[i],
+                              atomic_load_explicit(&src->buckets[i], memory_order_relaxed),
+                              memory_order_relaxed);
+    }
+}
+
+/* Upper bound of the bucket holding the pct-th percentile (capped at the max) */
+static inline uint64_t latency_percentile(const latency_hist_t *h, double pct) {
+    uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(pct / 100.0 * count);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        if (seen > rank) {
+            uint64_t bound = 1ULL << i;
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+static inline uint64_t latency_mean(const latency_hist_t *h) {
+    uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    return count ? atomic_load_explicit(&h->total_ns, memory_order_relaxed) / count : 0;
+}
+
+#endif /* LATENCY_H */
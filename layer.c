@@ -0,0 +1,197 @@
+/**
+ * Layer Engine - Implementation
+ */
+
+#include "layer.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Resolve one key through the active stack, top layer first */
+static uint16_t resolve_key(const layer_engine_t *engine, uint16_t code) {
+    for (int i = engine->depth - 1; i >= 0; i--) {
+        uint16_t action = engine->map[engine->stack[i]][code];
+        if (action != LAYER_TRANSPARENT) {
+            return action;
+        }
+    }
+    return code;
+}
+
+/* Refold the resolved table - only on layer changes, never per key */
+static void rebuild(layer_engine_t *engine) {
+    for (int k = 0; k < KEY_CNT; k++) {
+        engine->resolved[k] = resolve_key(engine, k);
+    }
+}
+
+/* Recompute the stack membership of one layer */
+static void update_layer(layer_engine_t *engine, int layer) {
+    bool want = engine->momentary[layer] > 0 || engine->toggled[layer];
+    int pos = -1;
+    for (int i = 1; i < engine->depth; i++) {
+        if (engine->stack[i] == layer) {
+            pos = i;
+            break;
+        }
+    }
+
+    if (want && pos < 0) {
+        /* Newly active layers go on top */
+        engine->stack[engine->depth++] = layer;
+    } else if (!want && pos >= 0) {
+        memmove(&engine->stack[pos], &engine->stack[pos + 1], engine->depth - pos - 1);
+        engine->depth--;
+    } else {
+        return;
+    }
+    rebuild(engine);
+}
+
+/* Initialize layer engine */
+void layer_engine_init(layer_engine_t *engine) {
+    if (!engine) {
+        return;
+    }
+
+    memset(engine, 0, sizeof(*engine));
+    for (int k = 0; k < KEY_CNT; k++) {
+        engine->map[0][k] = k;
+        for (int l = 1; l < LAYER_MAX; l++) {
+            engine->map[l][k] = LAYER_TRANSPARENT;
+        }
+    }
+    engine->stack[0] = 0;
+    engine->depth = 1;
+    engine->filter_id = -1;
+    rebuild(engine);
+}
+
+/* Set the action for a key on a layer */
+int layer_set_key(layer_engine_t *engine, int layer, uint16_t key_code, uint16_t action) {
+    if (!engine || layer < 0 || layer >= LAYER_MAX || key_code >= KEY_CNT) {
+        fprintf(stderr, "layer_set_key: Invalid arguments\n");
+        return -1;
+    }
+
+    bool layer_action = LAYER_IS_MO(action) || LAYER_IS_TG(action);
+    if (layer_action ? (LAYER_ARG(action) == 0 || LAYER_ARG(action) >= LAYER_MAX)
+                     : (action >= KEY_CNT && action != LAYER_TRANSPARENT)) {
+        fprintf(stderr, "layer_set_key: Invalid action 0x%04x\n", action);
+        return -1;
+    }
+    if (layer == 0 && action == LAYER_TRANSPARENT) {
+        action = key_code;  /* Nothing below the base layer */
+    }
+
+    engine->map[layer][key_code] = action;
+    engine->resolved[key_code] = resolve_key(engine, key_code);
+    return 0;
+}
+
+/* Activate / deactivate a layer */
+int layer_set_active(layer_engine_t *engine, int layer, bool on) {
+    if (!engine || layer <= 0 || layer >= LAYER_MAX) {
+        fprintf(stderr, "layer_set_active: Invalid layer\n");
+        return -1;
+    }
+
+    engine->toggled[layer] = on;
+    update_layer(engine, layer);
+    return 0;
+}
+
+/* Check if a layer is active */
+bool layer_is_active(const layer_engine_t *engine, int layer) {
+    if (!engine || layer < 0 || layer >= LAYER_MAX) {
+        return false;
+    }
+    for (int i = 0; i < engine->depth; i++) {
+        if (engine->stack[i] == layer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Filter stage: O(1) resolution per key */
+static vkbd_verdict_t layer_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)ctx;
+    layer_engine_t *engine = user_data;
+    const uint16_t code = ev->code;
+
+    if (__builtin_expect(code >= KEY_CNT, 0)) {
+        return VKBD_FILTER_PASS;
+    }
+
+    /* Pressed again while down (two keyboards, a replayed press): a repeat of
+     * what it is held as - one release must undo it */
+    if (ev->value == 1 && keyset_test(&engine->pressed, code)) {
+        ev->value = 2;
+    }
+
+    uint16_t action;
+    if (ev->value == 1) {
+        /* Press: resolve through the active layers and remember the result */
+        action = engine->resolved[code];
+        engine->held_as[code] = action;
+        keyset_set(&engine->pressed, code);
+
+        if (LAYER_IS_MO(action)) {
+            engine->momentary[LAYER_ARG(action)]++;
+            update_layer(engine, LAYER_ARG(action));
+            return VKBD_FILTER_DROP;
+        }
+        if (LAYER_IS_TG(action)) {
+            engine->toggled[LAYER_ARG(action)] = !engine->toggled[LAYER_ARG(action)];
+            update_layer(engine, LAYER_ARG(action));
+            return VKBD_FILTER_DROP;
+        }
+    } else {
+        /* Repeat / release: act as whatever the key was pressed as */
+        if (!keyset_test(&engine->pressed, code)) {
+            return VKBD_FILTER_DROP;  /* Pressed before we were attached */
+        }
+        action = engine->held_as[code];
+
+        if (ev->value == 0) {
+            keyset_clear(&engine->pressed, code);
+            if (LAYER_IS_MO(action)) {
+                engine->momentary[LAYER_ARG(action)]--;
+                update_layer(engine, LAYER_ARG(action));
+            }
+        }
+        if (LAYER_IS_MO(action) || LAYER_IS_TG(action)) {
+            return VKBD_FILTER_DROP;
+        }
+    }
+
+    if (action == LAYER_NONE) {
+        return VKBD_FILTER_DROP;
+    }
+    ev->code = action;
+    return VKBD_FILTER_PASS;
+}
+
+/* Install the filter stage */
+int layer_engine_attach(layer_engine_t *engine, vkbd_context_t *ctx) {
+    if (!engine || !ctx) {
+        fprintf(stderr, "layer_engine_attach: Invalid arguments\n");
+        return -1;
+    }
+
+    engine->filter_id = vkbd_register_filter(ctx, layer_filter, engine);
+    if (engine->filter_id < 0) {
+        return -1;
+    }
+    engine->vkbd_ctx = ctx;
+    return 0;
+}
+
+/* Remove the filter stage */
+void layer_engine_detach(layer_engine_t *engine) {
+    if (engine && engine->vkbd_ctx && engine->filter_id >= 0) {
+        vkbd_unregister_filter(engine->vkbd_ctx, engine->filter_id);
+        engine->filter_id = -1;
+        engine->vkbd_ctx = NULL;
+    }
+}
@@ -0,0 +1,100 @@
+/**
+ * Layer Engine
+ *
+ * QMK-style layers (Fn, nav, gaming, ...) on ordinary keyboards.
+ * Each layer is a dense table indexed by key code; the active layers are
+ * folded into one resolved table whenever they change, so each key costs
+ * a single indexed load. Keys are released as whatever they were pressed
+ * as, so switching layers never leaves a key stuck.
+ */
+
+#ifndef LAYER_H
+#define LAYER_H
+
+#include "vkbd.h"
+#include "keyset.h"
+#include <stdint.h>
+
+/* Maximum number of layers (layer 0 is the always-active base layer) */
+#define LAYER_MAX 8
+
+/* Layer table actions - plain key codes (< KEY_CNT) or one of these */
+#define LAYER_TRANSPARENT 0xFFFF              /* Use the next active layer below */
+#define LAYER_NONE        KEY_RESERVED        /* Swallow the key */
+#define LAYER_MO(n)       (0xF000 | (n))      /* Layer n active while held */
+#define LAYER_TG(n)       (0xF100 | (n))      /* Toggle layer n on press */
+
+#define LAYER_IS_MO(a)    (((a) & 0xFF00) == 0xF000)
+#define LAYER_IS_TG(a)    (((a) & 0xFF00) == 0xF100)
+#define LAYER_ARG(a)      ((a) & 0x00FF)
+
+/* Layer engine structure */
+typedef struct {
+    uint16_t map[LAYER_MAX][KEY_CNT];  /* Per-layer action tables */
+    uint16_t resolved[KEY_CNT];        /* Active layers folded top-down */
+    uint16_t held_as[KEY_CNT];         /* Action each pressed key resolved to */
+    keyset_t pressed;                  /* Physically pressed keys */
+    uint8_t stack[LAYER_MAX];          /* Active layers, bottom (0) to top */
+    int depth;
+    uint8_t momentary[LAYER_MAX];      /* Held LAYER_MO keys per layer */
+    bool toggled[LAYER_MAX];           /* LAYER_TG state per layer */
+    int filter_id;
+    vkbd_context_t *vkbd_ctx;
+} layer_engine_t;
+
+/**
+ * Initialize layer engine
+ *
+ * Layer 0 maps every key to itself, all other layers are transparent.
+ *
+ * @param engine Pointer to layer_engine_t structure
+ */
+void layer_engine_init(layer_engine_t *engine);
+
+/**
+ * Set the action for a key on a layer
+ *
+ * @param engine Pointer to layer_engine_t structure
+ * @param layer Layer index (0 to LAYER_MAX-1)
+ * @param key_code Physical key code
+ * @param action Key code, LAYER_NONE, LAYER_TRANSPARENT, LAYER_MO(n) or LAYER_TG(n)
+ * @return 0 on success, -1 on error
+ */
+int layer_set_key(layer_engine_t *engine, int layer, uint16_t key_code, uint16_t action);
+
+/**
+ * Activate / deactivate a layer programmatically (like a toggle)
+ *
+ * @param engine Pointer to layer_engine_t structure
+ * @param layer Layer index (1 to LAYER_MAX-1)
+ * @param on true to activate
+ * @return 0 on success, -1 on error
+ */
+int layer_set_active(layer_engine_t *engine, int layer, bool on);
+
+/**
+ * Check if a layer is currently active
+ *
+ * @param engine Pointer to layer_engine_t structure
+ * @param layer Layer index
+ * @return true if active
+ */
+bool layer_is_active(const layer_engine_t *engine, int layer);
+
+/**
+ * Install the engine as a filter stage
+ *
+ * @param engine Pointer to layer_engine_t structure
+ * @param ctx Pointer to vkbd_context_t structure
+ * @return 0 on success, -1 on error
+ */
+int layer_engine_attach(layer_engine_t *engine, vkbd_context_t *ctx);
+
+/**
+ * Remove the filter stage
+ *
+ * @param engine Pointer to layer_engine_t structure
+ */
+void layer_engine_detach(layer_engine_t *engine);
+
+#endif /* LAYER_H */
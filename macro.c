@@ -0,0 +1,377 @@
+/**
+ * Macro Engine - Implementation
+ */
+
+#include "macro.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+/* Stage one key and close its frame, tracking what the playback holds */
+static void emit_key(macro_engine_t *me, uint16_t code, int32_t value) {
+    vkbd_emit_key(me->vkbd_ctx, code, value);
+    if (value) {
+        keyset_set(&me->held, code);
+    } else {
+        keyset_clear(&me->held, code);
+    }
+}
+
+/* Playback over: release whatever a step left down, then the modifiers */
+static void finish(macro_engine_t *me) {
+    const macro_t *m = &me->macros[me->playing];
+    keyset_t mods;
+
+    keyset_clear_all(&mods);
+    for (int i = 0; i < m->mod_count; i++) {
+        keyset_set(&mods, m->mods[i]);
+    }
+    for (int w = 0; w < KEYSET_WORDS; w++) {
+        uint64_t keys = me->held.w[w] & ~mods.w[w];
+        while (keys) {
+            emit_key(me, w * 64 + __builtin_ctzll(keys), 0);
+            keys &= keys - 1;
+        }
+    }
+    for (int i = m->mod_count - 1; i >= 0; i--) {
+        if (keyset_test(&me->held, m->mods[i])) {
+            emit_key(me, m->mods[i], 0);
+        }
+    }
+
+    timerfd_arm_at(me->timer_fd, 0);
+    me->playing = -1;
+}
+
+/* Stage every step due by the end of the current frame, then re-arm */
+static void advance(macro_engine_t *me, uint64_t now) {
+    const macro_t *m = &me->macros[me->playing];
+    uint64_t horizon = now + me->frame_ns;
+
+    while (me->next_step < m->step_count && me->next_deadline_ns <= horizon) {
+        const macro_step_t *step = &m->steps[me->next_step++];
+        emit_key(me, step->code, step->value);
+        me->stats.steps++;
+        if (me->next_step < m->step_count) {
+            me->next_deadline_ns += (uint64_t)m->steps[me->next_step].delay_us * 1000ULL;
+        }
+    }
+
+    if (me->next_step == m->step_count) {
+        finish(me);
+    } else {
+        timerfd_arm_at(me->timer_fd, me->next_deadline_ns);
+    }
+}
+
+/* Begin a playback - everything due right away is staged with the caller's batch */
+static void start(macro_engine_t *me, int macro, uint64_t now) {
+    const macro_t *m = &me->macros[macro];
+
+    if (me->playing >= 0) {
+        finish(me);
+    }
+
+    me->playing = macro;
+    me->next_step = 0;
+    me->stats.plays++;
+    for (int i = 0; i < m->mod_count; i++) {
+        emit_key(me, m->mods[i], 1);
+    }
+    me->next_deadline_ns = now + (m->step_count ? (uint64_t)m->steps[0].delay_us * 1000ULL : 0);
+    advance(me, now);
+}
+
+static void stop(macro_engine_t *me) {
+    if (me->playing >= 0) {
+        me->stats.cancels++;
+        finish(me);
+    }
+}
+
+/* Grow a sequence by one step */
+static int append_step(macro_t *m, uint16_t code, int32_t value, uint32_t delay_us) {
+    if (m->step_count == m->step_cap) {
+        int cap = m->step_cap ? m->step_cap * 2 : 32;
+        macro_step_t *steps = realloc(m->steps, cap * sizeof(*steps));
+        if (!steps) {
+            fprintf(stderr, "macro: Out of memory\n");
+            return -1;
+        }
+        m->steps = steps;
+        m->step_cap = cap;
+    }
+
+    m->steps[m->step_count++] = (macro_step_t){ code, value, delay_us };
+    return 0;
+}
+
+/* Recording: keep presses and releases with the time since the previous one */
+static void record(macro_engine_t *me, const struct input_event *ev) {
+    uint64_t t = (uint64_t)ev->time.tv_sec * 1000000000ULL + (uint64_t)ev->time.tv_usec * 1000ULL;
+    if (t == 0) {
+        t = monotonic_ns();
+    }
+
+    uint64_t delay_us = me->last_record_ns && t > me->last_record_ns ?
+                        (t - me->last_record_ns) / 1000ULL : 0;
+    if (delay_us > UINT32_MAX) {
+        delay_us = UINT32_MAX;
+    }
+    if (append_step(&me->macros[me->recording], ev->code, ev->value, delay_us) == 0) {
+        me->last_record_ns = t;
+    }
+}
+
+/* Filter stage: hotkeys are consumed, everything else passes */
+static vkbd_verdict_t macro_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)ctx;
+    macro_engine_t *me = user_data;
+    int idx = ev->code < KEY_CNT ? me->index[ev->code] - 1 : -1;
+
+    if (__builtin_expect(idx < 0, 1)) {
+        if (__builtin_expect(me->recording >= 0, 0) && ev->value != 2) {
+            record(me, ev);
+        }
+        return VKBD_FILTER_PASS;
+    }
+
+    if (ev->value == 1) {
+        if (idx == me->recording) {
+            macro_record_stop(me);   /* The hotkey being recorded ends the recording */
+        } else {
+            start(me, idx, monotonic_ns());
+        }
+    } else if (ev->value == 0 && idx == me->playing && me->macros[idx].cancel_on_release) {
+        stop(me);
+    }
+    return VKBD_FILTER_DROP;
+}
+
+/* timerfd source: the next step is due - one write for the whole frame */
+static void macro_timer_handler(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)listener;
+    (void)events;
+    macro_engine_t *me = user_data;
+    uint64_t expirations;
+
+    if (read(me->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;  /* Disarmed or re-armed since it became readable */
+    }
+    if (me->playing < 0) {
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t late = now > me->next_deadline_ns ? now - me->next_deadline_ns : 0;
+    me->stats.frames++;
+    me->stats.total_late_ns += late;
+    if (late > me->stats.max_late_ns) {
+        me->stats.max_late_ns = late;
+    }
+
+    advance(me, now);
+    vkbd_flush(me->vkbd_ctx);
+}
+
+/* Initialize macro engine */
+void macro_init(macro_engine_t *me, int frame_us) {
+    if (!me) {
+        return;
+    }
+
+    memset(me, 0, sizeof(*me));
+    me->frame_ns = (uint64_t)(frame_us > 0 ? frame_us : MACRO_FRAME_US) * 1000ULL;
+    me->playing = -1;
+    me->recording = -1;
+    me->timer_fd = -1;
+    me->filter_id = -1;
+}
+
+/* Free sequences */
+void macro_destroy(macro_engine_t *me) {
+    if (!me) {
+        return;
+    }
+
+    for (int i = 0; i < me->macro_count; i++) {
+        free(me->macros[i].steps);
+        me->macros[i].steps = NULL;
+        me->macros[i].step_count = 0;
+        me->macros[i].step_cap = 0;
+    }
+}
+
+/* Define a macro */
+int macro_add(macro_engine_t *me, uint16_t hotkey, bool cancel_on_release) {
+    if (!me || hotkey == 0 || hotkey >= KEY_CNT) {
+        fprintf(stderr, "macro_add: Invalid arguments\n");
+        return -1;
+    }
+
+    if (me->index[hotkey]) {
+        fprintf(stderr, "macro_add: Key %d already starts a macro\n", hotkey);
+        return -1;
+    }
+
+    if (me->macro_count >= MACRO_MAX) {
+        fprintf(stderr, "macro_add: Too many macros\n");
+        return -1;
+    }
+
+    macro_t *m = &me->macros[me->macro_count];
+    memset(m, 0, sizeof(*m));
+    m->hotkey = hotkey;
+    m->cancel_on_release = cancel_on_release;
+    me->index[hotkey] = ++me->macro_count;
+    return me->macro_count - 1;
+}
+
+/* Wrap a modifier around a macro */
+int macro_add_mod(macro_engine_t *me, int macro, uint16_t mod) {
+    if (!me || macro < 0 || macro >= me->macro_count || mod == 0 || mod >= KEY_CNT) {
+        fprintf(stderr, "macro_add_mod: Invalid arguments\n");
+        return -1;
+    }
+
+    macro_t *m = &me->macros[macro];
+    if (m->mod_count >= MACRO_MAX_MODS) {
+        fprintf(stderr, "macro_add_mod: Too many modifiers\n");
+        return -1;
+    }
+
+    m->mods[m->mod_count++] = mod;
+    return 0;
+}
+
+/* Append a step */
+int macro_add_step(macro_engine_t *me, int macro, uint16_t code, int32_t value, uint32_t delay_us) {
+    if (!me || macro < 0 || macro >= me->macro_count || code == 0 || code >= KEY_CNT ||
+        (value != 0 && value != 1)) {
+        fprintf(stderr, "macro_add_step: Invalid arguments\n");
+        return -1;
+    }
+
+    if (me->playing == macro) {
+        fprintf(stderr, "macro_add_step: Macro is playing\n");
+        return -1;
+    }
+
+    return append_step(&me->macros[macro], code, value, delay_us);
+}
+
+/* Start recording */
+int macro_record_start(macro_engine_t *me, uint16_t hotkey, bool cancel_on_release) {
+    if (!me || hotkey == 0 || hotkey >= KEY_CNT) {
+        fprintf(stderr, "macro_record_start: Invalid arguments\n");
+        return -1;
+    }
+
+    int macro = me->index[hotkey] - 1;
+    if (macro < 0) {
+        macro = macro_add(me, hotkey, cancel_on_release);
+        if (macro < 0) {
+            return -1;
+        }
+    }
+    if (me->playing == macro) {
+        stop(me);
+    }
+
+    me->macros[macro].step_count = 0;
+    me->recording = macro;
+    me->last_record_ns = 0;
+    return macro;
+}
+
+/* Stop recording */
+int macro_record_stop(macro_engine_t *me) {
+    if (!me || me->recording < 0) {
+        return -1;
+    }
+
+    int steps = me->macros[me->recording].step_count;
+    me->recording = -1;
+    return steps;
+}
+
+/* Play from the API */
+int macro_play(macro_engine_t *me, int macro) {
+    if (!me || macro < 0 || macro >= me->macro_count || !me->vkbd_ctx) {
+        fprintf(stderr, "macro_play: Invalid arguments\n");
+        return -1;
+    }
+
+    start(me, macro, monotonic_ns());
+    return vkbd_flush(me->vkbd_ctx);
+}
+
+/* Cancel from the API */
+void macro_cancel(macro_engine_t *me) {
+    if (!me || !me->vkbd_ctx) {
+        return;
+    }
+
+    stop(me);
+    vkbd_flush(me->vkbd_ctx);
+}
+
+/* Install filter and timer */
+int macro_attach(macro_engine_t *me, vkbd_context_t *ctx, event_listener_t *listener) {
+    if (!me || !ctx || !listener) {
+        fprintf(stderr, "macro_attach: Invalid arguments\n");
+        return -1;
+    }
+
+    me->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (me->timer_fd < 0) {
+        perror("macro_attach: timerfd_create failed");
+        return -1;
+    }
+
+    if (event_listener_add_source(listener, me->timer_fd, EPOLLIN,
+                                  macro_timer_handler, me) < 0) {
+        goto fail;
+    }
+    me->listener = listener;
+
+    me->filter_id = vkbd_register_filter(ctx, macro_filter, me);
+    if (me->filter_id < 0) {
+        event_listener_remove_source(listener, me->timer_fd);
+        me->listener = NULL;
+        goto fail;
+    }
+    me->vkbd_ctx = ctx;
+    return 0;
+
+fail:
+    close(me->timer_fd);
+    me->timer_fd = -1;
+    return -1;
+}
+
+/* Remove filter and timer */
+void macro_detach(macro_engine_t *me) {
+    if (!me) {
+        return;
+    }
+
+    if (me->vkbd_ctx && me->filter_id >= 0) {
+        macro_cancel(me);
+        vkbd_unregister_filter(me->vkbd_ctx, me->filter_id);
+        me->filter_id = -1;
+    }
+    if (me->timer_fd >= 0) {
+        if (me->listener) {
+            event_listener_remove_source(me->listener, me->timer_fd);
+            me->listener = NULL;
+        }
+        close(me->timer_fd);
+        me->timer_fd = -1;
+    }
+}
@@ -0,0 +1,186 @@
+/**
+ * Macro Engine
+ *
+ * Key sequences played back on a hotkey, with per-step delays and optional
+ * modifiers held around the whole sequence. Step deadlines are absolute
+ * CLOCK_MONOTONIC times on a timerfd in the listener's epoll set, so delays
+ * do not drift, and every step due within the same frame is staged and
+ * written with one write() and one timestamp. Sequences can also be
+ * recorded from the keys passing through.
+ *
+ * Its output is staged with vkbd_emit() - see there for filter order.
+ */
+
+#ifndef MACRO_H
+#define MACRO_H
+
+#include "vkbd.h"
+#include "event_listener.h"
+#include "keyset.h"
+#include <stdint.h>
+
+/* Maximum number of macros */
+#define MACRO_MAX 32
+
+/* Modifiers wrapped around one macro */
+#define MACRO_MAX_MODS 4
+
+/* Default frame: steps due within 1 ms of each other go out together */
+#define MACRO_FRAME_US 1000
+
+/* One step of a sequence */
+typedef struct {
+    uint16_t code;
+    int32_t value;      /* 1 press, 0 release */
+    uint32_t delay_us;  /* Wait after the previous step (after the start for the first) */
+} macro_step_t;
+
+/* Macro definition */
+typedef struct {
+    uint16_t hotkey;
+    bool cancel_on_release;           /* Stop when the hotkey is let go early */
+    uint16_t mods[MACRO_MAX_MODS];    /* Pressed before the first step, released after the last */
+    int mod_count;
+    macro_step_t *steps;
+    int step_count;
+    int step_cap;
+} macro_t;
+
+/* Playback statistics */
+typedef struct {
+    unsigned long plays;
+    unsigned long cancels;
+    unsigned long steps;              /* Steps emitted */
+    unsigned long frames;             /* Batches written from the timer */
+    uint64_t max_late_ns;             /* Worst deadline -> emitted */
+    uint64_t total_late_ns;           /* Summed over timer frames */
+} macro_stats_t;
+
+/* Macro engine structure */
+typedef struct {
+    macro_t macros[MACRO_MAX];
+    int macro_count;
+    uint8_t index[KEY_CNT];           /* hotkey -> macros[] index + 1, 0 = not a hotkey */
+    uint64_t frame_ns;
+
+    int playing;                      /* macros[] index being played, -1 if none */
+    int next_step;
+    uint64_t next_deadline_ns;
+    keyset_t held;                    /* Keys the playback has down (modifiers included) */
+
+    int recording;                    /* macros[] index being recorded, -1 if none */
+    uint64_t last_record_ns;
+
+    int timer_fd;
+    int filter_id;
+    vkbd_context_t *vkbd_ctx;
+    event_listener_t *listener;
+    macro_stats_t stats;
+} macro_engine_t;
+
+/**
+ * Initialize macro engine
+ *
+ * @param me Pointer to macro_engine_t structure
+ * @param frame_us Steps due within this many microseconds are written together (<= 0: MACRO_FRAME_US)
+ */
+void macro_init(macro_engine_t *me, int frame_us);
+
+/**
+ * Free every sequence (detach first)
+ *
+ * @param me Pointer to macro_engine_t structure
+ */
+void macro_destroy(macro_engine_t *me);
+
+/**
+ * Define a macro on a hotkey
+ *
+ * The hotkey itself is never forwarded. Pressing it (again) restarts the
+ * playback; only one macro plays at a time.
+ *
+ * @param me Pointer to macro_engine_t structure
+ * @param hotkey Key code that starts it
+ * @param cancel_on_release Stop playback when the hotkey is released
+ * @return Macro index on success, -1 on error
+ */
+int macro_add(macro_engine_t *me, uint16_t hotkey, bool cancel_on_release);
+
+/**
+ * Hold a modifier around the whole sequence
+ *
+ * @param me Pointer to macro_engine_t structure
+ * @param macro Index returned by macro_add
+ * @param mod Modifier key code (e.g., KEY_LEFTCTRL)
+ * @return 0 on success, -1 on error
+ */
+int macro_add_mod(macro_engine_t *me, int macro, uint16_t mod);
+
+/**
+ * Append a step
+ *
+ * @param me Pointer to macro_engine_t structure
+ * @param macro Index returned by macro_add
+ * @param code Key code
+ * @param value 1 press, 0 release
+ * @param delay_us Delay after the previous step in microseconds
+ * @return 0 on success, -1 on error
+ */
+int macro_add_step(macro_engine_t *me, int macro, uint16_t code, int32_t value, uint32_t delay_us);
+
+/**
+ * Start recording a hotkey's sequence from the keys passing through
+ *
+ * Keys keep being forwarded; the delays between them are recorded from
+ * their kernel timestamps. Any previous sequence of the hotkey is replaced.
+ * Pressing the hotkey itself stops the recording.
+ *
+ * @param me Pointer to macro_engine_t structure
+ * @param hotkey Key code the recording is played back on
+ * @param cancel_on_release For a new macro, as in macro_add
+ * @return Macro index on success, -1 on error
+ */
+int macro_record_start(macro_engine_t *me, uint16_t hotkey, bool cancel_on_release);
+
+/**
+ * Stop recording
+ *
+ * @param me Pointer to macro_engine_t structure
+ * @return Number of steps recorded, -1 if not recording
+ */
+int macro_record_stop(macro_engine_t *me);
+
+/**
+ * Start playing a macro as if its hotkey was pressed (listener thread)
+ *
+ * @param me Pointer to macro_engine_t structure
+ * @param macro Index returned by macro_add
+ * @return 0 on success, -1 on error
+ */
+int macro_play(macro_engine_t *me, int macro);
+
+/**
+ * Stop playback, releasing every key it still holds (listener thread)
+ *
+ * @param me Pointer to macro_engine_t structure
+ */
+void macro_cancel(macro_engine_t *me);
+
+/**
+ * Install as a filter stage and register the step timer with the listener
+ *
+ * @param me Pointer to macro_engine_t structure
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param listener Listener whose epoll set receives the timerfd
+ * @return 0 on success, -1 on error
+ */
+int macro_attach(macro_engine_t *me, vkbd_context_t *ctx, event_listener_t *listener);
+
+/**
+ * Remove the filter stage and close the timer
+ *
+ * @param me Pointer to macro_engine_t structure
+ */
+void macro_detach(macro_engine_t *me);
+
+#endif /* MACRO_H */
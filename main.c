@@ -7,45 +7,55 @@
 
 #include "vkbd.h"
 #include "event_listener.h"
+#include "keymap.h"
+#include "metrics.h"
+#include "capture.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <linux/input-event-codes.h>
 
 /* Global variables for signal handling */
 static vkbd_context_t *g_vkbd_ctx = NULL;
-static event_listener_t *g_listener = NULL;
+static event_listener_t *volatile g_listener = NULL;  /* Set once the listener is initialized */
+static volatile sig_atomic_t g_stop_requested = 0;     /* Signal before that */
 
-/* Signal handler for clean shutdown */
+/* Signal handler for clean shutdown (async-signal-safe: write + eventfd wakeup) */
 void signal_handler(int sig) {
-    printf("\nReceived signal %d, shutting down...\n", sig);
+    (void)sig;
+    static const char msg[] = "\nReceived signal, shutting down...\n";
+    if (write(STDOUT_FILENO, msg, sizeof(msg) - 1) < 0) {
+        /* Nothing useful to do in a signal handler */
+    }
     
+    g_stop_requested = 1;
     if (g_listener) {
         event_listener_stop(g_listener);
     }
 }
 
-/* Example callback: Print key events */
-void key_logger_callback(uint16_t key_code, int32_t value, void *user_data) {
+/* Example observer: Print forwarded key events (off the forwarding path) */
+void key_logger_observer(const struct input_event *ev, void *user_data) {
     (void)user_data; /* Unused */
     const char *action = NULL;
     
-    switch (value) {
+    switch (ev->value) {
         case 0: action = "RELEASE"; break;
         case 1: action = "PRESS  "; break;
         case 2: action = "REPEAT "; break;
         default: action = "UNKNOWN"; break;
     }
     
-    printf("[KEY] %s: code=%d\n", action, key_code);
+    printf("[KEY] %s: code=%d\n", action, ev->code);
 }
 
-/* Example callback: Play sound on keypress (placeholder) */
-void key_sound_callback(uint16_t key_code, int32_t value, void *user_data) {
+/* Example observer: Play sound on keypress (placeholder) */
+void key_sound_observer(const struct input_event *ev, void *user_data) {
     (void)user_data; /* Unused */
     /* Only on key press (not release or repeat) */
-    if (value == 1) {
+    if (ev->value == 1) {
         /* TODO: Add actual sound playback here
          * This is where you would integrate with a sound library
          * like ALSA, PulseAudio, or SDL_mixer
@@ -55,7 +65,7 @@ void key_sound_callback(uint16_t key_code, int32_t value, void *user_data) {
          */
         
         /* For demonstration, just print */
-        printf("[SOUND] Playing key sound for key %d\n", key_code);
+        printf("[SOUND] Playing key sound for key %d\n", ev->code);
     }
 }
 
@@ -72,16 +82,115 @@ void key_mapper_callback(uint16_t key_code, int32_t value, void *user_data) {
     }
 }
 
+/* --per-source: a virtual keyboard for each source, with that source's keys */
+static vkbd_context_t *create_source_output(const input_device_t *dev, void *user_data) {
+    (void)user_data;
+    char name[UINPUT_MAX_NAME_SIZE];
+    vkbd_context_t *out = malloc(sizeof(*out));
+    if (!out) {
+        return NULL;
+    }
+
+    snprintf(name, sizeof(name), "vkbd: %.60s", dev->name);
+    if (vkbd_init_keys(out, name, NULL, &dev->info.keys) < 0) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static void destroy_source_output(vkbd_context_t *out, void *user_data) {
+    (void)user_data;
+    vkbd_destroy(out);
+    free(out);
+}
+
+static const listener_output_ops_t source_outputs = {
+    .create = create_source_output,
+    .destroy = destroy_source_output,
+};
+
 int main(int argc, char *argv[]) {
-    (void)argc; /* Unused */
-    (void)argv; /* Unused */
     int ret = 0;
     vkbd_context_t vkbd_ctx;
     event_listener_t listener;
+    bool listener_ready = false;
+    keymap_t keymap;
+    const char *keymap_path = NULL;
+    rt_config_t rt;
+    bool rt_enabled = false;
+    bool pipelined = false;
+    bool uring = false;
+    bool metrics_enabled = true;
+    bool all_keys = false;
+    keyset_t keys;
+    listener_match_t matches[MAX_LISTENER_MATCHES];
+    int match_count = 0;
+    listener_match_t routes[MAX_LISTENER_ROUTES];
+    vkbd_context_t *route_outs[MAX_LISTENER_ROUTES] = { NULL };
+    int route_count = 0;
+    bool per_source = false;
+    const char *capture_path = NULL;
+    const char *replay_path = NULL;
+    double replay_speed = 1.0;
+    capture_t capture;
+    metrics_t metrics;
+
+    /* Parse options */
+    rt_config_default(&rt);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--keymap") == 0 && i + 1 < argc) {
+            keymap_path = argv[++i];
+        } else if (strcmp(argv[i], "--rt") == 0 && i + 1 < argc) {
+            rt.priority = atoi(argv[++i]);
+            rt_enabled = true;
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            rt.cpu = atoi(argv[++i]);
+            rt_enabled = true;
+        } else if (strcmp(argv[i], "--pipelined") == 0) {
+            pipelined = true;
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc &&
+                   (strcmp(argv[i + 1], "epoll") == 0 || strcmp(argv[i + 1], "uring") == 0)) {
+            uring = strcmp(argv[++i], "uring") == 0;
+        } else if (strcmp(argv[i], "--no-metrics") == 0) {
+            metrics_enabled = false;
+        } else if (strcmp(argv[i], "--all-keys") == 0) {
+            all_keys = true;
+        } else if (strcmp(argv[i], "--match") == 0 && i + 1 < argc &&
+                   match_count < MAX_LISTENER_MATCHES) {
+            if (listener_match_parse(argv[++i], &matches[match_count]) < 0) {
+                return 1;
+            }
+            match_count++;
+        } else if (strcmp(argv[i], "--route") == 0 && i + 1 < argc &&
+                   route_count < MAX_LISTENER_ROUTES) {
+            if (listener_match_parse(argv[++i], &routes[route_count]) < 0) {
+                return 1;
+            }
+            route_count++;
+        } else if (strcmp(argv[i], "--per-source") == 0) {
+            per_source = true;
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            replay_speed = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--keymap compiled.bin] [--rt PRIORITY] [--cpu N] "
+                    "[--pipelined | --engine epoll|uring] [--no-metrics] [--all-keys] "
+                    "[--match VVVV:PPPP,phys=PATTERN,name=PATTERN]... [--route RULE]... "
+                    "[--per-source] [--capture FILE] [--replay FILE [--speed X]]\n", argv[0]);
+            return 1;
+        }
+    }
+    memset(&keymap, 0, sizeof(keymap));
+    keymap.inotify_fd = -1;
+    memset(&capture, 0, sizeof(capture));
+    metrics_init(&metrics, NULL, 1000);
     
     /* Set global pointers for signal handler */
     g_vkbd_ctx = &vkbd_ctx;
-    g_listener = &listener;
 
     printf("=== Virtual Keyboard Example ===\n");
     printf("This program intercepts keyboard input and forwards it through a virtual device\n");
@@ -97,35 +206,84 @@ int main(int argc, char *argv[]) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    /* Load compiled keymap (vkbd-compile output) - its outputs are advertised too */
+    if (keymap_path && keymap_init(&keymap, keymap_path) < 0) {
+        fprintf(stderr, "Failed to load keymap %s\n", keymap_path);
+        return 1;
+    }
+
+    /* Advertise what the keyboards present can produce, after remapping */
+    keyset_clear_all(&keys);
+    int keyboards = all_keys ? 0 : event_listener_probe_keys(matches, match_count, &keys);
+    if (keyboards > 0) {
+        if (keymap_path) {
+            keymap_add_outputs(&keymap, &keys);
+        }
+        printf("Mirroring the keys of %d keyboard(s)\n", keyboards);
+    }
+
     /* Initialize virtual keyboard */
     printf("Initializing virtual keyboard...\n");
-    if (vkbd_init(&vkbd_ctx, "Virtual Keyboard Example") < 0) {
+    if (vkbd_init_keys(&vkbd_ctx, "Virtual Keyboard Example", NULL,
+                       keyboards > 0 ? &keys : NULL) < 0) {
         fprintf(stderr, "Failed to initialize virtual keyboard\n");
+        keymap_destroy(&keymap);
         return 1;
     }
 
-    /* Register callbacks */
+    /* Register callbacks and observers */
     printf("Registering callbacks...\n");
     
-    int logger_id = vkbd_register_callback(&vkbd_ctx, key_logger_callback, NULL);
+    /* Logging and sound only watch: observers run after the key is forwarded */
+    int logger_id = vkbd_register_observer(&vkbd_ctx, key_logger_observer, NULL);
     if (logger_id < 0) {
-        fprintf(stderr, "Failed to register logger callback\n");
+        fprintf(stderr, "Failed to register logger observer\n");
         goto cleanup;
     }
     
-    int sound_id = vkbd_register_callback(&vkbd_ctx, key_sound_callback, NULL);
+    int sound_id = vkbd_register_observer(&vkbd_ctx, key_sound_observer, NULL);
     if (sound_id < 0) {
-        fprintf(stderr, "Failed to register sound callback\n");
+        fprintf(stderr, "Failed to register sound observer\n");
         goto cleanup;
     }
 
-    int mapper_id = vkbd_register_callback(&vkbd_ctx, key_mapper_callback, NULL);
+    /* The mapper only cares about Caps Lock presses - other keys never reach it */
+    int mapper_id = vkbd_register_key_callback(&vkbd_ctx, KEY_CAPSLOCK, VKBD_VALUE_PRESS,
+                                               key_mapper_callback, NULL);
     if (mapper_id < 0) {
         fprintf(stderr, "Failed to register mapper callback\n");
         goto cleanup;
     }
 
-    printf("Registered %d callbacks\n", 3);
+    printf("Registered %d observers, %d callback\n", 2, 1);
+
+    /* One more virtual keyboard per --route, advertising what its sources have */
+    for (int i = 0; i < route_count; i++) {
+        char name[UINPUT_MAX_NAME_SIZE];
+        keyset_clear_all(&keys);
+        int found = event_listener_probe_keys(&routes[i], 1, &keys);
+
+        route_outs[i] = malloc(sizeof(vkbd_context_t));
+        snprintf(name, sizeof(name), "Virtual Keyboard Example %d", i + 1);
+        if (!route_outs[i] || vkbd_init_keys(route_outs[i], name, NULL, found > 0 ? &keys : NULL) < 0) {
+            fprintf(stderr, "Failed to initialize output for route %d\n", i + 1);
+            free(route_outs[i]);
+            route_outs[i] = NULL;
+            goto cleanup;
+        }
+    }
+    if (route_count > 0 || per_source) {
+        printf("Keymap and callbacks apply to the shared output only\n");
+    }
+
+    /* Install the keymap loaded above */
+    if (keymap_path) {
+        if (keymap_attach(&keymap, &vkbd_ctx) < 0) {
+            fprintf(stderr, "Failed to attach keymap %s\n", keymap_path);
+            goto cleanup;
+        }
+        printf("Loaded keymap: %s\n", keymap_path);
+    }
 
     /* Initialize event listener */
     printf("Initializing event listener...\n");
@@ -134,12 +292,82 @@ int main(int argc, char *argv[]) {
         goto cleanup;
     }
 
+    listener_ready = true;
+
+    /* Only now may the signal handler wake it (stop writes to its eventfd) */
+    g_listener = &listener;
+    if (g_stop_requested) {
+        goto cleanup;
+    }
+
+    /* Only the keyboards the rules select (default: all of them) */
+    for (int i = 0; i < match_count; i++) {
+        event_listener_add_match(&listener, &matches[i]);
+    }
+
+    /* Routed keyboards go to their route's output, with --per-source the
+     * others each get their own instead of sharing the first one */
+    for (int i = 0; i < route_count; i++) {
+        event_listener_add_route(&listener, &routes[i], route_outs[i]);
+    }
+    if (per_source) {
+        event_listener_set_outputs(&listener, &source_outputs, NULL);
+    }
+
+    /* Reload the keymap whenever it is recompiled */
+    if (keymap_path && keymap_watch(&keymap, &listener) < 0) {
+        fprintf(stderr, "Warning: Keymap hot reload disabled\n");
+    }
+
+    /* Live counters for vkbd-stat, published once a second */
+    if (metrics_enabled) {
+        if (metrics_attach(&metrics, &vkbd_ctx, &listener) < 0) {
+            fprintf(stderr, "Warning: Metrics disabled\n");
+        } else {
+            printf("Metrics: /dev/shm/%s (vkbd-stat -p %d)\n", metrics.name, (int)getpid());
+        }
+    }
+
+    /* Replay a capture through the keymap and callbacks instead of listening */
+    if (replay_path) {
+        capture_replay_stats_t rs;
+        printf("Replaying %s at %s...\n", replay_path, replay_speed > 0 ? "recorded pace" : "full speed");
+        ret = capture_replay(replay_path, &vkbd_ctx, replay_speed, -1, &rs) < 0 ? 1 : 0;
+        printf("Replay: %lu events in %lu frames, %.2f ms, max late %.1f us\n",
+               rs.records, rs.frames, rs.duration_ns / 1e6, rs.max_late_ns / 1e3);
+        goto cleanup;
+    }
+
+    /* SCHED_FIFO, pinning and mlockall for the forwarding thread */
+    if (rt_enabled) {
+        event_listener_set_rt(&listener, &rt);
+        printf("Real-time mode: priority %d, cpu %d\n", rt.priority, rt.cpu);
+    }
+
+    /* Follow keyboards plugged in later (KVM switches, docks, ...) */
+    bool hotplug = event_listener_enable_hotplug(&listener) == 0;
+    if (!hotplug) {
+        fprintf(stderr, "Warning: Hotplug disabled, only keyboards present now are used\n");
+    }
+
     /* Auto-detect keyboard devices */
     printf("Auto-detecting keyboard devices...\n");
     if (event_listener_auto_detect(&listener) < 0) {
-        fprintf(stderr, "Failed to detect keyboard devices\n");
-        fprintf(stderr, "Make sure you have permission to access /dev/input/event* devices\n");
-        goto cleanup;
+        if (!hotplug) {
+            fprintf(stderr, "Failed to detect keyboard devices\n");
+            fprintf(stderr, "Make sure you have permission to access /dev/input/event* devices\n");
+            goto cleanup;
+        }
+        printf("Waiting for a keyboard to be plugged in...\n");
+    }
+
+    /* Record everything read, for --replay later */
+    if (capture_path) {
+        if (capture_start(&capture, capture_path, &listener) < 0) {
+            fprintf(stderr, "Failed to start capture to %s\n", capture_path);
+            goto cleanup;
+        }
+        printf("Capturing to %s\n", capture_path);
     }
 
     printf("\n=== Virtual keyboard is now active ===\n");
@@ -147,15 +375,66 @@ int main(int argc, char *argv[]) {
     printf("Check the output to see key events being processed\n\n");
 
     /* Start listening (blocking) */
-    ret = event_listener_run(&listener);
+    if (pipelined) {
+        ret = event_listener_run_pipelined(&listener);
+        const pipeline_stats_t *ps = &listener.pipeline_stats;
+        printf("Pipeline: %lu events in %lu batches, max depth %u, %lu full stalls, %lu SYN_DROPPED\n",
+               ps->events, ps->batches, ps->max_depth, ps->full_stalls, ps->syn_dropped);
+    } else if (uring) {
+        ret = event_listener_run_uring(&listener);
+        const uring_stats_t *us = &listener.uring_stats;
+        printf("io_uring: %lu enters, %lu reads, %lu writes, %lu deferred flushes\n",
+               us->enters, us->reads, us->writes, us->write_deferrals);
+    } else {
+        ret = event_listener_run(&listener);
+    }
 
 cleanup:
     printf("\nCleaning up...\n");
     
+    /* Destroy keymap and metrics (before the listener that runs their timers) */
+    keymap_destroy(&keymap);
+    metrics_detach(&metrics);
+
+    /* Finish the capture file */
+    if (capture.running) {
+        capture_stop(&capture);
+        printf("Capture: %lu events, %lu dropped, %lu write errors\n",
+               (unsigned long)counter_get(&capture.records), (unsigned long)counter_get(&capture.dropped),
+               (unsigned long)counter_get(&capture.write_errors));
+    }
+
     /* Destroy listener */
-    event_listener_destroy(&listener);
+    g_listener = NULL;
+    if (listener_ready) {
+        event_listener_destroy(&listener);
+    }
+
+    /* Observer cost, reported apart from forwarding */
+    vkbd_observer_stats_t obs_stats;
+    vkbd_get_observer_stats(&vkbd_ctx, &obs_stats);
+    if (obs_stats.delivered > 0) {
+        printf("Observers: %lu events, %.1f us/event, max lag %.3f ms, %lu dropped\n",
+               obs_stats.delivered, obs_stats.busy_ns / 1e3 / obs_stats.delivered,
+               obs_stats.max_lag_ns / 1e6, obs_stats.dropped);
+    }
     
-    /* Destroy virtual keyboard */
+    /* Kernel timestamp -> forwarded, for every key */
+    latency_hist_t lat;
+    vkbd_get_latency(&vkbd_ctx, &lat);
+    if (lat.count > 0) {
+        printf("Latency: %lu keys, mean %.1f us, p99 < %.1f us, max %.1f us\n",
+               (unsigned long)lat.count, latency_mean(&lat) / 1e3,
+               latency_percentile(&lat, 99.0) / 1e3, lat.max_ns / 1e3);
+    }
+
+    /* Destroy virtual keyboards */
+    for (int i = 0; i < route_count; i++) {
+        if (route_outs[i]) {
+            vkbd_destroy(route_outs[i]);
+            free(route_outs[i]);
+        }
+    }
     vkbd_destroy(&vkbd_ctx);
     
     printf("Goodbye!\n");
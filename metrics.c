@@ -0,0 +1,274 @@
+/**
+ * Metrics - Implementation
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include "clock.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#define METRICS_READ_TRIES 1000
+
+/* timerfd source: the interval elapsed */
+static void metrics_timer_handler(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)listener;
+    (void)events;
+    metrics_t *m = user_data;
+    uint64_t expirations;
+
+    if (read(m->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    metrics_publish(m);
+}
+
+/* Initialize a publisher */
+void metrics_init(metrics_t *m, const char *name, int interval_ms) {
+    if (!m) {
+        return;
+    }
+
+    memset(m, 0, sizeof(*m));
+    if (name) {
+        snprintf(m->name, sizeof(m->name), "%s", name);
+    } else {
+        snprintf(m->name, sizeof(m->name), METRICS_PREFIX "%d", (int)getpid());
+    }
+    m->interval_ns = (uint64_t)(interval_ms > 0 ? interval_ms : 1000) * 1000000ULL;
+    m->timer_fd = -1;
+}
+
+/* Create the segment and start publishing */
+int metrics_attach(metrics_t *m, vkbd_context_t *ctx, event_listener_t *listener) {
+    char path[sizeof(m->name) + 1];
+
+    if (!m || !ctx || !listener) {
+        fprintf(stderr, "metrics_attach: Invalid arguments\n");
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/%s", m->name);
+    int fd = shm_open(path, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("metrics_attach: shm_open failed");
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(metrics_shm_t)) < 0) {
+        perror("metrics_attach: ftruncate failed");
+        goto fail_unlink;
+    }
+
+    m->shm = mmap(NULL, sizeof(metrics_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    fd = -1;
+    if (m->shm == MAP_FAILED) {
+        perror("metrics_attach: mmap failed");
+        m->shm = NULL;
+        goto fail_unlink;
+    }
+
+    /* Header first, published by the first snapshot's release store */
+    memset(m->shm, 0, sizeof(metrics_shm_t));
+    m->shm->magic = METRICS_MAGIC;
+    m->shm->version = METRICS_VERSION;
+    m->shm->pid = getpid();
+    m->shm->interval_ms = m->interval_ns / 1000000ULL;
+    m->shm->started_ns = monotonic_ns();
+    m->vkbd_ctx = ctx;
+    m->listener = listener;
+    metrics_publish(m);
+
+    m->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m->timer_fd < 0) {
+        perror("metrics_attach: timerfd_create failed");
+        goto fail_unmap;
+    }
+
+    struct itimerspec its;
+    its.it_value.tv_sec = m->interval_ns / 1000000000ULL;
+    its.it_value.tv_nsec = m->interval_ns % 1000000000ULL;
+    its.it_interval = its.it_value;
+    if (timerfd_settime(m->timer_fd, 0, &its, NULL) < 0 ||
+        event_listener_add_source(listener, m->timer_fd, EPOLLIN, metrics_timer_handler, m) < 0) {
+        close(m->timer_fd);
+        m->timer_fd = -1;
+        goto fail_unmap;
+    }
+    return 0;
+
+fail_unmap:
+    munmap(m->shm, sizeof(metrics_shm_t));
+    m->shm = NULL;
+    m->vkbd_ctx = NULL;
+    m->listener = NULL;
+fail_unlink:
+    if (fd >= 0) {
+        close(fd);
+    }
+    shm_unlink(path);
+    return -1;
+}
+
+/* Copy every counter into the segment under the seqlock */
+void metrics_publish(metrics_t *m) {
+    if (!m || !m->shm) {
+        return;
+    }
+
+    metrics_shm_t *shm = m->shm;
+    const vkbd_counters_t *vc = &m->vkbd_ctx->counters;
+    const listener_counters_t *lc = &m->listener->counters;
+    const latency_hist_t *lat = &m->vkbd_ctx->latency;
+    vkbd_observer_stats_t obs;
+
+    /* Gathered outside the write section: it takes the observer lock */
+    vkbd_get_observer_stats(m->vkbd_ctx, &obs);
+
+    uint32_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+    atomic_store_explicit(&shm->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    shm->published_ns = monotonic_ns();
+    shm->publishes++;
+
+    shm->written = counter_get(&vc->written);
+    shm->writes = counter_get(&vc->writes);
+    shm->deferred = counter_get(&vc->deferred);
+    shm->coalesced = counter_get(&vc->coalesced);
+    shm->overflows = counter_get(&vc->overflows);
+    shm->write_errors = counter_get(&vc->write_errors);
+    shm->filtered = counter_get(&vc->filtered);
+
+    shm->read_errors = counter_get(&lc->read_errors);
+    shm->error_resets = counter_get(&lc->error_resets);
+    shm->syn_dropped = counter_get(&lc->syn_dropped);
+
+    shm->observer_delivered = obs.delivered;
+    shm->observer_dropped = obs.dropped;
+
+    shm->latency_count = counter_get(&lat->count);
+    shm->latency_total_ns = counter_get(&lat->total_ns);
+    shm->latency_max_ns = counter_get(&lat->max_ns);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        shm->latency_buckets[i] = counter_get(&lat->buckets[i]);
+    }
+
+    uint32_t n = 0;
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        const input_device_t *dev = &m->listener->devices[i];
+        if (!dev->active) {
+            continue;
+        }
+        metrics_device_t *md = &shm->devices[n++];
+        snprintf(md->name, sizeof(md->name), "%s", dev->name);
+        snprintf(md->path, sizeof(md->path), "%s", dev->path);
+        md->events = counter_get(&dev->events);
+        md->keys = counter_get(&dev->keys);
+    }
+    shm->device_count = n;
+
+    atomic_store_explicit(&shm->seq, seq + 2, memory_order_release);
+}
+
+/* Last snapshot, then remove the segment */
+void metrics_detach(metrics_t *m) {
+    char path[sizeof(m->name) + 1];
+
+    if (!m || !m->shm) {
+        return;
+    }
+
+    if (m->timer_fd >= 0) {
+        event_listener_remove_source(m->listener, m->timer_fd);
+        close(m->timer_fd);
+        m->timer_fd = -1;
+    }
+
+    metrics_publish(m);
+    m->shm->pid = 0;
+    munmap(m->shm, sizeof(metrics_shm_t));
+    m->shm = NULL;
+
+    snprintf(path, sizeof(path), "/%s", m->name);
+    shm_unlink(path);
+    m->vkbd_ctx = NULL;
+    m->listener = NULL;
+}
+
+/* Map a segment read-only */
+const metrics_shm_t *metrics_open(const char *name) {
+    char path[128];
+
+    if (!name) {
+        fprintf(stderr, "metrics_open: Invalid arguments\n");
+        return NULL;
+    }
+
+    snprintf(path, sizeof(path), "/%s", name);
+    int fd = shm_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(metrics_shm_t)) {
+        fprintf(stderr, "metrics_open: %s is not a vkbd metrics segment\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    metrics_shm_t *shm = mmap(NULL, sizeof(metrics_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("metrics_open: mmap failed");
+        return NULL;
+    }
+
+    if (shm->magic != METRICS_MAGIC || shm->version != METRICS_VERSION) {
+        fprintf(stderr, "metrics_open: %s has an unknown layout\n", name);
+        munmap(shm, sizeof(metrics_shm_t));
+        return NULL;
+    }
+    return shm;
+}
+
+/* Unmap a segment */
+void metrics_close(const metrics_shm_t *shm) {
+    if (shm) {
+        munmap((void *)shm, sizeof(metrics_shm_t));
+    }
+}
+
+/* Seqlock read: copy, then check that no update started or finished meanwhile */
+int metrics_read(const metrics_shm_t *shm, metrics_shm_t *out) {
+    if (!shm || !out) {
+        fprintf(stderr, "metrics_read: Invalid arguments\n");
+        return -1;
+    }
+
+    metrics_shm_t *src = (metrics_shm_t *)shm;
+    for (int i = 0; i < METRICS_READ_TRIES; i++) {
+        uint32_t seq = atomic_load_explicit(&src->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(out, shm, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&src->seq, memory_order_relaxed) == seq) {
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,143 @@
+/**
+ * Metrics - Live counters in a shared-memory segment
+ *
+ * The hot path only bumps single-writer counters (counter.h) in the vkbd
+ * context, the listener and each device. A timerfd in the listener's epoll
+ * set copies them, plus the latency histogram and observer statistics, into
+ * a /dev/shm segment every interval under a seqlock, so another process
+ * (tools/vkbd-stat) can read a consistent snapshot without a socket and
+ * without ever blocking the publisher.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "vkbd.h"
+#include "event_listener.h"
+#include <stdint.h>
+
+#define METRICS_MAGIC 0x766b6d31u   /* "vkm1" */
+#define METRICS_VERSION 2
+
+/* Segment names are "vkbd.<pid>" unless given (see /dev/shm) */
+#define METRICS_PREFIX "vkbd."
+
+/* Per-device counters in the segment */
+typedef struct {
+    char name[64];
+    char path[64];
+    uint64_t events;
+    uint64_t keys;
+} metrics_device_t;
+
+/* Segment layout - written by the publisher, read-only for everyone else */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;                 /* Publisher, 0 once it detached */
+    uint32_t interval_ms;
+    _Atomic uint32_t seq;        /* Seqlock: odd while an update is in progress */
+    uint32_t device_count;
+    uint64_t started_ns;         /* CLOCK_MONOTONIC when publishing started */
+    uint64_t published_ns;       /* CLOCK_MONOTONIC of this snapshot */
+    uint64_t publishes;
+
+    /* Output (vkbd_counters_t) */
+    uint64_t written;
+    uint64_t writes;
+    uint64_t deferred;
+    uint64_t coalesced;
+    uint64_t overflows;
+    uint64_t write_errors;
+    uint64_t filtered;
+
+    /* Listener (listener_counters_t) */
+    uint64_t read_errors;
+    uint64_t error_resets;
+    uint64_t syn_dropped;
+
+    /* Observers */
+    uint64_t observer_delivered;
+    uint64_t observer_dropped;
+
+    /* Source timestamp -> flush (latency.h buckets) */
+    uint64_t latency_count;
+    uint64_t latency_total_ns;
+    uint64_t latency_max_ns;
+    uint64_t latency_buckets[LATENCY_BUCKETS];
+
+    metrics_device_t devices[MAX_INPUT_DEVICES];  /* Active devices, device_count of them */
+} metrics_shm_t;
+
+/* Publisher structure */
+typedef struct {
+    char name[64];               /* shm_open name without the leading '/' */
+    uint64_t interval_ns;
+    metrics_shm_t *shm;
+    int timer_fd;
+    vkbd_context_t *vkbd_ctx;
+    event_listener_t *listener;
+} metrics_t;
+
+/**
+ * Initialize a publisher
+ *
+ * @param m Pointer to metrics_t structure
+ * @param name Segment name, NULL for "vkbd.<pid>"
+ * @param interval_ms Publishing interval in milliseconds (<= 0: 1000)
+ */
+void metrics_init(metrics_t *m, const char *name, int interval_ms);
+
+/**
+ * Create the segment and start publishing from the listener thread
+ *
+ * @param m Pointer to metrics_t structure
+ * @param ctx Virtual keyboard whose counters are published
+ * @param listener Listener whose epoll set receives the timerfd
+ * @return 0 on success, -1 on error
+ */
+int metrics_attach(metrics_t *m, vkbd_context_t *ctx, event_listener_t *listener);
+
+/**
+ * Publish a snapshot now (on the thread that runs the listener)
+ *
+ * @param m Pointer to metrics_t structure
+ */
+void metrics_publish(metrics_t *m);
+
+/**
+ * Publish a last snapshot, stop the timer and remove the segment
+ *
+ * Readers that still have it mapped see pid 0.
+ *
+ * @param m Pointer to metrics_t structure
+ */
+void metrics_detach(metrics_t *m);
+
+/**
+ * Map a publisher's segment read-only
+ *
+ * @param name Segment name (e.g., "vkbd.1234")
+ * @return Mapped segment, NULL on error (unmap with metrics_close)
+ */
+const metrics_shm_t *metrics_open(const char *name);
+
+/**
+ * Unmap a segment returned by metrics_open
+ *
+ * @param shm Mapped segment (may be NULL)
+ */
+void metrics_close(const metrics_shm_t *shm);
+
+/**
+ * Copy a consistent snapshot out of a mapped segment
+ *
+ * Retries while the publisher is in the middle of an update.
+ *
+ * @param shm Mapped segment
+ * @param out Receives the snapshot
+ * @return 0 on success, -1 if no consistent copy could be taken
+ */
+int metrics_read(const metrics_shm_t *shm, metrics_shm_t *out);
+
+#endif /* METRICS_H */
@@ -0,0 +1,333 @@
+/**
+ * Observer Queue - Implementation
+ *
+ * Bounded MPSC queue (Vyukov): each cell carries a sequence number, so
+ * producers claim a slot with one CAS and the single consumer needs no
+ * atomic read-modify-write at all. The consumer thread only sleeps on an
+ * eventfd when the queue is empty; producers write to it only if it is
+ * asleep, so a busy stream costs no syscalls.
+ */
+
+#define _GNU_SOURCE
+
+#include "observer.h"
+#include "clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#define OBSERVER_MASK (VKBD_OBSERVER_QUEUE - 1)
+#define OBSERVER_BATCH 64
+
+/* One queued event */
+typedef struct {
+    _Atomic size_t seq;
+    struct input_event ev;
+    uint64_t posted_ns;
+} observer_cell_t;
+
+/* Registered observer */
+typedef struct {
+    vkbd_observer_t observer;
+    void *user_data;
+    bool active;
+} observer_entry_t;
+
+/* Per-context observer state */
+struct vkbd_observers {
+    _Alignas(64) _Atomic size_t enqueue_pos;     /* Shared by producers */
+    _Alignas(64) size_t dequeue_pos;             /* Consumer only */
+    _Atomic bool sleeping;                       /* Consumer is waiting on wake_fd */
+    _Atomic bool stop;
+    _Atomic unsigned long dropped;
+    observer_cell_t cells[VKBD_OBSERVER_QUEUE];
+
+    pthread_mutex_t lock;                        /* Guards entries; held while observers run */
+    observer_entry_t entries[MAX_OBSERVERS];
+    _Atomic int count;                           /* Active entries - 0 skips posting */
+    vkbd_observer_stats_t stats;                 /* Written by the consumer under lock */
+
+    int wake_fd;
+    pthread_t thread;
+};
+
+/* Producer: claim the next cell, false if the queue is full */
+static inline bool queue_push(struct vkbd_observers *obs, const struct input_event *ev, uint64_t now) {
+    size_t pos = atomic_load_explicit(&obs->enqueue_pos, memory_order_relaxed);
+    observer_cell_t *cell;
+
+    for (;;) {
+        cell = &obs->cells[pos & OBSERVER_MASK];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&obs->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&obs->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->ev = *ev;
+    cell->posted_ns = now;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+/* Consumer: take the oldest cell, false if the queue is empty */
+static inline bool queue_pop(struct vkbd_observers *obs, struct input_event *ev, uint64_t *posted_ns) {
+    observer_cell_t *cell = &obs->cells[obs->dequeue_pos & OBSERVER_MASK];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+    if (seq != obs->dequeue_pos + 1) {
+        return false;
+    }
+    *ev = cell->ev;
+    *posted_ns = cell->posted_ns;
+    atomic_store_explicit(&cell->seq, obs->dequeue_pos + VKBD_OBSERVER_QUEUE, memory_order_release);
+    obs->dequeue_pos++;
+    return true;
+}
+
+/* Queue forwarded events */
+void vkbd_observers_post(struct vkbd_observers *obs, const struct input_event *events, int count) {
+    if (atomic_load_explicit(&obs->count, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    uint64_t now = monotonic_ns();
+    bool posted = false;
+
+    for (int i = 0; i < count; i++) {
+        if (events[i].type != EV_KEY) {
+            continue;
+        }
+        if (__builtin_expect(!queue_push(obs, &events[i], now), 0)) {
+            atomic_fetch_add_explicit(&obs->dropped, 1, memory_order_relaxed);
+            continue;
+        }
+        posted = true;
+    }
+
+    /* Pairs with the fence in observer_thread: either it sees our cells or we see it asleep */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (posted && atomic_load_explicit(&obs->sleeping, memory_order_relaxed) &&
+        atomic_exchange(&obs->sleeping, false)) {
+        uint64_t one = 1;
+        if (write(obs->wake_fd, &one, sizeof(one)) < 0) {
+            /* Counter saturated - a wakeup is already pending */
+        }
+    }
+}
+
+/* Background thread: deliver queued events to every observer */
+static void *observer_thread(void *arg) {
+    struct vkbd_observers *obs = arg;
+    struct input_event batch[OBSERVER_BATCH];
+    uint64_t posted[OBSERVER_BATCH];
+
+    for (;;) {
+        int n = 0;
+        while (n < OBSERVER_BATCH && queue_pop(obs, &batch[n], &posted[n])) {
+            n++;
+        }
+
+        if (n > 0) {
+            pthread_mutex_lock(&obs->lock);
+            uint64_t start = monotonic_ns();
+            uint64_t lag = start - posted[0];
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < MAX_OBSERVERS; j++) {
+                    if (obs->entries[j].active) {
+                        obs->entries[j].observer(&batch[i], obs->entries[j].user_data);
+                    }
+                }
+            }
+            obs->stats.busy_ns += monotonic_ns() - start;
+            obs->stats.delivered += n;
+            if (lag > obs->stats.max_lag_ns) {
+                obs->stats.max_lag_ns = lag;
+            }
+            pthread_mutex_unlock(&obs->lock);
+            continue;
+        }
+
+        /* Empty: announce we are going to sleep, then look once more */
+        atomic_store(&obs->sleeping, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        observer_cell_t *next = &obs->cells[obs->dequeue_pos & OBSERVER_MASK];
+        if (atomic_load_explicit(&next->seq, memory_order_acquire) == obs->dequeue_pos + 1) {
+            atomic_store(&obs->sleeping, false);
+            continue;
+        }
+        if (atomic_load(&obs->stop)) {
+            break;
+        }
+
+        uint64_t value;
+        if (read(obs->wake_fd, &value, sizeof(value)) < 0) {
+            /* EINTR - look again */
+        }
+        atomic_store(&obs->sleeping, false);
+    }
+    return NULL;
+}
+
+/* Create the queue and start the thread */
+static struct vkbd_observers *observers_create(void) {
+    struct vkbd_observers *obs;
+    if (posix_memalign((void **)&obs, 64, sizeof(*obs)) != 0) {
+        fprintf(stderr, "vkbd_register_observer: Out of memory\n");
+        return NULL;
+    }
+    memset(obs, 0, sizeof(*obs));
+
+    for (size_t i = 0; i < VKBD_OBSERVER_QUEUE; i++) {
+        atomic_init(&obs->cells[i].seq, i);
+    }
+    pthread_mutex_init(&obs->lock, NULL);
+
+    /* Blocking: the thread sleeps in read() until a producer kicks it */
+    obs->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (obs->wake_fd < 0) {
+        perror("vkbd_register_observer: Failed to create eventfd");
+        goto fail;
+    }
+
+    if (pthread_create(&obs->thread, NULL, observer_thread, obs) != 0) {
+        fprintf(stderr, "vkbd_register_observer: Failed to start observer thread\n");
+        close(obs->wake_fd);
+        goto fail;
+    }
+    return obs;
+
+fail:
+    pthread_mutex_destroy(&obs->lock);
+    free(obs);
+    return NULL;
+}
+
+/* Stop the thread and free */
+void vkbd_observers_destroy(struct vkbd_observers *obs) {
+    if (!obs) {
+        return;
+    }
+
+    uint64_t one = 1;
+    atomic_store(&obs->stop, true);
+    if (write(obs->wake_fd, &one, sizeof(one)) < 0) {
+        perror("vkbd_destroy: Failed to wake observer thread");
+    }
+    pthread_join(obs->thread, NULL);
+
+    close(obs->wake_fd);
+    pthread_mutex_destroy(&obs->lock);
+    free(obs);
+}
+
+/* Register an observer */
+int vkbd_register_observer(vkbd_context_t *ctx, vkbd_observer_t observer, void *user_data) {
+    if (!ctx) {
+        fprintf(stderr, "vkbd_register_observer: NULL context\n");
+        return -1;
+    }
+
+    if (!observer) {
+        fprintf(stderr, "vkbd_register_observer: NULL observer\n");
+        return -1;
+    }
+
+    /* First one: publish the block with a CAS - a racing registration
+     * that loses throws its own away and uses the winner's */
+    struct vkbd_observers *obs = atomic_load_explicit(&ctx->observers, memory_order_acquire);
+    if (!obs) {
+        struct vkbd_observers *created = observers_create();
+        if (!created) {
+            return -1;
+        }
+        obs = NULL;
+        if (atomic_compare_exchange_strong_explicit(&ctx->observers, &obs, created,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            obs = created;
+        } else {
+            vkbd_observers_destroy(created);
+        }
+    }
+
+    int id = -1;
+    pthread_mutex_lock(&obs->lock);
+    for (int i = 0; i < MAX_OBSERVERS; i++) {
+        if (!obs->entries[i].active) {
+            obs->entries[i].observer = observer;
+            obs->entries[i].user_data = user_data;
+            obs->entries[i].active = true;
+            obs->count++;
+            id = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&obs->lock);
+
+    if (id < 0) {
+        fprintf(stderr, "vkbd_register_observer: Too many observers\n");
+    }
+    return id;
+}
+
+/* Unregister an observer */
+int vkbd_unregister_observer(vkbd_context_t *ctx, int observer_id) {
+    if (!ctx) {
+        fprintf(stderr, "vkbd_unregister_observer: NULL context\n");
+        return -1;
+    }
+
+    struct vkbd_observers *obs = atomic_load_explicit(&ctx->observers, memory_order_acquire);
+    if (!obs || observer_id < 0 || observer_id >= MAX_OBSERVERS) {
+        fprintf(stderr, "vkbd_unregister_observer: Invalid observer ID\n");
+        return -1;
+    }
+
+    int ret = -1;
+    pthread_mutex_lock(&obs->lock);
+    if (obs->entries[observer_id].active) {
+        obs->entries[observer_id].active = false;
+        obs->count--;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&obs->lock);
+
+    if (ret < 0) {
+        fprintf(stderr, "vkbd_unregister_observer: Invalid observer ID\n");
+    }
+    return ret;
+}
+
+/* Get observer statistics */
+void vkbd_get_observer_stats(const vkbd_context_t *ctx, vkbd_observer_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    if (!ctx) {
+        return;
+    }
+
+    struct vkbd_observers *obs = atomic_load_explicit(&ctx->observers, memory_order_acquire);
+    if (!obs) {
+        return;
+    }
+    pthread_mutex_lock(&obs->lock);
+    *stats = obs->stats;
+    pthread_mutex_unlock(&obs->lock);
+    stats->dropped = atomic_load_explicit(&obs->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,31 @@
+/**
+ * Observer Queue - Internal interface used by vkbd.c
+ *
+ * The public API (vkbd_register_observer, ...) is declared in vkbd.h.
+ */
+
+#ifndef OBSERVER_H
+#define OBSERVER_H
+
+#include "vkbd.h"
+
+/**
+ * Queue forwarded events for the observer thread (key events only)
+ *
+ * Safe to call from several threads at once; never blocks or allocates.
+ *
+ * @param obs Observer state of the context
+ * @param events Events just written to the device
+ * @param count Number of events
+ */
+void vkbd_observers_post(struct vkbd_observers *obs, const struct input_event *events, int count)
+    __attribute__((hot));
+
+/**
+ * Stop the observer thread after it delivered everything queued, and free
+ *
+ * @param obs Observer state of the context (may be NULL)
+ */
+void vkbd_observers_destroy(struct vkbd_observers *obs);
+
+#endif /* OBSERVER_H */
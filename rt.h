@@ -0,0 +1,52 @@
+/**
+ * Real-Time Mode
+ *
+ * Opt-in settings that trade CPU and memory for a flat latency tail:
+ * SCHED_FIFO priority, CPU pinning, locked memory and a prefaulted stack,
+ * so the forwarding thread is never preempted by ordinary tasks, migrated
+ * between cores or stalled on a page fault.
+ *
+ * The read() -> uinput write() path itself never allocates or prints;
+ * test/quick_test.c checks this with an allocator hook.
+ */
+
+#ifndef RT_H
+#define RT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Default SCHED_FIFO priority (above IRQ threads' default of 50) */
+#define RT_DEFAULT_PRIORITY 60
+
+/* Default amount of stack touched up front */
+#define RT_DEFAULT_STACK_PREFAULT (256 * 1024)
+
+/* Real-time settings */
+typedef struct {
+    int priority;            /* SCHED_FIFO priority 1-99, 0 = keep current policy */
+    int cpu;                 /* Pin the calling thread to this CPU, -1 = no pinning */
+    bool lock_memory;        /* mlockall(MCL_CURRENT | MCL_FUTURE) */
+    size_t stack_prefault;   /* Bytes of stack to fault in, 0 = none */
+} rt_config_t;
+
+/**
+ * Fill in the defaults: RT_DEFAULT_PRIORITY, no pinning, locked memory
+ * and RT_DEFAULT_STACK_PREFAULT
+ *
+ * @param cfg Pointer to rt_config_t structure
+ */
+void rt_config_default(rt_config_t *cfg);
+
+/**
+ * Apply settings to the calling thread (memory locking is process-wide)
+ *
+ * Every step is attempted; failures (usually missing CAP_SYS_NICE or
+ * CAP_IPC_LOCK) are reported on stderr.
+ *
+ * @param cfg Pointer to rt_config_t structure
+ * @return 0 if everything was applied, -1 if any step failed
+ */
+int rt_apply(const rt_config_t *cfg);
+
+#endif /* RT_H */
@@ -0,0 +1,93 @@
+/**
+ * SPSC Ring - Lock-free single-producer / single-consumer event queue
+ *
+ * Header-only. Carries input events (and control records) from the reader
+ * thread to the writer thread in pipelined mode. Producer and consumer
+ * indices live on separate cache lines, each side keeps a cached copy of
+ * the other's index, and batches are published with one release store.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <linux/input.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Ring capacity in items (power of two) */
+#define SPSC_RING_SIZE 4096
+#define SPSC_RING_MASK (SPSC_RING_SIZE - 1)
+
+#define SPSC_CACHE_LINE 64
+
+/* One queued item */
+typedef struct {
+    struct input_event ev;
+    uint64_t read_ns;    /* CLOCK_MONOTONIC when the reader got it */
+    void *ctrl;          /* Non-NULL: control record, ev is unused */
+    void *out;           /* Output the event is routed to (vkbd_context_t) */
+} spsc_item_t;
+
+/* Ring structure - allocate with SPSC_CACHE_LINE alignment */
+typedef struct {
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t tail;  /* Next slot to fill (producer) */
+    uint32_t head_cache;                              /* Producer's view of head */
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t head;  /* Next slot to drain (consumer) */
+    uint32_t tail_cache;                              /* Consumer's view of tail */
+    _Alignas(SPSC_CACHE_LINE) spsc_item_t items[SPSC_RING_SIZE];
+} spsc_ring_t;
+
+static inline void spsc_init(spsc_ring_t *ring) {
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    ring->head_cache = 0;
+    ring->tail_cache = 0;
+}
+
+/* Producer: append up to n items, returns how many fit */
+static inline int spsc_write(spsc_ring_t *ring, const spsc_item_t *in, int n) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t space = SPSC_RING_SIZE - (tail - ring->head_cache);
+
+    if (space < (uint32_t)n) {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        space = SPSC_RING_SIZE - (tail - ring->head_cache);
+        if (space < (uint32_t)n) {
+            n = space;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        ring->items[(tail + i) & SPSC_RING_MASK] = in[i];
+    }
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+/* Consumer: take up to max items, returns how many were taken */
+static inline int spsc_read(spsc_ring_t *ring, spsc_item_t *out, int max) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t avail = ring->tail_cache - head;
+
+    if (avail < (uint32_t)max) {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        avail = ring->tail_cache - head;
+        if (avail < (uint32_t)max) {
+            max = avail;
+        }
+    }
+
+    for (int i = 0; i < max; i++) {
+        out[i] = ring->items[(head + i) & SPSC_RING_MASK];
+    }
+    atomic_store_explicit(&ring->head, head + max, memory_order_release);
+    return max;
+}
+
+/* Items currently queued (approximate when called concurrently) */
+static inline uint32_t spsc_depth(spsc_ring_t *ring) {
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) -
+           atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+#endif /* SPSC_RING_H */
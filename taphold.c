@@ -0,0 +1,228 @@
+/**
+ * Tap-Hold Scheduler - Implementation
+ */
+
+#include "taphold.h"
+#include "clock.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+static void feed(taphold_t *th, uint16_t code, int32_t value);
+
+/* Resolve the pending key, then replay everything that waited on it */
+static void decide(taphold_t *th, bool hold) {
+    const taphold_key_t *k = &th->keys[th->pending];
+    uint64_t latency = monotonic_ns() - th->pending_since_ns;
+
+    timerfd_arm_at(th->timer_fd, 0);
+    th->pending = -1;
+
+    th->stats.last_decision_ns = latency;
+    th->stats.total_decision_ns += latency;
+    if (latency > th->stats.max_decision_ns) {
+        th->stats.max_decision_ns = latency;
+    }
+    th->stats.buffered += th->buffered;
+
+    if (hold) {
+        th->stats.holds++;
+        keyset_set(&th->held, k->key);
+        vkbd_emit(th->vkbd_ctx, EV_KEY, k->hold, 1);
+    } else {
+        th->stats.taps++;
+        vkbd_emit(th->vkbd_ctx, EV_KEY, k->tap, 1);
+        vkbd_emit(th->vkbd_ctx, EV_SYN, SYN_REPORT, 0);
+        vkbd_emit(th->vkbd_ctx, EV_KEY, k->tap, 0);
+    }
+
+    if (th->log_decisions) {
+        fprintf(stderr, "[taphold] key %d -> %s after %.3f ms (%d buffered)\n",
+                k->key, hold ? "hold" : "tap", latency / 1e6, th->buffered);
+    }
+
+    /* Replay in order - a buffered dual-role press may start a new decision */
+    int count = th->buffered;
+    taphold_event_t replay[TAPHOLD_BUFFER];
+    memcpy(replay, th->buffer, count * sizeof(replay[0]));
+    th->buffered = 0;
+    for (int i = 0; i < count; i++) {
+        feed(th, replay[i].code, replay[i].value);
+    }
+}
+
+/* Core state machine - every event it lets through is emitted */
+static void feed(taphold_t *th, uint16_t code, int32_t value) {
+    int idx = code < KEY_CNT ? th->index[code] - 1 : -1;
+
+    if (th->pending >= 0) {
+        if (idx == th->pending) {
+            /* Released inside the term: tap. Repeats while undecided are dropped */
+            if (value == 0) {
+                decide(th, false);
+            }
+            return;
+        }
+
+        if (th->buffered == TAPHOLD_BUFFER) {
+            decide(th, true);
+            feed(th, code, value);
+            return;
+        }
+        th->buffer[th->buffered].code = code;
+        th->buffer[th->buffered].value = value;
+        th->buffered++;
+
+        if (value == 1) {
+            keyset_set(&th->pressed_while_pending, code);
+        } else if (value == 0 && th->permissive_hold &&
+                   keyset_test(&th->pressed_while_pending, code)) {
+            /* Another key tapped while ours is down: hold */
+            decide(th, true);
+        }
+        return;
+    }
+
+    if (idx >= 0) {
+        const taphold_key_t *k = &th->keys[idx];
+        if (value == 1) {
+            /* Undecided until release, permissive hold or the deadline */
+            th->pending = idx;
+            th->pending_since_ns = monotonic_ns();
+            keyset_clear_all(&th->pressed_while_pending);
+            timerfd_arm_at(th->timer_fd, th->pending_since_ns + th->tapping_term_ns);
+            return;
+        }
+        if (keyset_test(&th->held, code)) {
+            if (value == 0) {
+                keyset_clear(&th->held, code);
+            }
+            vkbd_emit(th->vkbd_ctx, EV_KEY, k->hold, value);
+        }
+        return;
+    }
+
+    vkbd_emit(th->vkbd_ctx, EV_KEY, code, value);
+}
+
+/* Filter stage: plain keys pass straight through when nothing is pending */
+static vkbd_verdict_t taphold_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)ctx;
+    taphold_t *th = user_data;
+
+    if (__builtin_expect(th->pending < 0 &&
+                         (ev->code >= KEY_CNT || th->index[ev->code] == 0), 1)) {
+        return VKBD_FILTER_PASS;
+    }
+
+    feed(th, ev->code, ev->value);
+    return VKBD_FILTER_DROP;
+}
+
+/* timerfd source: the tapping term expired */
+static void taphold_timer_handler(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)listener;
+    (void)events;
+    taphold_t *th = user_data;
+    uint64_t expirations;
+
+    if (read(th->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;  /* Disarmed or re-armed since it became readable */
+    }
+    if (th->pending >= 0) {
+        decide(th, true);
+    }
+}
+
+/* Initialize tap-hold scheduler */
+void taphold_init(taphold_t *th, int tapping_term_ms, bool permissive_hold) {
+    if (!th) {
+        return;
+    }
+
+    memset(th, 0, sizeof(*th));
+    th->tapping_term_ns = (uint64_t)(tapping_term_ms > 0 ? tapping_term_ms : 200) * 1000000ULL;
+    th->permissive_hold = permissive_hold;
+    th->pending = -1;
+    th->timer_fd = -1;
+    th->filter_id = -1;
+}
+
+/* Add a dual-role key */
+int taphold_add_key(taphold_t *th, uint16_t key, uint16_t tap, uint16_t hold) {
+    if (!th || key == 0 || key >= KEY_CNT || tap >= KEY_CNT || hold >= KEY_CNT) {
+        fprintf(stderr, "taphold_add_key: Invalid arguments\n");
+        return -1;
+    }
+
+    if (th->index[key]) {
+        fprintf(stderr, "taphold_add_key: Key %d already dual-role\n", key);
+        return -1;
+    }
+
+    if (th->key_count >= TAPHOLD_MAX_KEYS) {
+        fprintf(stderr, "taphold_add_key: Too many keys\n");
+        return -1;
+    }
+
+    th->keys[th->key_count] = (taphold_key_t){ key, tap, hold };
+    th->index[key] = ++th->key_count;
+    return 0;
+}
+
+/* Install filter and timer */
+int taphold_attach(taphold_t *th, vkbd_context_t *ctx, event_listener_t *listener) {
+    if (!th || !ctx || !listener) {
+        fprintf(stderr, "taphold_attach: Invalid arguments\n");
+        return -1;
+    }
+
+    th->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (th->timer_fd < 0) {
+        perror("taphold_attach: timerfd_create failed");
+        return -1;
+    }
+
+    if (event_listener_add_source(listener, th->timer_fd, EPOLLIN,
+                                  taphold_timer_handler, th) < 0) {
+        goto fail;
+    }
+    th->listener = listener;
+
+    th->filter_id = vkbd_register_filter(ctx, taphold_filter, th);
+    if (th->filter_id < 0) {
+        event_listener_remove_source(listener, th->timer_fd);
+        th->listener = NULL;
+        goto fail;
+    }
+    th->vkbd_ctx = ctx;
+    return 0;
+
+fail:
+    close(th->timer_fd);
+    th->timer_fd = -1;
+    return -1;
+}
+
+/* Remove filter and timer */
+void taphold_detach(taphold_t *th) {
+    if (!th) {
+        return;
+    }
+
+    if (th->vkbd_ctx && th->filter_id >= 0) {
+        vkbd_unregister_filter(th->vkbd_ctx, th->filter_id);
+        th->filter_id = -1;
+    }
+    if (th->timer_fd >= 0) {
+        if (th->listener) {
+            event_listener_remove_source(th->listener, th->timer_fd);
+            th->listener = NULL;
+        }
+        close(th->timer_fd);
+        th->timer_fd = -1;
+    }
+}
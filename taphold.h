@@ -0,0 +1,109 @@
+/**
+ * Tap-Hold Scheduler
+ *
+ * Dual-role keys (e.g., Caps Lock = Esc on tap, Ctrl on hold). Decision
+ * deadlines are timerfds in the listener's epoll set, so they fire on time
+ * without relying on the loop waking up. While a key is undecided, later
+ * events are buffered and flushed in order once the decision is made.
+ *
+ * Its output is staged with vkbd_emit() - see there for filter order.
+ */
+
+#ifndef TAPHOLD_H
+#define TAPHOLD_H
+
+#include "vkbd.h"
+#include "event_listener.h"
+#include "keyset.h"
+#include <stdint.h>
+
+/* Maximum number of dual-role keys */
+#define TAPHOLD_MAX_KEYS 32
+
+/* Events buffered while a key is undecided (overflow forces hold) */
+#define TAPHOLD_BUFFER 64
+
+/* Dual-role key definition */
+typedef struct {
+    uint16_t key;   /* Physical key */
+    uint16_t tap;   /* Sent on tap (press + release within the tapping term) */
+    uint16_t hold;  /* Held while the key is held past the term */
+} taphold_key_t;
+
+/* Event waiting for a decision */
+typedef struct {
+    uint16_t code;
+    int32_t value;
+} taphold_event_t;
+
+/* Decision statistics (nanoseconds) */
+typedef struct {
+    unsigned long taps;
+    unsigned long holds;
+    unsigned long buffered;           /* Events that waited for a decision */
+    uint64_t last_decision_ns;        /* Press -> decision of the last key */
+    uint64_t max_decision_ns;
+    uint64_t total_decision_ns;
+} taphold_stats_t;
+
+/* Tap-hold scheduler structure */
+typedef struct {
+    taphold_key_t keys[TAPHOLD_MAX_KEYS];
+    int key_count;
+    uint8_t index[KEY_CNT];           /* key code -> keys[] index + 1, 0 = plain key */
+    keyset_t held;                    /* Dual-role keys decided as hold */
+    uint64_t tapping_term_ns;
+    bool permissive_hold;             /* Hold if another key is tapped inside the term */
+    bool log_decisions;               /* Print each decision and its latency to stderr */
+
+    int pending;                      /* keys[] index being decided, -1 if none */
+    uint64_t pending_since_ns;
+    keyset_t pressed_while_pending;
+    taphold_event_t buffer[TAPHOLD_BUFFER];
+    int buffered;
+
+    int timer_fd;
+    int filter_id;
+    vkbd_context_t *vkbd_ctx;
+    event_listener_t *listener;
+    taphold_stats_t stats;
+} taphold_t;
+
+/**
+ * Initialize tap-hold scheduler
+ *
+ * @param th Pointer to taphold_t structure
+ * @param tapping_term_ms Tap/hold decision deadline in milliseconds
+ * @param permissive_hold Decide hold as soon as another key is pressed and released
+ */
+void taphold_init(taphold_t *th, int tapping_term_ms, bool permissive_hold);
+
+/**
+ * Add a dual-role key
+ *
+ * @param th Pointer to taphold_t structure
+ * @param key Physical key code
+ * @param tap Key code sent on tap
+ * @param hold Key code held on hold
+ * @return 0 on success, -1 on error
+ */
+int taphold_add_key(taphold_t *th, uint16_t key, uint16_t tap, uint16_t hold);
+
+/**
+ * Install as a filter stage and register the decision timer with the listener
+ *
+ * @param th Pointer to taphold_t structure
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param listener Listener whose epoll set receives the timerfd
+ * @return 0 on success, -1 on error
+ */
+int taphold_attach(taphold_t *th, vkbd_context_t *ctx, event_listener_t *listener);
+
+/**
+ * Remove the filter stage and close the timer
+ *
+ * @param th Pointer to taphold_t structure
+ */
+void taphold_detach(taphold_t *th);
+
+#endif /* TAPHOLD_H */
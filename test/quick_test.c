@@ -0,0 +1,2013 @@
+/**
+ * Quick Test
+ * 
+ * Exercises the processing path end to end on the in-process pipe backends,
+ * so it runs in well under a second without /dev/uinput or root.
+ * 
+ * Build & run: make test
+ */
+
+#define _GNU_SOURCE
+
+#include "../vkbd.h"
+#include "../event_listener.h"
+#include "../keymap.h"
+#include "../layer.h"
+#include "../taphold.h"
+#include "../macro.h"
+#include "../combo.h"
+#include "../uring.h"
+#include "../metrics.h"
+#include "../capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/* Allocator hook: counts allocations while armed (glibc's entry points) */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static volatile int alloc_armed = 0;
+static volatile int alloc_hits = 0;
+
+void *malloc(size_t size) {
+    alloc_hits += alloc_armed;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    alloc_hits += alloc_armed;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_hits += alloc_armed;
+    return __libc_realloc(ptr, size);
+}
+
+/* Read whatever the virtual device produced (up to max events) */
+static int read_output(vkbd_context_t *ctx, struct input_event *out, int max) {
+    struct pollfd pfd = { .fd = ctx->device.peer_fd, .events = POLLIN };
+    int total = 0;
+
+    while (total < max && poll(&pfd, 1, total ? 0 : 100) > 0) {
+        ssize_t n = read(pfd.fd, out + total, (max - total) * sizeof(*out));
+        if (n <= 0) {
+            break;
+        }
+        total += n / sizeof(*out);
+    }
+    return total;
+}
+
+/* Write raw events into a pipe-backed source device */
+static void inject(input_device_t *dev, uint16_t type, uint16_t code, int32_t value) {
+    struct input_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    if (write(dev->peer_fd, &ev, sizeof(ev)) != sizeof(ev)) {
+        perror("inject");
+    }
+}
+
+static int callback_hits = 0;
+static uint16_t callback_last_code = 0;
+
+static void count_callback(uint16_t key_code, int32_t value, void *user_data) {
+    (void)value;
+    (void)user_data;
+    callback_hits++;
+    callback_last_code = key_code;
+}
+
+/* vkbd_process_key emits the key followed by SYN_REPORT */
+static void test_process_key(void) {
+    vkbd_context_t ctx;
+    struct input_event out[8];
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(vkbd_register_callback(&ctx, count_callback, NULL) >= 0);
+
+    callback_hits = 0;
+    CHECK(vkbd_process_key(&ctx, KEY_A, 1) == 0);
+    CHECK(callback_hits == 1);
+    CHECK(callback_last_code == KEY_A);
+
+    int n = read_output(&ctx, out, 8);
+    CHECK(n == 2);
+    CHECK(out[0].type == EV_KEY && out[0].code == KEY_A && out[0].value == 1);
+    CHECK(out[1].type == EV_SYN && out[1].code == SYN_REPORT);
+
+    vkbd_destroy(&ctx);
+}
+
+/* Count key events by value over everything the output has written so far */
+static void tally_output(vkbd_context_t *ctx, uint16_t code, int counts[3], int *last) {
+    struct input_event out[256];
+    struct pollfd pfd = { .fd = ctx->device.peer_fd, .events = POLLIN };
+
+    while (poll(&pfd, 1, 0) > 0) {
+        ssize_t n = read(pfd.fd, out, sizeof(out)) / (ssize_t)sizeof(out[0]);
+        if (n <= 0) {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (out[i].type == EV_KEY && out[i].code == code && out[i].value >= 0 && out[i].value <= 2) {
+                counts[out[i].value]++;
+                *last = out[i].value;
+            }
+        }
+    }
+}
+
+/* Output queue: a full device defers instead of spinning, repeats collapse, transitions survive */
+static void test_output_queue(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    int counts[3] = { 0, 0, 0 };
+    int last = -1;
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(fcntl(ctx.device.fd, F_SETPIPE_SZ, 4096) >= 0);   /* ~170 events */
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "storm") == 0);
+    input_device_t *dev = &listener.devices[0];
+
+    /* A held key repeating while nothing reads the output */
+    inject(dev, EV_KEY, KEY_W, 1);
+    inject(dev, EV_SYN, SYN_REPORT, 0);
+    event_listener_poll(&listener, 0);
+    for (int i = 0; i < 400; i++) {
+        inject(dev, EV_KEY, KEY_W, 2);
+        inject(dev, EV_SYN, SYN_REPORT, 0);
+        event_listener_poll(&listener, 0);
+    }
+    inject(dev, EV_KEY, KEY_W, 0);
+    inject(dev, EV_SYN, SYN_REPORT, 0);
+    event_listener_poll(&listener, 0);
+
+    CHECK(counter_get(&ctx.counters.deferred) > 0 && counter_get(&ctx.counters.coalesced) > 300);
+    CHECK(counter_get(&ctx.counters.overflows) == 0 && counter_get(&ctx.counters.write_errors) == 0);
+    CHECK(vkbd_backlog(&ctx) > 0 && vkbd_backlog(&ctx) <= 4);
+
+    /* Reading makes room; the listener's EPOLLOUT source writes the rest */
+    tally_output(&ctx, KEY_W, counts, &last);
+    for (int i = 0; i < 10 && vkbd_backlog(&ctx) > 0; i++) {
+        event_listener_poll(&listener, 20);
+    }
+    CHECK(vkbd_backlog(&ctx) == 0);
+    tally_output(&ctx, KEY_W, counts, &last);
+    CHECK(counts[1] == 1 && counts[0] == 1 && last == 0 && counts[2] < 400);
+    bool watched = false;
+    for (int i = 0; i < MAX_LISTENER_SOURCES; i++) {
+        watched |= listener.sources[i].active && listener.sources[i].fd == ctx.device.fd;
+    }
+    CHECK(!watched);
+
+    /* Fills the queue itself: repeats make way, every press and release is kept */
+    for (int i = 0; i < 250; i++) {
+        vkbd_process_key(&ctx, KEY_E, 1);
+        vkbd_process_key(&ctx, KEY_E, 2);
+        vkbd_process_key(&ctx, KEY_E, 0);
+    }
+    CHECK(vkbd_backlog(&ctx) > 0 && counter_get(&ctx.counters.overflows) == 0);
+    memset(counts, 0, sizeof(counts));
+    while (vkbd_backlog(&ctx) > 0) {
+        tally_output(&ctx, KEY_E, counts, &last);
+        CHECK(vkbd_drain(&ctx) >= 0);
+    }
+    tally_output(&ctx, KEY_E, counts, &last);
+    CHECK(counts[1] == 250 && counts[0] == 250 && counts[2] < 250 && last == 0);
+    CHECK(counter_get(&ctx.counters.write_errors) == 0);
+
+    /* More transitions than the queue starts with: it grows, none are lost */
+    for (int i = 0; i < 1000; i++) {
+        vkbd_process_key(&ctx, KEY_R, 1);
+        vkbd_process_key(&ctx, KEY_R, 0);
+    }
+    CHECK(vkbd_backlog(&ctx) > VKBD_OUT_QUEUE && ctx.outq.size > VKBD_OUT_QUEUE);
+    CHECK(counter_get(&ctx.counters.overflows) == 0);
+    memset(counts, 0, sizeof(counts));
+    while (vkbd_backlog(&ctx) > 0) {
+        tally_output(&ctx, KEY_R, counts, &last);
+        CHECK(vkbd_drain(&ctx) >= 0);
+    }
+    tally_output(&ctx, KEY_R, counts, &last);
+    CHECK(counts[1] == 1000 && counts[0] == 1000 && counts[2] == 0 && last == 0);
+    CHECK(counter_get(&ctx.counters.write_errors) == 0);
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* Backpressure: past the high-water mark the sources are left unread, never a blocking flush */
+static void test_backpressure(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    int counts[3] = { 0, 0, 0 };
+    int last = -1;
+    int pairs = 0;
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(fcntl(ctx.device.fd, F_SETPIPE_SZ, 4096) >= 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "flood") == 0);
+    input_device_t *dev = &listener.devices[0];
+
+    /* Transitions only, so nothing can be coalesced away */
+    for (int round = 0; round < 20 && !dev->paused; round++) {
+        for (int i = 0; i < 200; i++, pairs++) {
+            inject(dev, EV_KEY, KEY_T, 1);
+            inject(dev, EV_SYN, SYN_REPORT, 0);
+            inject(dev, EV_KEY, KEY_T, 0);
+            inject(dev, EV_SYN, SYN_REPORT, 0);
+        }
+        event_listener_poll(&listener, 0);
+    }
+    CHECK(dev->paused && vkbd_backlog(&ctx) >= VKBD_OUT_HIGH_WATER);
+
+    /* Paused: more input stays in the source's buffer */
+    unsigned long read_before = counter_get(&dev->events);
+    for (int i = 0; i < 200; i++, pairs++) {
+        inject(dev, EV_KEY, KEY_T, 1);
+        inject(dev, EV_SYN, SYN_REPORT, 0);
+        inject(dev, EV_KEY, KEY_T, 0);
+        inject(dev, EV_SYN, SYN_REPORT, 0);
+    }
+    event_listener_poll(&listener, 0);
+    CHECK(counter_get(&dev->events) == read_before);
+
+    /* Reading the output drains the queue; below the low-water mark the source is read again */
+    for (int i = 0; i < 2000 && (vkbd_backlog(&ctx) > 0 || counts[0] < pairs); i++) {
+        tally_output(&ctx, KEY_T, counts, &last);
+        event_listener_poll(&listener, 10);
+    }
+    tally_output(&ctx, KEY_T, counts, &last);
+    CHECK(!dev->paused && vkbd_backlog(&ctx) == 0);
+    CHECK(counts[1] == pairs && counts[0] == pairs && last == 0);
+    CHECK(counter_get(&ctx.counters.overflows) == 0 && counter_get(&ctx.counters.write_errors) == 0);
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+typedef struct {
+    int calls;
+    int events;
+    int largest;
+} batch_tally_t;
+
+static void tally_batch(vkbd_context_t *ctx, const struct input_event *events, int count, void *user_data) {
+    batch_tally_t *t = user_data;
+    (void)ctx;
+    (void)events;
+    t->calls++;
+    t->events += count;
+    if (count > t->largest) {
+        t->largest = count;
+    }
+}
+
+static void count_adapted_key(uint16_t keycode, int value, void *user_data) {
+    (void)keycode;
+    (void)value;
+    (*(int *)user_data)++;
+}
+
+/* Batch handlers: one call per read, adapter for per-key callbacks */
+static void test_batch(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    batch_tally_t tally = { 0, 0, 0 };
+    int keys = 0;
+    vkbd_key_adapter_t adapter = { count_adapted_key, &keys };
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "batch") == 0);
+    input_device_t *dev = &listener.devices[0];
+
+    int id = vkbd_register_batch_handler(&ctx, tally_batch, &tally);
+    int aid = vkbd_register_batch_handler(&ctx, vkbd_key_adapter, &adapter);
+    CHECK(id >= 0 && aid >= 0 && id != aid);
+    CHECK(vkbd_register_batch_handler(&ctx, NULL, NULL) == -1);
+
+    /* Four frames in the pipe: one read, one call */
+    for (int i = 0; i < 4; i++) {
+        inject(dev, EV_MSC, MSC_SCAN, 0x1e);
+        inject(dev, EV_KEY, KEY_A, i % 2 == 0);
+        inject(dev, EV_SYN, SYN_REPORT, 0);
+    }
+    CHECK(event_listener_poll(&listener, 0) > 0);
+    CHECK(tally.calls == 1 && tally.events == 12 && tally.largest == 12);
+    CHECK(keys == 4);
+    struct input_event out[16];
+    CHECK(read_output(&ctx, out, 16) == 8);
+
+    /* A single key is a span of one */
+    CHECK(vkbd_process_key(&ctx, KEY_B, 1) == 0);
+    CHECK(tally.calls == 2 && tally.events == 13 && keys == 5);
+
+    /* Only the caller flushes */
+    struct input_event span[2] = {
+        { .type = EV_KEY, .code = KEY_B, .value = 0 },
+        { .type = EV_SYN, .code = SYN_REPORT, .value = 0 },
+    };
+    CHECK(vkbd_process_batch(&ctx, span, 2) == 0);
+    CHECK(vkbd_process_batch(&ctx, span, 0) == 0);
+    CHECK(tally.calls == 3 && keys == 6);
+    CHECK(vkbd_flush(&ctx) == 0);
+    CHECK(read_output(&ctx, out, 16) == 4);
+
+    /* A callback ID is not a batch handler ID; a removed handler is not called again */
+    int cb = vkbd_register_callback(&ctx, count_adapted_key, &keys);
+    CHECK(vkbd_unregister_batch_handler(&ctx, cb) == -1);
+    CHECK(vkbd_unregister_callback(&ctx, cb) == 0);
+    CHECK(vkbd_unregister_batch_handler(&ctx, id) == 0);
+    CHECK(vkbd_unregister_batch_handler(&ctx, id) == -1);
+    CHECK(vkbd_process_key(&ctx, KEY_C, 1) == 0);
+    CHECK(tally.calls == 3 && keys == 7);
+    CHECK(vkbd_unregister_batch_handler(&ctx, aid) == 0);
+    CHECK(vkbd_process_key(&ctx, KEY_C, 0) == 0);
+    CHECK(keys == 7);
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* Source device -> listener -> virtual device */
+static void test_listener_forwarding(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    struct input_event out[16];
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-source") == 0);
+    CHECK(listener.device_count == 1);
+
+    input_device_t *src = &listener.devices[0];
+    inject(src, EV_MSC, MSC_SCAN, 0x1e);
+    inject(src, EV_KEY, KEY_B, 1);
+    inject(src, EV_SYN, SYN_REPORT, 0);
+    inject(src, EV_KEY, KEY_B, 0);
+    inject(src, EV_SYN, SYN_REPORT, 0);
+
+    CHECK(event_listener_poll(&listener, 100) == 2);
+
+    int n = read_output(&ctx, out, 16);
+    int keys = 0;
+    for (int i = 0; i < n; i++) {
+        if (out[i].type == EV_KEY) {
+            CHECK(out[i].code == KEY_B);
+            CHECK(out[i].value == (keys == 0 ? 1 : 0));
+            keys++;
+        }
+        CHECK(out[i].type != EV_MSC);
+    }
+    CHECK(keys == 2);
+    CHECK(n > 0 && out[n - 1].type == EV_SYN);
+
+    /* Nothing pending: poll times out without processing */
+    CHECK(event_listener_poll(&listener, 0) == 0);
+
+    /* Stop wakes a poll that would otherwise block forever */
+    event_listener_stop(&listener);
+    CHECK(event_listener_poll(&listener, -1) == 0);
+    CHECK(!atomic_load(&listener.running));
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* A chord read in one go comes out as one frame with one timestamp */
+static void test_batched_chord(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    struct input_event out[16];
+    static const uint16_t chord[] = { KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_T };
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-chord") == 0);
+
+    for (int i = 0; i < 4; i++) {
+        inject(&listener.devices[0], EV_KEY, chord[i], 1);
+    }
+    inject(&listener.devices[0], EV_SYN, SYN_REPORT, 0);
+
+    CHECK(event_listener_poll(&listener, 100) == 4);
+
+    int n = read_output(&ctx, out, 16);
+    CHECK(n == 5);
+    for (int i = 0; i < 4 && i < n; i++) {
+        CHECK(out[i].type == EV_KEY && out[i].code == chord[i] && out[i].value == 1);
+        CHECK(out[i].time.tv_sec == out[4].time.tv_sec && out[i].time.tv_usec == out[4].time.tv_usec);
+    }
+    CHECK(n == 5 && out[4].type == EV_SYN && out[4].code == SYN_REPORT);
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* Per-source outputs: created by the test, counted, pipe-backed */
+static int outputs_created = 0;
+static int outputs_destroyed = 0;
+
+static vkbd_context_t *create_output(const input_device_t *dev, void *user_data) {
+    (void)user_data;
+    vkbd_context_t *out = malloc(sizeof(*out));
+    if (!out || vkbd_init_backend(out, dev->name, &vkbd_backend_pipe) < 0) {
+        free(out);
+        return NULL;
+    }
+    outputs_created++;
+    return out;
+}
+
+static void destroy_output(vkbd_context_t *out, void *user_data) {
+    (void)user_data;
+    vkbd_destroy(out);
+    free(out);
+    outputs_destroyed++;
+}
+
+static const listener_output_ops_t test_output_ops = {
+    .create = create_output,
+    .destroy = destroy_output,
+};
+
+/* Routing table and per-source outputs; our own outputs are never sources */
+static void test_routing(void) {
+    vkbd_context_t ctx, left;
+    event_listener_t listener;
+    listener_match_t rule;
+    struct input_event out[16];
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(vkbd_init_backend(&left, "Quick Test Left", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+
+    CHECK(listener_match_parse("name=left-*", &rule) == 0);
+    CHECK(event_listener_add_route(&listener, &rule, &left) == 0);
+    CHECK(event_listener_add_route(&listener, &rule, NULL) == -1);
+    CHECK(event_listener_add_device(&listener, "left-kbd") == 0);
+    CHECK(event_listener_add_device(&listener, "right-kbd") == 0);
+    CHECK(listener.devices[0].out == &left && listener.devices[1].out == &ctx);
+
+    /* One round, one write per output */
+    inject(&listener.devices[0], EV_KEY, KEY_A, 1);
+    inject(&listener.devices[0], EV_SYN, SYN_REPORT, 0);
+    inject(&listener.devices[1], EV_KEY, KEY_B, 1);
+    inject(&listener.devices[1], EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 2);
+    CHECK(listener.pending_count == 0);
+    int n = read_output(&left, out, 16);
+    CHECK(n == 2 && out[0].code == KEY_A && counter_get(&left.counters.writes) == 1);
+    n = read_output(&ctx, out, 16);
+    CHECK(n == 2 && out[0].code == KEY_B && counter_get(&ctx.counters.writes) == 1);
+
+    /* Unrouted sources get an output of their own, released with them */
+    outputs_created = outputs_destroyed = 0;
+    event_listener_set_outputs(&listener, &test_output_ops, NULL);
+    CHECK(event_listener_add_device(&listener, "solo-kbd") == 0);
+    CHECK(event_listener_add_device(&listener, "left-2") == 0);
+    input_device_t *solo = &listener.devices[2];
+    CHECK(outputs_created == 1 && solo->owns_out && solo->out != &ctx);
+    CHECK(listener.devices[3].out == &left && !listener.devices[3].owns_out);
+
+    inject(solo, EV_KEY, KEY_C, 1);
+    inject(solo, EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 1);
+    n = read_output(solo->out, out, 16);
+    CHECK(n == 2 && out[0].code == KEY_C);
+
+    /* Feedback guard: the outputs' event nodes are refused */
+    snprintf(left.device.node, sizeof(left.device.node), "quick-test-left-node");
+    snprintf(solo->out->device.node, sizeof(solo->out->device.node), "quick-test-solo-node");
+    CHECK(event_listener_add_device(&listener, "quick-test-left-node") == -1);
+    CHECK(event_listener_add_device(&listener, "quick-test-solo-node") == -1);
+    CHECK(outputs_created == 1 && listener.device_count == 4);
+
+    /* A released source takes its output with it; the next one gets a new one */
+    CHECK(event_listener_remove_device(&listener, "solo-kbd") == 0);
+    CHECK(outputs_destroyed == 1 && solo->out == NULL);
+    CHECK(event_listener_add_device(&listener, "solo-2") == 0);
+    CHECK(outputs_created == 2);
+
+    event_listener_destroy(&listener);
+    CHECK(outputs_destroyed == 2);
+    vkbd_destroy(&left);
+    vkbd_destroy(&ctx);
+}
+
+/* Unplugged devices are released and their slots reused */
+static void test_device_slots(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    struct input_event out[16];
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-a") == 0);
+    CHECK(event_listener_add_device(&listener, "quick-test-b") == 0);
+    CHECK(event_listener_add_device(&listener, "quick-test-a") < 0);
+    CHECK(listener.device_count == 2);
+
+    /* Closing the writer is an unplug: queued events still get through */
+    inject(&listener.devices[0], EV_KEY, KEY_A, 1);
+    close(listener.devices[0].peer_fd);
+    listener.devices[0].peer_fd = -1;
+    CHECK(event_listener_poll(&listener, 100) == 1);
+    CHECK(read_output(&ctx, out, 16) == 2);
+    CHECK(!listener.devices[0].active && listener.devices[0].fd == -1);
+    CHECK(listener.device_count == 1);
+
+    /* The freed slot is taken first */
+    CHECK(event_listener_add_device(&listener, "quick-test-c") == 0);
+    CHECK(listener.devices[0].active && strcmp(listener.devices[0].path, "quick-test-c") == 0);
+    inject(&listener.devices[0], EV_KEY, KEY_C, 1);
+    CHECK(event_listener_poll(&listener, 100) == 1);
+    CHECK(read_output(&ctx, out, 16) == 2 && out[0].code == KEY_C);
+
+    CHECK(event_listener_remove_device(&listener, "quick-test-b") == 0);
+    CHECK(event_listener_remove_device(&listener, "quick-test-b") < 0);
+    CHECK(listener.device_count == 1);
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* Wait for `want` key events from another thread (code*10 + value) */
+static int wait_keys(vkbd_context_t *ctx, int *keys, int want) {
+    struct input_event out[64];
+    int count = 0;
+
+    while (count < want) {
+        int n = read_output(ctx, out, 64);
+        if (n == 0) {
+            break;  /* 100 ms without output */
+        }
+        for (int i = 0; i < n && count < want; i++) {
+            if (out[i].type == EV_KEY) {
+                keys[count++] = out[i].code * 10 + out[i].value;
+            }
+        }
+    }
+    return count;
+}
+
+static void *pipelined_thread(void *arg) {
+    event_listener_run_pipelined(arg);
+    return NULL;
+}
+
+/* Reader thread -> ring -> writer thread, in order, disconnects included */
+static void test_pipelined(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    pthread_t tid;
+    int keys[64];
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-pipe-a") == 0);
+    CHECK(event_listener_add_device(&listener, "quick-test-pipe-b") == 0);
+
+    /* The test keeps b's write end: closing it is the unplug */
+    int unplug_fd = listener.devices[1].peer_fd;
+    listener.devices[1].peer_fd = -1;
+    CHECK(pthread_create(&tid, NULL, pipelined_thread, &listener) == 0);
+
+    for (int i = 0; i < 10; i++) {
+        inject(&listener.devices[0], EV_KEY, KEY_A + i, 1);
+        inject(&listener.devices[0], EV_KEY, KEY_A + i, 0);
+        inject(&listener.devices[0], EV_SYN, SYN_REPORT, 0);
+    }
+    int n = wait_keys(&ctx, keys, 20);
+    CHECK(n == 20);
+    for (int i = 0; i < n && i < 20; i++) {
+        CHECK(keys[i] == (KEY_A + i / 2) * 10 + !(i & 1));
+    }
+
+    /* Unplug b: the reader queues the hangup ahead of anything read later,
+     * so once Z comes out the writer has released b */
+    close(unplug_fd);
+    usleep(20000);
+    inject(&listener.devices[0], EV_KEY, KEY_Z, 1);
+    CHECK(wait_keys(&ctx, keys, 1) == 1 && keys[0] == KEY_Z * 10 + 1);
+
+    event_listener_stop(&listener);
+    pthread_join(tid, NULL);
+
+    CHECK(!listener.devices[1].active);
+    CHECK(listener.device_count == 1);
+    CHECK(listener.pipeline == NULL);
+    CHECK(listener.pipeline_stats.events >= 32);
+    CHECK(listener.pipeline_stats.batches > 0);
+    CHECK(listener.pipeline_stats.max_depth > 0);
+
+    /* Devices are back in the plain epoll set */
+    inject(&listener.devices[0], EV_KEY, KEY_Z, 0);
+    CHECK(event_listener_poll(&listener, 100) == 1);
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+static void *uring_thread(void *arg) {
+    event_listener_run_uring(arg);
+    return NULL;
+}
+
+/* Extra source on the io_uring engine: emits KEY_X when poked */
+static void poke_handler(event_listener_t *listener, uint32_t events, void *user_data) {
+    (void)events;
+    uint64_t value;
+    if (read(*(int *)user_data, &value, sizeof(value)) == sizeof(value)) {
+        vkbd_emit(listener->vkbd_ctx, EV_KEY, KEY_X, 1);
+    }
+}
+
+/* Reads and writes on one ring, extra sources polled through it, unplug */
+static void test_uring(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    pthread_t tid;
+    int keys[64];
+    uring_t probe;
+
+    if (uring_init(&probe, 4) < 0) {
+        printf("io_uring unavailable - engine not tested\n");
+        return;
+    }
+    uring_destroy(&probe);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-uring-a") == 0);
+    CHECK(event_listener_add_device(&listener, "quick-test-uring-b") == 0);
+
+    int poke_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK(event_listener_add_source(&listener, poke_fd, EPOLLIN, poke_handler, &poke_fd) == 0);
+
+    int unplug_fd = listener.devices[1].peer_fd;
+    listener.devices[1].peer_fd = -1;
+    CHECK(pthread_create(&tid, NULL, uring_thread, &listener) == 0);
+
+    /* Both devices, in order per device */
+    for (int i = 0; i < 10; i++) {
+        inject(&listener.devices[0], EV_KEY, KEY_A + i, 1);
+        inject(&listener.devices[0], EV_KEY, KEY_A + i, 0);
+        inject(&listener.devices[0], EV_SYN, SYN_REPORT, 0);
+    }
+    int n = wait_keys(&ctx, keys, 20);
+    CHECK(n == 20);
+    for (int i = 0; i < n && i < 20; i++) {
+        CHECK(keys[i] == (KEY_A + i / 2) * 10 + !(i & 1));
+    }
+
+    struct input_event ev = { .type = EV_KEY, .code = KEY_B, .value = 1 };
+    CHECK(write(unplug_fd, &ev, sizeof(ev)) == sizeof(ev));
+    CHECK(wait_keys(&ctx, keys, 1) == 1 && keys[0] == KEY_B * 10 + 1);
+
+    /* Sources still run on the loop thread */
+    uint64_t one = 1;
+    CHECK(write(poke_fd, &one, sizeof(one)) == sizeof(one));
+    CHECK(wait_keys(&ctx, keys, 1) == 1 && keys[0] == KEY_X * 10 + 1);
+
+    /* Unplug b: its read returns EOF and the slot is released */
+    close(unplug_fd);
+    usleep(20000);
+    inject(&listener.devices[0], EV_KEY, KEY_Z, 1);
+    CHECK(wait_keys(&ctx, keys, 1) == 1 && keys[0] == KEY_Z * 10 + 1);
+
+    event_listener_stop(&listener);
+    pthread_join(tid, NULL);
+
+    CHECK(!listener.devices[1].active);
+    CHECK(listener.device_count == 1);
+    CHECK(listener.uring == NULL);
+    CHECK(ctx.sink == NULL);
+    CHECK(listener.uring_stats.reads >= 3);
+    CHECK(listener.uring_stats.writes >= 3);
+    /* Each enter submits and waits at once - never more enters than completions */
+    CHECK(listener.uring_stats.enters <= listener.uring_stats.completions);
+
+    /* Devices are back in the plain epoll set */
+    inject(&listener.devices[0], EV_KEY, KEY_Z, 0);
+    CHECK(event_listener_poll(&listener, 100) == 1);
+
+    event_listener_remove_source(&listener, poke_fd);
+    close(poke_fd);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* io_uring engine on a full device: the write waits on a poll, overflow goes to the output queue */
+static void test_uring_backlog(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    pthread_t tid;
+    int counts[3] = { 0, 0, 0 };
+    int last = -1;
+    uring_t probe;
+
+    if (uring_init(&probe, 4) < 0) {
+        printf("io_uring unavailable - engine not tested\n");
+        return;
+    }
+    uring_destroy(&probe);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(fcntl(ctx.device.fd, F_SETPIPE_SZ, 4096) >= 0);   /* ~170 events */
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-uring-full") == 0);
+    input_device_t *dev = &listener.devices[0];
+    CHECK(pthread_create(&tid, NULL, uring_thread, &listener) == 0);
+
+    /* Far more than the pipe and both write buffers hold, nothing reading */
+    const int pairs = 500;
+    for (int i = 0; i < pairs; i++) {
+        inject(dev, EV_KEY, KEY_U, 1);
+        inject(dev, EV_SYN, SYN_REPORT, 0);
+        inject(dev, EV_KEY, KEY_U, 0);
+        inject(dev, EV_SYN, SYN_REPORT, 0);
+        if (i % 100 == 99) {
+            usleep(5000);
+        }
+    }
+    usleep(50000);
+    CHECK(counter_get(&ctx.counters.deferred) > 0);
+
+    /* The stalled write waits for POLLOUT instead of being resubmitted */
+    unsigned long before = __atomic_load_n(&listener.uring_stats.completions, __ATOMIC_RELAXED);
+    usleep(50000);
+    CHECK(__atomic_load_n(&listener.uring_stats.completions, __ATOMIC_RELAXED) - before < 5);
+
+    /* Reading makes room: completions drain the queue into the freed buffers */
+    for (int i = 0; i < 200 && counts[0] < pairs; i++) {
+        tally_output(&ctx, KEY_U, counts, &last);
+        usleep(1000);
+    }
+
+    event_listener_stop(&listener);
+    pthread_join(tid, NULL);
+
+    CHECK(counts[1] == pairs && counts[0] == pairs && last == 0);
+    CHECK(vkbd_backlog(&ctx) == 0 && counter_get(&ctx.counters.write_errors) == 0);
+    CHECK(listener.uring_stats.write_deferrals > 0);
+    CHECK(ctx.sink == NULL);
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* read() -> filters -> write(): no allocation, no stdio */
+static void test_hot_path_quiet(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    layer_engine_t *layers = malloc(sizeof(*layers));
+    struct input_event out[64];
+    int capture[2];
+    rt_config_t rt = { .priority = 0, .cpu = -1, .lock_memory = false, .stack_prefault = 64 * 1024 };
+
+    /* Pin to a CPU we are allowed on, and give the rest of the run its mask back */
+    cpu_set_t allowed;
+    CHECK(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    for (int cpu = 0; cpu < CPU_SETSIZE && rt.cpu < 0; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            rt.cpu = cpu;
+        }
+    }
+    CHECK(rt_apply(&rt) == 0);
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-quiet") == 0);
+    CHECK(vkbd_register_callback(&ctx, count_callback, NULL) >= 0);
+    layer_engine_init(layers);
+    layer_set_key(layers, 0, KEY_CAPSLOCK, KEY_ESC);
+    CHECK(layer_engine_attach(layers, &ctx) == 0);
+
+    /* Anything printed while armed ends up in the capture pipe */
+    CHECK(pipe2(capture, O_NONBLOCK) == 0);
+    fflush(stdout);
+    fflush(stderr);
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+
+    int processed = 0, produced = 0;
+    dup2(capture[1], STDOUT_FILENO);
+    dup2(capture[1], STDERR_FILENO);
+    alloc_hits = 0;
+    alloc_armed = 1;
+    for (int round = 0; round < 32; round++) {
+        for (int i = 0; i < 8; i++) {
+            inject(&listener.devices[0], EV_KEY, i & 1 ? KEY_A : KEY_CAPSLOCK, !((i >> 1) & 1));
+        }
+        inject(&listener.devices[0], EV_SYN, SYN_REPORT, 0);
+        processed += event_listener_poll(&listener, 100);
+        produced += read_output(&ctx, out, 64);
+    }
+    alloc_armed = 0;
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    char c;
+    CHECK(alloc_hits == 0);
+    CHECK(read(capture[0], &c, 1) < 0);
+    CHECK(processed == 32 * 8);
+    CHECK(produced == 32 * 9);
+    close(capture[0]);
+    close(capture[1]);
+
+    layer_engine_detach(layers);
+    free(layers);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+    CHECK(pthread_setaffinity_np(pthread_self(), sizeof(allowed), &allowed) == 0);
+}
+
+/* Remap CapsLock, drop F1, turn F2 into a Ctrl+C tap */
+static vkbd_verdict_t chain_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)user_data;
+    switch (ev->code) {
+        case KEY_CAPSLOCK:
+            ev->code = KEY_ESC;
+            return VKBD_FILTER_PASS;
+        case KEY_F1:
+            return VKBD_FILTER_DROP;
+        case KEY_F2:
+            if (ev->value == 1) {
+                vkbd_emit(ctx, EV_KEY, KEY_LEFTCTRL, 1);
+                vkbd_emit(ctx, EV_KEY, KEY_C, 1);
+                vkbd_emit(ctx, EV_KEY, KEY_C, 0);
+                vkbd_emit(ctx, EV_KEY, KEY_LEFTCTRL, 0);
+            }
+            return VKBD_FILTER_DROP;
+        default:
+            return VKBD_FILTER_PASS;
+    }
+}
+
+/* Second stage sees the first stage's output */
+static int second_stage_escapes = 0;
+
+static vkbd_verdict_t count_escape_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)ctx;
+    (void)user_data;
+    second_stage_escapes += (ev->code == KEY_ESC);
+    return VKBD_FILTER_PASS;
+}
+
+/* The output is exactly what the filter chain produced */
+static void test_filter_chain(void) {
+    vkbd_context_t ctx;
+    struct input_event out[16];
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(vkbd_register_filter(&ctx, chain_filter, NULL) == 0);
+    CHECK(vkbd_register_filter(&ctx, count_escape_filter, NULL) == 1);
+
+    second_stage_escapes = 0;
+    CHECK(vkbd_process_key(&ctx, KEY_CAPSLOCK, 1) == 0);
+    CHECK(second_stage_escapes == 1);
+    int n = read_output(&ctx, out, 16);
+    CHECK(n == 2);
+    CHECK(out[0].type == EV_KEY && out[0].code == KEY_ESC && out[0].value == 1);
+
+    /* Dropped: nothing written at all */
+    CHECK(vkbd_process_key(&ctx, KEY_F1, 1) == 0);
+    struct pollfd pfd = { .fd = ctx.device.peer_fd, .events = POLLIN };
+    CHECK(poll(&pfd, 1, 0) == 0);
+
+    /* Emitted events replace the original in one frame */
+    CHECK(vkbd_process_key(&ctx, KEY_F2, 1) == 0);
+    n = read_output(&ctx, out, 16);
+    CHECK(n == 5);
+    CHECK(out[0].code == KEY_LEFTCTRL && out[0].value == 1);
+    CHECK(out[1].code == KEY_C && out[1].value == 1);
+    CHECK(out[2].code == KEY_C && out[2].value == 0);
+    CHECK(out[3].code == KEY_LEFTCTRL && out[3].value == 0);
+    CHECK(out[4].type == EV_SYN);
+
+    /* Unregistered stage no longer runs */
+    CHECK(vkbd_unregister_filter(&ctx, 0) == 0);
+    CHECK(vkbd_process_key(&ctx, KEY_CAPSLOCK, 0) == 0);
+    n = read_output(&ctx, out, 16);
+    CHECK(n == 2 && out[0].code == KEY_CAPSLOCK);
+
+    vkbd_destroy(&ctx);
+}
+
+static void nop_callback(uint16_t key_code, int32_t value, void *user_data) {
+    (void)key_code;
+    (void)value;
+    atomic_fetch_add((_Atomic int *)user_data, 1);
+}
+
+static vkbd_verdict_t pass_filter(vkbd_context_t *ctx, struct input_event *ev, void *user_data) {
+    (void)ctx;
+    (void)ev;
+    atomic_fetch_add((_Atomic int *)user_data, 1);
+    return VKBD_FILTER_PASS;
+}
+
+typedef struct {
+    vkbd_context_t *ctx;
+    _Atomic int hits;
+    _Atomic bool done;
+} churn_t;
+
+/* Control thread: add and remove plugins while keys are flowing */
+static void *churn_thread(void *arg) {
+    churn_t *c = arg;
+    for (int i = 0; i < 500; i++) {
+        int cb = vkbd_register_callback(c->ctx, nop_callback, &c->hits);
+        int f = vkbd_register_filter(c->ctx, pass_filter, &c->hits);
+        vkbd_unregister_callback(c->ctx, cb);
+        vkbd_unregister_filter(c->ctx, f);
+    }
+    atomic_store(&c->done, true);
+    return NULL;
+}
+
+/* Handler table: unbounded, compacted, swappable while dispatching */
+static void test_handler_table(void) {
+    vkbd_context_t ctx;
+    struct input_event out[64];
+    static _Atomic int hits;
+    int ids[40];
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+
+    /* Well past the old 16-entry limit */
+    atomic_store(&hits, 0);
+    for (int i = 0; i < 40; i++) {
+        ids[i] = vkbd_register_callback(&ctx, nop_callback, &hits);
+        CHECK(ids[i] >= 0);
+    }
+    CHECK(vkbd_process_key(&ctx, KEY_A, 1) == 0);
+    CHECK(atomic_load(&hits) == 40);
+
+    /* Unregistering compacts: the table holds only live entries */
+    for (int i = 0; i < 40; i += 2) {
+        CHECK(vkbd_unregister_callback(&ctx, ids[i]) == 0);
+    }
+    CHECK(vkbd_unregister_callback(&ctx, ids[0]) < 0);
+    CHECK(vkbd_unregister_filter(&ctx, ids[1]) < 0);
+    CHECK(atomic_load(&ctx.table)->callback_count == 20);
+    atomic_store(&hits, 0);
+    CHECK(vkbd_process_key(&ctx, KEY_A, 0) == 0);
+    CHECK(atomic_load(&hits) == 20);
+    for (int i = 1; i < 40; i += 2) {
+        CHECK(vkbd_unregister_callback(&ctx, ids[i]) == 0);
+    }
+    CHECK(atomic_load(&ctx.table) == NULL);
+    read_output(&ctx, out, 64);
+
+    /* Registration from another thread never stalls or corrupts dispatch */
+    churn_t churn = { .ctx = &ctx };
+    pthread_t tid;
+    int sent = 0, received = 0;
+    CHECK(pthread_create(&tid, NULL, churn_thread, &churn) == 0);
+    while (!atomic_load(&churn.done)) {
+        vkbd_process_key(&ctx, KEY_B, sent & 1 ? 0 : 1);
+        sent++;
+        int n = read_output(&ctx, out, 64);
+        for (int i = 0; i < n; i++) {
+            received += out[i].type == EV_KEY;
+        }
+    }
+    pthread_join(tid, NULL);
+    CHECK(sent == received);
+    CHECK(atomic_load(&ctx.table) == NULL);
+
+    vkbd_destroy(&ctx);
+}
+
+/* Advertised key set: given explicitly, or the legacy 1..255 default */
+static void test_capabilities(void) {
+    vkbd_context_t ctx;
+    keyset_t keys;
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(keyset_test(&ctx.device.keys, KEY_A) && keyset_test(&ctx.device.keys, MAX_KEY_CODES - 1));
+    CHECK(!keyset_test(&ctx.device.keys, KEY_RESERVED) && !keyset_test(&ctx.device.keys, KEY_FN));
+    vkbd_destroy(&ctx);
+
+    keyset_clear_all(&keys);
+    keyset_set(&keys, KEY_RESERVED);
+    keyset_set(&keys, KEY_A);
+    keyset_set(&keys, KEY_FN);
+    keyset_set(&keys, KEY_PLAYPAUSE);
+    CHECK(vkbd_init_keys(&ctx, "Quick Test", &vkbd_backend_pipe, &keys) == 0);
+    CHECK(keyset_test(&ctx.device.keys, KEY_FN) && keyset_test(&ctx.device.keys, KEY_PLAYPAUSE));
+    CHECK(!keyset_test(&ctx.device.keys, KEY_RESERVED) && !keyset_test(&ctx.device.keys, KEY_B));
+    vkbd_destroy(&ctx);
+
+    /* No /dev/input here is fine: nothing found or an error, never a crash */
+    keyset_clear_all(&keys);
+    int found = event_listener_probe_keys(NULL, 0, &keys);
+    CHECK(found != 0 || keyset_empty(&keys));
+}
+
+static void write_attr(const char *dir, const char *attr, const char *text) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fprintf(f, "%s\n", text);
+        fclose(f);
+    }
+}
+
+/* Discovery: describe a device from (fake) sysfs and match it against rules */
+static void test_discovery(void) {
+    char dir[] = "/tmp/vkbd-sysfs-XXXXXX";
+    char sub[512];
+    input_info_t info;
+    listener_match_t rule;
+    event_listener_t listener;
+    vkbd_context_t ctx;
+
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(sub, sizeof(sub), "%s/id", dir);
+    mkdir(sub, 0755);
+    snprintf(sub, sizeof(sub), "%s/capabilities", dir);
+    mkdir(sub, 0755);
+    write_attr(dir, "name", "Logitech USB Receiver");
+    write_attr(dir, "phys", "usb-0000:00:14.0-2/input0");
+    write_attr(dir, "id/bustype", "0003");
+    write_attr(dir, "id/vendor", "046d");
+    write_attr(dir, "id/product", "c52b");
+    write_attr(dir, "capabilities/ev", "120013");
+    /* Most significant long first: KEY_FN (0x1d0) in the top word, KEY_Q..KEY_P in the bottom */
+    write_attr(dir, "capabilities/key", sizeof(long) == 8 ? "10000 0 0 0 0 0 0 3ff0000"
+                                                          : "10000 0 0 0 0 0 0 0 0 0 0 0 0 0 0 3ff0000");
+
+    CHECK(input_info_from_sysfs(dir, &info) == 0);
+    CHECK(strcmp(info.name, "Logitech USB Receiver") == 0 && info.node[0] == '\0');
+    CHECK(info.bustype == BUS_USB && info.vendor == 0x046d && info.product == 0xc52b);
+    CHECK(info.has_keys && keyset_test(&info.keys, KEY_Q) && keyset_test(&info.keys, KEY_P));
+    CHECK(keyset_test(&info.keys, KEY_FN) && !keyset_test(&info.keys, KEY_A) &&
+          !keyset_test(&info.keys, KEY_ESC));
+
+    /* No capabilities: not an input device */
+    snprintf(sub, sizeof(sub), "%s/capabilities", dir);
+    CHECK(input_info_from_sysfs(sub, &info) == -1);
+    CHECK(input_info_from_sysfs(dir, &info) == 0);
+
+    CHECK(listener_match_parse("046d:c52b", &rule) == 0);
+    CHECK(rule.vendor == 0x046d && rule.product == 0xc52b && listener_match_test(&rule, &info));
+    CHECK(listener_match_parse("046d:*,phys=usb-0000:00:14.0-*", &rule) == 0);
+    CHECK(rule.product == 0 && listener_match_test(&rule, &info));
+    CHECK(listener_match_parse("*:c52c", &rule) == 0 && !listener_match_test(&rule, &info));
+    CHECK(listener_match_parse("name=*Receiver", &rule) == 0 && listener_match_test(&rule, &info));
+    CHECK(listener_match_parse("phys=usb-*-3/*", &rule) == 0 && !listener_match_test(&rule, &info));
+    CHECK(listener_match_parse("046d", &rule) == -1);
+    CHECK(listener_match_parse("046d:xyz", &rule) == -1);
+    CHECK(listener_match_parse(":c52b", &rule) == -1);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    listener_match_parse("*:*", &rule);
+    for (int i = 0; i < MAX_LISTENER_MATCHES; i++) {
+        CHECK(event_listener_add_match(&listener, &rule) == 0);
+    }
+    CHECK(event_listener_add_match(&listener, &rule) == -1);
+    CHECK(listener.match_count == MAX_LISTENER_MATCHES);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+
+    const char *attrs[] = { "name", "phys", "id/bustype", "id/vendor", "id/product",
+                            "capabilities/ev", "capabilities/key", "id", "capabilities" };
+    for (size_t i = 0; i < sizeof(attrs) / sizeof(attrs[0]); i++) {
+        snprintf(sub, sizeof(sub), "%s/%s", dir, attrs[i]);
+        remove(sub);
+    }
+    rmdir(dir);
+}
+
+/* Scoped callbacks: only the handlers subscribed to a key and value run */
+static void test_key_dispatch(void) {
+    vkbd_context_t ctx;
+    struct input_event out[64];
+    static _Atomic int caps_presses, arrows, all;
+    keyset_t arrow_keys;
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    atomic_store(&caps_presses, 0);
+    atomic_store(&arrows, 0);
+    atomic_store(&all, 0);
+
+    keyset_clear_all(&arrow_keys);
+    keyset_set(&arrow_keys, KEY_LEFT);
+    keyset_set(&arrow_keys, KEY_RIGHT);
+
+    int caps = vkbd_register_key_callback(&ctx, KEY_CAPSLOCK, VKBD_VALUE_PRESS, nop_callback, &caps_presses);
+    int arrow = vkbd_register_keyset_callback(&ctx, &arrow_keys, VKBD_VALUE_ALL, nop_callback, &arrows);
+    CHECK(caps >= 0 && arrow >= 0);
+    CHECK(vkbd_register_callback(&ctx, nop_callback, &all) >= 0);
+
+    /* Handlers that could never fire are rejected */
+    CHECK(vkbd_register_key_callback(&ctx, KEY_A, 0, nop_callback, &all) < 0);
+    CHECK(vkbd_register_key_callback(&ctx, KEY_CNT, VKBD_VALUE_PRESS, nop_callback, &all) < 0);
+
+    const vkbd_handler_table_t *t = atomic_load(&ctx.table);
+    CHECK(t->key_start[KEY_A + 1] - t->key_start[KEY_A] == 1);
+    CHECK(t->key_start[KEY_CAPSLOCK + 1] - t->key_start[KEY_CAPSLOCK] == 2);
+    CHECK(t->key_start[KEY_LEFT + 1] - t->key_start[KEY_LEFT] == 2);
+
+    vkbd_process_key(&ctx, KEY_A, 1);
+    vkbd_process_key(&ctx, KEY_A, 0);
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 1);
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 2);
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 0);
+    vkbd_process_key(&ctx, KEY_RIGHT, 1);
+    vkbd_process_key(&ctx, KEY_RIGHT, 0);
+    CHECK(atomic_load(&caps_presses) == 1);
+    CHECK(atomic_load(&arrows) == 2);
+    CHECK(atomic_load(&all) == 7);
+
+    /* Removing a scoped handler drops it from the index */
+    CHECK(vkbd_unregister_callback(&ctx, caps) == 0);
+    t = atomic_load(&ctx.table);
+    CHECK(t->key_start[KEY_CAPSLOCK + 1] - t->key_start[KEY_CAPSLOCK] == 1);
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 1);
+    CHECK(atomic_load(&caps_presses) == 1);
+    CHECK(atomic_load(&all) == 8);
+
+    read_output(&ctx, out, 64);
+    vkbd_destroy(&ctx);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Write one event stamped with a CLOCK_MONOTONIC time, like a clock-switched evdev node */
+static void inject_at(input_device_t *dev, uint64_t t, uint16_t type, uint16_t code, int32_t value) {
+    struct input_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.time.tv_sec = t / 1000000000ULL;
+    ev.time.tv_usec = (t % 1000000000ULL) / 1000;
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    if (write(dev->peer_fd, &ev, sizeof(ev)) != sizeof(ev)) {
+        perror("inject_at");
+    }
+}
+
+/* Source timestamps: latency histogram and the output time policy */
+static void test_timestamps(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    struct input_event out[16];
+    latency_hist_t lat;
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-source") == 0);
+    input_device_t *src = &listener.devices[0];
+
+    /* Default policy: stamped at flush, latency measured from the source time */
+    uint64_t t0 = monotonic_ns() - 3000000;
+    inject_at(src, t0, EV_KEY, KEY_A, 1);
+    inject_at(src, t0, EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 1);
+    uint64_t after = monotonic_ns();
+    CHECK(read_output(&ctx, out, 16) == 2);
+    uint64_t stamped = (uint64_t)out[0].time.tv_sec * 1000000000ULL + out[0].time.tv_usec * 1000ULL;
+    CHECK(stamped > t0 + 2000000 && stamped <= after);
+
+    CHECK(vkbd_get_latency(&ctx, &lat) == 0);
+    CHECK(lat.count == 1);
+    CHECK(lat.max_ns >= 3000000 && lat.max_ns < after - t0 + 1000);
+    CHECK(latency_percentile(&lat, 50.0) == lat.max_ns);
+
+    /* Source policy: the kernel timestamp goes out unchanged, SYN included */
+    vkbd_set_time_policy(&ctx, VKBD_TIME_SOURCE);
+    inject_at(src, t0, EV_KEY, KEY_A, 0);
+    inject_at(src, t0, EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 1);
+    CHECK(read_output(&ctx, out, 16) == 2);
+    CHECK(out[0].time.tv_sec == (time_t)(t0 / 1000000000ULL) &&
+          out[0].time.tv_usec == (suseconds_t)((t0 % 1000000000ULL) / 1000));
+    CHECK(out[1].type == EV_SYN && out[1].time.tv_usec == out[0].time.tv_usec);
+
+    /* Events without a source time are stamped at flush and not counted */
+    CHECK(vkbd_process_key(&ctx, KEY_B, 1) == 0);
+    CHECK(read_output(&ctx, out, 16) == 2);
+    CHECK(out[0].time.tv_sec != 0);
+    vkbd_get_latency(&ctx, &lat);
+    CHECK(lat.count == 2);
+
+    vkbd_reset_latency(&ctx);
+    vkbd_get_latency(&ctx, &lat);
+    CHECK(lat.count == 0 && lat.max_ns == 0 && latency_percentile(&lat, 99.0) == 0);
+    CHECK(vkbd_get_latency(NULL, &lat) < 0);
+
+    /* A key the full device had to queue is measured when it is written, not flushed */
+    int counts[3] = { 0, 0, 0 };
+    int last = -1;
+    CHECK(fcntl(ctx.device.fd, F_SETPIPE_SZ, 4096) >= 0);
+    for (int i = 0; i < 200 && vkbd_backlog(&ctx) == 0; i++) {
+        vkbd_process_key(&ctx, KEY_B, i & 1);
+    }
+    CHECK(vkbd_backlog(&ctx) > 0);
+    uint64_t t1 = monotonic_ns();
+    inject_at(src, t1, EV_KEY, KEY_C, 1);
+    inject_at(src, t1, EV_SYN, SYN_REPORT, 0);
+    event_listener_poll(&listener, 100);
+    vkbd_get_latency(&ctx, &lat);
+    CHECK(lat.count == 0);
+    usleep(2000);
+    while (vkbd_backlog(&ctx) > 0) {
+        tally_output(&ctx, KEY_C, counts, &last);
+        CHECK(vkbd_drain(&ctx) >= 0);
+    }
+    tally_output(&ctx, KEY_C, counts, &last);
+    vkbd_get_latency(&ctx, &lat);
+    CHECK(counts[1] == 1 && lat.count == 1 && lat.max_ns >= 2000000);
+
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+static int observed[64];
+static _Atomic int observed_count = 0;
+
+static void record_observer(const struct input_event *ev, void *user_data) {
+    (void)user_data;
+    int i = atomic_load(&observed_count);
+    if (i < 64) {
+        observed[i] = ev->code * 10 + ev->value;
+        atomic_store(&observed_count, i + 1);
+    }
+}
+
+/* Observers see forwarded keys after the write, on their own thread */
+static void *register_observer_thread(void *arg) {
+    vkbd_context_t *ctx = arg;
+    return (void *)(intptr_t)vkbd_register_observer(ctx, record_observer, NULL);
+}
+
+static void test_observers(void) {
+    vkbd_context_t ctx;
+    struct input_event out[16];
+    vkbd_observer_stats_t stats;
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(vkbd_register_filter(&ctx, chain_filter, NULL) >= 0);
+    int id = vkbd_register_observer(&ctx, record_observer, NULL);
+    CHECK(id >= 0);
+
+    CHECK(vkbd_process_key(&ctx, KEY_CAPSLOCK, 1) == 0);   /* Filter: -> ESC */
+    CHECK(vkbd_process_key(&ctx, KEY_F1, 1) == 0);         /* Filter: dropped */
+    CHECK(vkbd_process_key(&ctx, KEY_CAPSLOCK, 0) == 0);
+    CHECK(read_output(&ctx, out, 16) == 4);
+
+    for (int i = 0; i < 100 && atomic_load(&observed_count) < 2; i++) {
+        usleep(1000);
+    }
+    CHECK(atomic_load(&observed_count) == 2);
+    CHECK(observed[0] == KEY_ESC * 10 + 1 && observed[1] == KEY_ESC * 10 + 0);
+
+    vkbd_get_observer_stats(&ctx, &stats);
+    CHECK(stats.delivered == 2 && stats.dropped == 0);
+
+    /* Unregistered: no longer called, nothing queued */
+    CHECK(vkbd_unregister_observer(&ctx, id) == 0);
+    CHECK(vkbd_unregister_observer(&ctx, id) < 0);
+    CHECK(vkbd_process_key(&ctx, KEY_B, 1) == 0);
+    usleep(5000);
+    CHECK(atomic_load(&observed_count) == 2);
+    vkbd_destroy(&ctx);
+
+    /* First registrations racing each other and the forwarding thread: one block, distinct IDs */
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    pthread_t tids[4];
+    int ids[4];
+    for (int i = 0; i < 4; i++) {
+        CHECK(pthread_create(&tids[i], NULL, register_observer_thread, &ctx) == 0);
+    }
+    for (int i = 0; i < 20; i++) {
+        vkbd_process_key(&ctx, KEY_Z, i % 2 == 0);
+    }
+    for (int i = 0; i < 4; i++) {
+        void *r;
+        pthread_join(tids[i], &r);
+        ids[i] = (int)(intptr_t)r;
+    }
+    unsigned seen = 0;
+    for (int i = 0; i < 4; i++) {
+        CHECK(ids[i] >= 0 && ids[i] < 4);
+        seen |= 1u << (ids[i] & 3);
+    }
+    CHECK(seen == 0xF);
+    for (int i = 0; i < 4; i++) {
+        CHECK(vkbd_unregister_observer(&ctx, ids[i]) == 0);
+    }
+    read_output(&ctx, out, 16);
+    vkbd_destroy(&ctx);
+}
+
+/* Counters published to shared memory and read back like vkbd-stat does */
+static void test_metrics(void) {
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    metrics_t metrics;
+    metrics_shm_t snap;
+    struct input_event out[16];
+    char name[64];
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-source") == 0);
+    CHECK(vkbd_register_filter(&ctx, chain_filter, NULL) >= 0);
+    input_device_t *src = &listener.devices[0];
+
+    snprintf(name, sizeof(name), "vkbd-test.%d", (int)getpid());
+    metrics_init(&metrics, name, 10);
+    CHECK(metrics_attach(&metrics, &ctx, &listener) == 0);
+
+    const metrics_shm_t *shm = metrics_open(name);
+    CHECK(shm != NULL);
+    if (!shm) {
+        metrics_detach(&metrics);
+        event_listener_destroy(&listener);
+        vkbd_destroy(&ctx);
+        return;
+    }
+    CHECK(shm->pid == getpid() && shm->interval_ms == 10);
+
+    /* A, then F1 which the filter drops */
+    inject(src, EV_KEY, KEY_A, 1);
+    inject(src, EV_SYN, SYN_REPORT, 0);
+    inject(src, EV_KEY, KEY_F1, 1);
+    inject(src, EV_SYN, SYN_REPORT, 0);
+    inject(src, EV_SYN, SYN_DROPPED, 0);
+    CHECK(event_listener_poll(&listener, 100) == 2);
+
+    /* The timer publishes on the listener thread */
+    uint64_t publishes = shm->publishes;
+    for (int i = 0; i < 20 && shm->publishes == publishes; i++) {
+        event_listener_poll(&listener, 20);
+    }
+    CHECK(metrics_read(shm, &snap) == 0);
+    CHECK(snap.publishes > publishes);
+    CHECK(snap.device_count == 1);
+    CHECK(strcmp(snap.devices[0].path, "quick-test-source") == 0);
+    CHECK(snap.devices[0].events == 5 && snap.devices[0].keys == 2);
+    CHECK(snap.writes == 1 && snap.written == 2);
+    CHECK(snap.filtered == 1 && snap.syn_dropped == 1);
+    CHECK(snap.write_errors == 0 && snap.read_errors == 0);
+    CHECK(snap.published_ns >= snap.started_ns);
+
+    /* Detaching marks the segment stopped and removes the name */
+    metrics_detach(&metrics);
+    CHECK(metrics_read(shm, &snap) == 0 && snap.pid == 0);
+    metrics_close(shm);
+    CHECK(metrics_open(name) == NULL);
+
+    read_output(&ctx, out, 16);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* Write a text keymap */
+static void write_text(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fputs(text, f);
+        fclose(f);
+    }
+}
+
+/* Compiled keymap: lookup, drop, and hot reload through the listener */
+static void test_keymap(void) {
+    char dir[] = "/tmp/vkbd-test-XXXXXX";
+    char src[64], bin[64];
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    keymap_t km;
+    struct input_event out[16];
+
+    CHECK(keymap_key_code("KEY_ESC") == KEY_ESC);
+    CHECK(keymap_key_code("capslock") == KEY_CAPSLOCK);
+    CHECK(keymap_key_code("KEY_FN") == KEY_FN);
+    CHECK(keymap_key_code("0x1d") == KEY_LEFTCTRL);
+    CHECK(keymap_key_code("nonsense") == -1);
+
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(src, sizeof(src), "%s/map.txt", dir);
+    snprintf(bin, sizeof(bin), "%s/map.bin", dir);
+
+    write_text(src, "# test\nCAPSLOCK = ESC\nKEY_FN = F13  # above 255\nINSERT = none\n");
+    CHECK(keymap_compile(src, bin) == 3);
+    write_text(src, "CAPSLOCK = NOTAKEY\n");
+    CHECK(keymap_compile(src, bin) == -1);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(keymap_init(&km, bin) == 0);
+    CHECK(keymap_attach(&km, &ctx) == 0);
+
+    CHECK(vkbd_process_key(&ctx, KEY_CAPSLOCK, 1) == 0);
+    CHECK(vkbd_process_key(&ctx, KEY_FN, 1) == 0);
+    CHECK(vkbd_process_key(&ctx, KEY_INSERT, 1) == 0);
+    CHECK(vkbd_process_key(&ctx, KEY_A, 1) == 0);
+    int n = read_output(&ctx, out, 16);
+    CHECK(n == 6);
+    CHECK(out[0].code == KEY_ESC);
+    CHECK(out[2].code == KEY_F13);
+    CHECK(out[4].code == KEY_A);
+
+    /* Capabilities to advertise: sources plus what they are remapped to */
+    keyset_t caps;
+    keyset_clear_all(&caps);
+    keyset_set(&caps, KEY_CAPSLOCK);
+    keyset_set(&caps, KEY_FN);
+    keyset_set(&caps, KEY_INSERT);
+    CHECK(keymap_add_outputs(&km, &caps) == 0);
+    CHECK(keyset_test(&caps, KEY_ESC) && keyset_test(&caps, KEY_F13));
+    CHECK(keyset_test(&caps, KEY_CAPSLOCK) && !keyset_test(&caps, KEY_RESERVED));
+    CHECK(!keyset_test(&caps, KEY_A));
+
+    /* Recompile under the running listener: the table is swapped in place */
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "quick-test-keymap") == 0);
+    CHECK(keymap_watch(&km, &listener) == 0);
+
+    write_text(src, "CAPSLOCK = LEFTCTRL\n");
+    CHECK(keymap_compile(src, bin) == 1);
+    for (int i = 0; i < 10 && km.reloads == 0; i++) {
+        event_listener_poll(&listener, 50);
+    }
+    CHECK(km.reloads == 1);
+
+    /* Held across the reload: released as pressed (ESC up, INSERT still dropped) */
+    inject(&listener.devices[0], EV_KEY, KEY_CAPSLOCK, 0);
+    inject(&listener.devices[0], EV_KEY, KEY_INSERT, 0);
+    inject(&listener.devices[0], EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 2);
+    n = read_output(&ctx, out, 16);
+    CHECK(n == 2);
+    CHECK(out[0].code == KEY_ESC && out[0].value == 0);
+
+    /* Pressed after it: the new table */
+    inject(&listener.devices[0], EV_KEY, KEY_CAPSLOCK, 1);
+    inject(&listener.devices[0], EV_KEY, KEY_CAPSLOCK, 0);
+    inject(&listener.devices[0], EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 2);
+    n = read_output(&ctx, out, 16);
+    CHECK(n == 3);
+    CHECK(out[0].code == KEY_LEFTCTRL && out[0].value == 1 && out[1].code == KEY_LEFTCTRL);
+
+    /* Rewritten in place (no rename): the live table is a copy, the reload sees the whole file */
+    char bin2[64];
+    snprintf(bin2, sizeof(bin2), "%s/other.bin", dir);
+    write_text(src, "CAPSLOCK = TAB\n");
+    CHECK(keymap_compile(src, bin2) == 1);
+    char image[2048];
+    FILE *f = fopen(bin2, "rb");
+    size_t len = f ? fread(image, 1, sizeof(image), f) : 0;
+    if (f) {
+        fclose(f);
+    }
+    f = fopen(bin, "wb");
+    CHECK(f != NULL && len > sizeof(keymap_header_t));
+    if (f) {
+        fwrite(image, 1, len, f);
+        fclose(f);
+    }
+    for (int i = 0; i < 10 && km.reloads < 2; i++) {
+        event_listener_poll(&listener, 50);
+    }
+    CHECK(km.reloads == 2);
+    CHECK(vkbd_process_key(&ctx, KEY_CAPSLOCK, 1) == 0);
+    n = read_output(&ctx, out, 16);
+    CHECK(n == 2 && out[0].code == KEY_TAB);
+    unlink(bin2);
+
+    keymap_destroy(&km);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+    unlink(src);
+    unlink(bin);
+    rmdir(dir);
+}
+
+/* Press/release one key and return the forwarded code (0 if nothing) */
+static uint16_t tap_code(vkbd_context_t *ctx, uint16_t code, int32_t value) {
+    struct input_event out[8];
+    vkbd_process_key(ctx, code, value);
+    struct pollfd pfd = { .fd = ctx->device.peer_fd, .events = POLLIN };
+    if (poll(&pfd, 1, 0) <= 0) {
+        return 0;
+    }
+    int n = read_output(ctx, out, 8);
+    return (n == 2 && out[0].value == value) ? out[0].code : 0xFFFF;
+}
+
+/* Momentary and toggle layers, and releases that survive layer changes */
+static void test_layers(void) {
+    static layer_engine_t engine;
+    vkbd_context_t ctx;
+
+    layer_engine_init(&engine);
+    CHECK(layer_set_key(&engine, 0, KEY_RIGHTALT, LAYER_MO(1)) == 0);
+    CHECK(layer_set_key(&engine, 0, KEY_SCROLLLOCK, LAYER_TG(2)) == 0);
+    CHECK(layer_set_key(&engine, 1, KEY_H, KEY_LEFT) == 0);
+    CHECK(layer_set_key(&engine, 1, KEY_J, LAYER_NONE) == 0);
+    CHECK(layer_set_key(&engine, 2, KEY_H, KEY_A) == 0);
+    CHECK(layer_set_key(&engine, 1, KEY_A, LAYER_MO(LAYER_MAX)) == -1);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(layer_engine_attach(&engine, &ctx) == 0);
+
+    CHECK(tap_code(&ctx, KEY_H, 1) == KEY_H);
+    CHECK(tap_code(&ctx, KEY_H, 0) == KEY_H);
+
+    /* Fn held: H -> LEFT, J swallowed, other keys fall through */
+    CHECK(tap_code(&ctx, KEY_RIGHTALT, 1) == 0);
+    CHECK(layer_is_active(&engine, 1));
+    CHECK(tap_code(&ctx, KEY_H, 1) == KEY_LEFT);
+    CHECK(tap_code(&ctx, KEY_H, 2) == KEY_LEFT);
+    CHECK(tap_code(&ctx, KEY_J, 1) == 0);
+    CHECK(tap_code(&ctx, KEY_K, 1) == KEY_K);
+
+    /* Fn released while H is held: H still releases as LEFT */
+    CHECK(tap_code(&ctx, KEY_RIGHTALT, 0) == 0);
+    CHECK(!layer_is_active(&engine, 1));
+    CHECK(tap_code(&ctx, KEY_H, 0) == KEY_LEFT);
+    CHECK(tap_code(&ctx, KEY_J, 0) == 0);
+    CHECK(tap_code(&ctx, KEY_K, 0) == KEY_K);
+
+    /* Toggle layer stays on until toggled again; top layer wins */
+    CHECK(tap_code(&ctx, KEY_SCROLLLOCK, 1) == 0);
+    CHECK(tap_code(&ctx, KEY_SCROLLLOCK, 0) == 0);
+    CHECK(tap_code(&ctx, KEY_H, 1) == KEY_A);
+    CHECK(tap_code(&ctx, KEY_H, 0) == KEY_A);
+    CHECK(tap_code(&ctx, KEY_RIGHTALT, 1) == 0);
+    CHECK(tap_code(&ctx, KEY_H, 1) == KEY_LEFT);
+    CHECK(tap_code(&ctx, KEY_H, 0) == KEY_LEFT);
+    CHECK(tap_code(&ctx, KEY_RIGHTALT, 0) == 0);
+    CHECK(layer_set_active(&engine, 2, false) == 0);
+    CHECK(tap_code(&ctx, KEY_H, 1) == KEY_H);
+    CHECK(tap_code(&ctx, KEY_H, 0) == KEY_H);
+    CHECK(keyset_empty(&engine.pressed));
+
+    /* Pressed twice (merged keyboards, replayed press): the second is a repeat, nothing sticks */
+    CHECK(tap_code(&ctx, KEY_RIGHTALT, 1) == 0);
+    CHECK(tap_code(&ctx, KEY_RIGHTALT, 1) == 0);
+    CHECK(engine.momentary[1] == 1);
+    CHECK(tap_code(&ctx, KEY_H, 1) == KEY_LEFT);
+    CHECK(tap_code(&ctx, KEY_H, 1) == 0xFFFF);          /* Forwarded as LEFT repeat */
+    CHECK(tap_code(&ctx, KEY_H, 0) == KEY_LEFT);
+    CHECK(tap_code(&ctx, KEY_H, 0) == 0);
+    CHECK(tap_code(&ctx, KEY_RIGHTALT, 0) == 0);
+    CHECK(!layer_is_active(&engine, 1) && engine.momentary[1] == 0);
+    CHECK(tap_code(&ctx, KEY_RIGHTALT, 0) == 0);
+    CHECK(keyset_empty(&engine.pressed));
+
+    layer_engine_detach(&engine);
+    vkbd_destroy(&ctx);
+}
+
+/* Collect forwarded key events (SYN dropped) as code*10+value */
+static int collect_keys(vkbd_context_t *ctx, int *keys, int max) {
+    struct input_event out[32];
+    struct pollfd pfd = { .fd = ctx->device.peer_fd, .events = POLLIN };
+    int count = 0;
+
+    if (poll(&pfd, 1, 0) <= 0) {
+        return 0;
+    }
+    int n = read_output(ctx, out, 32);
+    for (int i = 0; i < n && count < max; i++) {
+        if (out[i].type == EV_KEY) {
+            keys[count++] = out[i].code * 10 + out[i].value;
+        }
+    }
+    return count;
+}
+
+/* Dual-role Caps Lock: Esc on tap, Ctrl on hold */
+static void test_taphold(void) {
+    static taphold_t th;
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    int keys[16];
+
+    taphold_init(&th, 30, true);
+    CHECK(taphold_add_key(&th, KEY_CAPSLOCK, KEY_ESC, KEY_LEFTCTRL) == 0);
+    CHECK(taphold_add_key(&th, KEY_CAPSLOCK, KEY_ESC, KEY_LEFTCTRL) == -1);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    CHECK(taphold_attach(&th, &ctx, &listener) == 0);
+
+    /* Tap */
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 1);
+    CHECK(collect_keys(&ctx, keys, 16) == 0);
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 0);
+    CHECK(collect_keys(&ctx, keys, 16) == 2);
+    CHECK(keys[0] == KEY_ESC * 10 + 1 && keys[1] == KEY_ESC * 10 + 0);
+    CHECK(th.stats.taps == 1);
+
+    /* Hold: the timerfd decides, the buffered key follows in order */
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 1);
+    vkbd_process_key(&ctx, KEY_A, 1);
+    CHECK(collect_keys(&ctx, keys, 16) == 0);
+    for (int i = 0; i < 10 && th.stats.holds == 0; i++) {
+        event_listener_poll(&listener, 20);
+    }
+    CHECK(th.stats.holds == 1);
+    CHECK(th.stats.last_decision_ns >= 30000000ULL);
+    CHECK(collect_keys(&ctx, keys, 16) == 2);
+    CHECK(keys[0] == KEY_LEFTCTRL * 10 + 1 && keys[1] == KEY_A * 10 + 1);
+    vkbd_process_key(&ctx, KEY_A, 0);
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 0);
+    CHECK(collect_keys(&ctx, keys, 16) == 2);
+    CHECK(keys[0] == KEY_A * 10 + 0 && keys[1] == KEY_LEFTCTRL * 10 + 0);
+
+    /* Permissive hold: another key tapped inside the term */
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 1);
+    vkbd_process_key(&ctx, KEY_C, 1);
+    vkbd_process_key(&ctx, KEY_C, 0);
+    CHECK(collect_keys(&ctx, keys, 16) == 3);
+    CHECK(keys[0] == KEY_LEFTCTRL * 10 + 1 && keys[1] == KEY_C * 10 + 1 && keys[2] == KEY_C * 10 + 0);
+    CHECK(th.stats.holds == 2 && th.stats.last_decision_ns < 30000000ULL);
+    vkbd_process_key(&ctx, KEY_CAPSLOCK, 0);
+    CHECK(collect_keys(&ctx, keys, 16) == 1 && keys[0] == KEY_LEFTCTRL * 10 + 0);
+
+    taphold_detach(&th);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* Macros: modifier wrap, timed steps in one write per frame, cancel, record */
+static void test_macros(void) {
+    static macro_engine_t me;
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    int keys[32];
+
+    macro_init(&me, 0);
+    int m = macro_add(&me, KEY_F1, false);
+    CHECK(m == 0 && macro_add(&me, KEY_F1, false) == -1);
+    CHECK(macro_add_mod(&me, m, KEY_LEFTCTRL) == 0);
+    CHECK(macro_add_step(&me, m, KEY_A, 1, 0) == 0);
+    CHECK(macro_add_step(&me, m, KEY_A, 0, 0) == 0);
+    CHECK(macro_add_step(&me, m, KEY_B, 1, 20000) == 0);
+    CHECK(macro_add_step(&me, m, KEY_B, 0, 0) == 0);
+    CHECK(macro_add_step(&me, m, KEY_B, 2, 0) == -1);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    CHECK(macro_attach(&me, &ctx, &listener) == 0);
+
+    /* Due at once: with the hotkey's batch. The rest from the timer, in one write */
+    uint64_t start = monotonic_ns();
+    vkbd_process_key(&ctx, KEY_F1, 1);
+    vkbd_process_key(&ctx, KEY_F1, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 3);
+    CHECK(keys[0] == KEY_LEFTCTRL * 10 + 1 && keys[1] == KEY_A * 10 + 1 && keys[2] == KEY_A * 10 + 0);
+    uint64_t writes = counter_get(&ctx.counters.writes);
+    for (int i = 0; i < 10 && me.playing >= 0; i++) {
+        event_listener_poll(&listener, 20);
+    }
+    CHECK(me.playing == -1 && monotonic_ns() - start >= 20000000ULL);
+    CHECK(counter_get(&ctx.counters.writes) == writes + 1 && me.stats.frames == 1);
+    CHECK(collect_keys(&ctx, keys, 32) == 3);
+    CHECK(keys[0] == KEY_B * 10 + 1 && keys[1] == KEY_B * 10 + 0 && keys[2] == KEY_LEFTCTRL * 10 + 0);
+    CHECK(me.stats.plays == 1 && me.stats.steps == 4);
+
+    /* Released early: the held key is let go and nothing else follows */
+    m = macro_add(&me, KEY_F2, true);
+    macro_add_step(&me, m, KEY_C, 1, 0);
+    macro_add_step(&me, m, KEY_C, 0, 50000);
+    macro_add_step(&me, m, KEY_D, 1, 0);
+    macro_add_step(&me, m, KEY_D, 0, 0);
+    vkbd_process_key(&ctx, KEY_F2, 1);
+    CHECK(collect_keys(&ctx, keys, 32) == 1 && keys[0] == KEY_C * 10 + 1);
+    vkbd_process_key(&ctx, KEY_F2, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 1 && keys[0] == KEY_C * 10 + 0);
+    CHECK(me.stats.cancels == 1 && me.playing == -1);
+    event_listener_poll(&listener, 70);
+    CHECK(collect_keys(&ctx, keys, 32) == 0);
+
+    /* Record with the source timestamps' spacing, stop on the hotkey, play back */
+    m = macro_record_start(&me, KEY_F3, false);
+    CHECK(m == 2);
+    struct input_event ev = { .time = { 100, 0 }, .type = EV_KEY, .code = KEY_X, .value = 1 };
+    vkbd_queue_event(&ctx, &ev);
+    ev.value = 2;
+    vkbd_queue_event(&ctx, &ev);
+    ev.time.tv_usec = 5000;
+    ev.value = 0;
+    vkbd_queue_event(&ctx, &ev);
+    vkbd_flush(&ctx);
+    CHECK(collect_keys(&ctx, keys, 32) == 3);
+    vkbd_process_key(&ctx, KEY_F3, 1);
+    CHECK(me.recording == -1 && me.macros[m].step_count == 2);
+    CHECK(me.macros[m].steps[0].delay_us == 0 && me.macros[m].steps[1].delay_us == 5000);
+    CHECK(macro_record_stop(&me) == -1);
+
+    CHECK(macro_play(&me, m) == 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 1 && keys[0] == KEY_X * 10 + 1);
+    for (int i = 0; i < 10 && me.playing >= 0; i++) {
+        event_listener_poll(&listener, 20);
+    }
+    CHECK(collect_keys(&ctx, keys, 32) == 1 && keys[0] == KEY_X * 10 + 0);
+
+    macro_detach(&me);
+    macro_destroy(&me);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+static int combo_fired = -1;
+
+static void combo_action(vkbd_context_t *ctx, int combo, void *user_data) {
+    (void)ctx;
+    (void)user_data;
+    combo_fired = combo;
+}
+
+/* Combos: chords in any order, longer chords, broken and timed-out chords, hotkeys */
+static void test_combos(void) {
+    static combo_engine_t ce;
+    vkbd_context_t ctx;
+    event_listener_t listener;
+    int keys[32];
+
+    combo_init(&ce, 30);
+    const uint16_t jk[] = { KEY_J, KEY_K };
+    const uint16_t jkl[] = { KEY_L, KEY_K, KEY_J };
+    const uint16_t dup[] = { KEY_K, KEY_J };
+    const uint16_t ctrl_alt[] = { KEY_LEFTCTRL, KEY_LEFTALT };
+    const uint16_t ctrl[] = { KEY_LEFTCTRL };
+    int c_jk = combo_add_chord(&ce, jk, 2, KEY_ESC);
+    int c_jkl = combo_add_chord(&ce, jkl, 3, KEY_ENTER);
+    CHECK(c_jk == 0 && c_jkl == 1);
+    CHECK(combo_add_chord(&ce, dup, 2, KEY_TAB) == -1);
+    CHECK(combo_add_chord(&ce, jk, 1, KEY_TAB) == -1);
+    int h_ct = combo_add_hotkey(&ce, ctrl_alt, 2, KEY_T, 0);
+    int h_t = combo_add_hotkey(&ce, ctrl, 1, KEY_T, KEY_F5);
+    CHECK(h_ct == 2 && h_t == 3);
+    CHECK(combo_add_hotkey(&ce, ctrl, 1, KEY_T, KEY_F6) == -1);
+    CHECK(combo_set_action(&ce, h_ct, combo_action, NULL) == 0);
+    CHECK(combo_set_action(&ce, 99, combo_action, NULL) == -1);
+
+    /* A hundred more on other keys do not change the work per key */
+    for (uint16_t k = KEY_F13; k < KEY_F13 + 10; k++) {
+        for (uint16_t m = KEY_KP7; m <= KEY_KP3; m++) {
+            uint16_t pair[] = { k, m };
+            combo_add_chord(&ce, pair, 2, 0);
+        }
+    }
+    CHECK(ce.combo_count > 100);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    CHECK(combo_attach(&ce, &ctx, &listener) == 0);
+
+    /* Keys in no combo are untouched */
+    vkbd_process_key(&ctx, KEY_A, 1);
+    vkbd_process_key(&ctx, KEY_A, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 2 && ce.stats.compared == 0);
+
+    /* K+J waits for a possible L; the window closes it as a chord */
+    vkbd_process_key(&ctx, KEY_K, 1);
+    vkbd_process_key(&ctx, KEY_J, 1);
+    CHECK(collect_keys(&ctx, keys, 32) == 0);
+    for (int i = 0; i < 10 && ce.buffered > 0; i++) {
+        event_listener_poll(&listener, 20);
+    }
+    CHECK(ce.stats.chords == 1 && ce.stats.timeouts == 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 1 && keys[0] == KEY_ESC * 10 + 1);
+    vkbd_process_key(&ctx, KEY_J, 2);
+    vkbd_process_key(&ctx, KEY_J, 0);
+    vkbd_process_key(&ctx, KEY_K, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 1 && keys[0] == KEY_ESC * 10 + 0);
+
+    /* All three: fires at once, nothing longer to wait for */
+    vkbd_process_key(&ctx, KEY_J, 1);
+    vkbd_process_key(&ctx, KEY_L, 1);
+    vkbd_process_key(&ctx, KEY_K, 1);
+    CHECK(ce.buffered == 0 && ce.stats.chords == 2);
+    vkbd_process_key(&ctx, KEY_L, 0);
+    vkbd_process_key(&ctx, KEY_K, 0);
+    vkbd_process_key(&ctx, KEY_J, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 2);
+    CHECK(keys[0] == KEY_ENTER * 10 + 1 && keys[1] == KEY_ENTER * 10 + 0);
+    CHECK(ce.stats.max_compared <= 2);
+
+    /* Broken by another key: forwarded as typed, in order */
+    vkbd_process_key(&ctx, KEY_J, 1);
+    vkbd_process_key(&ctx, KEY_X, 1);
+    vkbd_process_key(&ctx, KEY_X, 0);
+    vkbd_process_key(&ctx, KEY_J, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 4);
+    CHECK(keys[0] == KEY_J * 10 + 1 && keys[1] == KEY_X * 10 + 1 && keys[3] == KEY_J * 10 + 0);
+    CHECK(ce.stats.broken == 1);
+
+    /* Held alone past the window */
+    vkbd_process_key(&ctx, KEY_K, 1);
+    for (int i = 0; i < 10 && ce.buffered > 0; i++) {
+        event_listener_poll(&listener, 20);
+    }
+    CHECK(ce.stats.timeouts == 1);
+    vkbd_process_key(&ctx, KEY_K, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 2 && keys[0] == KEY_K * 10 + 1);
+
+    /* Hotkeys: the most specific wins, modifiers are forwarded, the trigger is not -
+     * Ctrl stays down around the output, so applications see Ctrl+F5 */
+    vkbd_process_key(&ctx, KEY_LEFTCTRL, 1);
+    vkbd_process_key(&ctx, KEY_T, 1);
+    vkbd_process_key(&ctx, KEY_T, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 3);
+    CHECK(keys[0] == KEY_LEFTCTRL * 10 + 1 && keys[1] == KEY_F5 * 10 + 1 && keys[2] == KEY_F5 * 10 + 0);
+    CHECK(keyset_test(&ce.pressed, KEY_LEFTCTRL) && !keyset_test(&ce.swallowed, KEY_LEFTCTRL));
+    vkbd_process_key(&ctx, KEY_LEFTALT, 1);
+    vkbd_process_key(&ctx, KEY_T, 1);
+    vkbd_process_key(&ctx, KEY_T, 0);
+    vkbd_process_key(&ctx, KEY_LEFTALT, 0);
+    vkbd_process_key(&ctx, KEY_LEFTCTRL, 0);
+    CHECK(combo_fired == h_ct && ce.stats.hotkeys == 2);
+    CHECK(collect_keys(&ctx, keys, 32) == 3);
+
+    /* Without its modifiers the trigger is a plain key */
+    vkbd_process_key(&ctx, KEY_T, 1);
+    vkbd_process_key(&ctx, KEY_T, 0);
+    CHECK(collect_keys(&ctx, keys, 32) == 2 && keys[0] == KEY_T * 10 + 1);
+    CHECK(keyset_empty(&ce.pressed) && keyset_empty(&ce.swallowed) && ce.active_count == 0);
+
+    combo_detach(&ce);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&ctx);
+}
+
+/* Capture two sources to a file, read it back, replay it fast and paced */
+static void test_capture(void) {
+    static capture_t cap;
+    vkbd_context_t ctx, replay;
+    event_listener_t listener;
+    capture_header_t header;
+    capture_replay_stats_t rs;
+    char path[] = "/tmp/vkbd-capture-XXXXXX";
+    size_t count;
+    int keys[32];
+
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    CHECK(vkbd_init_backend(&ctx, "Quick Test", &vkbd_backend_pipe) == 0);
+    CHECK(vkbd_init_backend(&replay, "Quick Test Replay", &vkbd_backend_pipe) == 0);
+    CHECK(event_listener_init(&listener, &ctx) == 0);
+    event_listener_set_backend(&listener, &input_backend_pipe);
+    CHECK(event_listener_add_device(&listener, "cap-a") == 0);
+    CHECK(event_listener_add_device(&listener, "cap-b") == 0);
+    CHECK(capture_start(&cap, path, &listener) == 0 && listener.capture == &cap);
+
+    /* Timestamps in whole microseconds, as the kernel reports them */
+    uint64_t base = monotonic_ns() / 1000 * 1000;
+    inject_at(&listener.devices[0], base, EV_KEY, KEY_A, 1);
+    inject_at(&listener.devices[0], base, EV_SYN, SYN_REPORT, 0);
+    inject_at(&listener.devices[1], base + 10000000, EV_KEY, KEY_B, 1);
+    inject_at(&listener.devices[1], base + 10000000, EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 2);
+    inject_at(&listener.devices[0], base + 20000000, EV_KEY, KEY_A, 0);
+    inject_at(&listener.devices[0], base + 20000000, EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 1);
+    CHECK(collect_keys(&ctx, keys, 32) == 3);
+
+    capture_stop(&cap);
+    CHECK(listener.capture == NULL);
+    CHECK(counter_get(&cap.records) == 6 && counter_get(&cap.written) == 6);
+    CHECK(counter_get(&cap.dropped) == 0 && counter_get(&cap.write_errors) == 0);
+
+    const capture_record_t *rec = capture_map(path, &header, &count);
+    CHECK(rec != NULL && count == 6);
+    if (rec) {
+        CHECK(strcmp(header.devices[0], "cap-a") == 0 && strcmp(header.devices[1], "cap-b") == 0);
+        CHECK(rec[0].device == 0 && rec[0].code == KEY_A && rec[0].value == 1 && rec[0].time_ns == base);
+        CHECK(rec[2].device == 1 && rec[2].code == KEY_B && rec[2].time_ns == base + 10000000);
+        CHECK(rec[5].type == EV_SYN && rec[5].time_ns == base + 20000000);
+        capture_unmap(rec, count);
+    }
+
+    /* As fast as possible: one write per recorded frame */
+    CHECK(capture_replay(path, &replay, 0, -1, &rs) == 0);
+    CHECK(rs.records == 6 && rs.frames == 3 && counter_get(&replay.counters.writes) == 3);
+    CHECK(collect_keys(&replay, keys, 32) == 3);
+    CHECK(keys[0] == KEY_A * 10 + 1 && keys[1] == KEY_B * 10 + 1 && keys[2] == KEY_A * 10 + 0);
+
+    /* One source only */
+    CHECK(capture_replay(path, &replay, 0, 1, &rs) == 0);
+    CHECK(rs.records == 2 && collect_keys(&replay, keys, 32) == 1 && keys[0] == KEY_B * 10 + 1);
+
+    /* Recorded pace: the 20 ms between first and last frame are kept */
+    CHECK(capture_replay(path, &replay, 1.0, -1, &rs) == 0);
+    CHECK(rs.frames == 3 && rs.duration_ns >= 20000000ULL);
+    CHECK(collect_keys(&replay, keys, 32) == 3);
+
+    /* Capturing into the file again continues it */
+    CHECK(capture_start(&cap, path, &listener) == 0);
+    inject(&listener.devices[1], EV_KEY, KEY_C, 1);
+    inject(&listener.devices[1], EV_SYN, SYN_REPORT, 0);
+    CHECK(event_listener_poll(&listener, 100) == 1);
+    capture_stop(&cap);
+    rec = capture_map(path, NULL, &count);
+    CHECK(rec != NULL && count == 8 && rec[6].code == KEY_C);
+    capture_unmap(rec, count);
+
+    /* Anything else is refused */
+    write_text(path, "not a capture, just some text long enough to look like a header");
+    CHECK(capture_map(path, NULL, &count) == NULL);
+    CHECK(capture_start(&cap, path, &listener) == -1 && listener.capture == NULL);
+
+    unlink(path);
+    event_listener_destroy(&listener);
+    vkbd_destroy(&replay);
+    vkbd_destroy(&ctx);
+}
+
+int main(void) {
+    test_process_key();
+    test_capabilities();
+    test_discovery();
+    test_listener_forwarding();
+    test_output_queue();
+    test_backpressure();
+    test_batch();
+    test_batched_chord();
+    test_device_slots();
+    test_routing();
+    test_hot_path_quiet();
+    test_pipelined();
+    test_uring();
+    test_uring_backlog();
+    test_observers();
+    test_handler_table();
+    test_key_dispatch();
+    test_timestamps();
+    test_metrics();
+    test_filter_chain();
+    test_keymap();
+    test_layers();
+    test_taphold();
+    test_macros();
+    test_combos();
+    test_capture();
+
+    printf("\n%d checks, %d failures\n", checks, failures);
+    return failures ? 1 : 0;
+}
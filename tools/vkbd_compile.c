@@ -0,0 +1,26 @@
+/**
+ * vkbd-compile - Compile a text keymap into a vkbd binary keymap
+ *
+ * Usage: vkbd-compile keymap.txt keymap.bin
+ *
+ * The output is renamed into place, so a daemon watching keymap.bin
+ * (vkbd --keymap keymap.bin) picks up the new table without a restart.
+ */
+
+#include "../keymap.h"
+#include <stdio.h>
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <keymap.txt> <keymap.bin>\n", argv[0]);
+        return 2;
+    }
+
+    int rules = keymap_compile(argv[1], argv[2]);
+    if (rules < 0) {
+        return 1;
+    }
+
+    printf("%s: %d rule(s) -> %s\n", argv[1], rules, argv[2]);
+    return 0;
+}
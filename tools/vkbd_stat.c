@@ -0,0 +1,203 @@
+/**
+ * vkbd-stat - Report a running vkbd's counters, vmstat style
+ *
+ * Usage: vkbd-stat [-d] [-n name | -p pid] [interval [count]]
+ *
+ * Reads the shared-memory segment a vkbd publishes its metrics in (see
+ * metrics.h). Without -n or -p the first live "vkbd.*" segment in
+ * /dev/shm is used. The first line covers the time since the publisher
+ * started, later lines each interval. Rates are per second, the other columns count
+ * what happened within the line's period. -d lists the devices and exits.
+ */
+
+#include "../metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <errno.h>
+
+#define HEADER_EVERY 20
+
+/* First segment in /dev/shm whose publisher is still running */
+static int find_segment(char *name, size_t len) {
+    DIR *dir = opendir("/dev/shm");
+    struct dirent *entry;
+    int found = -1;
+
+    if (!dir) {
+        perror("vkbd-stat: /dev/shm");
+        return -1;
+    }
+    while (found < 0 && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, METRICS_PREFIX, strlen(METRICS_PREFIX)) != 0) {
+            continue;
+        }
+        const metrics_shm_t *shm = metrics_open(entry->d_name);
+        if (!shm) {
+            continue;
+        }
+        if (shm->pid > 0 && (kill(shm->pid, 0) == 0 || errno == EPERM)) {
+            snprintf(name, len, "%s", entry->d_name);
+            found = 0;
+        }
+        metrics_close(shm);
+    }
+    closedir(dir);
+    return found;
+}
+
+/* Bucket upper bound of the pct-th percentile of a bucket delta, in microseconds */
+static double percentile_us(const uint64_t *cur, const uint64_t *prev, double pct) {
+    uint64_t count = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        count += cur[i] - prev[i];
+    }
+    if (count == 0) {
+        return 0.0;
+    }
+
+    uint64_t rank = (uint64_t)(pct / 100.0 * count);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += cur[i] - prev[i];
+        if (seen > rank) {
+            return (double)(1ULL << i) / 1e3;
+        }
+    }
+    return 0.0;
+}
+
+static void print_header(void) {
+    printf("%9s %9s %8s %6s %7s %5s %6s %7s %6s %8s %8s %9s\n",
+           "keys/s", "out/s", "writes/s", "defer", "coalesc", "werr", "filter",
+           "syndrop", "rderr", "p50<us", "p99<us", "max_us");
+}
+
+static void print_line(const metrics_shm_t *cur, const metrics_shm_t *prev) {
+    double secs = (cur->published_ns - prev->published_ns) / 1e9;
+    uint64_t keys = 0;
+
+    for (uint32_t i = 0; i < cur->device_count; i++) {
+        keys += cur->devices[i].keys;
+    }
+    for (uint32_t i = 0; i < prev->device_count; i++) {
+        keys -= prev->devices[i].keys;
+    }
+    if (secs <= 0) {
+        secs = 1;
+    }
+
+    printf("%9.0f %9.0f %8.0f %6lu %7lu %5lu %6lu %7lu %6lu %8.1f %8.1f %9.1f\n",
+           (int64_t)keys > 0 ? keys / secs : 0.0,
+           (cur->written - prev->written) / secs,
+           (cur->writes - prev->writes) / secs,
+           (unsigned long)(cur->deferred - prev->deferred),
+           (unsigned long)(cur->coalesced - prev->coalesced),
+           (unsigned long)(cur->write_errors - prev->write_errors),
+           (unsigned long)(cur->filtered - prev->filtered),
+           (unsigned long)(cur->syn_dropped - prev->syn_dropped),
+           (unsigned long)(cur->read_errors - prev->read_errors),
+           percentile_us(cur->latency_buckets, prev->latency_buckets, 50.0),
+           percentile_us(cur->latency_buckets, prev->latency_buckets, 99.0),
+           cur->latency_max_ns / 1e3);
+    fflush(stdout);
+}
+
+static void print_devices(const metrics_shm_t *m) {
+    printf("%-24s %-32s %12s %12s\n", "path", "name", "events", "keys");
+    for (uint32_t i = 0; i < m->device_count; i++) {
+        printf("%-24s %-32s %12lu %12lu\n", m->devices[i].path, m->devices[i].name,
+               (unsigned long)m->devices[i].events, (unsigned long)m->devices[i].keys);
+    }
+    printf("observers: %lu delivered, %lu dropped; errors: %lu reads, %lu resets\n",
+           (unsigned long)m->observer_delivered, (unsigned long)m->observer_dropped,
+           (unsigned long)m->read_errors, (unsigned long)m->error_resets);
+}
+
+int main(int argc, char *argv[]) {
+    char name[256];
+    bool devices = false;
+    int interval = 1;
+    long count = -1;
+    int opt;
+
+    name[0] = '\0';
+    while ((opt = getopt(argc, argv, "dn:p:")) != -1) {
+        switch (opt) {
+        case 'd':
+            devices = true;
+            break;
+        case 'n':
+            snprintf(name, sizeof(name), "%s", optarg);
+            break;
+        case 'p':
+            snprintf(name, sizeof(name), METRICS_PREFIX "%s", optarg);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind < argc) {
+        interval = atoi(argv[optind++]);
+    }
+    if (optind < argc) {
+        count = atol(argv[optind++]);
+    }
+    if (optind != argc || interval <= 0) {
+        fprintf(stderr, "Usage: %s [-d] [-n name | -p pid] [interval [count]]\n", argv[0]);
+        return 2;
+    }
+
+    if (!name[0] && find_segment(name, sizeof(name)) < 0) {
+        fprintf(stderr, "%s: No running vkbd found in /dev/shm\n", argv[0]);
+        return 1;
+    }
+
+    const metrics_shm_t *shm = metrics_open(name);
+    if (!shm) {
+        fprintf(stderr, "%s: Cannot open metrics segment %s\n", argv[0], name);
+        return 1;
+    }
+
+    metrics_shm_t prev, cur;
+    if (metrics_read(shm, &cur) < 0) {
+        fprintf(stderr, "%s: Segment %s keeps changing\n", argv[0], name);
+        metrics_close(shm);
+        return 1;
+    }
+
+    if (devices) {
+        print_devices(&cur);
+        metrics_close(shm);
+        return 0;
+    }
+
+    /* First line: everything since the publisher started */
+    memset(&prev, 0, sizeof(prev));
+    prev.published_ns = cur.started_ns;
+    print_header();
+    print_line(&cur, &prev);
+
+    for (long line = 1; count < 0 || line < count; line++) {
+        prev = cur;
+        sleep(interval);
+        if (metrics_read(shm, &cur) < 0) {
+            continue;
+        }
+        if (cur.pid == 0) {
+            printf("vkbd exited\n");
+            break;
+        }
+        if (line % HEADER_EVERY == 0) {
+            print_header();
+        }
+        print_line(&cur, &prev);
+    }
+
+    metrics_close(shm);
+    return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * io_uring - Implementation
+ */
+
+#define _GNU_SOURCE
+
+#include "uring.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Create a ring */
+int uring_init(uring_t *ring, unsigned entries) {
+    struct io_uring_params p;
+
+    if (!ring || entries == 0) {
+        fprintf(stderr, "uring_init: Invalid arguments\n");
+        return -1;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    /* Completions are only reaped by the thread that submits, inside enter */
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        ring->fd = sys_io_uring_setup(entries, &p);
+    }
+    if (ring->fd < 0) {
+        perror("uring_init: io_uring_setup failed");
+        return -1;
+    }
+    ring->flags = p.flags;
+    ring->features = p.features;
+    ring->entries = p.sq_entries;
+
+    ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_len > ring->sq_map_len) {
+            ring->sq_map_len = ring->cq_map_len;
+        }
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        perror("uring_init: Failed to map submission queue");
+        ring->sq_map = NULL;
+        goto fail;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            perror("uring_init: Failed to map completion queue");
+            ring->cq_map = NULL;
+            goto fail;
+        }
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("uring_init: Failed to map SQEs");
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_head = (_Atomic unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (_Atomic unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    ring->sq_local_tail = atomic_load(ring->sq_tail);
+    return 0;
+
+fail:
+    uring_destroy(ring);
+    return -1;
+}
+
+/* Unmap and close a ring */
+void uring_destroy(uring_t *ring) {
+    if (!ring) {
+        return;
+    }
+
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_len);
+        ring->sqes = NULL;
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    ring->cq_map = NULL;
+    if (ring->sq_map) {
+        munmap(ring->sq_map, ring->sq_map_len);
+        ring->sq_map = NULL;
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+/* Submit queued SQEs and wait for completions - one syscall */
+int uring_enter(uring_t *ring, unsigned min_complete) {
+    unsigned to_submit = uring_sq_pending(ring);
+
+    if (to_submit) {
+        atomic_store_explicit(ring->sq_tail, ring->sq_local_tail, memory_order_release);
+    }
+
+    unsigned flags = 0;
+    if (min_complete || (ring->flags & IORING_SETUP_DEFER_TASKRUN)) {
+        flags |= IORING_ENTER_GETEVENTS;  /* Deferred completions only run here */
+    }
+    if (to_submit == 0 && flags == 0) {
+        return 0;
+    }
+    return sys_io_uring_enter(ring->fd, to_submit, min_complete, flags);
+}
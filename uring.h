@@ -0,0 +1,122 @@
+/**
+ * io_uring - Minimal ring wrapper over the raw syscalls
+ *
+ * Just what the listener's io_uring engine needs: one submission and one
+ * completion queue mapped into memory, SQEs filled in place and submitted
+ * together with the wait for completions in a single io_uring_enter().
+ * No liburing dependency.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Ring structure */
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned flags;                /* IORING_SETUP_* actually in effect */
+    unsigned features;             /* IORING_FEAT_* of the kernel */
+
+    /* Submission queue (shared with the kernel) */
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail;        /* SQEs handed out, published on enter */
+
+    /* Completion queue (shared with the kernel) */
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+} uring_t;
+
+/**
+ * Create a ring
+ *
+ * Asks for single-issuer deferred task running first and falls back to a
+ * plain ring on kernels that do not have it.
+ *
+ * @param ring Pointer to uring_t structure
+ * @param entries Submission queue size (power of two)
+ * @return 0 on success, -1 on error (e.g., io_uring disabled)
+ */
+int uring_init(uring_t *ring, unsigned entries);
+
+/**
+ * Unmap and close a ring
+ *
+ * @param ring Pointer to uring_t structure
+ */
+void uring_destroy(uring_t *ring);
+
+/**
+ * Submit what was queued and wait for completions
+ *
+ * @param ring Pointer to uring_t structure
+ * @param min_complete Completions to wait for (0 = submit only)
+ * @return Number of SQEs consumed, -1 on error (errno set, EINTR included)
+ */
+int uring_enter(uring_t *ring, unsigned min_complete);
+
+/* SQEs queued but not consumed by the kernel yet */
+static inline unsigned uring_sq_pending(const uring_t *ring) {
+    return ring->sq_local_tail - atomic_load_explicit(ring->sq_head, memory_order_acquire);
+}
+
+/* Free submission slots */
+static inline unsigned uring_sq_space(const uring_t *ring) {
+    return ring->entries - uring_sq_pending(ring);
+}
+
+/* Next free SQE, zeroed - NULL if the queue is full (submit first) */
+static inline struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    if (uring_sq_space(ring) == 0) {
+        return NULL;
+    }
+
+    unsigned idx = ring->sq_local_tail++ & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    ring->sq_array[idx] = idx;
+    *sqe = (struct io_uring_sqe){ 0 };
+    return sqe;
+}
+
+/* Oldest unconsumed completion, NULL if none */
+static inline struct io_uring_cqe *uring_peek_cqe(uring_t *ring) {
+    unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/* Hand the completion returned by uring_peek_cqe back to the kernel */
+static inline void uring_cqe_seen(uring_t *ring) {
+    atomic_fetch_add_explicit(ring->cq_head, 1, memory_order_release);
+}
+
+/* Fill in a read/write style SQE */
+static inline void uring_prep_rw(struct io_uring_sqe *sqe, int op, int fd,
+                                 const void *addr, unsigned len, uint64_t user_data) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;  /* Current position - required for pipes and char devices */
+    sqe->user_data = user_data;
+}
+
+#endif /* URING_H */
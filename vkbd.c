@@ -4,41 +4,103 @@
  * Fast, extensible uinput-based virtual keyboard for Linux
  */
 
+#define _GNU_SOURCE
+
 #include "vkbd.h"
+#include "observer.h"
+#include "clock.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
 #include <sys/socket.h>
+#include <sys/inotify.h>
 #include <linux/input.h>
 
-/* Write event with retry on EINTR */
-static inline int write_event(int fd, const struct input_event *ev) {
-    ssize_t ret;
-    do {
-        ret = write(fd, ev, sizeof(*ev));
-    } while (ret < 0 && errno == EINTR);
-    
-    return (ret == sizeof(*ev)) ? 0 : -1;
+/* Event node the kernel attached to a uinput device: /sys/devices/virtual/input/inputN/eventM */
+static bool uinput_find_node(vkbd_device_t *dev) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", dev->sysname);
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return false;
+    }
+
+    struct dirent *entry;
+    bool found = false;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "event", 5) == 0) {
+            snprintf(dev->node, sizeof(dev->node), "/dev/input/%.16s", entry->d_name);
+            found = true;
+        }
+    }
+    closedir(dir);
+    return found && access(dev->node, F_OK) == 0;
 }
 
-/* Initialize virtual keyboard device */
-int vkbd_init(vkbd_context_t *ctx, const char *device_name) {
-    if (!ctx) {
-        fprintf(stderr, "vkbd_init: NULL context\n");
-        return -1;
+/* Wait until the device's event node exists instead of sleeping a fixed time
+ * Usually already there when UI_DEV_CREATE returns; otherwise inotify on
+ * /dev/input reports it being created */
+static void uinput_wait_ready(vkbd_device_t *dev) {
+    if (ioctl(dev->fd, UI_GET_SYSNAME(sizeof(dev->sysname)), dev->sysname) < 0) {
+        perror("vkbd_init: UI_GET_SYSNAME failed");
+        return;
     }
 
-    /* Initialize context */
-    memset(ctx, 0, sizeof(vkbd_context_t));
-    ctx->handler_count = 0;
-    ctx->device.fd = -1;
+    /* Watch first, then look - a node created in between is not missed */
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd >= 0 && inotify_add_watch(ifd, "/dev/input", IN_CREATE | IN_ATTRIB) < 0) {
+        close(ifd);
+        ifd = -1;
+    }
 
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int remaining_ms = VKBD_READY_TIMEOUT_MS;
+
+    while (!uinput_find_node(dev)) {
+        if (remaining_ms <= 0) {
+            fprintf(stderr, "Warning: %s has no event node after %d ms\n",
+                    dev->sysname, VKBD_READY_TIMEOUT_MS);
+            dev->node[0] = '\0';
+            break;
+        }
+
+        /* Without inotify, look again every millisecond */
+        if (ifd >= 0) {
+            struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+            if (poll(&pfd, 1, remaining_ms) > 0) {
+                char buf[4096];
+                while (read(ifd, buf, sizeof(buf)) > 0) {
+                    /* Drained - the directory is checked again below */
+                }
+            }
+        } else {
+            usleep(1000);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining_ms = VKBD_READY_TIMEOUT_MS - (int)((now.tv_sec - start.tv_sec) * 1000 +
+                                                     (now.tv_nsec - start.tv_nsec) / 1000000);
+    }
+
+    if (ifd >= 0) {
+        close(ifd);
+    }
+}
+
+/* uinput backend: open /dev/uinput and create the device */
+static int uinput_open(vkbd_device_t *dev) {
     /* Open uinput device */
-    ctx->device.fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-    if (ctx->device.fd < 0) {
+    dev->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (dev->fd < 0) {
         perror("vkbd_init: Failed to open /dev/uinput");
         fprintf(stderr, "Hint: Make sure uinput module is loaded (modprobe uinput)\n");
         fprintf(stderr, "Hint: You may need root privileges (sudo)\n");
@@ -46,23 +108,24 @@ int vkbd_init(vkbd_context_t *ctx, const char *device_name) {
     }
 
     /* Enable key events */
-    if (ioctl(ctx->device.fd, UI_SET_EVBIT, EV_KEY) < 0) {
+    if (ioctl(dev->fd, UI_SET_EVBIT, EV_KEY) < 0) {
         perror("vkbd_init: Failed to set EV_KEY");
-        close(ctx->device.fd);
-        return -1;
+        goto fail;
     }
 
     /* Enable synchronization events */
-    if (ioctl(ctx->device.fd, UI_SET_EVBIT, EV_SYN) < 0) {
+    if (ioctl(dev->fd, UI_SET_EVBIT, EV_SYN) < 0) {
         perror("vkbd_init: Failed to set EV_SYN");
-        close(ctx->device.fd);
-        return -1;
+        goto fail;
     }
 
-    /* Enable all keyboard keys (0-255 covers most keyboard keys) */
-    for (int i = 0; i < MAX_KEY_CODES; i++) {
-        if (ioctl(ctx->device.fd, UI_SET_KEYBIT, i) < 0) {
-            /* Some keys may not be supported, continue anyway */
+    /* Advertise exactly the requested keys - one ioctl per key, uinput has no bulk form */
+    for (int w = 0; w < KEYSET_WORDS; w++) {
+        for (uint64_t bits = dev->keys.w[w]; bits; bits &= bits - 1) {
+            int code = w * 64 + __builtin_ctzll(bits);
+            if (ioctl(dev->fd, UI_SET_KEYBIT, code) < 0) {
+                /* Some keys may not be supported, continue anyway */
+            }
         }
     }
 
@@ -75,48 +138,188 @@ int vkbd_init(vkbd_context_t *ctx, const char *device_name) {
     usetup.id.product = 0x5678;  /* Dummy product ID */
     usetup.id.version = 1;
     
-    strncpy(usetup.name, device_name ? device_name : "Virtual Keyboard", 
-            UINPUT_MAX_NAME_SIZE - 1);
-    strncpy(ctx->device.name, usetup.name, UINPUT_MAX_NAME_SIZE - 1);
+    strncpy(usetup.name, dev->name, UINPUT_MAX_NAME_SIZE - 1);
 
-    if (ioctl(ctx->device.fd, UI_DEV_SETUP, &usetup) < 0) {
+    if (ioctl(dev->fd, UI_DEV_SETUP, &usetup) < 0) {
         perror("vkbd_init: Failed to setup device");
-        close(ctx->device.fd);
-        return -1;
+        goto fail;
     }
 
     /* Create the device */
-    if (ioctl(ctx->device.fd, UI_DEV_CREATE) < 0) {
+    if (ioctl(dev->fd, UI_DEV_CREATE) < 0) {
         perror("vkbd_init: Failed to create device");
-        close(ctx->device.fd);
+        goto fail;
+    }
+
+    /* Ready once its event node exists */
+    uinput_wait_ready(dev);
+    return 0;
+
+fail:
+    close(dev->fd);
+    dev->fd = -1;
+    return -1;
+}
+
+/* uinput backend: destroy the device */
+static void uinput_close(vkbd_device_t *dev) {
+    ioctl(dev->fd, UI_DEV_DESTROY);
+    close(dev->fd);
+    dev->fd = -1;
+}
+
+const vkbd_backend_t vkbd_backend_uinput = {
+    .name = "uinput",
+    .open = uinput_open,
+    .close = uinput_close,
+};
+
+/* Pipe backend: events written to fd come out of peer_fd unchanged */
+static int pipe_open(vkbd_device_t *dev) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("vkbd_init: Failed to create pipe");
+        return -1;
+    }
+
+    /* Match uinput: the write side never blocks the listener */
+    int flags = fcntl(fds[1], F_GETFL);
+    if (flags < 0 || fcntl(fds[1], F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("vkbd_init: Failed to set O_NONBLOCK");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    dev->peer_fd = fds[0];
+    dev->fd = fds[1];
+    return 0;
+}
+
+/* Pipe backend: close both ends */
+static void pipe_close(vkbd_device_t *dev) {
+    close(dev->fd);
+    dev->fd = -1;
+    if (dev->peer_fd >= 0) {
+        close(dev->peer_fd);
+        dev->peer_fd = -1;
+    }
+}
+
+const vkbd_backend_t vkbd_backend_pipe = {
+    .name = "pipe",
+    .open = pipe_open,
+    .close = pipe_close,
+};
+
+static void table_free(vkbd_handler_table_t *t);
+
+/* Initialize virtual keyboard device */
+int vkbd_init(vkbd_context_t *ctx, const char *device_name) {
+    return vkbd_init_backend(ctx, device_name, &vkbd_backend_uinput);
+}
+
+/* Initialize virtual keyboard device on a given backend */
+int vkbd_init_backend(vkbd_context_t *ctx, const char *device_name,
+                      const vkbd_backend_t *backend) {
+    return vkbd_init_keys(ctx, device_name, backend, NULL);
+}
+
+/* Initialize virtual keyboard device advertising a given key set */
+int vkbd_init_keys(vkbd_context_t *ctx, const char *device_name,
+                   const vkbd_backend_t *backend, const keyset_t *keys) {
+    if (!ctx) {
+        fprintf(stderr, "vkbd_init: NULL context\n");
+        return -1;
+    }
+
+    /* Initialize context */
+    memset(ctx, 0, sizeof(vkbd_context_t));
+    atomic_init(&ctx->table, NULL);
+    atomic_init(&ctx->table_epoch, 0);
+    atomic_init(&ctx->table_readers[0], 0);
+    atomic_init(&ctx->table_readers[1], 0);
+    pthread_mutex_init(&ctx->table_lock, NULL);
+    ctx->device.fd = -1;
+    ctx->device.peer_fd = -1;
+    ctx->device.backend = backend ? backend : &vkbd_backend_uinput;
+    strncpy(ctx->device.name, device_name ? device_name : "Virtual Keyboard",
+            UINPUT_MAX_NAME_SIZE - 1);
+
+    if (keys) {
+        ctx->device.keys = *keys;
+        keyset_clear(&ctx->device.keys, KEY_RESERVED);
+    } else {
+        for (int i = 1; i < MAX_KEY_CODES; i++) {
+            keyset_set(&ctx->device.keys, i);
+        }
+    }
+
+    if (ctx->device.backend->open(&ctx->device) < 0) {
+        pthread_mutex_destroy(&ctx->table_lock);
         return -1;
     }
 
     ctx->device.initialized = true;
-    
-    /* Give kernel time to create the device */
-    usleep(100000); /* 100ms */
 
-    printf("Virtual keyboard '%s' created successfully\n", ctx->device.name);
+    printf("Virtual keyboard '%s' created successfully (%s)\n",
+           ctx->device.name, ctx->device.backend->name);
     return 0;
 }
 
+static int outq_drain(vkbd_context_t *ctx);
+
 /* Destroy virtual keyboard device */
 void vkbd_destroy(vkbd_context_t *ctx) {
     if (!ctx || !ctx->device.initialized) {
         return;
     }
 
+    /* Last chance for queued releases - a key must not stay down */
+    for (int i = 0; i < 10 && ctx->outq.count > 0 && ctx->device.fd >= 0; i++) {
+        struct pollfd pfd = { .fd = ctx->device.fd, .events = POLLOUT };
+        if (poll(&pfd, 1, VKBD_QUEUE_WAIT_MS) <= 0 || outq_drain(ctx) < 0) {
+            break;
+        }
+    }
+
     if (ctx->device.fd >= 0) {
-        ioctl(ctx->device.fd, UI_DEV_DESTROY);
-        close(ctx->device.fd);
-        ctx->device.fd = -1;
+        ctx->device.backend->close(&ctx->device);
     }
 
+    free(ctx->outq.ev);
+    free(ctx->outq.src);
+    ctx->outq.ev = NULL;
+    ctx->outq.src = NULL;
+
+    /* Delivers whatever is still queued, then joins the observer thread */
+    vkbd_observers_destroy(atomic_exchange(&ctx->observers, NULL));
+
+    /* No hot path can be running any more */
+    table_free(atomic_exchange(&ctx->table, NULL));
+    pthread_mutex_destroy(&ctx->table_lock);
+
     ctx->device.initialized = false;
     printf("Virtual keyboard destroyed\n");
 }
 
+/* Append one event to the staging buffer, flushing first if it is full */
+static inline int stage_event(vkbd_context_t *ctx, uint16_t type, uint16_t code, int32_t value) {
+    /* Keep one slot free for the closing SYN_REPORT */
+    if (__builtin_expect(ctx->out_count >= VKBD_OUT_BUFFER - 1, 0)) {
+        if (vkbd_flush(ctx) < 0) {
+            return -1;
+        }
+    }
+
+    struct input_event *ev = &ctx->out_buf[ctx->out_count++];
+    ev->time = ctx->src_time;
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+    return 0;
+}
+
 /* Send key event to virtual keyboard */
 int vkbd_send_key(vkbd_context_t *ctx, uint16_t key_code, int32_t value) {
     if (!ctx || !ctx->device.initialized) {
@@ -124,22 +327,27 @@ int vkbd_send_key(vkbd_context_t *ctx, uint16_t key_code, int32_t value) {
         return -1;
     }
 
-    struct input_event ev;
-    memset(&ev, 0, sizeof(ev));
-    
-    ev.type = EV_KEY;
-    ev.code = key_code;
-    ev.value = value;
-    
-    /* Get current time for event timestamp */
-    gettimeofday(&ev.time, NULL);
+    /* Staged so it stays ordered with batched events; written by vkbd_sync */
+    return stage_event(ctx, EV_KEY, key_code, value);
+}
 
-    if (write_event(ctx->device.fd, &ev) < 0) {
-        perror("vkbd_send_key: Failed to write key event");
+/* Stage an extra event (filters) */
+int vkbd_emit(vkbd_context_t *ctx, uint16_t type, uint16_t code, int32_t value) {
+    if (__builtin_expect(!ctx || !ctx->device.initialized, 0)) {
         return -1;
     }
+    return stage_event(ctx, type, code, value);
+}
 
-    return 0;
+/* Stage a key and its SYN_REPORT */
+int vkbd_emit_key(vkbd_context_t *ctx, uint16_t code, int32_t value) {
+    if (__builtin_expect(!ctx || !ctx->device.initialized, 0)) {
+        return -1;
+    }
+    if (stage_event(ctx, EV_KEY, code, value) < 0) {
+        return -1;
+    }
+    return stage_event(ctx, EV_SYN, SYN_REPORT, 0);
 }
 
 /* Send synchronization event */
@@ -149,25 +357,184 @@ int vkbd_sync(vkbd_context_t *ctx) {
         return -1;
     }
 
-    struct input_event ev;
-    memset(&ev, 0, sizeof(ev));
-    
-    ev.type = EV_SYN;
-    ev.code = SYN_REPORT;
-    ev.value = 0;
-    
-    gettimeofday(&ev.time, NULL);
+    if (stage_event(ctx, EV_SYN, SYN_REPORT, 0) < 0) {
+        return -1;
+    }
+    return vkbd_flush(ctx);
+}
+
+/* Hot path: enter a read-side section, returns the counter to release */
+static inline int table_read_lock(vkbd_context_t *ctx) {
+    int idx = atomic_load_explicit(&ctx->table_epoch, memory_order_relaxed) & 1;
+    atomic_fetch_add(&ctx->table_readers[idx], 1);
+    return idx;
+}
+
+static inline void table_read_unlock(vkbd_context_t *ctx, int idx) {
+    atomic_fetch_sub_explicit(&ctx->table_readers[idx], 1, memory_order_release);
+}
+
+/* Wait until no reader can still hold a table replaced before this call.
+ * Two phase flips: a reader that picked its counter just before the first
+ * flip is caught by the second. Called with table_lock held */
+static void table_synchronize(vkbd_context_t *ctx) {
+    for (int pass = 0; pass < 2; pass++) {
+        unsigned long old = atomic_fetch_add(&ctx->table_epoch, 1);
+        while (atomic_load(&ctx->table_readers[old & 1]) != 0) {
+            sched_yield();
+        }
+    }
+}
+
+/* Allocate a table with room for the given counts (one block) */
+static vkbd_handler_table_t *table_alloc(int callbacks, int filters, int batch) {
+    vkbd_handler_table_t *t = malloc(sizeof(*t) + callbacks * sizeof(vkbd_handler_t) +
+                                     filters * sizeof(vkbd_filter_entry_t) +
+                                     batch * sizeof(vkbd_batch_entry_t));
+    if (!t) {
+        fprintf(stderr, "vkbd: Out of memory for handler table\n");
+        return NULL;
+    }
+    t->callback_count = callbacks;
+    t->filter_count = filters;
+    t->batch_count = batch;
+    t->callbacks = (vkbd_handler_t *)(t + 1);
+    t->filters = (vkbd_filter_entry_t *)(t->callbacks + callbacks);
+    t->batch = (vkbd_batch_entry_t *)(t->filters + filters);
+    t->key_start = NULL;
+    t->dispatch = NULL;
+    return t;
+}
+
+static void table_free(vkbd_handler_table_t *t) {
+    if (t) {
+        free(t->key_start);
+        free(t);
+    }
+}
+
+/* Build the per-key dispatch index (key_start + dispatch, one block).
+ * Two passes over keys x handlers keep registration order per key */
+static int table_index(vkbd_handler_table_t *t) {
+    uint32_t n = 0;
+    for (int k = 0; k < KEY_CNT; k++) {
+        for (int i = 0; i < t->callback_count; i++) {
+            n += keyset_test(&t->callbacks[i].keys, k);
+        }
+    }
 
-    if (write_event(ctx->device.fd, &ev) < 0) {
-        perror("vkbd_sync: Failed to write sync event");
+    t->key_start = malloc((KEY_CNT + 1) * sizeof(uint32_t) + n * sizeof(vkbd_dispatch_t));
+    if (!t->key_start) {
+        fprintf(stderr, "vkbd: Out of memory for dispatch index\n");
         return -1;
     }
+    t->dispatch = (vkbd_dispatch_t *)(t->key_start + KEY_CNT + 1);
 
+    n = 0;
+    for (int k = 0; k < KEY_CNT; k++) {
+        t->key_start[k] = n;
+        for (int i = 0; i < t->callback_count; i++) {
+            const vkbd_handler_t *h = &t->callbacks[i];
+            if (keyset_test(&h->keys, k)) {
+                /* Unscoped handlers also see out-of-range values */
+                t->dispatch[n++] = (vkbd_dispatch_t){
+                    h->callback, h->user_data, h->values == VKBD_VALUE_ALL ? ~0u : h->values
+                };
+            }
+        }
+    }
+    t->key_start[KEY_CNT] = n;
     return 0;
 }
 
-/* Register a callback for key events */
-int vkbd_register_callback(vkbd_context_t *ctx, vkbd_callback_t callback, void *user_data) {
+/* Publish a new table and free the old one once no reader can see it.
+ * Called with table_lock held */
+static void table_publish(vkbd_context_t *ctx, vkbd_handler_table_t *next) {
+    if (next && next->callback_count == 0 && next->filter_count == 0 && next->batch_count == 0) {
+        table_free(next);
+        next = NULL;  /* Empty: the hot path skips the table entirely */
+    }
+
+    vkbd_handler_table_t *old = atomic_exchange(&ctx->table, next);
+    if (old) {
+        table_synchronize(ctx);
+        table_free(old);
+    }
+}
+
+/* Kinds of table entries, for removal by ID */
+typedef enum {
+    ENTRY_CALLBACK,
+    ENTRY_FILTER,
+    ENTRY_BATCH,
+} entry_kind_t;
+
+/* Copy the current table with one entry added or removed.
+ * add_* appends, remove_id (>= 0) drops the entry with that ID from the kind
+ * selected by remove_kind. Returns NULL (and sets *found false) on error */
+static vkbd_handler_table_t *table_copy(const vkbd_handler_table_t *cur,
+                                        const vkbd_handler_t *add_cb,
+                                        const vkbd_filter_entry_t *add_filter,
+                                        const vkbd_batch_entry_t *add_batch,
+                                        int remove_id, entry_kind_t remove_kind, bool *found) {
+    int callbacks = cur ? cur->callback_count : 0;
+    int filters = cur ? cur->filter_count : 0;
+    int batch = cur ? cur->batch_count : 0;
+    int keep_cb = 0, keep_filter = 0, keep_batch = 0;
+
+    *found = remove_id < 0;
+    vkbd_handler_table_t *t = table_alloc(callbacks + (add_cb != NULL), filters + (add_filter != NULL),
+                                          batch + (add_batch != NULL));
+    if (!t) {
+        return NULL;
+    }
+
+    /* Compacted copy - removed entries leave no hole for the hot path to skip */
+    for (int i = 0; i < callbacks; i++) {
+        if (remove_kind == ENTRY_CALLBACK && cur->callbacks[i].id == remove_id) {
+            *found = true;
+            continue;
+        }
+        t->callbacks[keep_cb++] = cur->callbacks[i];
+    }
+    for (int i = 0; i < filters; i++) {
+        if (remove_kind == ENTRY_FILTER && cur->filters[i].id == remove_id) {
+            *found = true;
+            continue;
+        }
+        t->filters[keep_filter++] = cur->filters[i];
+    }
+    for (int i = 0; i < batch; i++) {
+        if (remove_kind == ENTRY_BATCH && cur->batch[i].id == remove_id) {
+            *found = true;
+            continue;
+        }
+        t->batch[keep_batch++] = cur->batch[i];
+    }
+    if (add_cb) {
+        t->callbacks[keep_cb++] = *add_cb;
+    }
+    if (add_filter) {
+        t->filters[keep_filter++] = *add_filter;
+    }
+    if (add_batch) {
+        t->batch[keep_batch++] = *add_batch;
+    }
+
+    t->callback_count = keep_cb;
+    t->filter_count = keep_filter;
+    t->batch_count = keep_batch;
+    if (table_index(t) < 0) {
+        table_free(t);
+        *found = false;
+        return NULL;
+    }
+    return t;
+}
+
+/* Register a callback for a set of key codes */
+int vkbd_register_keyset_callback(vkbd_context_t *ctx, const keyset_t *keys, unsigned values,
+                                  vkbd_callback_t callback, void *user_data) {
     if (!ctx) {
         fprintf(stderr, "vkbd_register_callback: NULL context\n");
         return -1;
@@ -178,18 +545,68 @@ int vkbd_register_callback(vkbd_context_t *ctx, vkbd_callback_t callback, void *
         return -1;
     }
 
-    if (ctx->handler_count >= MAX_CALLBACKS) {
-        fprintf(stderr, "vkbd_register_callback: Too many callbacks\n");
+    if ((values & VKBD_VALUE_ALL) == 0 || (values & ~VKBD_VALUE_ALL) || (keys && keyset_empty(keys))) {
+        fprintf(stderr, "vkbd_register_callback: Callback would never be called\n");
+        return -1;
+    }
+
+    vkbd_handler_t entry = { callback, user_data, -1, values, { { 0 } } };
+    if (keys) {
+        entry.keys = *keys;
+    } else {
+        memset(&entry.keys, 0xff, sizeof(entry.keys));
+    }
+
+    pthread_mutex_lock(&ctx->table_lock);
+    entry.id = ctx->next_handler_id;
+    bool found;
+    vkbd_handler_table_t *next = table_copy(atomic_load(&ctx->table), &entry, NULL, NULL, -1, ENTRY_CALLBACK, &found);
+    if (!next) {
+        pthread_mutex_unlock(&ctx->table_lock);
+        return -1;
+    }
+    ctx->next_handler_id++;
+    table_publish(ctx, next);
+    pthread_mutex_unlock(&ctx->table_lock);
+
+    return entry.id;
+}
+
+/* Register a callback for key events */
+int vkbd_register_callback(vkbd_context_t *ctx, vkbd_callback_t callback, void *user_data) {
+    return vkbd_register_keyset_callback(ctx, NULL, VKBD_VALUE_ALL, callback, user_data);
+}
+
+/* Register a callback for one key code */
+int vkbd_register_key_callback(vkbd_context_t *ctx, uint16_t key_code, unsigned values,
+                               vkbd_callback_t callback, void *user_data) {
+    if (key_code >= KEY_CNT) {
+        fprintf(stderr, "vkbd_register_callback: Invalid key code %d\n", key_code);
         return -1;
     }
 
-    int handler_id = ctx->handler_count;
-    ctx->handlers[handler_id].callback = callback;
-    ctx->handlers[handler_id].user_data = user_data;
-    ctx->handlers[handler_id].active = true;
-    ctx->handler_count++;
+    keyset_t keys;
+    keyset_clear_all(&keys);
+    keyset_set(&keys, key_code);
+    return vkbd_register_keyset_callback(ctx, &keys, values, callback, user_data);
+}
 
-    return handler_id;
+/* Remove one entry by ID */
+static int unregister_entry(vkbd_context_t *ctx, int id, entry_kind_t kind) {
+    pthread_mutex_lock(&ctx->table_lock);
+    bool found = false;
+    vkbd_handler_table_t *next = NULL;
+    if (id >= 0) {
+        next = table_copy(atomic_load(&ctx->table), NULL, NULL, NULL, id, kind, &found);
+    }
+    if (!next || !found) {
+        table_free(next);
+        pthread_mutex_unlock(&ctx->table_lock);
+        return -1;
+    }
+    table_publish(ctx, next);
+    pthread_mutex_unlock(&ctx->table_lock);
+    return 0;
 }
 
 /* Unregister a callback */
@@ -199,83 +616,577 @@ int vkbd_unregister_callback(vkbd_context_t *ctx, int handler_id) {
         return -1;
     }
 
-    if (handler_id < 0 || handler_id >= ctx->handler_count) {
+    if (unregister_entry(ctx, handler_id, ENTRY_CALLBACK) < 0) {
         fprintf(stderr, "vkbd_unregister_callback: Invalid handler ID\n");
         return -1;
     }
+    return 0;
+}
+
+/* Register a filter stage */
+int vkbd_register_filter(vkbd_context_t *ctx, vkbd_filter_t filter, void *user_data) {
+    if (!ctx) {
+        fprintf(stderr, "vkbd_register_filter: NULL context\n");
+        return -1;
+    }
+
+    if (!filter) {
+        fprintf(stderr, "vkbd_register_filter: NULL filter\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->table_lock);
+    vkbd_filter_entry_t entry = { filter, user_data, ctx->next_handler_id };
+    bool found;
+    vkbd_handler_table_t *next = table_copy(atomic_load(&ctx->table), NULL, &entry, NULL, -1, ENTRY_FILTER, &found);
+    if (!next) {
+        pthread_mutex_unlock(&ctx->table_lock);
+        return -1;
+    }
+    ctx->next_handler_id++;
+    table_publish(ctx, next);
+    pthread_mutex_unlock(&ctx->table_lock);
+
+    return entry.id;
+}
+
+/* Unregister a filter stage */
+int vkbd_unregister_filter(vkbd_context_t *ctx, int filter_id) {
+    if (!ctx) {
+        fprintf(stderr, "vkbd_unregister_filter: NULL context\n");
+        return -1;
+    }
 
-    ctx->handlers[handler_id].active = false;
+    if (unregister_entry(ctx, filter_id, ENTRY_FILTER) < 0) {
+        fprintf(stderr, "vkbd_unregister_filter: Invalid filter ID\n");
+        return -1;
+    }
     return 0;
 }
 
-/* Process and forward key event - Maximum speed with robust error handling */
-int vkbd_process_key(vkbd_context_t *ctx, uint16_t key_code, int32_t value) {
+/* Register a batch handler */
+int vkbd_register_batch_handler(vkbd_context_t *ctx, vkbd_batch_handler_t handler, void *user_data) {
+    if (!ctx) {
+        fprintf(stderr, "vkbd_register_batch_handler: NULL context\n");
+        return -1;
+    }
+
+    if (!handler) {
+        fprintf(stderr, "vkbd_register_batch_handler: NULL handler\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->table_lock);
+    vkbd_batch_entry_t entry = { handler, user_data, ctx->next_handler_id };
+    bool found;
+    vkbd_handler_table_t *next = table_copy(atomic_load(&ctx->table), NULL, NULL, &entry, -1, ENTRY_BATCH, &found);
+    if (!next) {
+        pthread_mutex_unlock(&ctx->table_lock);
+        return -1;
+    }
+    ctx->next_handler_id++;
+    table_publish(ctx, next);
+    pthread_mutex_unlock(&ctx->table_lock);
+
+    return entry.id;
+}
+
+/* Unregister a batch handler */
+int vkbd_unregister_batch_handler(vkbd_context_t *ctx, int handler_id) {
+    if (!ctx) {
+        fprintf(stderr, "vkbd_unregister_batch_handler: NULL context\n");
+        return -1;
+    }
+
+    if (unregister_entry(ctx, handler_id, ENTRY_BATCH) < 0) {
+        fprintf(stderr, "vkbd_unregister_batch_handler: Invalid handler ID\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Per-key callback over a span */
+void vkbd_key_adapter(vkbd_context_t *ctx, const struct input_event *events, int count, void *user_data) {
+    (void)ctx;
+    const vkbd_key_adapter_t *adapter = user_data;
+
+    for (int i = 0; i < count; i++) {
+        if (events[i].type == EV_KEY) {
+            adapter->callback(events[i].code, events[i].value, adapter->user_data);
+        }
+    }
+}
+
+/* One input event against a table snapshot taken by the caller (NULL = none) */
+static inline int queue_event(vkbd_context_t *ctx, const vkbd_handler_table_t *t,
+                              const struct input_event *ev) {
+    /* Only key events - most common case */
+    if (__builtin_expect(ev->type == EV_KEY, 1)) {
+        /* Filter chain works on a private copy - the source buffer stays intact */
+        struct input_event out = *ev;
+
+        /* Everything staged for this event (vkbd_emit included) keeps its timestamp */
+        ctx->src_time = ev->time;
+
+        if (t) {
+            /* Only the callbacks subscribed to this key and value */
+            if (__builtin_expect(ev->code < KEY_CNT, 1)) {
+                unsigned bit = (uint32_t)ev->value <= 2 ? 1u << ev->value : 1u << 3;
+                const vkbd_dispatch_t *d = t->dispatch + t->key_start[ev->code];
+                const vkbd_dispatch_t *end = t->dispatch + t->key_start[ev->code + 1];
+                for (; d < end; d++) {
+                    if (d->values & bit) {
+                        d->callback(ev->code, ev->value, d->user_data);
+                    }
+                }
+            }
+
+            for (int i = 0; i < t->filter_count; i++) {
+                if (t->filters[i].filter(ctx, &out, t->filters[i].user_data) == VKBD_FILTER_DROP) {
+                    ctx->src_time = (struct timeval){ 0 };
+                    counter_add(&ctx->counters.filtered, 1);
+                    return 0;
+                }
+            }
+        }
+        int ret = stage_event(ctx, out.type, out.code, out.value);
+        ctx->src_time = (struct timeval){ 0 };
+        return ret;
+    }
+
+    /* Close the frame only if keys were staged since the last SYN_REPORT */
+    if (ev->type == EV_SYN && ev->code == SYN_REPORT &&
+        ctx->out_count > 0 && ctx->out_buf[ctx->out_count - 1].type != EV_SYN) {
+        ctx->src_time = ev->time;
+        int ret = stage_event(ctx, EV_SYN, SYN_REPORT, 0);
+        ctx->src_time = (struct timeval){ 0 };
+        return ret;
+    }
+
+    return 0;
+}
+
+/* Queue one input event - callbacks and filters for EV_KEY, keeps source frame boundaries */
+int vkbd_queue_event(vkbd_context_t *ctx, const struct input_event *ev) {
     /* Fast path: assume valid context (hot path optimization) */
     if (__builtin_expect(!ctx || !ctx->device.initialized, 0)) {
         return -1;
     }
+    if (__builtin_expect(ev->type != EV_KEY, 0)) {
+        return queue_event(ctx, NULL, ev);
+    }
+
+    /* Lock-free snapshot: registration never blocks this path */
+    int idx = table_read_lock(ctx);
+    int ret = queue_event(ctx, atomic_load(&ctx->table), ev);
+    table_read_unlock(ctx, idx);
+    return ret;
+}
+
+/* Hand written events to the observers, if any (acquire pairs with their publication) */
+static inline void post_observers(vkbd_context_t *ctx, const struct input_event *evs, int count) {
+    struct vkbd_observers *obs = atomic_load_explicit(&ctx->observers, memory_order_acquire);
+    if (obs) {
+        vkbd_observers_post(obs, evs, count);
+    }
+}
+
+/* Kernel timestamp -> accepted by the device, for the events that have one */
+static inline void record_latency(vkbd_context_t *ctx, const uint64_t *src_ns, int count) {
+    uint64_t now_ns = 0;
 
-    /* Inline callback processing - no function calls */
-    const int count = ctx->handler_count;
     for (int i = 0; i < count; i++) {
-        if (ctx->handlers[i].active) {
-            ctx->handlers[i].callback(key_code, value, ctx->handlers[i].user_data);
+        if (src_ns[i]) {
+            if (!now_ns) {
+                now_ns = monotonic_ns();   /* One clock read per write */
+            }
+            if (src_ns[i] <= now_ns) {
+                latency_record(&ctx->latency, now_ns - src_ns[i]);
+            }
         }
     }
+}
 
-    /* Pre-allocated events on stack - no heap allocation */
-    struct input_event events[2];
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    
-    /* Key event */
-    events[0].time = now;
-    events[0].type = EV_KEY;
-    events[0].code = key_code;
-    events[0].value = value;
-    
-    /* Sync event */
-    events[1].time = now;
-    events[1].type = EV_SYN;
-    events[1].code = SYN_REPORT;
-    events[1].value = 0;
-    
-    /* Single atomic write - retry on EINTR or EAGAIN */
-    ssize_t ret;
-    int retry = 0;
-    do {
-        ret = write(ctx->device.fd, events, sizeof(events));
-        if (ret == sizeof(events)) {
-            return 0;  /* Success */
+/* Output queue slot i (0 = oldest) */
+static inline struct input_event *outq_at(vkbd_outq_t *q, unsigned i) {
+    return &q->ev[(q->head + i) & (q->size - 1)];
+}
+
+/* Write as much of the queue as the device (or sink) takes: 0 once empty, 1 if it is full again, -1 on error */
+static int outq_drain(vkbd_context_t *ctx) {
+    vkbd_outq_t *q = &ctx->outq;
+
+    while (q->count > 0) {
+        /* Oldest contiguous run, from where the last short write stopped -
+         * at most a staging buffer's worth, so pipes take it whole */
+        unsigned first = q->head;
+        unsigned run = q->count < q->size - first ? q->count : q->size - first;
+        if (run > VKBD_OUT_BUFFER) {
+            run = VKBD_OUT_BUFFER;
         }
-        /* Retry on interrupt or would-block */
-        if (ret < 0 && (errno == EINTR || errno == EAGAIN)) {
-            if (++retry > 10) {
-                /* Too many retries - buffer might be full from key repeat */
-                usleep(100);  /* 0.1ms backoff */
-                if (retry > 100) {
-                    break;  /* Give up after 100 retries */
-                }
+
+        /* A sink takes whole runs; it records their latency on completion */
+        if (ctx->sink && q->offset == 0) {
+            int taken = ctx->sink(ctx, &q->ev[first], &q->src[first], run, ctx->sink_data);
+            if (taken != 0) {
+                return taken;
             }
+            counter_add(&ctx->counters.writes, 1);
+            counter_add(&ctx->counters.written, run);
+            post_observers(ctx, &q->ev[first], run);
+            q->head = (q->head + run) & (q->size - 1);
+            q->count -= run;
             continue;
         }
-        /* Other errors - fail immediately */
-        break;
-    } while (1);
-    
-    /* Log error only if write completely failed */
-    if (__builtin_expect(ret < 0, 0)) {
-        static int error_logged = 0;
-        if (!error_logged) {
-            perror("vkbd_process_key: write failed");
-            error_logged = 1;  /* Prevent log spam */
+
+        ssize_t ret = write(ctx->device.fd, (const char *)&q->ev[first] + q->offset,
+                            run * sizeof(struct input_event) - q->offset);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN ? 1 : -1;
+        }
+
+        size_t done = q->offset + ret;
+        unsigned sent = done / sizeof(struct input_event);
+        q->offset = done % sizeof(struct input_event);
+        counter_add(&ctx->counters.writes, 1);
+        counter_add(&ctx->counters.written, sent);
+        if (sent > 0) {
+            record_latency(ctx, &q->src[first], sent);
+            post_observers(ctx, &q->ev[first], sent);
+        }
+        q->head = (q->head + sent) & (q->size - 1);
+        q->count -= sent;
+    }
+
+    keyset_clear_all(&q->repeat);
+    return 0;
+}
+
+/* Drop every queued repeat (and the SYN_REPORTs left doubled): presses and releases stay */
+static unsigned outq_compact(vkbd_outq_t *q) {
+    unsigned keep = 0;
+
+    for (unsigned i = 0; i < q->count; i++) {
+        struct input_event *ev = outq_at(q, i);
+        bool partial = i == 0 && q->offset > 0;   /* Already half written */
+        if (!partial && keep > 0 && ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            const struct input_event *last = outq_at(q, keep - 1);
+            if (last->type == EV_SYN && last->code == SYN_REPORT) {
+                continue;
+            }
         }
+        if (!partial && ev->type == EV_KEY && ev->value == 2) {
+            continue;
+        }
+        q->src[(q->head + keep) & (q->size - 1)] = q->src[(q->head + i) & (q->size - 1)];
+        *outq_at(q, keep++) = *ev;
+    }
+
+    unsigned removed = q->count - keep;
+    q->count = keep;
+    keyset_clear_all(&q->repeat);
+    return removed;
+}
+
+/* Move the queue to size slots, oldest event first */
+static int outq_resize(vkbd_outq_t *q, unsigned size) {
+    struct input_event *ev = malloc(size * sizeof(struct input_event));
+    uint64_t *src = malloc(size * sizeof(uint64_t));
+    if (!ev || !src) {
+        perror("vkbd_flush: Failed to grow output queue");
+        free(ev);
+        free(src);
         return -1;
     }
-    
+    for (unsigned i = 0; i < q->count; i++) {
+        ev[i] = *outq_at(q, i);
+        src[i] = q->src[(q->head + i) & (q->size - 1)];
+    }
+    free(q->ev);
+    free(q->src);
+    q->ev = ev;
+    q->src = src;
+    q->size = size;
+    q->head = 0;
+    return 0;
+}
+
+/* Make room for one event: collapse repeats, grow - never waits for the device */
+static int outq_make_room(vkbd_context_t *ctx) {
+    vkbd_outq_t *q = &ctx->outq;
+
+    if (!q->ev) {
+        return outq_resize(q, VKBD_OUT_QUEUE);
+    }
+
+    counter_add(&ctx->counters.coalesced, outq_compact(q));
+    if (q->count < q->size) {
+        return 0;
+    }
+
+    /* Nothing but presses and releases: a key must not stay down */
+    if (q->size < VKBD_OUT_QUEUE_MAX) {
+        return outq_resize(q, q->size * 2);
+    }
+
+    /* The listener throttles its sources long before this */
+    errno = ENOBUFS;
+    return -1;
+}
+
+/* Queue events (and their source times) behind the backlog; offset = bytes of the first already written */
+static int outq_push(vkbd_context_t *ctx, const struct input_event *evs, const uint64_t *src_ns,
+                     int count, size_t offset) {
+    vkbd_outq_t *q = &ctx->outq;
+
+    if (q->count == 0) {
+        q->offset = offset;
+    }
+    for (int i = 0; i < count; i++) {
+        const struct input_event *ev = &evs[i];
+        bool partial = i == 0 && offset > 0;
+
+        if (ev->type == EV_KEY && ev->code < KEY_CNT && !partial) {
+            if (ev->value == 2) {
+                /* The key's last queued event already says "still held" */
+                if (keyset_test(&q->repeat, ev->code)) {
+                    counter_add(&ctx->counters.coalesced, 1);
+                    continue;
+                }
+                keyset_set(&q->repeat, ev->code);
+            } else {
+                keyset_clear(&q->repeat, ev->code);
+            }
+        } else if (ev->type == EV_SYN && ev->code == SYN_REPORT && q->count > 0 && !partial) {
+            /* A frame emptied by coalescing */
+            const struct input_event *last = outq_at(q, q->count - 1);
+            if (last->type == EV_SYN && last->code == SYN_REPORT) {
+                continue;
+            }
+        }
+
+        if (__builtin_expect(q->count == q->size, 0) && outq_make_room(ctx) < 0) {
+            counter_add(&ctx->counters.overflows, count - i);
+            return -1;
+        }
+        q->src[(q->head + q->count) & (q->size - 1)] = src_ns[i];
+        *outq_at(q, q->count++) = *ev;
+        counter_add(&ctx->counters.deferred, 1);
+    }
+    return 0;
+}
+
+/* Count a failed flush - its events are lost */
+static int write_failed(vkbd_context_t *ctx) {
+    counter_add(&ctx->counters.write_errors, 1);
+
+    /* Log error only once, to prevent log spam */
+    static int error_logged = 0;
+    if (!error_logged) {
+        perror("vkbd_flush: write failed");
+        error_logged = 1;
+    }
+    return -1;
+}
+
+/* Process a span - batch handlers once, then each event */
+int vkbd_process_batch(vkbd_context_t *ctx, const struct input_event *events, int count) {
+    if (__builtin_expect(!ctx || !ctx->device.initialized, 0)) {
+        return -1;
+    }
+    if (count <= 0) {
+        return 0;   /* Handlers never see an empty span */
+    }
+
+    /* One read-side section and one indirect call per handler for the whole span */
+    int idx = table_read_lock(ctx);
+    const vkbd_handler_table_t *t = atomic_load(&ctx->table);
+    if (t) {
+        for (int i = 0; i < t->batch_count; i++) {
+            t->batch[i].handler(ctx, events, count, t->batch[i].user_data);
+        }
+    }
+
+    int ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (__builtin_expect(queue_event(ctx, t, &events[i]) < 0, 0)) {
+            ret = -1;
+        }
+    }
+    table_read_unlock(ctx, idx);
+    return ret;
+}
+
+/* Write all staged events with one timestamp and one write() */
+int vkbd_flush(vkbd_context_t *ctx) {
+    if (__builtin_expect(!ctx || !ctx->device.initialized, 0)) {
+        return -1;
+    }
+
+    int count = ctx->out_count;
+    if (count == 0) {
+        return 0;
+    }
+
+    /* Terminate the last frame */
+    if (ctx->out_buf[count - 1].type != EV_SYN) {
+        ctx->out_buf[count].time = ctx->out_buf[count - 1].time;
+        ctx->out_buf[count].type = EV_SYN;
+        ctx->out_buf[count].code = SYN_REPORT;
+        ctx->out_buf[count].value = 0;
+        count++;
+    }
+    ctx->out_count = 0;
+
+    /* One clock read for the whole batch stamps it; source times of the key
+     * events are kept aside, latency is recorded once the device takes them */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    const struct timeval now = { ts.tv_sec, ts.tv_nsec / 1000 };
+    const bool keep_source = ctx->time_policy == VKBD_TIME_SOURCE;
+    uint64_t src[VKBD_OUT_BUFFER];
+    for (int i = 0; i < count; i++) {
+        struct input_event *ev = &ctx->out_buf[i];
+        uint64_t src_ns = (uint64_t)ev->time.tv_sec * 1000000000ULL + (uint64_t)ev->time.tv_usec * 1000;
+
+        src[i] = ev->type == EV_KEY ? src_ns : 0;
+        if (!keep_source || !src_ns) {
+            ev->time = now;
+        }
+    }
+
+    /* Behind on earlier output: queue behind it to keep the order */
+    if (__builtin_expect(ctx->outq.count > 0, 0)) {
+        if (outq_push(ctx, ctx->out_buf, src, count, 0) < 0 || outq_drain(ctx) < 0) {
+            return write_failed(ctx);
+        }
+        return 0;
+    }
+
+    /* An engine submits the write itself (e.g., on its io_uring) */
+    if (ctx->sink) {
+        int taken = ctx->sink(ctx, ctx->out_buf, src, count, ctx->sink_data);
+        if (__builtin_expect(taken != 0, 0)) {
+            if (taken < 0) {
+                counter_add(&ctx->counters.write_errors, 1);
+                return -1;
+            }
+            /* No room in the engine right now - queued like EAGAIN */
+            return outq_push(ctx, ctx->out_buf, src, count, 0) < 0 ? write_failed(ctx) : 0;
+        }
+        counter_add(&ctx->counters.writes, 1);
+        counter_add(&ctx->counters.written, count);
+        post_observers(ctx, ctx->out_buf, count);
+        return 0;
+    }
+
+    /* Single write - never waits: what the device does not take is queued */
+    const size_t len = count * sizeof(struct input_event);
+    ssize_t ret;
+    do {
+        ret = write(ctx->device.fd, ctx->out_buf, len);
+    } while (__builtin_expect(ret < 0 && errno == EINTR, 0));
+
+    if (__builtin_expect(ret == (ssize_t)len, 1)) {
+        counter_add(&ctx->counters.writes, 1);
+        counter_add(&ctx->counters.written, count);
+        record_latency(ctx, src, count);
+
+        /* Forwarded - observers get it afterwards, on their own thread */
+        post_observers(ctx, ctx->out_buf, count);
+        return 0;  /* Success */
+    }
+
+    /* Full (e.g., during a key repeat storm) or short write: queue the rest */
+    if (ret >= 0 || errno == EAGAIN) {
+        size_t done = ret > 0 ? (size_t)ret : 0;
+        int sent = done / sizeof(struct input_event);
+        if (sent > 0) {
+            counter_add(&ctx->counters.writes, 1);
+            counter_add(&ctx->counters.written, sent);
+            record_latency(ctx, src, sent);
+            post_observers(ctx, ctx->out_buf, sent);
+        }
+        if (outq_push(ctx, ctx->out_buf + sent, src + sent, count - sent,
+                      done % sizeof(struct input_event)) < 0) {
+            return write_failed(ctx);
+        }
+        return 0;
+    }
+
+    return write_failed(ctx);
+}
+
+/* Write queued output */
+int vkbd_drain(vkbd_context_t *ctx) {
+    if (!ctx || !ctx->device.initialized) {
+        return -1;
+    }
+    if (outq_drain(ctx) < 0) {
+        write_failed(ctx);
+        return -1;
+    }
+    return ctx->outq.count;
+}
+
+/* Events waiting in the output queue */
+int vkbd_backlog(const vkbd_context_t *ctx) {
+    return ctx ? (int)ctx->outq.count : 0;
+}
+
+/* Choose output timestamps */
+void vkbd_set_time_policy(vkbd_context_t *ctx, vkbd_time_policy_t policy) {
+    if (ctx) {
+        ctx->time_policy = policy;
+    }
+}
+
+/* Copy the forwarding latency histogram */
+int vkbd_get_latency(const vkbd_context_t *ctx, latency_hist_t *out) {
+    if (!ctx || !out) {
+        fprintf(stderr, "vkbd_get_latency: Invalid arguments\n");
+        return -1;
+    }
+
+    latency_snapshot(out, &ctx->latency);
     return 0;
 }
 
+/* Record latency for events a sink's write has completed */
+void vkbd_record_latency(vkbd_context_t *ctx, const uint64_t *src_ns, int count) {
+    if (ctx && src_ns && count > 0) {
+        record_latency(ctx, src_ns, count);
+    }
+}
+
+/* Clear the forwarding latency histogram */
+void vkbd_reset_latency(vkbd_context_t *ctx) {
+    if (ctx) {
+        latency_reset(&ctx->latency);
+    }
+}
+
+/* Install or remove an output sink */
+void vkbd_set_sink(vkbd_context_t *ctx, vkbd_sink_t sink, void *user_data) {
+    if (ctx) {
+        ctx->sink = sink;
+        ctx->sink_data = sink ? user_data : NULL;
+    }
+}
+
+/* Process and forward key event - Maximum speed with robust error handling */
+int vkbd_process_key(vkbd_context_t *ctx, uint16_t key_code, int32_t value) {
+    struct input_event ev = { .type = EV_KEY, .code = key_code, .value = value };
+
+    if (__builtin_expect(vkbd_process_batch(ctx, &ev, 1) < 0, 0)) {
+        return -1;
+    }
+    return vkbd_flush(ctx);
+}
+
 /* Get device file descriptor */
 int vkbd_get_fd(vkbd_context_t *ctx) {
     if (!ctx || !ctx->device.initialized) {
@@ -11,36 +11,220 @@
 #include <linux/uinput.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "keyset.h"
+#include "counter.h"
+#include "latency.h"
 
-/* Maximum number of callback handlers */
-#define MAX_CALLBACKS 16
+/* Maximum number of observers */
+#define MAX_OBSERVERS 16
 
-/* Maximum number of key codes to enable */
+/* Observer queue size in events (power of two) - overflow drops, never blocks */
+#define VKBD_OBSERVER_QUEUE 4096
+
+/* Key codes enabled when no key set is given (vkbd_init, vkbd_init_backend) */
 #define MAX_KEY_CODES 256
 
-/* Virtual keyboard device structure */
+/* Longest wait for a new uinput device's event node to appear */
+#define VKBD_READY_TIMEOUT_MS 1000
+
+/* Staging buffer size in events (one write() per flush, fits in PIPE_BUF) */
+#define VKBD_OUT_BUFFER 128
+
+/* Output queue size in events (power of two) - what the device would not take yet */
+#define VKBD_OUT_QUEUE 1024
+
+/* The queue doubles up to this many events when only presses and releases are left in it */
+#define VKBD_OUT_QUEUE_MAX 65536
+
+/* Backlog at which the event listener stops reading the sources of an output,
+ * and below which it reads them again */
+#define VKBD_OUT_HIGH_WATER 4096
+#define VKBD_OUT_LOW_WATER 512
+
+/* Wait per round for the device when destroying with a backlog */
+#define VKBD_QUEUE_WAIT_MS 10
+
+typedef struct vkbd_device vkbd_device_t;
+typedef struct vkbd_context vkbd_context_t;
+
+/* Output backend - creates and destroys the device behind vkbd_device_t.fd
+ * The hot path only ever write()s struct input_event records to that fd */
 typedef struct {
-    int fd;                          /* uinput device file descriptor */
+    const char *name;
+    int (*open)(vkbd_device_t *dev);   /* Returns 0 on success, -1 on error */
+    void (*close)(vkbd_device_t *dev);
+} vkbd_backend_t;
+
+/* Real /dev/uinput device (default) */
+extern const vkbd_backend_t vkbd_backend_uinput;
+
+/* In-process stand-in: events are written to a pipe, read them from peer_fd */
+extern const vkbd_backend_t vkbd_backend_pipe;
+
+/* Output timestamps
+ * Source devices are read on CLOCK_MONOTONIC and output is stamped on the same
+ * clock. uinput itself re-stamps injected events; the policy decides what
+ * other sinks (pipe backend, observers) see */
+typedef enum {
+    VKBD_TIME_FLUSH = 0,   /* Time the batch was flushed (default) */
+    VKBD_TIME_SOURCE,      /* Timestamp of the source event; the flush time if it had none */
+} vkbd_time_policy_t;
+
+/* Output sink - takes the place of the write() in vkbd_flush while installed
+ * Gets each timestamped batch and returns 0 once it has taken (copied) the
+ * events, 1 if it cannot take them now, -1 on error. Used by engines that
+ * submit the write themselves. A batch not taken goes to the output queue,
+ * offered to the sink again by vkbd_drain - call it when room frees up.
+ * src_ns[i] is the source time of events[i] (0 = none): pass the times of
+ * what the device accepts to vkbd_record_latency */
+typedef int (*vkbd_sink_t)(vkbd_context_t *ctx, const struct input_event *events,
+                           const uint64_t *src_ns, int count, void *user_data);
+
+/* Virtual keyboard device structure */
+struct vkbd_device {
+    int fd;                          /* Output file descriptor (uinput or pipe) */
+    int peer_fd;                     /* Read end for in-process backends, -1 otherwise */
     char name[UINPUT_MAX_NAME_SIZE]; /* Device name */
     bool initialized;                /* Initialization status */
-} vkbd_device_t;
+    const vkbd_backend_t *backend;   /* Backend that owns fd */
+    keyset_t keys;                   /* Key codes advertised, filled in before open */
+    char sysname[32];                /* uinput: "inputN" under /sys/devices/virtual/input */
+    char node[32];                   /* uinput: event node, e.g. "/dev/input/event7" */
+};
 
 /* Key event callback function type */
 typedef void (*vkbd_callback_t)(uint16_t key_code, int32_t value, void *user_data);
 
+/* Value masks for scoped callbacks - bit n stands for value n */
+#define VKBD_VALUE_RELEASE (1u << 0)
+#define VKBD_VALUE_PRESS   (1u << 1)
+#define VKBD_VALUE_REPEAT  (1u << 2)
+#define VKBD_VALUE_ALL     (VKBD_VALUE_RELEASE | VKBD_VALUE_PRESS | VKBD_VALUE_REPEAT)
+
 /* Callback handler structure */
 typedef struct {
     vkbd_callback_t callback;
     void *user_data;
-    bool active;
+    int id;
+    unsigned values;                 /* VKBD_VALUE_* mask */
+    keyset_t keys;                   /* Key codes subscribed to */
 } vkbd_handler_t;
 
-/* Virtual keyboard context */
+/* Dispatch index entry - what the hot path needs from a handler */
 typedef struct {
+    vkbd_callback_t callback;
+    void *user_data;
+    unsigned values;                 /* VKBD_VALUE_* mask, all bits set for VKBD_VALUE_ALL */
+} vkbd_dispatch_t;
+
+/* Filter verdicts */
+typedef enum {
+    VKBD_FILTER_PASS = 0,  /* Hand the (possibly modified) event to the next stage */
+    VKBD_FILTER_DROP,      /* Consume the event - nothing is forwarded for it */
+} vkbd_verdict_t;
+
+/* Filter stage: may rewrite ev in place, drop it, or vkbd_emit() extra events */
+typedef vkbd_verdict_t (*vkbd_filter_t)(vkbd_context_t *ctx, struct input_event *ev, void *user_data);
+
+/* Filter stage structure */
+typedef struct {
+    vkbd_filter_t filter;
+    void *user_data;
+    int id;
+} vkbd_filter_entry_t;
+
+/* Batch handler: sees each span passed to vkbd_process_batch in one call,
+ * read-only and with every event type, before callbacks and filters */
+typedef void (*vkbd_batch_handler_t)(vkbd_context_t *ctx, const struct input_event *events, int count,
+                                     void *user_data);
+
+/* Batch handler structure */
+typedef struct {
+    vkbd_batch_handler_t handler;
+    void *user_data;
+    int id;
+} vkbd_batch_entry_t;
+
+/* A per-key callback run as a batch handler (user_data of vkbd_key_adapter) */
+typedef struct {
+    vkbd_callback_t callback;
+    void *user_data;
+} vkbd_key_adapter_t;
+
+/* Immutable snapshot of the registered callbacks and filters
+ * Registration builds a new compacted copy and publishes it with one atomic
+ * pointer store; the old copy is freed after a grace period.
+ * Callbacks are also indexed by key code (CSR layout): the handlers for key k
+ * are dispatch[key_start[k]] up to dispatch[key_start[k + 1]] */
+typedef struct {
+    int callback_count;
+    int filter_count;
+    int batch_count;
+    vkbd_handler_t *callbacks;       /* Registration order */
+    vkbd_filter_entry_t *filters;    /* Registration order */
+    vkbd_batch_entry_t *batch;       /* Registration order */
+    uint32_t *key_start;             /* KEY_CNT + 1 offsets into dispatch */
+    vkbd_dispatch_t *dispatch;       /* Per key, registration order */
+} vkbd_handler_table_t;
+
+/* Observer: sees every forwarded key event, asynchronously and read-only
+ * ev->time is the output timestamp */
+typedef void (*vkbd_observer_t)(const struct input_event *ev, void *user_data);
+
+/* Observer statistics - kept apart from forwarding latency */
+typedef struct {
+    unsigned long delivered;     /* Events handed to the observers */
+    unsigned long dropped;       /* Lost because the queue was full */
+    uint64_t busy_ns;            /* Time spent inside observers */
+    uint64_t max_lag_ns;         /* Output written -> observers called, worst case */
+} vkbd_observer_stats_t;
+
+/* Output counters - written by the thread that flushes, readable anywhere */
+typedef struct {
+    counter_t written;           /* Events written (or taken by the sink) */
+    counter_t writes;            /* Successful write() / sink calls */
+    counter_t deferred;          /* Events queued because the device was full (EAGAIN) */
+    counter_t coalesced;         /* Key repeats collapsed while queued */
+    counter_t overflows;         /* Events lost with the queue at VKBD_OUT_QUEUE_MAX, all transitions */
+    counter_t write_errors;      /* Flushes that failed - their events are lost */
+    counter_t filtered;          /* Key events dropped by a filter stage */
+} vkbd_counters_t;
+
+/* Output queue - events the device did not take yet, oldest first
+ * Drained by later flushes and by vkbd_drain (EPOLLOUT on device.fd) */
+typedef struct {
+    struct input_event *ev;      /* Allocated by the first deferral */
+    uint64_t *src;               /* Source time of each queued event, 0 = none */
+    unsigned size;               /* Slots (power of two), VKBD_OUT_QUEUE up to VKBD_OUT_QUEUE_MAX */
+    unsigned head;               /* Index of the oldest event */
+    unsigned count;
+    size_t offset;               /* Bytes of the oldest event already written */
+    keyset_t repeat;             /* Keys whose last queued event is a repeat */
+} vkbd_outq_t;
+
+struct vkbd_observers;
+
+/* Virtual keyboard context */
+struct vkbd_context {
     vkbd_device_t device;
-    vkbd_handler_t handlers[MAX_CALLBACKS];
-    int handler_count;
-} vkbd_context_t;
+    _Atomic(vkbd_handler_table_t *) table;    /* Current snapshot, NULL = none registered */
+    _Atomic unsigned long table_epoch;         /* Grace-period phase, low bit picks the counter */
+    _Atomic long table_readers[2];             /* Hot-path threads inside each phase */
+    pthread_mutex_t table_lock;                /* Serializes (un)registration */
+    int next_handler_id;
+    struct input_event out_buf[VKBD_OUT_BUFFER]; /* Staged output, written by vkbd_flush */
+    int out_count;
+    struct timeval src_time;           /* Source event being processed, zero outside */
+    vkbd_time_policy_t time_policy;
+    latency_hist_t latency;            /* Source timestamp -> written, per key event */
+    vkbd_counters_t counters;
+    vkbd_outq_t outq;                  /* Backlog while the device returns EAGAIN */
+    vkbd_sink_t sink;                  /* NULL = write() to device.fd */
+    void *sink_data;
+    _Atomic(struct vkbd_observers *) observers;  /* Queue + thread, published by the first observer */
+};
 
 /**
  * Initialize virtual keyboard device
@@ -51,6 +235,37 @@ typedef struct {
  */
 int vkbd_init(vkbd_context_t *ctx, const char *device_name);
 
+/**
+ * Initialize virtual keyboard on a specific output backend
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param device_name Name of the virtual device
+ * @param backend Output backend (e.g., &vkbd_backend_pipe), NULL for uinput
+ * @return 0 on success, -1 on error
+ */
+int vkbd_init_backend(vkbd_context_t *ctx, const char *device_name,
+                      const vkbd_backend_t *backend);
+
+/**
+ * Initialize a virtual keyboard that advertises exactly the given keys
+ * 
+ * Use the union of the source keyboards' capabilities (see
+ * event_listener_probe_keys) plus whatever the filters can emit, so
+ * applications see the same key set as on the real hardware, including
+ * codes above 255 such as KEY_FN or media keys. Keys that are not
+ * advertised are discarded by the kernel when written.
+ * 
+ * Returns once the device's event node exists (no fixed delay).
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param device_name Name for the virtual device (NULL for default)
+ * @param backend Output backend (NULL for uinput)
+ * @param keys Key codes to advertise, NULL for every code below MAX_KEY_CODES
+ * @return 0 on success, -1 on error
+ */
+int vkbd_init_keys(vkbd_context_t *ctx, const char *device_name,
+                   const vkbd_backend_t *backend, const keyset_t *keys);
+
 /**
  * Destroy virtual keyboard device
  * 
@@ -61,6 +276,8 @@ void vkbd_destroy(vkbd_context_t *ctx);
 /**
  * Send key event to virtual keyboard
  * 
+ * The event is staged and written together with the next vkbd_sync/vkbd_flush
+ * 
  * @param ctx Pointer to vkbd_context_t structure
  * @param key_code Linux key code (from linux/input-event-codes.h)
  * @param value 0=release, 1=press, 2=repeat
@@ -69,7 +286,7 @@ void vkbd_destroy(vkbd_context_t *ctx);
 int vkbd_send_key(vkbd_context_t *ctx, uint16_t key_code, int32_t value);
 
 /**
- * Send synchronization event (EV_SYN)
+ * Send synchronization event (EV_SYN) and write everything staged so far
  * 
  * @param ctx Pointer to vkbd_context_t structure
  * @return 0 on success, -1 on error
@@ -79,6 +296,10 @@ int vkbd_sync(vkbd_context_t *ctx);
 /**
  * Register a callback for key events
  * 
+ * Callbacks and filters may be (un)registered from any thread while events
+ * are being processed; the hot path takes no lock. Not from inside a
+ * callback or filter of the same context.
+ * 
  * @param ctx Pointer to vkbd_context_t structure
  * @param callback Callback function to be called on key events
  * @param user_data User data passed to callback
@@ -86,17 +307,179 @@ int vkbd_sync(vkbd_context_t *ctx);
  */
 int vkbd_register_callback(vkbd_context_t *ctx, vkbd_callback_t callback, void *user_data);
 
+/**
+ * Register a callback for one key code
+ * 
+ * The callback is only called for key_code with a value in the mask, so it
+ * costs nothing on other keys.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param key_code Key code to watch
+ * @param values VKBD_VALUE_* mask (e.g., VKBD_VALUE_PRESS)
+ * @param callback Callback function
+ * @param user_data User data passed to callback
+ * @return Handler ID (>= 0) on success, -1 on error
+ */
+int vkbd_register_key_callback(vkbd_context_t *ctx, uint16_t key_code, unsigned values,
+                               vkbd_callback_t callback, void *user_data);
+
+/**
+ * Register a callback for a set of key codes
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param keys Key codes to watch (NULL = all keys)
+ * @param values VKBD_VALUE_* mask
+ * @param callback Callback function
+ * @param user_data User data passed to callback
+ * @return Handler ID (>= 0) on success, -1 on error
+ */
+int vkbd_register_keyset_callback(vkbd_context_t *ctx, const keyset_t *keys, unsigned values,
+                                  vkbd_callback_t callback, void *user_data);
+
 /**
  * Unregister a callback
  * 
+ * Once this returns the callback is not running and will not be called again.
+ * 
  * @param ctx Pointer to vkbd_context_t structure
- * @param handler_id Handler ID returned by vkbd_register_callback
+ * @param handler_id Handler ID returned by a vkbd_register_*callback function
  * @return 0 on success, -1 on error
  */
 int vkbd_unregister_callback(vkbd_context_t *ctx, int handler_id);
 
 /**
- * Process and forward key event (calls callbacks then sends to virtual device)
+ * Register a filter stage for key events
+ * 
+ * Filters run in registration order after the callbacks. Each stage sees the
+ * event as left by the previous one and returns VKBD_FILTER_PASS to forward
+ * it or VKBD_FILTER_DROP to consume it. Events pushed with vkbd_emit() are
+ * staged immediately (ahead of the current event) and skip later stages.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param filter Filter function
+ * @param user_data User data passed to filter
+ * @return Filter ID (>= 0) on success, -1 on error
+ */
+int vkbd_register_filter(vkbd_context_t *ctx, vkbd_filter_t filter, void *user_data);
+
+/**
+ * Unregister a filter stage
+ * 
+ * Once this returns the filter is not running and will not be called again.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param filter_id Filter ID returned by vkbd_register_filter
+ * @return 0 on success, -1 on error
+ */
+int vkbd_unregister_filter(vkbd_context_t *ctx, int filter_id);
+
+/**
+ * Register a batch handler
+ * 
+ * Called once per span given to vkbd_process_batch (the listener passes
+ * each read() buffer, vkbd_process_key a span of one), so the indirect call
+ * is paid per batch and the handler's own loop runs over contiguous memory.
+ * Same threading rules as vkbd_register_callback.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param handler Batch handler function
+ * @param user_data User data passed to handler
+ * @return Handler ID (>= 0) on success, -1 on error
+ */
+int vkbd_register_batch_handler(vkbd_context_t *ctx, vkbd_batch_handler_t handler, void *user_data);
+
+/**
+ * Unregister a batch handler
+ * 
+ * Once this returns the handler is not running and will not be called again.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param handler_id Handler ID returned by vkbd_register_batch_handler
+ * @return 0 on success, -1 on error
+ */
+int vkbd_unregister_batch_handler(vkbd_context_t *ctx, int handler_id);
+
+/**
+ * Batch handler that calls a per-key callback for each EV_KEY event
+ * 
+ * Register it with a vkbd_key_adapter_t (kept alive while registered) as
+ * user_data to move an existing vkbd_callback_t to batch dispatch.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param events Span of events
+ * @param count Number of events
+ * @param user_data Pointer to vkbd_key_adapter_t
+ */
+void vkbd_key_adapter(vkbd_context_t *ctx, const struct input_event *events, int count, void *user_data);
+
+/**
+ * Register an observer for forwarded key events
+ * 
+ * Observers cannot change or drop events. vkbd_flush queues what it wrote
+ * on a lock-free MPSC queue after the write, and a background thread
+ * (started with the first observer) calls the observers, so a slow logger
+ * or sound player never delays forwarding. If the queue is full the event
+ * is dropped for observers and counted.
+ * 
+ * May be called from any thread, also while events are being forwarded:
+ * the first registration publishes the queue and thread atomically.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param observer Observer function (runs on the observer thread)
+ * @param user_data User data passed to observer
+ * @return Observer ID (>= 0) on success, -1 on error
+ */
+int vkbd_register_observer(vkbd_context_t *ctx, vkbd_observer_t observer, void *user_data);
+
+/**
+ * Unregister an observer
+ * 
+ * Once this returns the observer is not running and will not be called
+ * again. Must not be called from inside an observer.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param observer_id Observer ID returned by vkbd_register_observer
+ * @return 0 on success, -1 on error
+ */
+int vkbd_unregister_observer(vkbd_context_t *ctx, int observer_id);
+
+/**
+ * Get observer statistics
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param stats Filled in (all zero if no observer was ever registered)
+ */
+void vkbd_get_observer_stats(const vkbd_context_t *ctx, vkbd_observer_stats_t *stats);
+
+/**
+ * Stage an extra event in the context's output buffer (no syscall)
+ * 
+ * Intended for filters and their timers; written with the rest of the batch
+ * on vkbd_flush. Emitted events do not pass through the filter stages
+ * registered after the caller, so engines that generate keys this way
+ * (tap-hold, macros, combos) are registered after the filters that should
+ * see their input.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param type Event type (EV_KEY, EV_SYN, ...)
+ * @param code Event code
+ * @param value Event value
+ * @return 0 on success, -1 on error
+ */
+int vkbd_emit(vkbd_context_t *ctx, uint16_t type, uint16_t code, int32_t value);
+
+/**
+ * Stage a key event and close its frame with SYN_REPORT (see vkbd_emit)
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param code Key code
+ * @param value 0=release, 1=press, 2=repeat
+ * @return 0 on success, -1 on error
+ */
+int vkbd_emit_key(vkbd_context_t *ctx, uint16_t code, int32_t value);
+
+/**
+ * Process and forward key event (calls callbacks and filters then sends to virtual device)
  * 
  * @param ctx Pointer to vkbd_context_t structure
  * @param key_code Linux key code
@@ -105,6 +488,132 @@ int vkbd_unregister_callback(vkbd_context_t *ctx, int handler_id);
  */
 int vkbd_process_key(vkbd_context_t *ctx, uint16_t key_code, int32_t value) __attribute__((hot));
 
+/**
+ * Queue an input event without writing it (batched output path)
+ * 
+ * EV_KEY events run the callbacks and filter chain and whatever survives is
+ * staged; SYN_REPORT closes the
+ * current frame if it contains keys; other event types are ignored.
+ * Call vkbd_flush once the whole batch has been queued.
+ * 
+ * ev->time is the source time (CLOCK_MONOTONIC, as read from evdev): it is
+ * carried to the staged events, measured as forwarding latency and kept on
+ * output under VKBD_TIME_SOURCE. Zero means no source time - not measured,
+ * stamped at flush.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param ev Source event, with its source time or a zero timestamp
+ * @return 0 on success, -1 on error
+ */
+int vkbd_queue_event(vkbd_context_t *ctx, const struct input_event *ev) __attribute__((hot));
+
+/**
+ * Process a span of input events, e.g. one read() from an evdev node
+ * 
+ * Batch handlers get the whole span first, one call each; then every event
+ * takes the vkbd_queue_event path (callbacks and filters for keys), all under
+ * one handler-table read section. The result is staged, not written: call
+ * vkbd_flush after the span or round.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param events Span of events, in source order
+ * @param count Number of events (0: nothing is called)
+ * @return 0 on success, -1 on error
+ */
+int vkbd_process_batch(vkbd_context_t *ctx, const struct input_event *events, int count) __attribute__((hot));
+
+/**
+ * Write all staged events with a single timestamp and a single write()
+ * 
+ * Never blocks on a full device: what it does not take (EAGAIN, short
+ * write) goes to the output queue, as does everything flushed while the
+ * queue is not empty, so order is kept. Queued key repeats are collapsed;
+ * presses and releases are kept - if the queue fills up with them it grows.
+ * The event listener stops reading the sources at VKBD_OUT_HIGH_WATER, so
+ * VKBD_OUT_QUEUE_MAX is only reached without it: past that the rest of the
+ * batch is lost (counted in overflows), as on a write error (write_errors).
+ * 
+ * With a sink installed the batch goes to the sink instead, through the
+ * same queue while the sink has no room; observers get it once the sink
+ * has taken it.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @return 0 on success (written, queued or nothing staged), -1 on error
+ */
+int vkbd_flush(vkbd_context_t *ctx) __attribute__((hot));
+
+/**
+ * Write queued output the device did not take earlier
+ * 
+ * Call when device.fd is writable (EPOLLOUT), or with a sink installed when
+ * the sink has room again; the event listener does this for the outputs it
+ * flushes.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @return Events still queued (0 = caught up), -1 on error
+ */
+int vkbd_drain(vkbd_context_t *ctx);
+
+/**
+ * Get the number of events waiting in the output queue
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @return Queued events
+ */
+int vkbd_backlog(const vkbd_context_t *ctx);
+
+/**
+ * Choose which timestamp forwarded events carry
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param policy VKBD_TIME_FLUSH or VKBD_TIME_SOURCE
+ */
+void vkbd_set_time_policy(vkbd_context_t *ctx, vkbd_time_policy_t policy);
+
+/**
+ * Get the forwarding latency histogram
+ * 
+ * Records, for every key event, the time from the source event's kernel
+ * timestamp to the device accepting it: the write() in vkbd_flush, the
+ * drain that finally writes it if it was queued, or the completion an
+ * installed sink reports. Events without a source timestamp
+ * (vkbd_send_key, or a clock other than CLOCK_MONOTONIC) are not counted.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param out Receives a copy of the histogram
+ * @return 0 on success, -1 on error
+ */
+int vkbd_get_latency(const vkbd_context_t *ctx, latency_hist_t *out);
+
+/**
+ * Record forwarding latency for events the device has just accepted
+ * 
+ * For output sinks, once their write completes; from the thread that flushes.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param src_ns Source times as handed to the sink (0 = none, not counted)
+ * @param count Number of events
+ */
+void vkbd_record_latency(vkbd_context_t *ctx, const uint64_t *src_ns, int count);
+
+/**
+ * Clear the forwarding latency histogram (from the thread that flushes)
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ */
+void vkbd_reset_latency(vkbd_context_t *ctx);
+
+/**
+ * Install or remove an output sink
+ * 
+ * Only from the thread that flushes, while it is not forwarding.
+ * 
+ * @param ctx Pointer to vkbd_context_t structure
+ * @param sink Sink function, NULL to write() to the device again
+ * @param user_data User data passed to sink
+ */
+void vkbd_set_sink(vkbd_context_t *ctx, vkbd_sink_t sink, void *user_data);
+
 /**
  * Get device file descriptor (for epoll/select integration)
  * 